@@ -21,6 +21,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
@@ -30,9 +31,18 @@
 
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_netif_net_stack.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
+#include "lwip/dhcp.h"
+#include "lwip/tcpip.h"
 
 #include "conn_wifi_b.h"
+#include "nvs_cache.h"
+#include "trace_ring.h"
+#include "wifi_life.h"
 
 // Task stack size.
 #define CWB_STACK_DEPTH_MIN 2800
@@ -56,6 +66,41 @@ static const size_t PASSWORD_MAX_LENGTH = 64;
 
 const char CWB_TAG[] = "CWB";
 
+#define BSSID_LENGTH 6
+
+// Lease cache, kept in NVS: the last DHCP lease obtained from every AP.
+static const char NVS_NAMESPACE[] = "conn_wifi_b";
+static const char NVS_KEY[] = "leases";
+#define LEASE_ENTRIES 4
+
+typedef struct {
+    nvc_entry_t lru;
+    uint8_t bssid[BSSID_LENGTH];
+    // Address, netmask and gateway, in network order.
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gw;
+    // System time when the lease was obtained, in s.
+    int64_t obtained;
+    // Duration of the lease, in s. 0 for an unused entry.
+    uint32_t duration;
+} lease_t;
+
+static lease_t leases[LEASE_ENTRIES];
+static bool leases_loaded = false;
+
+// Data exchanged with the functions run by the tcpip task, where the DHCP
+// client runs: the DHCP client data must not be accessed from another
+// task. done is given once the function has run, ok is its result.
+typedef struct {
+    struct netif *netif;
+    lease_t lease;
+    bool ok;
+    SemaphoreHandle_t done;
+} dhcp_call_t;
+
+static dhcp_call_t dhcp_call;
+
 // FSA states. In case of system error, ST_ERROR state is entered.
 // Starting from this instant, every client application service
 // request is responded with CWB_ERROR. It is then up to the application
@@ -82,6 +127,7 @@ typedef enum {
     MSG_DISCONNECT,     // Disconnection request.
     // Internal messages.
     MSG_STA_OK,         // ESP-IDF station started.
+    MSG_ASSOC,          // Associated to the AP.
     MSG_IP,             // IP address assigned.
     MSG_TIMEOUT,        // Timeout of IP address assignment.
     MSG_DIS,            // Disconnected from the AP.
@@ -94,10 +140,15 @@ typedef struct {
     uint32_t ip_timeout;
 } connect_t;
 
+typedef struct {
+    uint8_t bssid[BSSID_LENGTH];
+} assoc_t;
+
 typedef struct {
     msg_type_t type;
     union {
         connect_t connect;
+        assoc_t assoc;
     };
 } msg_t;
 
@@ -118,16 +169,23 @@ static SemaphoreHandle_t semaphore = NULL;
 // Remembering the loss of connectivity is done by the FSA state.
 static volatile cwb_status_t operation_result;
 
-// Is Wi-Fi initialized?
+// Are the event handlers registered? The Wi-Fi driver itself is managed
+// by the wifi_life component, and kept between connections.
 static volatile bool wifi_initialized = false;
 
-// ESP-NETIF instance.
-static esp_netif_t *netif_instance;
-
 // Event handler instances, used to unregister event handler.
 static esp_event_handler_instance_t wifi_event_handler_instance;
 static esp_event_handler_instance_t ip_event_handler_instance;
 
+// AP of the current connection, and time of the association.
+static uint8_t assoc_bssid[BSSID_LENGTH];
+static int64_t assoc_time;
+
+// Set when the cached lease was requested for the current connection.
+static bool lease_requested = false;
+
+static cwb_stats_t stats;
+
 /**
  * Event handler for events generated by the Wi-Fi task and the LwIP task.
  */
@@ -139,27 +197,35 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 
     bool msg_to_send = true;
 
+    TRACE(CWB_EVENT, trace_ring_4cc(event_base), event_id);
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         // Station initialization done. LwIP network interface initialized.
-        ESP_LOGI(CWB_TAG, "WIFI_EVENT_STA_START");
+        ESP_LOGD(CWB_TAG, "WIFI_EVENT_STA_START");
         msg.type = MSG_STA_OK;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        ESP_LOGD(CWB_TAG, "WIFI_EVENT_STA_CONNECTED");
+        // Associated to the AP. The DHCP client is started by esp_netif.
+        msg.type = MSG_ASSOC;
+        memcpy(msg.assoc.bssid,
+               ((wifi_event_sta_connected_t *)event_data)->bssid,
+               BSSID_LENGTH);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(CWB_TAG, "WIFI_EVENT_STA_DISCONNECTED");
+        ESP_LOGD(CWB_TAG, "WIFI_EVENT_STA_DISCONNECTED");
         // We were not able to connect, or we were connected and got disconnected,
         // or we requested a disconnection while connected. LwIP network
         // interface is shut down.
         msg.type = MSG_DIS;
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_STOP) {
-        ESP_LOGI(CWB_TAG, "WIFI_EVENT_STA_STOP");
+        ESP_LOGD(CWB_TAG, "WIFI_EVENT_STA_STOP");
         // IP address is released, DHCP client is stopped LwIP network
         // interface is cleared.
         msg.type = MSG_STOP;
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ESP_LOGI(CWB_TAG, "IP_EVENT_STA_GOT_IP");
+        ESP_LOGD(CWB_TAG, "IP_EVENT_STA_GOT_IP");
         // We got an IP address.
         msg.type = MSG_IP;
     } else {
-        ESP_LOGI(CWB_TAG, "Event: %d", event_id);
+        ESP_LOGD(CWB_TAG, "Event: %d", event_id);
         msg_to_send = false;
     }
 
@@ -188,6 +254,169 @@ static void timer_handler(TimerHandle_t timer) {
 
 }
 
+// Returns true if the system time went on since the leases were saved. It
+// is kept by software resets and deep sleep, but restarts from 0 after a
+// power-on.
+static bool system_time_kept(void) {
+
+    switch (esp_reset_reason()) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_DEEPSLEEP:
+        return true;
+    default:
+        return false;
+    }
+
+}
+
+// Reads the cache, once. Entries are unused if there is none, or if their
+// times can't be trusted.
+static void load_leases(void) {
+
+    if (leases_loaded) {
+        return;
+    }
+    leases_loaded = true;
+    if (!system_time_kept()) {
+        memset(leases, 0, sizeof(leases));
+        return;
+    }
+    nvc_load(NVS_NAMESPACE, NVS_KEY, leases, sizeof(leases));
+
+}
+
+// Returns the cached lease of bssid, NULL if none.
+static lease_t *find_lease(const uint8_t *bssid) {
+
+    load_leases();
+    for (int i = 0; i < LEASE_ENTRIES; i++) {
+        if ((leases[i].duration != 0) &&
+            (memcmp(leases[i].bssid, bssid, BSSID_LENGTH) == 0)) {
+            return &leases[i];
+        }
+    }
+    return NULL;
+
+}
+
+// Runs function in the tcpip task, for the station interface, and waits
+// for it. Returns the result of function, false if it could not be run.
+static bool call_dhcp(tcpip_callback_fn function) {
+
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (netif == NULL) {
+        return false;
+    }
+    dhcp_call.netif = esp_netif_get_netif_impl(netif);
+    dhcp_call.ok = false;
+    if (tcpip_callback(function, NULL) != ERR_OK) {
+        ESP_LOGW(CWB_TAG, "Error from tcpip_callback");
+        return false;
+    }
+    xSemaphoreTake(dhcp_call.done, portMAX_DELAY);
+    return dhcp_call.ok;
+
+}
+
+// Run by the tcpip task. If the DHCP client has not received any offer
+// yet, it requests the address of dhcp_call.lease instead, as in the
+// INIT-REBOOT state of RFC 2131: the server confirms it with a single
+// DHCPACK. On a DHCPNAK, or without any answer, the client goes back to a
+// DHCPDISCOVER. Once bound, the client renews the lease as usual.
+static void reboot_dhcp(void *arg) {
+
+    struct dhcp *dhcp = netif_dhcp_data(dhcp_call.netif);
+
+    if ((dhcp != NULL) && (dhcp->state == DHCP_STATE_SELECTING)) {
+        ip4_addr_set_u32(&dhcp->offered_ip_addr, dhcp_call.lease.ip);
+        ip4_addr_set_u32(&dhcp->offered_sn_mask, dhcp_call.lease.netmask);
+        ip4_addr_set_u32(&dhcp->offered_gw_addr, dhcp_call.lease.gw);
+        dhcp->state = DHCP_STATE_REBOOTING;
+        dhcp_network_changed(dhcp_call.netif);
+        dhcp_call.ok = true;
+    }
+    xSemaphoreGive(dhcp_call.done);
+
+}
+
+// Run by the tcpip task: copies the lease of the bound DHCP client to
+// dhcp_call.lease.
+static void read_dhcp(void *arg) {
+
+    struct dhcp *dhcp = netif_dhcp_data(dhcp_call.netif);
+
+    if ((dhcp != NULL) && (dhcp->state == DHCP_STATE_BOUND) &&
+        (dhcp->offered_t0_lease != 0)) {
+        dhcp_call.lease.ip = ip4_addr_get_u32(&dhcp->offered_ip_addr);
+        dhcp_call.lease.netmask = ip4_addr_get_u32(&dhcp->offered_sn_mask);
+        dhcp_call.lease.gw = ip4_addr_get_u32(&dhcp->offered_gw_addr);
+        dhcp_call.lease.duration = dhcp->offered_t0_lease;
+        dhcp_call.ok = true;
+    }
+    xSemaphoreGive(dhcp_call.done);
+
+}
+
+/**
+ * Requests the lease cached for the AP of the current connection, if not
+ * expired, instead of a new one. Returns true if requested.
+ */
+static bool request_lease(void) {
+
+    lease_t *lease = find_lease(assoc_bssid);
+    if (lease == NULL) {
+        return false;
+    }
+    int64_t now = time(NULL);
+    if ((now < lease->obtained) ||
+        (now - lease->obtained >= lease->duration)) {
+        ESP_LOGI(CWB_TAG, "Cached lease expired");
+        return false;
+    }
+    dhcp_call.lease = *lease;
+    if (!call_dhcp(reboot_dhcp)) {
+        // The DHCP client was faster.
+        return false;
+    }
+    ESP_LOGI(CWB_TAG, "Cached lease requested, obtained %lld s ago",
+             (long long)(now - lease->obtained));
+    return true;
+
+}
+
+/**
+ * Caches the lease just obtained, or confirmed, by the DHCP client, for
+ * the AP of the current connection. To limit flash writes, NVS is written
+ * only if the lease changed, or if half of it has elapsed.
+ */
+static void store_lease(void) {
+
+    if (!call_dhcp(read_dhcp)) {
+        return;
+    }
+    int64_t now = time(NULL);
+    lease_t *lease = find_lease(assoc_bssid);
+    if ((lease != NULL) && (lease->ip == dhcp_call.lease.ip) &&
+        (lease->netmask == dhcp_call.lease.netmask) &&
+        (lease->gw == dhcp_call.lease.gw) && (now >= lease->obtained) &&
+        (now - lease->obtained < lease->duration / 2)) {
+        return;
+    }
+    if (lease == NULL) {
+        lease = nvc_lru_oldest(leases, sizeof(leases[0]), LEASE_ENTRIES);
+    }
+    *lease = dhcp_call.lease;
+    memcpy(lease->bssid, assoc_bssid, BSSID_LENGTH);
+    lease->obtained = now;
+    nvc_lru_touch(leases, sizeof(leases[0]), LEASE_ENTRIES, lease);
+    nvc_save(NVS_NAMESPACE, NVS_KEY, leases, sizeof(leases));
+
+}
+
 /**
  * Returns true if Wi-Fi initialization is OK, false otherwise.
  */
@@ -195,15 +424,9 @@ static bool init_wifi(void) {
 
     esp_err_t esp_rs;
 
-    netif_instance = esp_netif_create_default_wifi_sta();
-    if (netif_instance == NULL) {
-        ESP_LOGE(CWB_TAG, "Error from esp_netif_create_default_wifi_sta");
-        return false;
-    }
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_rs = esp_wifi_init(&cfg);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(CWB_TAG, "Error from esp_wifi_init: %d", esp_rs);
+    // Initialized once, by the first scan or connection.
+    if (wfl_init() != WFL_OK) {
+        ESP_LOGE(CWB_TAG, "Error from wfl_init");
         return false;
     }
     // Register our event_handle that will receive Wi-Fi task events.
@@ -211,7 +434,6 @@ static bool init_wifi(void) {
             NULL, &wifi_event_handler_instance);
     if (esp_rs != ESP_OK) {
         ESP_LOGE(CWB_TAG, "Error from Wi-Fi esp_event_handler_instance_register: %s", esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
         return false;
     }
     // And register the same event handler to receive the event telling that an
@@ -221,13 +443,8 @@ static bool init_wifi(void) {
             NULL, &ip_event_handler_instance);
     if (esp_rs != ESP_OK) {
         ESP_LOGE(CWB_TAG, "Error from IP esp_event_handler_instance_register: %s", esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
-        return false;
-    }
-    esp_rs = esp_wifi_set_mode(WIFI_MODE_STA);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(CWB_TAG, "Error from esp_wifi_set_mode: %s", esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
+        esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                              wifi_event_handler_instance);
         return false;
     }
     // At this stage, Wi-Fi initialization is OK.
@@ -236,10 +453,17 @@ static bool init_wifi(void) {
 
 }
 
-cwb_status_t cwb_deinit_b(void) {
+/**
+ * Unregisters the event handlers, once Wi-Fi is stopped. The driver is kept
+ * for next scan or connection.
+ */
+static cwb_status_t release_wifi(void) {
 
     esp_err_t esp_rs;
 
+    if (!wifi_initialized) {
+        return CWB_OK;
+    }
     // Unregister event handler.
     esp_rs = esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID,
                                                    wifi_event_handler_instance);
@@ -253,13 +477,23 @@ cwb_status_t cwb_deinit_b(void) {
         ESP_LOGE(CWB_TAG, "Error from IP esp_event_handler_unregister: %s", esp_err_to_name(esp_rs));
         return CWB_SYS_ERR;
     }
-    esp_rs = esp_wifi_deinit();
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(CWB_TAG, "Error from esp_wifi_deinit: %s", esp_err_to_name(esp_rs));
+    wifi_initialized = false;
+    return CWB_OK;
+
+}
+
+cwb_status_t cwb_deinit_b(void) {
+
+    cwb_status_t cwb_rs;
+
+    cwb_rs = release_wifi();
+    if (cwb_rs != CWB_OK) {
+        return cwb_rs;
+    }
+    if (wfl_deinit() != WFL_OK) {
+        ESP_LOGE(CWB_TAG, "Error from wfl_deinit");
         return CWB_SYS_ERR;
     }
-    esp_netif_destroy(netif_instance);
-    wifi_initialized = false;
     return CWB_OK;
 
 }
@@ -272,6 +506,7 @@ static void cwb_task(void *pvParameters) {
     esp_err_t esp_rs;   // Return status for ESP-IDF calls.
     BaseType_t frt_rs;  // Return status for FreeRTOS calls.
     bool boo_rs;
+    bool started;
     cwb_status_t cwb_rs;
 
     msg_t msg;
@@ -357,10 +592,8 @@ static void cwb_task(void *pvParameters) {
                     xSemaphoreGive(semaphore);
                     break;
                 }
-                esp_rs = esp_wifi_start();
-                if (esp_rs != ESP_OK) {
-                    ESP_LOGE(CWB_TAG, "WAIT_STARTUP - Error from esp_wifi_start: %s",
-                             esp_err_to_name(esp_rs));
+                if (wfl_start(&started) != WFL_OK) {
+                    ESP_LOGE(CWB_TAG, "WAIT_STARTUP - Error from wfl_start");
                     operation_result = CWB_SYS_ERR;
                     current_state = ST_ERROR;
                     // Unblock the client request.
@@ -368,6 +601,20 @@ static void cwb_task(void *pvParameters) {
                     xSemaphoreGive(semaphore);
                     break;
                 }
+                if (!started) {
+                    // The radio was left started by another operation, no
+                    // WIFI_EVENT_STA_START will come.
+                    msg.type = MSG_STA_OK;
+                    if (xQueueSend(queue, &msg, 0) != pdTRUE) {
+                        ESP_LOGE(CWB_TAG, "WAIT_STARTUP - Error from xQueueSend");
+                        operation_result = CWB_SYS_ERR;
+                        current_state = ST_ERROR;
+                        // Unblock the client request.
+                        // We don't test return status, as we already are in error state.
+                        xSemaphoreGive(semaphore);
+                        break;
+                    }
+                }
                 current_state = ST_WAIT_STA;
                 break;
             }
@@ -433,6 +680,15 @@ static void cwb_task(void *pvParameters) {
             break;
 
         case ST_WAIT_IP:
+            if (msg.type == MSG_ASSOC) {
+                // Associated, the DHCP client is started. A lease cached for
+                // this AP saves a part of the DHCP exchange.
+                ESP_LOGI(CWB_TAG, "WAIT_IP - Associated");
+                assoc_time = esp_timer_get_time();
+                memcpy(assoc_bssid, msg.assoc.bssid, BSSID_LENGTH);
+                lease_requested = request_lease();
+                break;
+            }
             if (msg.type == MSG_DIS) {
                 // Disconnected from the AP.
                 ESP_LOGI(CWB_TAG, "WAIT_IP - Disconnected");
@@ -457,9 +713,8 @@ static void cwb_task(void *pvParameters) {
                     xSemaphoreGive(semaphore);
                     break;
                 }
-                esp_rs = esp_wifi_stop();
-                if (esp_rs != ESP_OK) {
-                    ESP_LOGE(CWB_TAG, "WAIT_IP - Error from esp_wifi_stop: %s", esp_err_to_name(esp_rs));
+                if (wfl_stop() != WFL_OK) {
+                    ESP_LOGE(CWB_TAG, "WAIT_IP - Error from wfl_stop");
                     operation_result = CWB_SYS_ERR;
                     current_state = ST_ERROR;
                     // Unblock the client request.
@@ -524,6 +779,16 @@ static void cwb_task(void *pvParameters) {
                     xSemaphoreGive(semaphore);
                     break;
                 }
+                stats.ip_time = esp_timer_get_time() - assoc_time;
+                stats.lease_reused = lease_requested;
+                if (lease_requested) {
+                    stats.leases_reused++;
+                } else {
+                    stats.dhcp_leases++;
+                }
+                store_lease();
+                ESP_LOGI(CWB_TAG, "WAIT_IP - IP address in %lld ms",
+                         (long long)(stats.ip_time / 1000));
                 // Inform our client.
                 operation_result = CWB_OK;
                 current_state = ST_WAIT_DIS_CMD;
@@ -560,16 +825,19 @@ static void cwb_task(void *pvParameters) {
                 }
                 break;
             }
+            if (msg.type == MSG_IP) {
+                // The lease was renewed or rebound by the DHCP client.
+                ESP_LOGD(CWB_TAG, "WAIT_DIS_CMD - IP address assigned again");
+                break;
+            }
             if (msg.type == MSG_DIS) {
                 // When this event occurs, the client has already been unblocked, as
                 // we were connected. This means that the semaphore give performed
                 // in ST_WAIT_STOP_ON_PB state is not required, for this specific
                 // case. But it does not harm.
                 ESP_LOGI(CWB_TAG, "WAIT_DIS_CMD - Disconnected");
-                esp_rs = esp_wifi_stop();
-                if (esp_rs != ESP_OK) {
-                    ESP_LOGE(CWB_TAG, "WAIT_DIS_CMD - Error from esp_wifi_stop: %s",
-                             esp_err_to_name(esp_rs));
+                if (wfl_stop() != WFL_OK) {
+                    ESP_LOGE(CWB_TAG, "WAIT_DIS_CMD - Error from wfl_stop");
                     operation_result = CWB_SYS_ERR;
                     current_state = ST_ERROR;
                     // Unblock the client request.
@@ -609,10 +877,8 @@ static void cwb_task(void *pvParameters) {
             if (msg.type == MSG_DIS) {
                 // Disconnected.
                 ESP_LOGI(CWB_TAG, "WAIT_DIS - disconnected");
-                esp_rs = esp_wifi_stop();
-                if (esp_rs != ESP_OK) {
-                    ESP_LOGE(CWB_TAG, "WAIT_DIS - Error from esp_wifi_stop: %s",
-                             esp_err_to_name(esp_rs));
+                if (wfl_stop() != WFL_OK) {
+                    ESP_LOGE(CWB_TAG, "WAIT_DIS - Error from wfl_stop");
                     operation_result = CWB_SYS_ERR;
                     current_state = ST_ERROR;
                     // Unblock the client request.
@@ -637,7 +903,7 @@ static void cwb_task(void *pvParameters) {
             if (msg.type == MSG_STOP) {
                 ESP_LOGI(CWB_TAG, "WAIT_STOP - Wif-Fi stopped");
                 operation_result = CWB_OK;
-                cwb_rs = cwb_deinit_b();
+                cwb_rs = release_wifi();
                 if (cwb_rs != CWB_OK) {
                 	// operation_result already returned.
                 	current_state = ST_ERROR;
@@ -671,10 +937,8 @@ static void cwb_task(void *pvParameters) {
             if (msg.type == MSG_DIS) {
                 // Disconnected.
                 ESP_LOGI(CWB_TAG, "WAIT_DIS_ON_PB - Disconnected");
-                esp_rs = esp_wifi_stop();
-                if (esp_rs != ESP_OK) {
-                    ESP_LOGE(CWB_TAG, "WAIT_DIS_ON_PB - Error from esp_wifi_stop: %s",
-                             esp_err_to_name(esp_rs));
+                if (wfl_stop() != WFL_OK) {
+                    ESP_LOGE(CWB_TAG, "WAIT_DIS_ON_PB - Error from wfl_stop");
                     operation_result = CWB_SYS_ERR;
                     current_state = ST_ERROR;
                     // Unblock the client request.
@@ -704,7 +968,7 @@ static void cwb_task(void *pvParameters) {
                 } else {
                 	operation_result = CWB_DIS;
                 }
-                cwb_rs = cwb_deinit_b();
+                cwb_rs = release_wifi();
                 if (cwb_rs != CWB_OK) {
                 	// operation_result already returned.
                 	current_state = ST_ERROR;
@@ -776,6 +1040,11 @@ cwb_status_t cwb_connect_b(const uint8_t *ssid, const uint8_t *password,
             ESP_LOGE(CWB_TAG, "Error from xSemaphoreCreateBinary");
             return CWB_SYS_ERR;
         }
+        dhcp_call.done = xSemaphoreCreateBinary();
+        if (dhcp_call.done == NULL) {
+            ESP_LOGE(CWB_TAG, "Error from xSemaphoreCreateBinary");
+            return CWB_SYS_ERR;
+        }
     }
     if (ssid == NULL) {
         return CWB_PARAM_ERR;
@@ -831,3 +1100,9 @@ cwb_status_t cwb_disconnect_b(void) {
     return CWB_DIS_TIMEOUT;
 
 }
+
+void cwb_get_stats_b(cwb_stats_t *stats_out) {
+
+    *stats_out = stats;
+
+}
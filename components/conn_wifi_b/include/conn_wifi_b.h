@@ -29,8 +29,11 @@
  *   - Wi-Fi must be inactive before the call to cwb_connect_b()
  *
  * Side effect:
- *   - An event handler is registered to the default loop
+ *   - An event handler is registered to the default loop, while connected
  *   - A task is started
+ *   - The Wi-Fi driver is initialized through the wifi_life component, and
+ *     kept initialized after the disconnection. Only the radio is stopped
+ *   - The last DHCP lease obtained from every AP (BSSID) is kept in NVS
  *
  * Usage:
  *   The client application calls cwb_connect_b() to connect to a given AP.
@@ -43,6 +46,15 @@
  *   or when an error is returned by a transmission request. The upper layer
  *   must then call cwb_disconnect_b().
  *
+ *   When the AP was already joined, and the lease obtained then did not
+ *   expire, the DHCP client requests its address again (INIT-REBOOT):
+ *   the server confirms it with a single DHCPACK, instead of the
+ *   DHCPDISCOVER / DHCPOFFER / DHCPREQUEST / DHCPACK exchange, followed by
+ *   the ARP check of the offered address. If the server refuses it, the
+ *   DHCP client gets a new address. Either way, the DHCP client then
+ *   renews the lease as usual. Leases are dropped after a power-on, as
+ *   the system time then restarts from 0.
+ *
  *   This component is not reentrant: it must be used by one client
  *   task only, at any given time.
  *
@@ -71,6 +83,17 @@ typedef enum {
     CWB_SYS_ERR,
 } cwb_status_t;
 
+typedef struct {
+    // Time from the association to the assignment of the IP address, for
+    // the last connection, in us.
+    int64_t ip_time;
+    // Was the cached lease requested again for the last connection?
+    bool lease_reused;
+    // Since startup: cached leases requested again, and new leases.
+    uint32_t leases_reused;
+    uint32_t dhcp_leases;
+} cwb_stats_t;
+
 /**
  * Tries to connect to the given AP, and waits for the assignment of an
  * IP address.
@@ -110,7 +133,8 @@ cwb_status_t cwb_connect_b(const uint8_t *ssid, const uint8_t *password,
 cwb_status_t cwb_disconnect_b(void);
 
 /**
- * Deinitializes Wi-Fi driver, if not done yet.
+ * Deinitializes Wi-Fi driver, if not done yet. Not required between
+ * connections: the driver is kept for next scan or connection.
  *
  * Parameters: none
  *
@@ -120,4 +144,6 @@ cwb_status_t cwb_disconnect_b(void);
  */
 cwb_status_t cwb_deinit_b(void);
 
+void cwb_get_stats_b(cwb_stats_t *stats);
+
 #endif /* CONN_WIFI_B_H_ */
@@ -0,0 +1,347 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <string.h>
+
+#include "base64.h"
+
+static const char STANDARD_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char URL_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Decoding tables: value of every character, or one of the following codes.
+#define PAD 0x40
+#define SPACE 0x41
+#define INVALID 0xff
+
+static const uint8_t STANDARD_TABLE[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x41, 0x41, 0xff,
+    0xff, 0x41, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x41, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
+    0xff, 0x40, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+    0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t URL_TABLE[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x41, 0x41, 0xff,
+    0xff, 0x41, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x41, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
+    0xff, 0x40, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0x3f,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+    0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+// Encodes a group of 3 bytes.
+static inline void encode_group(const char *alphabet, const uint8_t *src,
+                                char *dst) {
+
+    uint32_t group = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) |
+                     src[2];
+
+    dst[0] = alphabet[group >> 18];
+    dst[1] = alphabet[(group >> 12) & 0x3f];
+    dst[2] = alphabet[(group >> 6) & 0x3f];
+    dst[3] = alphabet[group & 0x3f];
+
+}
+
+void base64_encoder_init(base64_encoder_t *encoder, bool url) {
+
+    encoder->alphabet = url ? URL_ALPHABET : STANDARD_ALPHABET;
+    encoder->pad = !url;
+    encoder->pending_length = 0;
+
+}
+
+base64_status_t base64_encoder_update(base64_encoder_t *encoder,
+                                      const void *src, size_t length,
+                                      char *dst, size_t dst_size,
+                                      size_t *length_out) {
+
+    const uint8_t *bytes = src;
+    size_t written = 0;
+
+    *length_out = 0;
+    if ((encoder->pending_length + length) / 3 * 4 > dst_size) {
+        return BASE64_TOO_SMALL;
+    }
+    // Group started by previous chunks.
+    if (encoder->pending_length > 0) {
+        while ((encoder->pending_length < 3) && (length > 0)) {
+            encoder->pending[encoder->pending_length++] = *bytes++;
+            length--;
+            if (encoder->pending_length == 3) {
+                encode_group(encoder->alphabet, encoder->pending, dst);
+                written = 4;
+                encoder->pending_length = 0;
+                break;
+            }
+        }
+        if (encoder->pending_length > 0) {
+            return BASE64_OK;
+        }
+    }
+    for (; length >= 3; length -= 3, bytes += 3, written += 4) {
+        encode_group(encoder->alphabet, bytes, dst + written);
+    }
+    memcpy(encoder->pending, bytes, length);
+    encoder->pending_length = length;
+    *length_out = written;
+    return BASE64_OK;
+
+}
+
+base64_status_t base64_encoder_final(base64_encoder_t *encoder, char *dst,
+                                     size_t dst_size, size_t *length_out) {
+
+    uint8_t group[3] = { 0 };
+    size_t length;
+
+    *length_out = 0;
+    if (encoder->pending_length == 0) {
+        return BASE64_OK;
+    }
+    // Significant characters: 2 for 1 byte, 3 for 2 bytes.
+    length = encoder->pad ? 4 : encoder->pending_length + 1;
+    if (length > dst_size) {
+        return BASE64_TOO_SMALL;
+    }
+    memcpy(group, encoder->pending, encoder->pending_length);
+    char chars[4];
+    encode_group(encoder->alphabet, group, chars);
+    memset(chars + encoder->pending_length + 1, '=',
+           3 - encoder->pending_length);
+    memcpy(dst, chars, length);
+    encoder->pending_length = 0;
+    *length_out = length;
+    return BASE64_OK;
+
+}
+
+void base64_decoder_init(base64_decoder_t *decoder, bool url) {
+
+    decoder->table = url ? URL_TABLE : STANDARD_TABLE;
+    decoder->pad = !url;
+    decoder->group = 0;
+    decoder->digits = 0;
+    decoder->padding = 0;
+
+}
+
+base64_status_t base64_decoder_update(base64_decoder_t *decoder,
+                                      const char *src, size_t length,
+                                      uint8_t *dst, size_t dst_size,
+                                      size_t *length_out) {
+
+    const uint8_t *chars = (const uint8_t *)src;
+    const uint8_t *end = chars + length;
+    const uint8_t *table = decoder->table;
+    size_t written = 0;
+
+    *length_out = 0;
+    while (chars < end) {
+        // Fast path: whole group of 4 digits.
+        if ((decoder->digits == 0) && (decoder->padding == 0) &&
+            (end - chars >= 4)) {
+            uint8_t a = table[chars[0]];
+            uint8_t b = table[chars[1]];
+            uint8_t c = table[chars[2]];
+            uint8_t d = table[chars[3]];
+            if ((a | b | c | d) < PAD) {
+                if (written + 3 > dst_size) {
+                    return BASE64_TOO_SMALL;
+                }
+                uint32_t group = ((uint32_t)a << 18) | ((uint32_t)b << 12) |
+                                 ((uint32_t)c << 6) | d;
+                dst[written++] = group >> 16;
+                dst[written++] = group >> 8;
+                dst[written++] = group;
+                chars += 4;
+                continue;
+            }
+        }
+        uint8_t value = table[*chars++];
+        if (value < PAD) {
+            // No digit after padding.
+            if (decoder->padding > 0) {
+                return BASE64_INVALID;
+            }
+            decoder->group = (decoder->group << 6) | value;
+            if (++decoder->digits == 4) {
+                if (written + 3 > dst_size) {
+                    return BASE64_TOO_SMALL;
+                }
+                dst[written++] = decoder->group >> 16;
+                dst[written++] = decoder->group >> 8;
+                dst[written++] = decoder->group;
+                decoder->group = 0;
+                decoder->digits = 0;
+            }
+        } else if (value == PAD) {
+            // Padding completes a group of 2 or 3 digits.
+            if ((decoder->digits < 2) ||
+                (decoder->digits + decoder->padding == 4)) {
+                return BASE64_INVALID;
+            }
+            decoder->padding++;
+        } else if (value != SPACE) {
+            return BASE64_INVALID;
+        }
+    }
+    *length_out = written;
+    return BASE64_OK;
+
+}
+
+base64_status_t base64_decoder_final(base64_decoder_t *decoder, uint8_t *dst,
+                                     size_t dst_size, size_t *length_out) {
+
+    *length_out = 0;
+    if (decoder->digits == 0) {
+        return BASE64_OK;
+    }
+    if ((decoder->digits == 1) ||
+        ((decoder->pad || (decoder->padding > 0)) &&
+         (decoder->digits + decoder->padding != 4))) {
+        return BASE64_INVALID;
+    }
+    // 1 byte for 2 digits, 2 bytes for 3 digits.
+    size_t length = decoder->digits - 1;
+    if (length > dst_size) {
+        return BASE64_TOO_SMALL;
+    }
+    uint32_t group = decoder->group << (6 * (4 - decoder->digits));
+    dst[0] = group >> 16;
+    if (length == 2) {
+        dst[1] = group >> 8;
+    }
+    decoder->digits = 0;
+    decoder->padding = 0;
+    *length_out = length;
+    return BASE64_OK;
+
+}
+
+static base64_status_t encode(bool url, const void *src, size_t length,
+                              char *dst, size_t dst_size,
+                              size_t *length_out) {
+
+    base64_encoder_t encoder;
+    size_t final_length;
+
+    size_t required = (url ? (length * 4 + 2) / 3 :
+                       BASE64_ENCODED_LENGTH(length)) + 1;
+    if (dst_size < required) {
+        *length_out = required;
+        return BASE64_TOO_SMALL;
+    }
+    base64_encoder_init(&encoder, url);
+    base64_encoder_update(&encoder, src, length, dst, dst_size, length_out);
+    base64_encoder_final(&encoder, dst + *length_out, dst_size - *length_out,
+                         &final_length);
+    *length_out += final_length;
+    dst[*length_out] = '\0';
+    return BASE64_OK;
+
+}
+
+static base64_status_t decode(bool url, const char *src, size_t length,
+                              uint8_t *dst, size_t dst_size,
+                              size_t *length_out) {
+
+    base64_decoder_t decoder;
+    base64_status_t status;
+    size_t final_length;
+
+    base64_decoder_init(&decoder, url);
+    status = base64_decoder_update(&decoder, src, length, dst, dst_size,
+                                   length_out);
+    if (status != BASE64_OK) {
+        return status;
+    }
+    status = base64_decoder_final(&decoder, dst + *length_out,
+                                  dst_size - *length_out, &final_length);
+    *length_out += final_length;
+    return status;
+
+}
+
+base64_status_t base64_encode(const void *src, size_t length, char *dst,
+                              size_t dst_size, size_t *length_out) {
+
+    return encode(false, src, length, dst, dst_size, length_out);
+
+}
+
+base64_status_t base64_decode(const char *src, size_t length, uint8_t *dst,
+                              size_t dst_size, size_t *length_out) {
+
+    return decode(false, src, length, dst, dst_size, length_out);
+
+}
+
+base64_status_t base64_url_encode(const void *src, size_t length, char *dst,
+                                  size_t dst_size, size_t *length_out) {
+
+    return encode(true, src, length, dst, dst_size, length_out);
+
+}
+
+base64_status_t base64_url_decode(const char *src, size_t length,
+                                  uint8_t *dst, size_t dst_size,
+                                  size_t *length_out) {
+
+    return decode(true, src, length, dst, dst_size, length_out);
+
+}
@@ -17,225 +17,2266 @@
  * Copyright 2023 Pascal Bodin
  */
 
-#include "esp_system.h"
-#include "esp_event.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
 #include "esp_log.h"
-#include "esp_http_client.h"
-#include "esp_https_ota.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "base64.h"
 #include "fuota_b.h"
+#include "ota_budget.h"
+#include "ota_check.h"
+#include "ota_dedup.h"
+#include "ota_hsz.h"
+#include "ota_http.h"
+#include "ota_manifest.h"
+#include "ota_multi.h"
+#include "ota_patch.h"
+#include "ota_pipe.h"
+#include "ota_progress.h"
+#include "ota_storage.h"
+#include "ota_tune.h"
+#include "sdkconfig.h"
+#include "trace_ring.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "ota_flash.h"
+#include "ota_tls.h"
+#endif
 
 const char OTA_TAG[] = "OTA";
 
+ESP_EVENT_DEFINE_BASE(FUOTA_B_EVENT);
+
 static const char VER_PARAM[] = "app_ver";
-static const char HTTPS[] = "https://";
+// Tells the server which patch formats we are able to apply.
+static const char DELTA_PARAM[] = "delta";
+static const char DELTA_FORMATS[] = OTA_PATCH_MAGIC;
+// Tells the server which compression formats we are able to decompress.
+static const char COMP_PARAM[] = "comp";
+static const char COMP_FORMATS[] = OTA_HSZ_MAGIC;
 static const char DEVICES_PATH[] = "/devices";
 static const char FILES_PATH[] = "/files";
+// Suffix of the path of the block manifest of an update file.
+static const char MANIFEST_SUFFIX[] = ".fbm";
 
 // Buffer for update file path, including final '\0'.
-#define UPDATE_FILE_PATH_MAX_LENGTH 255
+#define UPDATE_FILE_PATH_MAX_LENGTH OTA_CHECK_PATH_MAX_LENGTH
 static char update_file_path[UPDATE_FILE_PATH_MAX_LENGTH + 1];
-// Buffer for the request URLs, including final '\0'.
-#define REQUEST_URL_MAX_LENGTH 512
-static char request_url[REQUEST_URL_MAX_LENGTH + 1];
+// Buffer for the request paths, including final '\0'.
+#define REQUEST_PATH_MAX_LENGTH 512
+static char request_path[REQUEST_PATH_MAX_LENGTH + 1];
+// Buffer for additional request headers, including final '\0'.
+#define REQUEST_HEADERS_MAX_LENGTH 192
+static char request_headers[REQUEST_HEADERS_MAX_LENGTH + 1];
+
+// HTTP client, kept between calls to ota_update_b(), so that its connection
+// to the update server is reused by next requests (HTTP keep-alive). It is
+// released by ota_close_b(). The TLS session is cached beyond that, so that
+// next connection resumes it.
+static ota_http_t http;
+static bool http_ready = false;
+// SHA-256 of the certificate and credentials the client was prepared with.
+static uint8_t http_settings_digest[32];
+
+// Send and receive timeout of the transport.
+#define TRANSPORT_TIMEOUT_MS 5000
+
+// Server of the current update, for the connections of parallel streams.
+static const char *server_cert_pem;
+static const char *server_username;
+static const char *server_password;
+
+// Number of connections an uncompressed image may be downloaded over, see
+// ota_set_streams_b().
+static uint8_t stream_count = CONFIG_FUOTA_B_STREAMS;
+// When parallel streams may be used, the update file is first requested up
+// to this offset: the rest is split in parts once its type and size are
+// known.
+#define HEAD_PART_SIZE (16 * OTA_STORAGE_SECTOR_SIZE)
+// Parts fetched by parallel streams are not smaller than this.
+#define MIN_PART_SIZE (16 * OTA_STORAGE_SECTOR_SIZE)
+// Number of attempts to fetch a part whose stream failed.
+#define PART_ATTEMPTS 3
+
+// Backends, see ota_set_backends_b(). NULL for the default ones.
+static ota_transport_create_t create_transport = NULL;
+static ota_storage_t *storage = NULL;
+
+// Metrics of the current, or last, call to ota_update_b().
+static ota_metrics_t metrics;
+
+// Set while an update runs, whether started by ota_update_b() or by
+// ota_start_b().
+static atomic_bool running = false;
+// Set by ota_cancel_b(), checked before every read of the update file.
+static atomic_bool cancelled = false;
+// Set by download_parts() when the first part failed, to stop the other
+// streams.
+static atomic_bool parts_stopped = false;
+// Bytes of the update file received by all connections, and size of the
+// update file.
+static atomic_uint received_bytes;
+static atomic_uint total_bytes;
+// Period, in bytes of the update file, of the progress events.
+#define PROGRESS_EVENT_PERIOD (64 * 1024)
+static uint32_t next_progress_event;
+
+// Update started by ota_start_b(), run by the update task.
+typedef struct {
+    const char *server_name;
+    uint16_t server_port;
+    const char *cert_pem;
+    const char *username;
+    const char *password;
+    const char *id;
+    const char *app_ver;
+    ota_event_cb_t callback;
+    void *arg;
+} async_update_t;
+
+static async_update_t async_update;
+// Callback of the running update, NULL if none.
+static ota_event_cb_t event_callback = NULL;
+static void *event_arg;
+static atomic_bool async_running = false;
+// Given at the end of the update task, and given back by ota_wait_b().
+static SemaphoreHandle_t async_done = NULL;
+static ota_status_t async_result = OTA_PARAM_ERR;
+
+// The update file is received by the calling task, and written by the
+// writer task, through a ring of buffers. When possible, the writer task
+// runs on the other core.
+#define WRITER_STACK_SIZE 4096
+static ota_pipe_t ring;
+// Read length and buffer size, adapted to the link.
+static ota_tune_t tune;
+static SemaphoreHandle_t writer_done = NULL;
+// Set by the writer task when it can't process the update file anymore.
+static atomic_bool write_failed;
+// Status of the reception, set before the end of the stream is committed.
+static ota_status_t receive_result;
+// Status of the processing, valid once writer_done is given.
+static ota_status_t write_result;
+
+// Period, in bytes of the update file, of the progress record saves. Must be
+// a multiple of the flash sector size: on resumption, writing restarts at the
+// beginning of a sector.
+#define PROGRESS_SAVE_PERIOD (16 * OTA_STORAGE_SECTOR_SIZE)
+
+#define SHA256_LENGTH 32
+static const char DIGEST_SHA256[] = "SHA-256=";
+
+// Response headers used to resume a download and to check the update file.
+#define HEADER_VALUE_MAX_LENGTH 127
+typedef struct {
+    char etag[OTA_PROGRESS_VALIDATOR_MAX_LENGTH + 1];
+    char last_modified[OTA_PROGRESS_VALIDATOR_MAX_LENGTH + 1];
+    char content_range[HEADER_VALUE_MAX_LENGTH + 1];
+    char digest[HEADER_VALUE_MAX_LENGTH + 1];
+    // Size of the application image, optionally given by the server in the
+    // update check response, whatever the type of the update file.
+    uint32_t image_size;
+    // Cache-Control max-age of the update check response, in seconds.
+    uint32_t max_age;
+} response_headers_t;
+
+static response_headers_t response_headers;
+
+// First byte of an application image.
+#define IMAGE_MAGIC 0xE9
+
+// Length of the longest magic identifying a file type.
+#define MAGIC_LENGTH 4
+
+// Above this number of corrupted blocks, the download is considered as
+// failed.
+#define MAX_BAD_BLOCKS 16
+// Number of attempts to fetch a corrupted block again.
+#define REFETCH_ATTEMPTS 2
+// Buffer for the manifest and for blocks fetched again.
+#define FETCH_BUF_SIZE 1024
+static uint8_t fetch_buf[FETCH_BUF_SIZE];
+
+// The update file is either an application image, a patch to be applied
+// to the running image, or one of both compressed. The type is known once
+// its first bytes are received.
+typedef enum {
+    FILE_UNKNOWN,
+    FILE_IMAGE,
+    FILE_PATCH,
+    FILE_COMPRESSED,
+} file_type_t;
+
+// A stream is either the update file as received, or the decompressed
+// content of a compressed update file.
+typedef struct {
+    file_type_t type;
+    uint8_t head[MAGIC_LENGTH];
+    size_t head_length;
+} stream_t;
+
+// Context of the current update.
+typedef struct {
+    stream_t file;
+    stream_t content;
+    // Offset of the next image byte in the update partition.
+    uint32_t offset;
+    // The update partition is erased up to this offset.
+    uint32_t erased_end;
+    // Size of the image announced by the server, 0 if unknown.
+    uint32_t image_size;
+    // Times of the start of the download and of the first image write, in
+    // microseconds.
+    int64_t start_time;
+    int64_t first_write_time;
+    // Number of update file bytes received, and their hash.
+    uint32_t file_offset;
+    mbedtls_sha256_context sha;
+    ota_progress_t progress;
+    // The image is checked against the manifest, if any, up to this offset.
+    uint32_t verified_end;
+    // Blocks which did not match the manifest, to be fetched again.
+    uint32_t bad_blocks[MAX_BAD_BLOCKS];
+    uint32_t bad_block_count;
+    // Set when the image is built block by block: only the range ending at
+    // range_end is being written, other blocks are kept or copied.
+    bool dedup;
+    uint32_t range_end;
+    // Set while the update file is received by parts: the range ending at
+    // range_end is not the end of the file.
+    bool partial;
+    // Digest header of the update file.
+    char digest[HEADER_VALUE_MAX_LENGTH + 1];
+} update_t;
+
+// The following contexts are large, so they are not allocated on the stack.
+static update_t update;
+static ota_patch_t patch;
+static ota_hsz_t hsz;
+static ota_manifest_t manifest;
+
+// Tells the application about the update, through the default event loop
+// and the callback, if any. Called by the task running the update.
+static void notify(ota_event_t event, ota_status_t status) {
+
+    ota_event_data_t data = {
+        .status = status,
+        .received = atomic_load(&received_bytes),
+        .total = atomic_load(&total_bytes),
+    };
+
+    // Without default event loop, the event is dropped.
+    esp_event_post(FUOTA_B_EVENT, event, &data, sizeof(data), 0);
+    if (event_callback != NULL) {
+        event_callback(event_arg, event, &data);
+    }
+
+}
+
+// Counts bytes of the update file received by the task running the update,
+// and tells about the progress, periodically.
+static void count_received(uint32_t length) {
+
+    uint32_t received = atomic_fetch_add(&received_bytes, length) + length;
 
-// Stops the communication with the server, deallocating resources.
+    if (received >= next_progress_event) {
+        next_progress_event = received + PROGRESS_EVENT_PERIOD;
+        notify(OTA_EVENT_PROGRESS, OTA_RUNNING);
+    }
+
+}
+
+// Returns true if ota_cancel_b() was called during the update.
+static bool is_cancelled(void) {
+
+    if (!atomic_load(&cancelled)) {
+        return false;
+    }
+    ESP_LOGW(OTA_TAG, "Update cancelled");
+    return true;
+
+}
+
+// Sends a request for request_path, with the given additional headers (may
+// be NULL), and receives the response headers. A connection kept open by a
+// previous request, and closed by the server in the meantime, is replaced
+// by a new one.
 // Returned value:
-// - OTA_OK
+// - OTA_OK: status code and content length are available from http
+// - OTA_PARAM_ERR: request too long
 // - OTA_CONN_ERR
+static ota_status_t open_request(const char *headers) {
+
+    memset(&response_headers, 0, sizeof(response_headers));
+    return ota_http_open(&http, request_path, headers);
+
+}
+
+// Copies a header value, truncating it if required. dest is always
+// NUL-terminated.
+static void copy_header(char *dest, size_t size, const char *value) {
+
+    size_t length = strnlen(value, size - 1);
+
+    memcpy(dest, value, length);
+    dest[length] = '\0';
+
+}
+
+// Called by the HTTP client for every response header.
+static void on_header(void *arg, const char *key, const char *value) {
+
+    TRACE(OTA_HEADER, trace_ring_4cc(key), strlen(value));
+    ESP_LOGD(OTA_TAG, "Header: %s: %s", key, value);
+    if (strcasecmp(key, "ETag") == 0) {
+        copy_header(response_headers.etag, sizeof(response_headers.etag),
+                    value);
+    } else if (strcasecmp(key, "Last-Modified") == 0) {
+        copy_header(response_headers.last_modified,
+                    sizeof(response_headers.last_modified), value);
+    } else if (strcasecmp(key, "Content-Range") == 0) {
+        copy_header(response_headers.content_range,
+                    sizeof(response_headers.content_range), value);
+    } else if (strcasecmp(key, "Digest") == 0) {
+        copy_header(response_headers.digest, sizeof(response_headers.digest),
+                    value);
+    } else if (strcasecmp(key, "X-Image-Size") == 0) {
+        response_headers.image_size = strtoul(value, NULL, 10);
+    } else if (strcasecmp(key, "Cache-Control") == 0) {
+        // no-cache and no-store directives leave max_age to 0.
+        const char *max_age = strstr(value, "max-age=");
+        if ((max_age != NULL) && (strstr(value, "no-cache") == NULL) &&
+            (strstr(value, "no-store") == NULL)) {
+            response_headers.max_age = strtoul(max_age + strlen("max-age="),
+                                               NULL, 10);
+        }
+    }
+
+}
+
+// Computes the SHA-256 of the certificate and credentials of a client.
+// Every value is preceded by a byte telling whether it is NULL, and
+// followed by its terminating NUL, so that different settings give
+// different digests.
+static void get_settings_digest(const char *cert_pem, const char *username,
+                                const char *password, uint8_t digest[32]) {
+
+    const char *values[] = { cert_pem, username, password };
+    mbedtls_sha256_context sha;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint8_t present = values[i] != NULL;
+        mbedtls_sha256_update_ret(&sha, &present, 1);
+        if (present) {
+            mbedtls_sha256_update_ret(&sha, (const uint8_t *)values[i],
+                                      strlen(values[i]) + 1);
+        }
+    }
+    mbedtls_sha256_finish_ret(&sha, digest);
+    mbedtls_sha256_free(&sha);
+
+}
+
+// Closes the client, if any, and its connection. Called with running set.
+static void close_client(void) {
+
+    if (!http_ready) {
+        return;
+    }
+    ota_http_deinit(&http);
+    http_ready = false;
+
+}
+
+// Prepares the client for requests to the given server. The current client,
+// and its connection, are reused if they are for the same server, with the
+// same certificate and credentials.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: server name too long, invalid certificate or credentials
 // - OTA_SYS_ERR
-static ota_status_t stop_comm(esp_http_client_handle_t client) {
+static ota_status_t prepare_client(const char *server_name,
+                                   uint16_t server_port, const char *cert_pem,
+                                   const char *username, const char *password) {
 
-    esp_err_t esp_rs;
+    ota_transport_t *transport;
+    uint8_t digest[sizeof(http_settings_digest)];
 
-    esp_rs = esp_http_client_close(client);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(OTA_TAG, "stop_comm - esp_http_client_close failed");
-        return OTA_CONN_ERR;
+    get_settings_digest(cert_pem, username, password, digest);
+    if (http_ready && (strcmp(server_name, http.transport->host) == 0) &&
+        (server_port == http.transport->port) &&
+        (memcmp(digest, http_settings_digest, sizeof(digest)) == 0)) {
+        return OTA_OK;
     }
-    esp_rs = esp_http_client_cleanup(client);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(OTA_TAG, "stop_comm - esp_http_client_cleanup failed");
-        return OTA_SYS_ERR;
+    close_client();
+    ota_status_t ota_rs = create_transport(server_name, server_port, cert_pem,
+                                           TRANSPORT_TIMEOUT_MS, &transport);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    ota_rs = ota_http_init(&http, transport, username, password, on_header,
+                           NULL);
+    if (ota_rs != OTA_OK) {
+        ota_http_deinit(&http);
+        return ota_rs;
     }
+    memcpy(http_settings_digest, digest, sizeof(digest));
+    http_ready = true;
     return OTA_OK;
 
 }
 
-/**
- * Event handler used by esp_https_ota().
- */
-esp_err_t http_event_handler(esp_http_client_event_t *evt)
-{
-    static uint32_t data_len = 0;
-
-    switch (evt->event_id) {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGI(OTA_TAG, "HTTP_EVENT_ERROR");
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGI(OTA_TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
-    case HTTP_EVENT_HEADERS_SENT:
-        ESP_LOGI(OTA_TAG, "HTTP_EVENT_HEADERS_SENT");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        ESP_LOGI(OTA_TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        break;
-    case HTTP_EVENT_ON_DATA:
-        data_len += evt->data_len;
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        ESP_LOGI(OTA_TAG, "HTTP_EVENT_ON_FINISH - data length: %u", data_len);
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-        ESP_LOGI(OTA_TAG, "HTTP_EVENT_DISCONNECTED - data length: %u", data_len);
-        break;
-    default:
-        ESP_LOGE(OTA_TAG, "http_event_handler - Unexpected event ID: %d", evt->event_id);
+// Erases the update partition up to the end of the sector containing the
+// byte preceding end, if not done yet.
+static ota_status_t erase_until(uint32_t end) {
+
+    if (end <= update.erased_end) {
+        return OTA_OK;
+    }
+    uint32_t erase_end = (end + OTA_STORAGE_SECTOR_SIZE - 1) &
+                         ~(OTA_STORAGE_SECTOR_SIZE - 1);
+    if (erase_end > storage->update_size) {
+        ESP_LOGE(OTA_TAG, "Image larger than update partition");
+        return OTA_PARAM_ERR;
     }
-    return ESP_OK;
+    TRACE(OTA_ERASE, update.erased_end, erase_end - update.erased_end);
+    ota_status_t ota_rs = storage->ops->erase(storage, update.erased_end,
+                                              erase_end - update.erased_end);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    update.erased_end = erase_end;
+    return OTA_OK;
+
 }
 
-ota_status_t ota_update_b(const char *server_name, uint16_t server_port,
-                          const char *cert_pem, const  char *username,
-                          const char *password,
-                          const char *id,
-                          const char *app_ver) {
+// Returns the size of the image being written, or 0 if it is not known
+// (yet).
+static uint32_t get_image_size(void) {
 
-    esp_err_t esp_rs;
-    ota_status_t ota_rs;
+    if (update.image_size != 0) {
+        return update.image_size;
+    }
+    if (manifest.loaded) {
+        return manifest.image_size;
+    }
+    if (update.file.type == FILE_IMAGE) {
+        return update.progress.file_size;
+    }
+    if ((update.file.type == FILE_PATCH) || (update.content.type == FILE_PATCH)) {
+        return patch.target_size;
+    }
+    return 0;
 
-    esp_http_client_config_t config = {0};
-    esp_http_client_handle_t client;
+}
 
-    ESP_LOGI(OTA_TAG, "Starting update with %s:%d", server_name,
-             server_port);
-    // Check whether an update is available.
-    // First, build the request URL: https://<server_name>:<server_port><path>?<query>.
-    // Path and query: /devices/<device_id>?app_ver=<app_version>.
-    // The assignment below allows to check that the resulting URL will not be too long
-    // for the buffer.
-    int url_length = snprintf(NULL, 0, "%s%s:%d%s/%s?%s=%s",
-                              HTTPS, server_name, server_port,
-                              DEVICES_PATH, id,
-                              VER_PARAM, app_ver);
-    if (url_length > REQUEST_URL_MAX_LENGTH) {
-        ESP_LOGE(OTA_TAG, "Request too long, exiting");
-        return OTA_PARAM_ERR;
+// Erases the sector following the erased part of the update partition, if
+// the image will be written to it. Called while waiting for data, so that
+// erasing overlaps with reception.
+// Returned value:
+// - true: a sector was erased
+// - false: nothing to erase, or erase error, which will be detected by next
+//   write
+static bool erase_ahead(void) {
+
+    uint32_t end = get_image_size();
+    int64_t start;
+
+    if ((update.range_end != 0) && (update.range_end < end)) {
+        end = update.range_end;
     }
-    snprintf(request_url, REQUEST_URL_MAX_LENGTH, "%s%s:%d%s/%s?%s=%s",
-              HTTPS, server_name, server_port,
-              DEVICES_PATH, id,
-              VER_PARAM, app_ver);
-    config.url = request_url;
-    config.method = HTTP_METHOD_GET;
-    config.cert_pem = (char *)cert_pem;
-    config.event_handler = http_event_handler;
-    config.auth_type =  HTTP_AUTH_TYPE_BASIC;
-    config.username = username;
-    config.password = password;
-    client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(OTA_TAG, "esp_http_client error, exiting");
-        return OTA_SYS_ERR;
+    if (update.erased_end >= end) {
+        return false;
     }
-    // We don't have any content to send: write_len is 0.
-    esp_rs = esp_http_client_open(client, 0);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(OTA_TAG, "esp_http_client_open error, exiting");
-        return OTA_CONN_ERR;
+    start = esp_timer_get_time();
+    bool erased = erase_until(update.erased_end + 1) == OTA_OK;
+    metrics.flash_time += esp_timer_get_time() - start;
+    return erased;
+
+}
+
+// Checks the blocks of the image written since last call against the
+// manifest, if any. A corrupted block of an uncompressed image is recorded,
+// to be fetched again at the end of the download. Blocks can't be fetched
+// again for other types of update file.
+static ota_status_t verify_blocks(void) {
+
+    ota_status_t ota_rs;
+    uint32_t block_end;
+
+    if (!manifest.loaded) {
+        return OTA_OK;
     }
-    int content_length = esp_http_client_fetch_headers(client);
-    ESP_LOGI(OTA_TAG, "Content length: %d", content_length);
-    if (content_length == ESP_FAIL) {
-        ESP_LOGE(OTA_TAG, "esp_http_client_fetch_headers error, exiting");
-        return OTA_CONN_ERR;
+    if (update.offset > manifest.image_size) {
+        ESP_LOGE(OTA_TAG, "Image larger than given by manifest");
+        return OTA_PARAM_ERR;
     }
-    // We do not test content_length against 0, as it can be 0 when
-    // no update is available. This case is handled by status code 204 below.
-    int status_code = esp_http_client_get_status_code(client);
-    if (status_code == 400) {
-        ESP_LOGW(OTA_TAG, "Bad Request");
-        ota_rs = stop_comm(client);
-        if (ota_rs != OTA_OK) {
+    while (update.verified_end < update.offset) {
+        block_end = update.verified_end + manifest.block_size;
+        if (block_end > manifest.image_size) {
+            block_end = manifest.image_size;
+        }
+        if (block_end > update.offset) {
+            // Block not written completely yet.
+            break;
+        }
+        uint32_t index = update.verified_end / manifest.block_size;
+        ota_rs = ota_manifest_check_block(&manifest, storage, index);
+        if (ota_rs == OTA_PARAM_ERR) {
+            if ((update.file.type != FILE_IMAGE) ||
+                (update.bad_block_count == MAX_BAD_BLOCKS)) {
+                ESP_LOGE(OTA_TAG, "Block %u corrupted", index);
+                return OTA_PARAM_ERR;
+            }
+            ESP_LOGW(OTA_TAG, "Block %u corrupted, will be fetched again",
+                     index);
+            update.bad_blocks[update.bad_block_count++] = index;
+        } else if (ota_rs != OTA_OK) {
             return ota_rs;
         }
+        update.verified_end = block_end;
+    }
+    return OTA_OK;
+
+}
+
+// Writes a chunk of an application image to the update partition.
+// The partition is erased on demand, so that the part written by a previous
+// download is kept when this download is resumed.
+static ota_status_t write_image(const uint8_t *data, size_t length) {
+
+    if ((update.offset == 0) && (data[0] != IMAGE_MAGIC)) {
+        ESP_LOGE(OTA_TAG, "Invalid image magic: 0x%02x", data[0]);
         return OTA_PARAM_ERR;
     }
-    if (status_code == 403) {
-        ESP_LOGW(OTA_TAG, "Forbidden");
-        ota_rs = stop_comm(client);
+    int64_t start = esp_timer_get_time();
+    if (update.first_write_time == 0) {
+        update.first_write_time = start;
+    }
+    ota_status_t ota_rs = erase_until(update.offset + length);
+    if (ota_rs == OTA_OK) {
+        TRACE(OTA_WRITE, update.offset, length);
+        ota_rs = storage->ops->write(storage, update.offset, data, length);
+    }
+    if (ota_rs == OTA_OK) {
+        update.offset += length;
+        metrics.image_bytes += length;
+        ota_rs = verify_blocks();
+    }
+    metrics.flash_time += esp_timer_get_time() - start;
+    return ota_rs;
+
+}
+
+// Receives the image built from a patch.
+static ota_status_t write_patch_output(void *arg, const uint8_t *data,
+                                       size_t length) {
+
+    return write_image(data, length);
+
+}
+
+static ota_status_t write_stream(stream_t *stream, const uint8_t *data,
+                                 size_t length);
+
+// Receives the decompressed content of a compressed update file.
+static ota_status_t write_content(void *arg, const uint8_t *data,
+                                  size_t length) {
+
+    return write_stream((stream_t *)arg, data, length);
+
+}
+
+// Sets the stream type from its first bytes, and prepares the processing
+// of the stream.
+static ota_status_t start_stream(stream_t *stream) {
+
+    if (stream->head[0] == IMAGE_MAGIC) {
+        stream->type = FILE_IMAGE;
+        return OTA_OK;
+    }
+    if (memcmp(stream->head, OTA_PATCH_MAGIC, OTA_PATCH_MAGIC_LENGTH) == 0) {
+        ESP_LOGI(OTA_TAG, "Update file is a patch");
+        stream->type = FILE_PATCH;
+        ota_patch_begin(&patch, storage, write_patch_output, NULL);
+        return OTA_OK;
+    }
+    // A compressed file can't contain another compressed file.
+    if ((stream == &update.file) &&
+        (memcmp(stream->head, OTA_HSZ_MAGIC, OTA_HSZ_MAGIC_LENGTH) == 0)) {
+        ESP_LOGI(OTA_TAG, "Update file is compressed");
+        stream->type = FILE_COMPRESSED;
+        ota_hsz_begin(&hsz, write_content, &update.content);
+        return OTA_OK;
+    }
+    ESP_LOGE(OTA_TAG, "Unknown update file type");
+    return OTA_PARAM_ERR;
+
+}
+
+static ota_status_t write_typed_stream(stream_t *stream, const uint8_t *data,
+                                       size_t length) {
+
+    switch (stream->type) {
+    case FILE_IMAGE:
+        return write_image(data, length);
+    case FILE_PATCH:
+        return ota_patch_write(&patch, data, length);
+    case FILE_COMPRESSED:
+        return ota_hsz_write(&hsz, data, length);
+    default:
+        ESP_LOGE(OTA_TAG, "Unexpected file type: %d", stream->type);
+        return OTA_SYS_ERR;
+    }
+
+}
+
+// Processes a chunk of a stream.
+static ota_status_t write_stream(stream_t *stream, const uint8_t *data,
+                                 size_t length) {
+
+    ota_status_t ota_rs;
+
+    if (stream->type == FILE_UNKNOWN) {
+        // Keep the first bytes, until the type is known.
+        size_t step = MAGIC_LENGTH - stream->head_length;
+        if (step > length) {
+            step = length;
+        }
+        memcpy(stream->head + stream->head_length, data, step);
+        stream->head_length += step;
+        data += step;
+        length -= step;
+        if ((stream->head_length < MAGIC_LENGTH) &&
+            (stream->head[0] != IMAGE_MAGIC)) {
+            return OTA_OK;
+        }
+        ota_rs = start_stream(stream);
         if (ota_rs != OTA_OK) {
             return ota_rs;
         }
-        return OTA_PARAM_ERR;
-    }
-    if (status_code == 404) {
-        ESP_LOGW(OTA_TAG, "Not Found");
-        ota_rs = stop_comm(client);
+        ota_rs = write_typed_stream(stream, stream->head, stream->head_length);
         if (ota_rs != OTA_OK) {
             return ota_rs;
         }
-        return OTA_NO_UPDATE;
     }
-    if (status_code == 204) {
-        ESP_LOGI(OTA_TAG, "No Content");
-        ota_rs = stop_comm(client);
+    if (length == 0) {
+        return OTA_OK;
+    }
+    return write_typed_stream(stream, data, length);
+
+}
+
+// Called once the whole stream has been received.
+static ota_status_t end_stream(stream_t *stream) {
+
+    ota_status_t ota_rs;
+
+    switch (stream->type) {
+    case FILE_UNKNOWN:
+        ESP_LOGE(OTA_TAG, "Update file too short");
+        return OTA_PARAM_ERR;
+    case FILE_IMAGE:
+        return OTA_OK;
+    case FILE_PATCH:
+        return ota_patch_end(&patch);
+    case FILE_COMPRESSED:
+        ota_rs = ota_hsz_end(&hsz);
         if (ota_rs != OTA_OK) {
             return ota_rs;
         }
-        return OTA_NO_UPDATE;
+        return end_stream(&update.content);
+    default:
+        ESP_LOGE(OTA_TAG, "Unexpected file type: %d", stream->type);
+        return OTA_SYS_ERR;
     }
-    if (status_code == 200) {
-        ESP_LOGI(OTA_TAG, "OK");
-        if (content_length > UPDATE_FILE_PATH_MAX_LENGTH) {
-            // We don't have enough space to store returned content. Abort.
-            ESP_LOGE(OTA_TAG, "Content_length too large: %d",
-                     content_length);
-            stop_comm(client);
-            return OTA_PARAM_ERR;
-        }
-        // At this stage, we can store received content. So, get it.
-        esp_http_client_read(client, update_file_path, content_length);
-        // And stop communication with the server.
-        ota_rs = stop_comm(client);
+
+}
+
+// Releases the resources used by the processing of the update file, after
+// an error. The update partition is left as is, for a possible resumption.
+static void abort_update(void) {
+
+    if (update.file.type == FILE_COMPRESSED) {
+        ota_hsz_end(&hsz);
+    }
+    mbedtls_sha256_free(&update.sha);
+    storage->ops->abort(storage);
+
+}
+
+// Only a download of an uncompressed image can be resumed: the state of
+// the other decoders is not saved. An image built block by block is resumed
+// from the blocks already written, without progress record. An image
+// received by parts is not written in order.
+static bool is_resumable(void) {
+
+    return (update.file.type == FILE_IMAGE) && !update.dedup &&
+           !update.partial && (update.progress.validator[0] != '\0');
+
+}
+
+// Checks the SHA-256 of the update file against the one given by the server
+// in a Digest header (RFC 3230), if any.
+static ota_status_t check_digest(void) {
+
+    uint8_t sha[SHA256_LENGTH];
+    uint8_t expected_sha[SHA256_LENGTH];
+    size_t sha_length;
+    const char *value = NULL;
+
+    mbedtls_sha256_finish_ret(&update.sha, sha);
+    for (const char *p = update.digest; *p != '\0'; p++) {
+        if (strncasecmp(p, DIGEST_SHA256, strlen(DIGEST_SHA256)) == 0) {
+            value = p + strlen(DIGEST_SHA256);
+            break;
+        }
+    }
+    if (value == NULL) {
+        return OTA_OK;
+    }
+    if ((base64_decode(value, strcspn(value, ", "), expected_sha,
+                       sizeof(expected_sha), &sha_length) != BASE64_OK) ||
+        (sha_length != SHA256_LENGTH)) {
+        ESP_LOGE(OTA_TAG, "Invalid Digest header: %s", update.digest);
+        return OTA_PARAM_ERR;
+    }
+    if (memcmp(sha, expected_sha, SHA256_LENGTH) != 0) {
+        ESP_LOGE(OTA_TAG, "Update file digest mismatch");
+        return OTA_PARAM_ERR;
+    }
+    ESP_LOGI(OTA_TAG, "Update file digest OK");
+    return OTA_OK;
+
+}
+
+// Processes a chunk of the update file. The chunk is split on progress save
+// points, so that the saved hash state matches the saved offset.
+static ota_status_t write_chunk(const uint8_t *data, size_t length) {
+
+    ota_status_t ota_rs;
+    uint32_t next_save;
+    size_t step;
+
+    for (size_t i = 0; i < length; i += step) {
+        next_save = (update.file_offset / PROGRESS_SAVE_PERIOD + 1) *
+                    PROGRESS_SAVE_PERIOD;
+        step = length - i;
+        if (step > next_save - update.file_offset) {
+            step = next_save - update.file_offset;
+        }
+        ota_rs = write_stream(&update.file, data + i, step);
         if (ota_rs != OTA_OK) {
             return ota_rs;
         }
-        // At this stage, update is supposed to be available, download and
-        // flash it.
-        ESP_LOGI(OTA_TAG, "Requesting %s", update_file_path);
-        // URL: https://<server_name>:<server_port><path>.
-        // Path: /files/<update_file_path>.
-        url_length = snprintf(NULL, 0, "%s%s:%d%s/%s",
-                              HTTPS, server_name, server_port,
-                              FILES_PATH,
-                              update_file_path);
-        if (url_length > REQUEST_URL_MAX_LENGTH) {
-            ESP_LOGE(OTA_TAG, "Request too long, exiting");
-            return OTA_PARAM_ERR;
-        }
-        snprintf(request_url, REQUEST_URL_MAX_LENGTH, "%s%s:%d%s/%s",
-                  HTTPS, server_name, server_port,
-                  FILES_PATH,
-                  update_file_path);
-        config.url = request_url;
-        esp_rs = esp_https_ota(&config);
-        if (esp_rs != ESP_OK) {
-            ESP_LOGE(OTA_TAG, "Update error: %s - Exiting",
-                     esp_err_to_name(esp_rs));
-            // We return a connectivity error, even if it could be something
-            // else.
+        mbedtls_sha256_update_ret(&update.sha, data + i, step);
+        update.file_offset += step;
+        // Corrupted blocks would not be fetched again after a resumption.
+        if ((update.file_offset == next_save) && is_resumable() &&
+            (update.bad_block_count == 0)) {
+            // Not being able to save progress is not a reason to stop.
+            update.progress.offset = update.file_offset;
+            ota_progress_save(&update.progress, &update.sha);
+        }
+    }
+    return OTA_OK;
+
+}
+
+// Writer task: processes the chunks of the update file received through the
+// ring, until the end of the stream. After an error, remaining chunks are
+// dropped, so that the receiving task is never blocked.
+static void writer_task(void *arg) {
+
+    ota_status_t ota_rs = OTA_OK;
+    const uint8_t *data;
+    size_t length;
+    int64_t start;
+
+    while (true) {
+        data = ota_pipe_try_peek(&ring, &length);
+        if (data == NULL) {
+            // Nothing received yet: prepare next writes.
+            start = esp_timer_get_time();
+            if (erase_ahead()) {
+                ota_budget_charge_writer(esp_timer_get_time() - start);
+                continue;
+            }
+            data = ota_pipe_peek(&ring, &length);
+        }
+        if (length == 0) {
+            ota_pipe_release(&ring);
+            break;
+        }
+        if (ota_rs == OTA_OK) {
+            start = esp_timer_get_time();
+            ota_rs = write_chunk(data, length);
+            ota_budget_charge_writer(esp_timer_get_time() - start);
+            if (ota_rs != OTA_OK) {
+                atomic_store(&write_failed, true);
+            }
+        }
+        ota_pipe_release(&ring);
+    }
+    // When the update file is received by parts, it is ended with the
+    // last one.
+    if ((ota_rs == OTA_OK) && (receive_result == OTA_OK) && !update.partial) {
+        ota_rs = end_stream(&update.file);
+        // When the image is built block by block, the stream is a range
+        // of the update file.
+        if ((ota_rs == OTA_OK) && manifest.loaded && !update.dedup &&
+            (update.offset != manifest.image_size)) {
+            ESP_LOGE(OTA_TAG, "Image size differs from manifest: %u",
+                     update.offset);
+            ota_rs = OTA_PARAM_ERR;
+        }
+        // Blocks fetched again are checked against the manifest, not
+        // against the digest of the whole file.
+        if ((ota_rs == OTA_OK) && !update.dedup &&
+            (update.bad_block_count == 0)) {
+            ota_rs = check_digest();
+        }
+    }
+    write_result = ota_rs;
+    xSemaphoreGive(writer_done);
+    vTaskDelete(NULL);
+
+}
+
+// Receives the update file, and passes it to the writer task.
+static ota_status_t receive_update_file(void) {
+
+    uint8_t *buffer;
+    int read_length;
+    int64_t start;
+    int64_t read_start;
+    int64_t end;
+
+    while (!atomic_load(&write_failed)) {
+        if (is_cancelled()) {
+            return OTA_CANCELLED;
+        }
+        metrics.throttle_time += ota_budget_wait();
+        start = esp_timer_get_time();
+        buffer = ota_pipe_acquire(&ring);
+        read_start = esp_timer_get_time();
+        read_length = ota_http_read(&http, buffer, tune.chunk_size);
+        end = esp_timer_get_time();
+        TRACE(OTA_RECEIVE, read_length, 0);
+        if (read_length < 0) {
+            ESP_LOGE(OTA_TAG, "ota_http_read error");
             return OTA_CONN_ERR;
         }
-        // At this stage, update OK.
-        ESP_LOGI(OTA_TAG, "Update successful");
-        return OTA_UPDATED;
+        ota_budget_charge(read_length, end - read_start);
+        ota_tune_record(&tune, read_length, end - start);
+        count_received(read_length);
+        if (read_length == 0) {
+            if (!http.complete) {
+                ESP_LOGE(OTA_TAG, "Connection closed before end of file");
+                return OTA_CONN_ERR;
+            }
+            break;
+        }
+        ota_pipe_commit(&ring, read_length);
+    }
+    return OTA_OK;
+
+}
+
+// Reads the update file and writes the resulting image to the update
+// partition: the calling task receives, the writer task processes and
+// writes. The response headers must have been received.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: invalid update file
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t write_update_file(void) {
+
+    TaskHandle_t writer;
+    BaseType_t core;
+    int64_t start = esp_timer_get_time();
+    uint32_t body_bytes = http.counters.body_bytes;
+
+    if (writer_done == NULL) {
+        writer_done = xSemaphoreCreateBinary();
+        if (writer_done == NULL) {
+            ESP_LOGE(OTA_TAG, "Error from xSemaphoreCreateBinary");
+            return OTA_SYS_ERR;
+        }
+    }
+    if (!ota_pipe_init(&ring, tune.buffer_size)) {
+        ESP_LOGE(OTA_TAG, "Error from ota_pipe_init");
+        return OTA_SYS_ERR;
+    }
+    atomic_store(&write_failed, false);
+#if CONFIG_FREERTOS_UNICORE
+    core = tskNO_AFFINITY;
+#else
+    core = xPortGetCoreID() == 0 ? 1 : 0;
+#endif
+    if (xTaskCreatePinnedToCore(writer_task, "fuota_b_writer",
+                                WRITER_STACK_SIZE, NULL,
+                                uxTaskPriorityGet(NULL), &writer,
+                                core) != pdPASS) {
+        ESP_LOGE(OTA_TAG, "Error from xTaskCreatePinnedToCore");
+        return OTA_SYS_ERR;
     }
-    // At this stage, unexpected status code.
-    ESP_LOGE(OTA_TAG, "Unexpected status code: %d - Exiting",
-             status_code);
-    return OTA_SYS_ERR;
+    ota_budget_set_writer(writer);
+    receive_result = receive_update_file();
+    // End of stream, also after an error.
+    ota_pipe_acquire(&ring);
+    ota_pipe_commit(&ring, 0);
+    xSemaphoreTake(writer_done, portMAX_DELAY);
+    ota_budget_set_writer(NULL);
+    metrics.transfer_time += esp_timer_get_time() - start;
+    metrics.file_bytes += http.counters.body_bytes - body_bytes;
+    ESP_LOGI(OTA_TAG, "Stalls - receive: %u, write: %u",
+             ring.producer_stalls, ring.consumer_stalls);
+    if (write_result != OTA_OK) {
+        return write_result;
+    }
+    return receive_result;
+
+}
+
+// Returns true if the update file may be downloaded over parallel streams:
+// they are not subject to the budget set by ota_set_budget_b().
+static bool is_parallel_allowed(void) {
+
+    ota_budget_t budget;
+
+    ota_budget_get(&budget);
+    return (stream_count > 1) && (budget.max_rate == 0) &&
+           ((budget.cpu_share == 0) || (budget.cpu_share >= 100));
 
 }
 
+// Records the validator of the update file, which allows to check, on
+// resumption or when fetching a part, that the file did not change.
+static void set_validator(void) {
+
+    const char *validator = response_headers.etag;
+
+    if (validator[0] == '\0') {
+        validator = response_headers.last_modified;
+    }
+    // Header values have been truncated to the size of the validator.
+    size_t length = strnlen(validator, OTA_PROGRESS_VALIDATOR_MAX_LENGTH);
+    memcpy(update.progress.validator, validator, length);
+    update.progress.validator[length] = '\0';
+
+}
+
+// Sends the request for the update file. If a previous download of the same
+// file was interrupted, only the missing part is requested, provided that
+// the file did not change on the server. Otherwise, when parallel streams
+// are allowed, only the head of the file is requested: the rest is
+// requested by download_parts().
+// Returned value:
+// - OTA_OK: client is ready to read the update file
+// - OTA_PARAM_ERR: update file not found
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t request_update_file(const char *file_path) {
+
+    ota_status_t ota_rs;
+    unsigned int range_start;
+    unsigned int range_last;
+    unsigned int file_size;
+
+    bool resuming = ota_progress_load(&update.progress, storage->app_id,
+                                      file_path) &&
+                    (update.progress.offset > 0) &&
+                    (update.progress.validator[0] != '\0');
+    bool head = !resuming && is_parallel_allowed();
+    request_headers[0] = '\0';
+    if (resuming) {
+        ESP_LOGI(OTA_TAG, "Resuming download at offset %u",
+                 update.progress.offset);
+        // If the file changed, the server returns the whole new file.
+        snprintf(request_headers, sizeof(request_headers),
+                 "Range: bytes=%u-\r\nIf-Range: %s\r\n",
+                 update.progress.offset, update.progress.validator);
+    } else if (head) {
+        snprintf(request_headers, sizeof(request_headers),
+                 "Range: bytes=0-%u\r\n", HEAD_PART_SIZE - 1);
+    }
+    ota_rs = open_request(request_headers);
+    if (ota_rs != OTA_OK) {
+        ESP_LOGE(OTA_TAG, "Request error, exiting");
+        return ota_rs;
+    }
+    copy_header(update.digest, sizeof(update.digest),
+                response_headers.digest);
+    int content_length = http.content_length;
+    int status_code = http.status_code;
+    if ((status_code == 206) && head) {
+        if ((sscanf(response_headers.content_range, "bytes %u-%u/%u",
+                    &range_start, &range_last, &file_size) != 3) ||
+            (range_start != 0) || (range_last >= file_size)) {
+            ESP_LOGE(OTA_TAG, "Unexpected Content-Range: %s",
+                     response_headers.content_range);
+            return OTA_CONN_ERR;
+        }
+        update.progress.file_size = file_size;
+        atomic_store(&total_bytes, file_size);
+        set_validator();
+        update.range_end = range_last + 1;
+        update.partial = update.range_end < file_size;
+        return OTA_OK;
+    }
+    if ((status_code == 206) && resuming) {
+        if ((sscanf(response_headers.content_range, "bytes %u-%*u/%u",
+                    &range_start, &file_size) != 2) ||
+            (range_start != update.progress.offset) ||
+            (file_size != update.progress.file_size)) {
+            ESP_LOGE(OTA_TAG, "Unexpected Content-Range: %s",
+                     response_headers.content_range);
+            // Next attempt will start from zero.
+            ota_progress_clear();
+            return OTA_CONN_ERR;
+        }
+        mbedtls_sha256_clone(&update.sha, &update.progress.sha);
+        update.file.type = FILE_IMAGE;
+        update.file_offset = update.progress.offset;
+        update.offset = update.progress.offset;
+        update.erased_end = update.progress.offset;
+        // Blocks written before the interruption were checked then.
+        update.verified_end = update.progress.offset;
+        atomic_store(&total_bytes, file_size);
+        atomic_store(&received_bytes, range_start);
+        return OTA_OK;
+    }
+    if (status_code == 200) {
+        if (resuming) {
+            ESP_LOGI(OTA_TAG, "Update file changed, restarting from zero");
+            ota_progress_init(&update.progress, storage->app_id,
+                              file_path);
+        }
+        update.progress.file_size = content_length > 0 ? content_length : 0;
+        atomic_store(&total_bytes, update.progress.file_size);
+        set_validator();
+        return OTA_OK;
+    }
+    ESP_LOGE(OTA_TAG, "Unexpected status code: %d - Exiting", status_code);
+    if (resuming) {
+        ota_progress_clear();
+    }
+    return OTA_PARAM_ERR;
+
+}
+
+// Requests the part of the update file from start to end - 1 on the main
+// connection.
+// Returned value:
+// - OTA_OK: client is ready to read the part
+// - OTA_PARAM_ERR: update file changed
+// - OTA_CONN_ERR
+static ota_status_t request_part(uint32_t start, uint32_t end) {
+
+    ota_status_t ota_rs;
+    unsigned int range_start;
+    unsigned int range_last;
+
+    int length = snprintf(request_headers, sizeof(request_headers),
+                          "Range: bytes=%u-%u\r\n", start, end - 1);
+    if (update.progress.validator[0] != '\0') {
+        snprintf(request_headers + length, sizeof(request_headers) - length,
+                 "If-Range: %s\r\n", update.progress.validator);
+    }
+    ota_rs = open_request(request_headers);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if ((http.status_code != 206) ||
+        (sscanf(response_headers.content_range, "bytes %u-%u/",
+                &range_start, &range_last) != 2) ||
+        (range_start != start) || (range_last != end - 1)) {
+        ESP_LOGE(OTA_TAG, "Unexpected response to range request: %d",
+                 http.status_code);
+        return OTA_PARAM_ERR;
+    }
+    return OTA_OK;
+
+}
+
+// Writes the part of the update file requested by request_part(), through
+// the writer task. The update file is ended with its last part.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: invalid update file
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t write_part(uint32_t end) {
+
+    ota_status_t ota_rs;
+
+    update.range_end = end;
+    update.partial = end < update.progress.file_size;
+    ota_rs = write_update_file();
+    if ((ota_rs == OTA_OK) && (update.file_offset != end)) {
+        ESP_LOGE(OTA_TAG, "Part shorter than requested: %u",
+                 update.file_offset);
+        ota_rs = OTA_CONN_ERR;
+    }
+    if (ota_rs == OTA_OK) {
+        ota_http_finish(&http);
+    }
+    return ota_rs;
+
+}
+
+// Fetches again, over a new stream, the rest of a part whose stream failed,
+// from the start of the sector reached.
+// Returned value: see ota_multi_wait().
+static ota_status_t refetch_part(const ota_multi_request_t *request,
+                                 uint32_t offset, uint32_t end) {
+
+    ota_status_t ota_rs = OTA_CONN_ERR;
+    ota_multi_stream_t *stream;
+
+    for (int attempt = 0; (attempt < PART_ATTEMPTS) &&
+                          (ota_rs == OTA_CONN_ERR); attempt++) {
+        offset &= ~(OTA_STORAGE_SECTOR_SIZE - 1);
+        ESP_LOGW(OTA_TAG, "Fetching part again from 0x%x", offset);
+        ota_rs = ota_multi_start(request, offset, end, &stream);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        ota_rs = ota_multi_wait(stream, &http.counters, &offset);
+    }
+    return ota_rs;
+
+}
+
+// Checks an image received by parts, once they are all written: its size
+// and its blocks against the manifest, if any, and its digest, if any. The
+// part of the image not written by the writer task, from offset, is read
+// back to complete the hash of the update file.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: invalid image
+// - OTA_SYS_ERR
+static ota_status_t check_parts(uint32_t offset) {
+
+    ota_status_t ota_rs;
+    uint32_t file_size = update.progress.file_size;
+    size_t step;
+
+    if (manifest.loaded && (file_size != manifest.image_size)) {
+        ESP_LOGE(OTA_TAG, "Image size differs from manifest: %u", file_size);
+        return OTA_PARAM_ERR;
+    }
+    update.offset = file_size;
+    ota_rs = verify_blocks();
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    // Blocks fetched again are checked against the manifest, not against
+    // the digest of the whole file.
+    if ((update.digest[0] == '\0') || (update.bad_block_count > 0)) {
+        return OTA_OK;
+    }
+    int64_t start = esp_timer_get_time();
+    for (; offset < file_size; offset += step) {
+        step = file_size - offset;
+        if (step > sizeof(fetch_buf)) {
+            step = sizeof(fetch_buf);
+        }
+        ota_rs = storage->ops->read(storage, OTA_STORAGE_UPDATE, offset,
+                                    fetch_buf, step);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        mbedtls_sha256_update_ret(&update.sha, fetch_buf, step);
+    }
+    metrics.flash_time += esp_timer_get_time() - start;
+    return check_digest();
+
+}
+
+// Downloads the rest of the update file, once its head is written. An
+// uncompressed image is split in parts: the first one is fetched on the
+// main connection, the other ones over parallel streams, as many as the
+// free heap allows. The rest of other types of update file is fetched on
+// the main connection, as it is processed in order.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: update file changed, or invalid update file
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t download_parts(void) {
+
+    ota_status_t ota_rs;
+    ota_status_t part_rs;
+    ota_storage_t *target = storage;
+    ota_multi_request_t request;
+    ota_multi_stream_t *streams[OTA_MULTI_MAX_STREAMS];
+    uint32_t part_starts[OTA_MULTI_MAX_STREAMS];
+    uint32_t part_ends[OTA_MULTI_MAX_STREAMS];
+    uint32_t file_size = update.progress.file_size;
+    uint32_t start = update.range_end;
+    uint32_t part_size;
+    uint32_t offset;
+    uint32_t body_bytes;
+    int count;
+    int64_t transfer_start = esp_timer_get_time();
+    int64_t transfer_time = metrics.transfer_time;
+
+    ota_http_finish(&http);
+    if (update.file.type != FILE_IMAGE) {
+        ota_rs = request_part(start, file_size);
+        return ota_rs != OTA_OK ? ota_rs : write_part(file_size);
+    }
+    if (file_size > storage->update_size) {
+        ESP_LOGE(OTA_TAG, "Image larger than update partition: %u",
+                 file_size);
+        return OTA_PARAM_ERR;
+    }
+    count = 1 + ota_multi_get_available(stream_count - 1);
+    while ((count > 1) && ((file_size - start) / count < MIN_PART_SIZE)) {
+        count--;
+    }
+    // Parts start on a sector boundary, so that each stream erases its own
+    // sectors.
+    part_size = ((file_size - start) / count + OTA_STORAGE_SECTOR_SIZE - 1) &
+                ~(OTA_STORAGE_SECTOR_SIZE - 1);
+    for (int i = 0; i < count; i++) {
+        part_starts[i] = start + i * part_size;
+        part_ends[i] = part_starts[i] + part_size;
+        if ((i == count - 1) || (part_ends[i] > file_size)) {
+            part_ends[i] = file_size;
+        }
+    }
+    ESP_LOGI(OTA_TAG, "Downloading %u bytes in %d parts", file_size - start,
+             count);
+    ota_rs = ota_multi_begin(target, &storage);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    request = (ota_multi_request_t){
+        .create_transport = create_transport,
+        .host = http.transport->host,
+        .port = http.transport->port,
+        .cert_pem = server_cert_pem,
+        .username = server_username,
+        .password = server_password,
+        .timeout_ms = TRANSPORT_TIMEOUT_MS,
+        .path = request_path,
+        .validator = update.progress.validator,
+        .file_size = file_size,
+        .cancelled = &cancelled,
+        .stopped = &parts_stopped,
+        .received = &received_bytes,
+    };
+    atomic_store(&parts_stopped, false);
+    // A part whose stream could not be started is fetched afterwards.
+    ota_rs = request_part(part_starts[0], part_ends[0]);
+    for (int i = 1; i < count; i++) {
+        streams[i] = NULL;
+        if ((ota_rs == OTA_OK) &&
+            (ota_multi_start(&request, part_starts[i], part_ends[i],
+                             &streams[i]) != OTA_OK)) {
+            streams[i] = NULL;
+        }
+    }
+    if (ota_rs == OTA_OK) {
+        ota_rs = write_part(part_ends[0]);
+    }
+    if (ota_rs != OTA_OK) {
+        // The update is thrown away: the other parts are not needed.
+        atomic_store(&parts_stopped, true);
+    }
+    body_bytes = http.counters.body_bytes;
+    for (int i = 1; i < count; i++) {
+        offset = part_starts[i];
+        part_rs = OTA_CONN_ERR;
+        if (streams[i] != NULL) {
+            part_rs = ota_multi_wait(streams[i], &http.counters, &offset);
+        }
+        if ((part_rs == OTA_CONN_ERR) && (ota_rs == OTA_OK)) {
+            part_rs = refetch_part(&request, offset, part_ends[i]);
+        }
+        if (ota_rs == OTA_OK) {
+            ota_rs = part_rs;
+        }
+    }
+    storage = target;
+    ota_multi_end();
+    metrics.transfer_time = transfer_time + esp_timer_get_time() -
+                            transfer_start;
+    metrics.file_bytes += http.counters.body_bytes - body_bytes;
+    metrics.image_bytes += http.counters.body_bytes - body_bytes;
+    if ((ota_rs != OTA_OK) || (count == 1)) {
+        return ota_rs;
+    }
+    update.partial = false;
+    return check_parts(part_ends[0]);
+
+}
+
+#if CONFIG_FUOTA_B_MANIFEST
+// Requests the block manifest of the update file. The lack of manifest is
+// not an error.
+// Returned value:
+// - OTA_OK: manifest loaded, or no manifest
+// - OTA_PARAM_ERR: invalid manifest
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t fetch_manifest(const char *file_path) {
+
+    ota_status_t ota_rs;
+    int read_length;
+
+    ota_manifest_init(&manifest);
+    // Path: /files/<update_file_path>.fbm.
+    int path_length = snprintf(request_path, sizeof(request_path), "%s/%s%s",
+                               FILES_PATH, file_path, MANIFEST_SUFFIX);
+    if (path_length > REQUEST_PATH_MAX_LENGTH) {
+        ESP_LOGW(OTA_TAG, "Manifest path too long");
+        return OTA_OK;
+    }
+    ota_rs = open_request(NULL);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (http.status_code != 200) {
+        ESP_LOGI(OTA_TAG, "No manifest: %d", http.status_code);
+        ota_http_finish(&http);
+        return OTA_OK;
+    }
+    do {
+        read_length = ota_http_read(&http, fetch_buf, sizeof(fetch_buf));
+        if (read_length < 0) {
+            ESP_LOGE(OTA_TAG, "ota_http_read error");
+            ota_rs = OTA_CONN_ERR;
+        } else if (read_length > 0) {
+            ota_rs = ota_manifest_write(&manifest, fetch_buf, read_length);
+        } else if (!http.complete) {
+            ESP_LOGE(OTA_TAG, "Connection closed before end of manifest");
+            ota_rs = OTA_CONN_ERR;
+        } else {
+            ota_rs = ota_manifest_end(&manifest);
+        }
+    } while ((ota_rs == OTA_OK) && (read_length > 0));
+    ota_http_finish(&http);
+    if (ota_rs != OTA_OK) {
+        ota_manifest_free(&manifest);
+    }
+    return ota_rs;
+
+}
+#endif
+
+// Erases the sectors of the update partition containing a block. Blocks
+// start on a sector boundary.
+static ota_status_t erase_block(uint32_t start, uint32_t end) {
+
+    uint32_t erase_end = (end + OTA_STORAGE_SECTOR_SIZE - 1) &
+                         ~(OTA_STORAGE_SECTOR_SIZE - 1);
+    return storage->ops->erase(storage, start, erase_end - start);
+
+}
+
+// Fetches a block of the image again, with a range request, and checks it.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: block still corrupted, or update file changed
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t refetch_block(uint32_t index) {
+
+    ota_status_t ota_rs;
+    unsigned int range_start;
+    int read_length;
+    uint32_t start = index * manifest.block_size;
+    uint32_t end = start + manifest.block_size;
+
+    if (end > manifest.image_size) {
+        end = manifest.image_size;
+    }
+    ota_rs = erase_block(start, end);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    // If the file changed, the server returns the whole new file.
+    int length = snprintf(request_headers, sizeof(request_headers),
+                          "Range: bytes=%u-%u\r\n", start, end - 1);
+    if (update.progress.validator[0] != '\0') {
+        snprintf(request_headers + length, sizeof(request_headers) - length,
+                 "If-Range: %s\r\n", update.progress.validator);
+    }
+    ota_rs = open_request(request_headers);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if ((http.status_code != 206) ||
+        (sscanf(response_headers.content_range, "bytes %u-", &range_start) != 1) ||
+        (range_start != start)) {
+        ESP_LOGE(OTA_TAG, "Unexpected response to range request: %d",
+                 http.status_code);
+        ota_http_close(&http);
+        return OTA_PARAM_ERR;
+    }
+    while (start < end) {
+        size_t step = end - start;
+        if (step > sizeof(fetch_buf)) {
+            step = sizeof(fetch_buf);
+        }
+        read_length = ota_http_read(&http, fetch_buf, step);
+        if (read_length <= 0) {
+            ESP_LOGE(OTA_TAG, "Error while fetching block %u", index);
+            ota_http_close(&http);
+            return OTA_CONN_ERR;
+        }
+        ota_rs = storage->ops->write(storage, start, fetch_buf, read_length);
+        if (ota_rs != OTA_OK) {
+            ota_http_close(&http);
+            return ota_rs;
+        }
+        metrics.image_bytes += read_length;
+        count_received(read_length);
+        start += read_length;
+    }
+    ota_http_finish(&http);
+    return ota_manifest_check_block(&manifest, storage, index);
+
+}
+
+// Fetches again the blocks which did not match the manifest.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: a block is still corrupted
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t refetch_blocks(void) {
+
+    ota_status_t ota_rs = OTA_OK;
+
+    for (uint32_t i = 0; i < update.bad_block_count; i++) {
+        if (is_cancelled()) {
+            return OTA_CANCELLED;
+        }
+        for (int attempt = 0; attempt < REFETCH_ATTEMPTS; attempt++) {
+            TRACE(OTA_REFETCH, update.bad_blocks[i], 0);
+            ESP_LOGD(OTA_TAG, "Fetching block %u again", update.bad_blocks[i]);
+            metrics.refetched_blocks++;
+            ota_rs = refetch_block(update.bad_blocks[i]);
+            if (ota_rs != OTA_PARAM_ERR) {
+                break;
+            }
+        }
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+    }
+    return OTA_OK;
+
+}
+
+// Validates the image written to the update partition, and sets this
+// partition as the boot one.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: invalid image
+// - OTA_SYS_ERR
+static ota_status_t end_update(void) {
+
+    int64_t start = esp_timer_get_time();
+    ota_status_t ota_rs = storage->ops->end(storage);
+    metrics.validation_time = esp_timer_get_time() - start;
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    ESP_LOGI(OTA_TAG, "First image write after %lld ms, update time: %lld ms",
+             (long long)((update.first_write_time - update.start_time) / 1000),
+             (long long)((esp_timer_get_time() - update.start_time) / 1000));
+    return OTA_OK;
+
+}
+
+#if CONFIG_FUOTA_B_DEDUP
+// Source of every block of the image.
+static ota_dedup_t dedup;
+
+// Downloads the blocks first to end - 1 of the image with a range request,
+// and writes them through the writer task. The first request gives the
+// validator of the update file, next ones check that it did not change.
+// Returned value:
+// - OTA_OK: *expected is false if the server did not return the range of
+//   an uncompressed image of the size given by the manifest
+// - OTA_PARAM_ERR: more corrupted blocks than can be fetched again
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t fetch_range(uint32_t first, uint32_t end, bool *expected) {
+
+    ota_status_t ota_rs;
+    unsigned int range_start;
+    unsigned int range_last;
+    unsigned int file_size;
+    uint32_t start = first * manifest.block_size;
+    uint32_t stop = end * manifest.block_size;
+
+    *expected = false;
+    if (stop > manifest.image_size) {
+        stop = manifest.image_size;
+    }
+    int length = snprintf(request_headers, sizeof(request_headers),
+                          "Range: bytes=%u-%u\r\n", start, stop - 1);
+    if (update.progress.validator[0] != '\0') {
+        snprintf(request_headers + length, sizeof(request_headers) - length,
+                 "If-Range: %s\r\n", update.progress.validator);
+    }
+    ota_rs = open_request(request_headers);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    // A patch, or a compressed file, has not the size of the image.
+    if ((http.status_code != 206) ||
+        (sscanf(response_headers.content_range, "bytes %u-%u/%u",
+                &range_start, &range_last, &file_size) != 3) ||
+        (range_start != start) || (range_last != stop - 1) ||
+        (file_size != manifest.image_size)) {
+        ESP_LOGW(OTA_TAG, "Unexpected response to range request: %d",
+                 http.status_code);
+        ota_http_close(&http);
+        return OTA_OK;
+    }
+    *expected = true;
+    if (update.progress.validator[0] == '\0') {
+        set_validator();
+    }
+    update.offset = start;
+    update.erased_end = start;
+    update.verified_end = start;
+    update.range_end = stop;
+    ota_rs = write_update_file();
+    if ((ota_rs == OTA_OK) && (update.offset != stop)) {
+        ESP_LOGE(OTA_TAG, "Range shorter than requested: %u", update.offset);
+        ota_rs = OTA_CONN_ERR;
+    }
+    if (ota_rs != OTA_OK) {
+        ota_http_close(&http);
+        return ota_rs;
+    }
+    ota_http_finish(&http);
+    return OTA_OK;
+
+}
+
+// Copies a block from the running partition, and checks it. A corrupted
+// block is fetched again later.
+static ota_status_t copy_block(uint32_t index) {
+
+    ota_status_t ota_rs;
+    uint32_t start = index * manifest.block_size;
+    uint32_t end = start + manifest.block_size;
+
+    if (end > manifest.image_size) {
+        end = manifest.image_size;
+    }
+    int64_t copy_start = esp_timer_get_time();
+    if (update.first_write_time == 0) {
+        update.first_write_time = copy_start;
+    }
+    ota_rs = erase_block(start, end);
+    if (ota_rs == OTA_OK) {
+        ota_rs = ota_dedup_copy_block(&dedup, &manifest, storage, index);
+    }
+    if (ota_rs == OTA_OK) {
+        update.verified_end = start;
+        update.offset = end;
+        metrics.image_bytes += end - start;
+        ota_rs = verify_blocks();
+    }
+    metrics.flash_time += esp_timer_get_time() - copy_start;
+    return ota_rs;
+
+}
+
+// Builds the image described by the manifest from the blocks already
+// present in the update partition, the blocks of the running partition,
+// and the missing blocks, downloaded with range requests. Missing blocks are
+// downloaded first, so that an update file which is not an uncompressed
+// image is detected before any copy.
+// Returned value:
+// - OTA_OK: *done is true if the image is written, false if the update file
+//   has to be downloaded as a whole
+// - OTA_PARAM_ERR: a block is still corrupted
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t download_blocks(bool *done) {
+
+    ota_status_t ota_rs = OTA_OK;
+    bool expected = true;
+    uint32_t first;
+    uint32_t i;
+
+    *done = false;
+    if ((ota_dedup_plan(&dedup, &manifest, storage) != OTA_OK) ||
+        (dedup.fetch_count == manifest.block_count)) {
+        // Nothing to gain.
+        ota_dedup_free(&dedup);
+        return OTA_OK;
+    }
+    ota_rs = storage->ops->begin(storage);
+    if (ota_rs != OTA_OK) {
+        ota_dedup_free(&dedup);
+        return ota_rs;
+    }
+    update.dedup = true;
+    update.file.type = FILE_IMAGE;
+    i = 0;
+    while ((ota_rs == OTA_OK) && expected && (i < manifest.block_count)) {
+        if (ota_dedup_get_source(&dedup, i) != OTA_DEDUP_FETCH) {
+            i++;
+            continue;
+        }
+        first = i;
+        while ((i < manifest.block_count) &&
+               (ota_dedup_get_source(&dedup, i) == OTA_DEDUP_FETCH)) {
+            i++;
+        }
+        ota_rs = fetch_range(first, i, &expected);
+    }
+    for (i = 0; (ota_rs == OTA_OK) && expected && (i < manifest.block_count);
+         i++) {
+        uint16_t source = ota_dedup_get_source(&dedup, i);
+        if (is_cancelled()) {
+            ota_rs = OTA_CANCELLED;
+        } else if ((source != OTA_DEDUP_KEEP) &&
+                   (source != OTA_DEDUP_FETCH)) {
+            ota_rs = copy_block(i);
+        }
+    }
+    ota_dedup_free(&dedup);
+    update.dedup = false;
+    if ((ota_rs == OTA_OK) && expected && (update.bad_block_count > 0)) {
+        ota_rs = refetch_blocks();
+    }
+    if ((ota_rs != OTA_OK) || !expected) {
+        storage->ops->abort(storage);
+        if (ota_rs == OTA_OK) {
+            // Back to the download of the whole file.
+            memset(&update.file, 0, sizeof(update.file));
+            update.offset = 0;
+            update.erased_end = 0;
+            update.verified_end = 0;
+            update.range_end = 0;
+            update.bad_block_count = 0;
+            update.first_write_time = 0;
+            update.progress.validator[0] = '\0';
+            mbedtls_sha256_starts_ret(&update.sha, 0);
+        }
+        return ota_rs;
+    }
+    *done = true;
+    return OTA_OK;
+
+}
+#endif
+
+// Downloads the update file, writes the resulting image to the next update
+// partition and sets this partition as the boot one. image_size is the size
+// of the resulting image, 0 if unknown.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: update file not found, or invalid update file
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t download_update(const char *file_path,
+                                    uint32_t image_size) {
+
+    ota_status_t ota_rs;
+
+    memset(&update, 0, sizeof(update));
+    update.start_time = esp_timer_get_time();
+    ota_tune_begin(&tune);
+    ota_rs = storage->ops->open(storage);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (image_size > storage->update_size) {
+        ESP_LOGE(OTA_TAG, "Image larger than update partition: %u", image_size);
+        return OTA_PARAM_ERR;
+    }
+    update.image_size = image_size;
+#if CONFIG_FUOTA_B_MANIFEST
+    ota_rs = fetch_manifest(file_path);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (manifest.loaded && (manifest.image_size > storage->update_size)) {
+        ESP_LOGE(OTA_TAG, "Image larger than update partition: %u",
+                 manifest.image_size);
+        return OTA_PARAM_ERR;
+    }
+    snprintf(request_path, sizeof(request_path), "%s/%s", FILES_PATH,
+             file_path);
+#endif
+    mbedtls_sha256_init(&update.sha);
+    mbedtls_sha256_starts_ret(&update.sha, 0);
+#if CONFIG_FUOTA_B_DEDUP
+    if (manifest.loaded) {
+        bool done;
+        ota_rs = download_blocks(&done);
+        if ((ota_rs != OTA_OK) || done) {
+            mbedtls_sha256_free(&update.sha);
+        }
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        if (done) {
+            // A progress record, if any, is superseded by the blocks
+            // written.
+            ota_progress_clear();
+            return end_update();
+        }
+    }
+#endif
+    ota_rs = request_update_file(file_path);
+    if (ota_rs != OTA_OK) {
+        mbedtls_sha256_free(&update.sha);
+        ota_http_finish(&http);
+        return ota_rs;
+    }
+    ESP_LOGI(OTA_TAG, "Writing to partition %s", storage->update_label);
+    // The partition is not erased here, but while it is written.
+    ota_rs = storage->ops->begin(storage);
+    if (ota_rs != OTA_OK) {
+        mbedtls_sha256_free(&update.sha);
+        ota_http_close(&http);
+        return ota_rs;
+    }
+    ota_rs = write_update_file();
+    if ((ota_rs == OTA_OK) && update.partial) {
+        ota_rs = download_parts();
+    }
+    if (ota_rs != OTA_OK) {
+        abort_update();
+        ota_http_finish(&http);
+        // Progress is kept only if the download can be resumed.
+        if ((ota_rs != OTA_CONN_ERR) && (ota_rs != OTA_CANCELLED)) {
+            ota_progress_clear();
+        }
+        return ota_rs;
+    }
+    mbedtls_sha256_free(&update.sha);
+    ota_progress_clear();
+    ota_http_finish(&http);
+    if (update.bad_block_count > 0) {
+        ota_rs = refetch_blocks();
+        if (ota_rs != OTA_OK) {
+            storage->ops->abort(storage);
+            return ota_rs;
+        }
+    }
+    return end_update();
+
+}
+
+// Result of the last update check.
+static ota_check_t check;
+
+// Checks whether an update is available. The request is conditional if the
+// result of the previous check is cached, and is not sent at all if this
+// result is still fresh. request_path must contain the request path and
+// query.
+// Returned value:
+// - OTA_OK: update available, its path is in update_file_path and its image
+//   size, 0 if unknown, in image_size
+// - OTA_NO_UPDATE
+// - OTA_PARAM_ERR
+// - OTA_CONN_ERR
+// - OTA_SYS_ERR
+static ota_status_t check_update(const char *server_name, uint16_t server_port,
+                                 uint32_t *image_size) {
+
+    ota_status_t ota_rs;
+
+    bool cached = ota_check_load(&check, server_name, server_port,
+                                 request_path);
+    if (cached && ota_check_is_fresh(&check)) {
+        ESP_LOGI(OTA_TAG, "Cached check result still fresh: %u",
+                 check.status_code);
+        if (check.status_code != 200) {
+            return OTA_NO_UPDATE;
+        }
+        strcpy(update_file_path, check.file_path);
+        *image_size = check.image_size;
+        return OTA_OK;
+    }
+    request_headers[0] = '\0';
+    if (cached && (check.etag[0] != '\0')) {
+        snprintf(request_headers, sizeof(request_headers),
+                 "If-None-Match: %s\r\n", check.etag);
+    }
+    if (cached && (check.last_modified[0] != '\0')) {
+        size_t length = strlen(request_headers);
+        snprintf(request_headers + length, sizeof(request_headers) - length,
+                 "If-Modified-Since: %s\r\n", check.last_modified);
+    }
+    ota_rs = open_request(request_headers);
+    if (ota_rs != OTA_OK) {
+        ESP_LOGE(OTA_TAG, "Request error, exiting");
+        return ota_rs;
+    }
+    int content_length = http.content_length;
+    ESP_LOGI(OTA_TAG, "Content length: %d", content_length);
+    // We do not test content_length against 0, as it can be 0 when
+    // no update is available. This case is handled by status code 204 below.
+    int status_code = http.status_code;
+    if (status_code == 400) {
+        ESP_LOGW(OTA_TAG, "Bad Request");
+        ota_http_finish(&http);
+        return OTA_PARAM_ERR;
+    }
+    if (status_code == 403) {
+        ESP_LOGW(OTA_TAG, "Forbidden");
+        ota_http_finish(&http);
+        return OTA_PARAM_ERR;
+    }
+    if ((status_code == 304) && cached) {
+        ESP_LOGI(OTA_TAG, "Not Modified");
+        ota_http_finish(&http);
+        // The TTL is refreshed, the record is not written again.
+        ota_check_save(&check, response_headers.max_age);
+        if (check.status_code != 200) {
+            return OTA_NO_UPDATE;
+        }
+        strcpy(update_file_path, check.file_path);
+        *image_size = check.image_size;
+        return OTA_OK;
+    }
+    if ((status_code != 200) && (status_code != 204) && (status_code != 404)) {
+        // At this stage, unexpected status code.
+        ESP_LOGE(OTA_TAG, "Unexpected status code: %d - Exiting",
+                 status_code);
+        ota_http_close(&http);
+        return OTA_SYS_ERR;
+    }
+    copy_header(check.etag, sizeof(check.etag), response_headers.etag);
+    copy_header(check.last_modified, sizeof(check.last_modified),
+                response_headers.last_modified);
+    check.status_code = status_code;
+    memset(check.file_path, 0, sizeof(check.file_path));
+    check.image_size = 0;
+    if (status_code == 404) {
+        ESP_LOGW(OTA_TAG, "Not Found");
+        ota_http_finish(&http);
+        ota_check_save(&check, response_headers.max_age);
+        return OTA_NO_UPDATE;
+    }
+    if (status_code == 204) {
+        ESP_LOGI(OTA_TAG, "No Content");
+        ota_http_finish(&http);
+        ota_check_save(&check, response_headers.max_age);
+        return OTA_NO_UPDATE;
+    }
+    ESP_LOGI(OTA_TAG, "OK");
+    if (content_length > UPDATE_FILE_PATH_MAX_LENGTH) {
+        // We don't have enough space to store returned content. Abort.
+        ESP_LOGE(OTA_TAG, "Content_length too large: %d",
+                 content_length);
+        ota_http_close(&http);
+        return OTA_PARAM_ERR;
+    }
+    // At this stage, we can store received content. So, get it. Without
+    // Content-Length header, the body is read up to the buffer size.
+    int read_length = ota_http_read(&http, (uint8_t *)update_file_path,
+                                    UPDATE_FILE_PATH_MAX_LENGTH);
+    if ((read_length < 0) || !http.complete) {
+        ESP_LOGE(OTA_TAG, "Error while reading update file path");
+        ota_http_close(&http);
+        return OTA_CONN_ERR;
+    }
+    update_file_path[read_length] = '\0';
+    *image_size = response_headers.image_size;
+    // The connection is kept for the download.
+    ota_http_finish(&http);
+    strcpy(check.file_path, update_file_path);
+    check.image_size = *image_size;
+    ota_check_save(&check, response_headers.max_age);
+    return OTA_OK;
+
+}
+
+// Selects the default backends, where no other one was given.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: no default backend
+static ota_status_t select_backends(void) {
+
+#if !CONFIG_IDF_TARGET_LINUX
+    if (create_transport == NULL) {
+        create_transport = ota_tls_create;
+    }
+    if (storage == NULL) {
+        storage = ota_flash_get();
+    }
+#endif
+    if ((create_transport == NULL) || (storage == NULL)) {
+        ESP_LOGE(OTA_TAG, "No transport or storage sink");
+        return OTA_PARAM_ERR;
+    }
+    return OTA_OK;
+
+}
+
+// Checks whether an update is available, and downloads and installs it.
+// Returned value: see ota_update_b().
+static ota_status_t run_update(const char *server_name, uint16_t server_port,
+                               const char *cert_pem, const char *username,
+                               const char *password, const char *id,
+                               const char *app_ver) {
+
+    ota_status_t ota_rs;
+    uint32_t image_size;
+    int64_t start;
+
+    ESP_LOGI(OTA_TAG, "Starting update with %s:%d", server_name,
+             server_port);
+    // Check whether an update is available.
+    // First, build the request path and query:
+    // /devices/<device_id>?app_ver=<app_version>&delta=<formats>&comp=<formats>.
+    // The assignment below allows to check that the resulting path will not be
+    // too long for the buffer.
+    int path_length = snprintf(NULL, 0, "%s/%s?%s=%s&%s=%s&%s=%s",
+                               DEVICES_PATH, id,
+                               VER_PARAM, app_ver,
+                               DELTA_PARAM, DELTA_FORMATS,
+                               COMP_PARAM, COMP_FORMATS);
+    if (path_length > REQUEST_PATH_MAX_LENGTH) {
+        ESP_LOGE(OTA_TAG, "Request too long, exiting");
+        return OTA_PARAM_ERR;
+    }
+    snprintf(request_path, sizeof(request_path), "%s/%s?%s=%s&%s=%s&%s=%s",
+             DEVICES_PATH, id,
+             VER_PARAM, app_ver,
+             DELTA_PARAM, DELTA_FORMATS,
+             COMP_PARAM, COMP_FORMATS);
+    ota_rs = select_backends();
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    server_cert_pem = cert_pem;
+    server_username = username;
+    server_password = password;
+    // The client of the previous call, and its connection, are reused when
+    // possible. No connection is opened here.
+    ota_rs = prepare_client(server_name, server_port, cert_pem, username,
+                            password);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    start = esp_timer_get_time();
+    ota_rs = check_update(server_name, server_port, &image_size);
+    metrics.check_time = esp_timer_get_time() - start;
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (is_cancelled()) {
+        return OTA_CANCELLED;
+    }
+    // At this stage, update is supposed to be available, download and
+    // flash it.
+    ESP_LOGI(OTA_TAG, "Requesting %s", update_file_path);
+    // Path: /files/<update_file_path>.
+    path_length = snprintf(NULL, 0, "%s/%s", FILES_PATH, update_file_path);
+    if (path_length > REQUEST_PATH_MAX_LENGTH) {
+        ESP_LOGE(OTA_TAG, "Request too long, exiting");
+        return OTA_PARAM_ERR;
+    }
+    snprintf(request_path, sizeof(request_path), "%s/%s", FILES_PATH,
+             update_file_path);
+    // The update file is either a full image, or a patch to be applied
+    // to the running image.
+    ota_rs = download_update(update_file_path, image_size);
+    ota_manifest_free(&manifest);
+    if (ota_rs != OTA_OK) {
+        ESP_LOGE(OTA_TAG, "Update error: %d - Exiting", ota_rs);
+        return ota_rs;
+    }
+    // At this stage, update OK.
+    ESP_LOGI(OTA_TAG, "Update successful");
+    return OTA_UPDATED;
+
+}
+
+// Runs an update, and measures it. Called with running set.
+// Returned value: see ota_update_b().
+static ota_status_t measure_update(const char *server_name,
+                                  uint16_t server_port, const char *cert_pem,
+                                  const char *username, const char *password,
+                                  const char *id, const char *app_ver) {
+
+    int64_t start = esp_timer_get_time();
+
+    TRACE(OTA_UPDATE_START, server_port, 0);
+    memset(&metrics, 0, sizeof(metrics));
+    memset(&http.counters, 0, sizeof(http.counters));
+    atomic_store(&received_bytes, 0);
+    atomic_store(&total_bytes, 0);
+    next_progress_event = PROGRESS_EVENT_PERIOD;
+    ota_budget_begin();
+    ota_status_t ota_rs = run_update(server_name, server_port, cert_pem,
+                                     username, password, id, app_ver);
+    ota_budget_end();
+    metrics.status = ota_rs;
+    metrics.total_time = esp_timer_get_time() - start;
+    metrics.dns_time = http.counters.dns_time;
+    metrics.tcp_time = http.counters.tcp_time;
+    metrics.tls_time = http.counters.handshake_time;
+    metrics.header_time = http.counters.header_time;
+    metrics.connections = http.counters.connections;
+    metrics.requests = http.counters.requests;
+    metrics.request_retries = http.counters.retries;
+    metrics.bytes_received = http.counters.body_bytes;
+    if (metrics.transfer_time > 0) {
+        metrics.throughput = (int64_t)metrics.file_bytes * 1000000 /
+                             metrics.transfer_time;
+    }
+    if (metrics.file_bytes > 0) {
+        metrics.chunk_size = tune.chunk_size;
+    }
+    if (ota_rs == OTA_UPDATED) {
+        ota_tune_end(&tune, metrics.file_bytes, metrics.throughput);
+    }
+    TRACE(OTA_UPDATE_END, ota_rs, metrics.total_time / 1000);
+    return ota_rs;
+
+}
+
+// Takes the right to run an update, or to change the resources it uses.
+// Returned value:
+// - true: no other update is running
+// - false: an update is running
+static bool start_running(void) {
+
+    bool expected = false;
+
+    if (!atomic_compare_exchange_strong(&running, &expected, true)) {
+        ESP_LOGE(OTA_TAG, "An update is already running");
+        return false;
+    }
+    atomic_store(&cancelled, false);
+    return true;
+
+}
+
+static void update_task(void *arg) {
+
+    ota_status_t ota_rs = measure_update(async_update.server_name,
+                                         async_update.server_port,
+                                         async_update.cert_pem,
+                                         async_update.username,
+                                         async_update.password,
+                                         async_update.id,
+                                         async_update.app_ver);
+
+    async_result = ota_rs;
+    notify(OTA_EVENT_DONE, ota_rs);
+    event_callback = NULL;
+    atomic_store(&async_running, false);
+    // running is cleared first, so that the caller can close the client as
+    // soon as it is told of the end. A new update may then be started
+    // before async_done is given: ota_wait_b() ignores this give.
+    atomic_store(&running, false);
+    xSemaphoreGive(async_done);
+    vTaskDelete(NULL);
+
+}
+
+ota_status_t ota_update_b(const char *server_name, uint16_t server_port,
+                          const char *cert_pem, const  char *username,
+                          const char *password,
+                          const char *id,
+                          const char *app_ver) {
+
+    if (!start_running()) {
+        return OTA_PARAM_ERR;
+    }
+    ota_status_t ota_rs = measure_update(server_name, server_port, cert_pem,
+                                         username, password, id, app_ver);
+    notify(OTA_EVENT_DONE, ota_rs);
+    atomic_store(&running, false);
+    return ota_rs;
+
+}
+
+ota_status_t ota_start_b(const char *server_name, uint16_t server_port,
+                         const char *cert_pem, const char *username,
+                         const char *password, const char *id,
+                         const char *app_ver, ota_event_cb_t callback,
+                         void *arg) {
+
+    if (async_done == NULL) {
+        async_done = xSemaphoreCreateBinary();
+        if (async_done == NULL) {
+            ESP_LOGE(OTA_TAG, "Error from xSemaphoreCreateBinary");
+            return OTA_SYS_ERR;
+        }
+    }
+    if (!start_running()) {
+        return OTA_PARAM_ERR;
+    }
+    // The end of a previous update may not have been waited for.
+    xSemaphoreTake(async_done, 0);
+    async_update = (async_update_t){
+        .server_name = server_name,
+        .server_port = server_port,
+        .cert_pem = cert_pem,
+        .username = username,
+        .password = password,
+        .id = id,
+        .app_ver = app_ver,
+    };
+    event_callback = callback;
+    event_arg = arg;
+    atomic_store(&async_running, true);
+    if (xTaskCreatePinnedToCore(update_task, "fuota_b_update",
+                                CONFIG_FUOTA_B_TASK_STACK_SIZE, NULL,
+                                uxTaskPriorityGet(NULL), NULL,
+                                tskNO_AFFINITY) != pdPASS) {
+        ESP_LOGE(OTA_TAG, "Error from xTaskCreatePinnedToCore");
+        event_callback = NULL;
+        atomic_store(&async_running, false);
+        atomic_store(&running, false);
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+ota_status_t ota_poll_b(ota_event_data_t *progress) {
+
+    ota_status_t ota_rs = atomic_load(&async_running) ? OTA_RUNNING :
+                                                        async_result;
+
+    if (progress != NULL) {
+        progress->status = ota_rs;
+        progress->received = atomic_load(&received_bytes);
+        progress->total = atomic_load(&total_bytes);
+    }
+    return ota_rs;
+
+}
+
+ota_status_t ota_wait_b(uint32_t timeout_ms) {
+
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed = 0;
+
+    if (async_done == NULL) {
+        return async_result;
+    }
+    while (xSemaphoreTake(async_done, timeout == portMAX_DELAY ?
+                                     portMAX_DELAY :
+                                     timeout - elapsed) == pdTRUE) {
+        // The semaphore is given back, so that every waiting task, and
+        // later calls, see the end of the update.
+        if (!atomic_load(&async_running)) {
+            xSemaphoreGive(async_done);
+            break;
+        }
+        // Given by the end of the previous update, after this one was
+        // started.
+        elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            break;
+        }
+    }
+    return ota_poll_b(NULL);
+
+}
+
+void ota_cancel_b(void) {
+
+    if (atomic_load(&running)) {
+        atomic_store(&cancelled, true);
+    }
+
+}
+
+ota_status_t ota_close_b(void) {
+
+    if (!start_running()) {
+        return OTA_RUNNING;
+    }
+    close_client();
+    atomic_store(&running, false);
+    return OTA_OK;
+
+}
+
+void ota_get_tls_stats_b(ota_tls_stats_t *stats) {
+
+    ota_http_get_tls_stats(stats);
+
+}
+
+void ota_get_last_metrics_b(ota_metrics_t *metrics_out) {
+
+    *metrics_out = metrics;
+
+}
+
+ota_status_t ota_set_backends_b(ota_transport_create_t create_transport_in,
+                                ota_storage_t *storage_in) {
+
+    if (!start_running()) {
+        return OTA_RUNNING;
+    }
+    close_client();
+    create_transport = create_transport_in;
+    storage = storage_in;
+    atomic_store(&running, false);
+    return OTA_OK;
+
+}
+
+ota_status_t ota_set_link_b(const uint8_t *link_id, size_t length) {
+
+    if (!start_running()) {
+        return OTA_RUNNING;
+    }
+    ota_tune_set_link(&tune, link_id, length);
+    atomic_store(&running, false);
+    return OTA_OK;
+
+}
+
+void ota_set_budget_b(const ota_budget_t *budget) {
+
+    ota_budget_set(budget);
+
+}
+
+void ota_get_budget_b(ota_budget_t *budget) {
+
+    ota_budget_get(budget);
+
+}
+
+void ota_set_streams_b(uint8_t count) {
+
+    if (count < 1) {
+        count = 1;
+    } else if (count > OTA_MULTI_MAX_STREAMS) {
+        count = OTA_MULTI_MAX_STREAMS;
+    }
+    stream_count = count;
+
+}
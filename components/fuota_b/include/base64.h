@@ -1,17 +1,168 @@
-/*
- * Base64 encoding/decoding (RFC1341)
- * Copyright (c) 2005, Jouni Malinen <j@w1.fi>
+/**
+ * This file is part of esp32-fuota.
  *
- * This software may be distributed under the terms of the BSD license.
- * See README for more details.
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Base64 encoding and decoding (RFC 4648), with the standard alphabet or
+ *   the URL and filename safe one. Nothing is allocated: results are
+ *   written into buffers provided by the caller, and data can be processed
+ *   by chunks of any size, for instance as it is received, with an encoder
+ *   or a decoder context.
+ *
+ *   The standard encoding is padded with '=', the URL safe one is not.
+ *   When decoding, spaces, tabs and line breaks are ignored. Padding is
+ *   required with the standard alphabet, and optional with the URL safe
+ *   one.
+ *
+ * Usage:
+ *   Whole buffers: base64_encode(), base64_decode(), base64_url_encode()
+ *   and base64_url_decode().
+ *   By chunks: base64_encoder_init(), then base64_encoder_update() for
+ *   every chunk, and finally base64_encoder_final(). Same sequence for a
+ *   decoder. Any other status than BASE64_OK means that the context can't
+ *   be used anymore.
+ */
+
+#ifndef BASE64_H_
+#define BASE64_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Length of the padded encoding of n bytes, without any final '\0'. Also
+// the largest output of base64_encoder_update() for a chunk of n bytes.
+#define BASE64_ENCODED_LENGTH(n) (((n) + 2) / 3 * 4)
+
+// Largest number of bytes resulting from the decoding of n characters,
+// whether whole or by chunks.
+#define BASE64_DECODED_MAX_LENGTH(n) (((n) + 3) / 4 * 3)
+
+// Largest output of base64_encoder_final() and base64_decoder_final().
+#define BASE64_FINAL_MAX_LENGTH 4
+
+typedef enum {
+    BASE64_OK,
+    // Invalid character, padding or length.
+    BASE64_INVALID,
+    // Output buffer too small.
+    BASE64_TOO_SMALL,
+} base64_status_t;
+
+typedef struct {
+    const char *alphabet;
+    bool pad;
+    // Bytes not encoded yet, waiting for a complete group of 3.
+    uint8_t pending[3];
+    uint8_t pending_length;
+} base64_encoder_t;
+
+typedef struct {
+    const uint8_t *table;
+    bool pad;
+    // Digits of the group being decoded, 6 bits each.
+    uint32_t group;
+    uint8_t digits;
+    // Number of '=' received, the group being complete once padded.
+    uint8_t padding;
+} base64_decoder_t;
+
+/**
+ * Prepares an encoding, with the URL safe alphabet if url is true.
  */
+void base64_encoder_init(base64_encoder_t *encoder, bool url);
 
-#ifndef BASE64_H
-#define BASE64_H
+/**
+ * Encodes a chunk. length_out is set to the number of characters written
+ * into dst, which are not followed by a '\0'.
+ *
+ * Returned value:
+ * - BASE64_OK
+ * - BASE64_TOO_SMALL: dst_size is lower than the number of characters to
+ *   be written, at most BASE64_ENCODED_LENGTH(length)
+ */
+base64_status_t base64_encoder_update(base64_encoder_t *encoder,
+                                      const void *src, size_t length,
+                                      char *dst, size_t dst_size,
+                                      size_t *length_out);
+
+/**
+ * Ends an encoding, writing the last group and its padding, if any.
+ * Returns the same values as base64_encoder_update().
+ */
+base64_status_t base64_encoder_final(base64_encoder_t *encoder, char *dst,
+                                     size_t dst_size, size_t *length_out);
+
+/**
+ * Prepares a decoding, with the URL safe alphabet if url is true.
+ */
+void base64_decoder_init(base64_decoder_t *decoder, bool url);
+
+/**
+ * Decodes a chunk. length_out is set to the number of bytes written into
+ * dst.
+ *
+ * Returned value:
+ * - BASE64_OK
+ * - BASE64_INVALID: invalid character or padding
+ * - BASE64_TOO_SMALL: dst_size is lower than the number of bytes to be
+ *   written, at most BASE64_DECODED_MAX_LENGTH(length)
+ */
+base64_status_t base64_decoder_update(base64_decoder_t *decoder,
+                                      const char *src, size_t length,
+                                      uint8_t *dst, size_t dst_size,
+                                      size_t *length_out);
 
-char * base64_encode(const void *src, size_t len, size_t *out_len);
-unsigned char * base64_decode(const char *src, size_t len, size_t *out_len);
-char * base64_url_encode(const void *src, size_t len, size_t *out_len);
-unsigned char * base64_url_decode(const char *src, size_t len, size_t *out_len);
+/**
+ * Ends a decoding, writing the bytes of an incomplete last group, if any.
+ * Returns the same values as base64_decoder_update(), BASE64_INVALID
+ * meaning that the encoded data is truncated.
+ */
+base64_status_t base64_decoder_final(base64_decoder_t *decoder, uint8_t *dst,
+                                     size_t dst_size, size_t *length_out);
+
+/**
+ * Encodes length bytes with the standard alphabet. dst is terminated by a
+ * '\0', not counted in length_out. On BASE64_TOO_SMALL, length_out is set
+ * to the required dst_size.
+ */
+base64_status_t base64_encode(const void *src, size_t length, char *dst,
+                              size_t dst_size, size_t *length_out);
+
+/**
+ * Decodes length characters of the standard alphabet.
+ */
+base64_status_t base64_decode(const char *src, size_t length, uint8_t *dst,
+                              size_t dst_size, size_t *length_out);
+
+/**
+ * Same as base64_encode(), with the URL safe alphabet and no padding.
+ */
+base64_status_t base64_url_encode(const void *src, size_t length, char *dst,
+                                  size_t dst_size, size_t *length_out);
+
+/**
+ * Same as base64_decode(), with the URL safe alphabet.
+ */
+base64_status_t base64_url_decode(const char *src, size_t length,
+                                  uint8_t *dst, size_t dst_size,
+                                  size_t *length_out);
 
-#endif /* BASE64_H */
+#endif /* BASE64_H_ */
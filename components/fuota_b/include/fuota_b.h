@@ -34,13 +34,99 @@
  *   The client requests an update by calling ota_update_b(). The function
  *   returns the result: failure (for instance if connectivity is lost),
  *   system error, no update available, update received and installed.
+ *   The component reaches the server through a transport, and writes to
+ *   flash through a storage sink. Both can be replaced, with
+ *   ota_set_backends_b(), so that the component can run on a host, for
+ *   instance with an OpenSSL transport and files as partitions (see the
+ *   host directory).
+ *
+ *   After each call, ota_get_last_metrics_b() tells where the time was
+ *   spent (connection steps, wait for responses, transfer, flash writes,
+ *   image validation), and how many bytes were transferred.
+ *
+ *   The update check and the download of the update file use the same
+ *   connection to the server. This connection is kept open after
+ *   ota_update_b() returns, so that next call, while the network connection
+ *   is still up, does not have to establish a new TLS session. It is closed
+ *   by ota_close_b().
+ *
+ *   The TLS session itself is cached beyond ota_close_b(), in RAM and,
+ *   depending on the configuration, in NVS or in RTC memory. Next
+ *   connection to the same server then performs an abbreviated handshake,
+ *   even after a Wi-Fi disconnection, or after a restart. ota_get_tls_stats_b()
+ *   tells how many handshakes were full or resumed, and how long they took.
+ *
+ *   During the download, a writer task is created, on the other core if
+ *   possible, with the priority of the calling task. It writes the data
+ *   received by the calling task to flash.
+ *
+ *   The update check is conditional: the result of the previous check is
+ *   cached, and the server may confirm it with a 304 Not Modified response.
+ *   If the server gave a Cache-Control max-age directive, the cached result
+ *   is used without any request until it expires.
+ *
+ *   The update file returned by the server is either a full application
+ *   image, or a patch (FDP1 format, see ota_patch.h) to be applied to the
+ *   running image. The device tells the server its application version and
+ *   the patch formats it supports. A patch is applied while it is being
+ *   received: the running partition is read as the source, and the new
+ *   image is written into the update partition.
+ *
+ *   Both types of update file may also be compressed (HSZ1 format, see
+ *   ota_hsz.h). They are then decompressed on the fly, by chunks, before
+ *   being written or applied.
+ *
+ *   If the server provides a block manifest for the update file (FBM1
+ *   format, see ota_manifest.h), every block of the image is checked once
+ *   written. Corrupted blocks of an uncompressed image are fetched again
+ *   at the end of the download.
+ *
+ *   When the update file is an uncompressed image with a manifest, blocks
+ *   of the new image found in the running partition are copied from flash,
+ *   blocks already written to the update partition are kept, and only the
+ *   other blocks are downloaded, with range requests.
+ *
+ *   The download of an uncompressed application image can be resumed: its
+ *   progress is regularly saved in NVS, and when ota_update_b() is called
+ *   again after a connection error, only the missing part of the file is
+ *   requested, provided that it did not change on the server. If the server
+ *   sends a SHA-256 Digest header, the whole file is checked against it.
+ *
+ *   The length of the reads of the update file, and the size of the
+ *   download buffers, can be adapted to the network link: see the
+ *   FUOTA_B_TUNE configuration option. The selected values are cached per
+ *   link, identified by ota_set_link_b().
+ *
+ *   By default, an update runs as fast as possible, at the priority of the
+ *   calling task. ota_set_budget_b() caps its throughput and its share of
+ *   CPU time, and sets the priority of its tasks, so that it can run in
+ *   the background of the application. The budget can be changed while an
+ *   update is running, from another task.
+ *
+ *   ota_update_b() blocks the calling task until the end of the update.
+ *   ota_start_b() runs the update in a task of the component, and returns
+ *   at once: the application polls the update with ota_poll_b(), or waits
+ *   for its end with ota_wait_b(), and is told of its progress and of its
+ *   end by a callback, called by the update task. Progress and end of
+ *   every update are also posted to the default event loop, as
+ *   FUOTA_B_EVENT events. ota_cancel_b() stops the running update, which
+ *   can be resumed by next one.
+ *
+ *   Over a link with a long round-trip time, a single connection may not
+ *   use the available bandwidth. ota_set_streams_b() allows to download an
+ *   uncompressed image over several connections, each one fetching a part
+ *   of the image with a range request, when no budget limits the update.
  */
 
 #ifndef FUOTA_B_H_
 #define FUOTA_B_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "esp_event.h"
+
 extern const char OTA_TAG[];
 
 //Status values.
@@ -51,8 +137,121 @@ typedef enum {
     OTA_NO_UPDATE,
     OTA_CONN_ERR,
     OTA_SYS_ERR,
+    OTA_RUNNING,
+    OTA_CANCELLED,
 } ota_status_t;
 
+// Base of the events posted to the default event loop during an update.
+// Their data is an ota_event_data_t.
+ESP_EVENT_DECLARE_BASE(FUOTA_B_EVENT);
+
+typedef enum {
+    // Posted every 64 kB of the update file received.
+    OTA_EVENT_PROGRESS,
+    // End of the update.
+    OTA_EVENT_DONE,
+} ota_event_t;
+
+typedef struct {
+    // OTA_RUNNING, or the result of the update for OTA_EVENT_DONE.
+    ota_status_t status;
+    // Bytes of the update file received, and size of the update file, 0 if
+    // unknown.
+    uint32_t received;
+    uint32_t total;
+} ota_event_data_t;
+
+// Callback of an update started by ota_start_b(), called by the update
+// task. It must return quickly, and must not call ota_wait_b(). The update
+// is still running when it is called: ota_close_b() would be refused.
+typedef void (*ota_event_cb_t)(void *arg, ota_event_t event,
+                               const ota_event_data_t *data);
+
+// Backends of the component, see ota_transport.h and ota_storage.h.
+typedef struct ota_transport ota_transport_t;
+typedef struct ota_storage ota_storage_t;
+
+// Creates a transport to the given server. cert_pem is the CA certificate
+// used to check the server certificate, timeout_ms the send and receive
+// timeout. The transport is released by its destroy operation.
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: invalid certificate, or host name too long
+// - OTA_SYS_ERR
+typedef ota_status_t (*ota_transport_create_t)(const char *host,
+                                               uint16_t port,
+                                               const char *cert_pem,
+                                               uint32_t timeout_ms,
+                                               ota_transport_t **transport);
+
+// Statistics about the connections to the update server, since startup.
+// Times are in ms.
+typedef struct {
+    uint32_t full_handshakes;
+    uint32_t resumed_handshakes;
+    // Cumulated handshake times.
+    uint32_t full_handshake_time;
+    uint32_t resumed_handshake_time;
+    // Last connection.
+    bool last_resumed;
+    uint32_t last_dns_time;
+    uint32_t last_tcp_time;
+    uint32_t last_handshake_time;
+} ota_tls_stats_t;
+
+// Resources an update may use, see ota_set_budget_b().
+typedef struct {
+    // Maximum throughput of the download, in bytes per second. 0 for no
+    // limit.
+    uint32_t max_rate;
+    // Share of the time the update tasks may be busy, in percent, from 1
+    // to 100. 0 is the same as 100: no limit.
+    uint8_t cpu_share;
+    // Priority of the update tasks. 0 for the priority of the task calling
+    // ota_update_b().
+    uint8_t priority;
+} ota_budget_t;
+
+// Metrics of the last call to ota_update_b(). Times are in microseconds.
+// Phases which did not take place are set to 0.
+typedef struct {
+    ota_status_t status;
+    int64_t total_time;
+    // Update check, from its request to the end of its processing.
+    int64_t check_time;
+    // Connection steps, cumulated over all connection attempts.
+    int64_t dns_time;
+    int64_t tcp_time;
+    int64_t tls_time;
+    // From the sending of requests to the reception of their response
+    // headers, cumulated over all requests.
+    int64_t header_time;
+    // Reception of the update file body, including the wait for the end of
+    // its processing.
+    int64_t transfer_time;
+    // Time spent erasing, writing, copying and checking flash.
+    int64_t flash_time;
+    // Time spent waiting for the budget set by ota_set_budget_b().
+    int64_t throttle_time;
+    // Final validation of the image, and boot partition setting.
+    int64_t validation_time;
+    uint32_t connections;
+    uint32_t requests;
+    // Requests sent again over a new connection.
+    uint32_t request_retries;
+    // Blocks fetched again after a manifest mismatch.
+    uint32_t refetched_blocks;
+    // Response body bytes, for all requests.
+    uint32_t bytes_received;
+    // Update file bytes, and resulting image bytes written to flash.
+    uint32_t file_bytes;
+    uint32_t image_bytes;
+    // Update file bytes per second, over the transfer time.
+    uint32_t throughput;
+    // Length of the reads of the update file, at the end of the download.
+    uint32_t chunk_size;
+} ota_metrics_t;
+
 /**
  * Requests an OTA firmware update.
  *
@@ -74,9 +273,11 @@ typedef enum {
  * Returned value:
  * - OTA_UPDATED: update received and stored
  * - OTA_NO_UPDATE: no update available
- * - OTA_PARAM_ERR: incorrect OTA parameter
+ * - OTA_PARAM_ERR: incorrect OTA parameter, invalid update file, or an
+ *   update is already running
  * - OTA_SYS_ERR: system error, a restart could be good
  * - OTA_CONN_ERR: chances are high that there was a connectivity probleme
+ * - OTA_CANCELLED: ota_cancel_b() was called
  */
 ota_status_t ota_update_b(const char *server_name, uint16_t server_port,
                           const char *cert_pem, const  char *username,
@@ -84,4 +285,122 @@ ota_status_t ota_update_b(const char *server_name, uint16_t server_port,
                           const char *id,
                           const char *app_ver);
 
+/**
+ * Starts an update, as ota_update_b() would do, in a task of the
+ * component, and returns at once. The strings must remain valid until the
+ * end of the update. callback, which may be NULL, is called with arg for
+ * every event of the update.
+ *
+ * Returned value:
+ * - OTA_OK: update started
+ * - OTA_PARAM_ERR: an update is already running
+ * - OTA_SYS_ERR
+ */
+ota_status_t ota_start_b(const char *server_name, uint16_t server_port,
+                         const char *cert_pem, const char *username,
+                         const char *password, const char *id,
+                         const char *app_ver, ota_event_cb_t callback,
+                         void *arg);
+
+/**
+ * Returns the state of the update started by ota_start_b(). If progress is
+ * not NULL, it is set to the progress of the running, or last, update.
+ *
+ * Returned value:
+ * - OTA_RUNNING
+ * - result of the update, see ota_update_b()
+ * - OTA_PARAM_ERR: no update was started
+ */
+ota_status_t ota_poll_b(ota_event_data_t *progress);
+
+/**
+ * Waits for the end of the update started by ota_start_b(), for at most
+ * timeout_ms ms.
+ *
+ * Returned value: see ota_poll_b().
+ */
+ota_status_t ota_wait_b(uint32_t timeout_ms);
+
+/**
+ * Stops the running update, if any, as soon as possible: its result is then
+ * OTA_CANCELLED. The download can be resumed by next update. Can be called
+ * by any task.
+ */
+void ota_cancel_b(void);
+
+/**
+ * Closes the connection to the update server kept open by ota_update_b(),
+ * and releases the associated resources. Must be called before the network
+ * connection is stopped. A call to ota_update_b() with another server,
+ * certificate or credentials closes the connection by itself, and opens a
+ * new one. Refused while an update is running: for an update started by
+ * ota_start_b(), wait for its end first, with ota_wait_b(), possibly after
+ * ota_cancel_b().
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_RUNNING: an update is running, nothing was done
+ */
+ota_status_t ota_close_b(void);
+
+/**
+ * Returns statistics about the connections established with the update
+ * server: number of full and resumed TLS handshakes, and their durations.
+ */
+void ota_get_tls_stats_b(ota_tls_stats_t *stats);
+
+/**
+ * Returns the metrics of the last call to ota_update_b(): duration of every
+ * phase, bytes transferred, throughput and retries.
+ */
+void ota_get_last_metrics_b(ota_metrics_t *metrics);
+
+/**
+ * Replaces the transport and the storage sink used by ota_update_b(). NULL
+ * selects the default one: TLS over lwIP, and ESP-IDF OTA partitions. The
+ * connection kept open, if any, is closed. For a host build, where there is
+ * no default, both must be given before the first call to ota_update_b().
+ * Refused while an update is running, as ota_close_b().
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_RUNNING: an update is running, nothing was done
+ */
+ota_status_t ota_set_backends_b(ota_transport_create_t create_transport,
+                                ota_storage_t *storage);
+
+/**
+ * Identifies the network link used by next calls to ota_update_b(), for
+ * instance with the BSSID of the access point. The download settings
+ * adapted to a link are cached, and used again on the same link. NULL for
+ * an unknown link. Identifiers longer than 16 bytes are truncated. Refused
+ * while an update is running, as ota_close_b().
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_RUNNING: an update is running, nothing was done
+ */
+ota_status_t ota_set_link_b(const uint8_t *link_id, size_t length);
+
+/**
+ * Sets the budget of next updates, and of the running one, if any, from its
+ * next read of the update file. Can be called by any task. The initial
+ * budget is given by the FUOTA_B_MAX_RATE and FUOTA_B_CPU_SHARE
+ * configuration options, at the priority of the calling task.
+ */
+void ota_set_budget_b(const ota_budget_t *budget);
+
+/**
+ * Returns the current budget.
+ */
+void ota_get_budget_b(ota_budget_t *budget);
+
+/**
+ * Sets the maximum number of connections, from 1 to 4, an uncompressed
+ * image is downloaded over, from next update. Additional connections are
+ * opened only when the free heap allows it. The initial number is given by
+ * the FUOTA_B_STREAMS configuration option.
+ */
+void ota_set_streams_b(uint8_t count);
+
 #endif /* FUOTA_B_H_ */
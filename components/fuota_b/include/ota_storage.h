@@ -0,0 +1,136 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Interface of the storage sinks used by the fuota_b component. A
+ *   storage sink gives access to two partitions: the running one, which
+ *   contains the running image, and the update one, which receives the
+ *   new image.
+ *
+ *   The default storage sink uses the ESP-IDF OTA partitions (ota_flash.c).
+ *   Other storage sinks, for instance backed by files for a host build, are
+ *   given to ota_set_backends_b().
+ *
+ * Implementation:
+ *   A storage sink structure starts with an ota_storage_t field. The fields
+ *   following ops are set by the open function.
+ *
+ *   Erase and write operations follow the rules of the ESP32 flash: the
+ *   update partition is erased by sectors, and a byte can only be written
+ *   once after an erase.
+ */
+
+#ifndef OTA_STORAGE_H_
+#define OTA_STORAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+
+#define OTA_STORAGE_SECTOR_SIZE 4096
+#define OTA_STORAGE_ID_LENGTH 32
+
+typedef enum {
+    OTA_STORAGE_RUNNING,
+    OTA_STORAGE_UPDATE,
+} ota_storage_partition_t;
+
+typedef struct {
+    /**
+     * Selects the update partition, and sets the fields of the storage
+     * structure. Called before every update.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_SYS_ERR: no update partition
+     */
+    ota_status_t (*open)(ota_storage_t *storage);
+    /**
+     * Reads from one of the partitions.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_SYS_ERR
+     */
+    ota_status_t (*read)(ota_storage_t *storage,
+                         ota_storage_partition_t partition, uint32_t offset,
+                         void *data, size_t length);
+    /**
+     * Computes the SHA-256 of the running image.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_SYS_ERR
+     */
+    ota_status_t (*get_running_sha256)(ota_storage_t *storage, uint8_t *sha);
+    /**
+     * Prepares the writing of a new image to the update partition, without
+     * erasing it.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_SYS_ERR
+     */
+    ota_status_t (*begin)(ota_storage_t *storage);
+    /**
+     * Erases a part of the update partition. offset and length are
+     * multiples of OTA_STORAGE_SECTOR_SIZE.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_SYS_ERR
+     */
+    ota_status_t (*erase)(ota_storage_t *storage, uint32_t offset,
+                          size_t length);
+    /**
+     * Writes to the update partition, which must have been erased.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_SYS_ERR
+     */
+    ota_status_t (*write)(ota_storage_t *storage, uint32_t offset,
+                          const void *data, size_t length);
+    /**
+     * Validates the new image, and makes the update partition the boot
+     * one.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_PARAM_ERR: invalid image
+     * - OTA_SYS_ERR
+     */
+    ota_status_t (*end)(ota_storage_t *storage);
+    // Ends the writing of a new image, after an error.
+    void (*abort)(ota_storage_t *storage);
+} ota_storage_ops_t;
+
+struct ota_storage {
+    const ota_storage_ops_t *ops;
+    // Name of the update partition, for logs.
+    const char *update_label;
+    uint32_t update_size;
+    uint32_t running_size;
+    // Identifies the running application.
+    uint8_t app_id[OTA_STORAGE_ID_LENGTH];
+};
+
+#endif /* OTA_STORAGE_H_ */
@@ -0,0 +1,92 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Interface of the transports used by the fuota_b component to reach the
+ *   update server. A transport provides one connection at a time to a
+ *   given server: the HTTP client of the component sends its requests over
+ *   it.
+ *
+ *   The default transport is TLS over lwIP (ota_tls.c). Other transports,
+ *   for instance for a host build, are given to ota_set_backends_b().
+ *
+ * Implementation:
+ *   A transport structure starts with an ota_transport_t field, initialized
+ *   by the create function of the transport. The fields following ops are
+ *   updated by the transport, and read by its user.
+ */
+
+#ifndef OTA_TRANSPORT_H_
+#define OTA_TRANSPORT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+
+#define OTA_TRANSPORT_HOST_MAX_LENGTH 253
+
+typedef struct {
+    /**
+     * Opens a connection to the server, closing the current one if any.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_CONN_ERR
+     */
+    ota_status_t (*connect)(ota_transport_t *transport);
+    /**
+     * Reads at most length bytes. Returns the number of bytes read, 0 if
+     * the server closed the connection with a TLS close_notify alert, or a
+     * negative value in case of error, including a connection closed
+     * without close_notify.
+     */
+    int (*read)(ota_transport_t *transport, uint8_t *data, size_t length);
+    /**
+     * Writes length bytes.
+     *
+     * Returned value:
+     * - OTA_OK
+     * - OTA_CONN_ERR
+     */
+    ota_status_t (*write)(ota_transport_t *transport, const uint8_t *data,
+                          size_t length);
+    // Closes the connection, if open.
+    void (*close)(ota_transport_t *transport);
+    // Closes the connection, if open, and releases the transport.
+    void (*destroy)(ota_transport_t *transport);
+} ota_transport_ops_t;
+
+struct ota_transport {
+    const ota_transport_ops_t *ops;
+    char host[OTA_TRANSPORT_HOST_MAX_LENGTH + 1];
+    uint16_t port;
+    bool connected;
+    // Last connection attempt: durations of its steps, in microseconds,
+    // set to 0 for steps not performed, and whether a previous session was
+    // resumed.
+    int64_t dns_time;
+    int64_t tcp_time;
+    int64_t handshake_time;
+    bool resumed;
+};
+
+#endif /* OTA_TRANSPORT_H_ */
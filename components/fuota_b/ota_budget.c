@@ -0,0 +1,197 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "esp_timer.h"
+
+#include "ota_budget.h"
+#include "ota_pipe.h"
+#include "sdkconfig.h"
+
+// Budget, written by any task.
+static atomic_uint max_rate = CONFIG_FUOTA_B_MAX_RATE * 1024;
+static atomic_uint cpu_share = CONFIG_FUOTA_B_CPU_SHARE;
+static atomic_uint priority = 0;
+// Busy time of the writer task not taken from the bucket yet, in
+// microseconds.
+static atomic_uint writer_busy_time;
+
+// Receiving task side.
+static TaskHandle_t receiver = NULL;
+static TaskHandle_t writer = NULL;
+static UBaseType_t initial_priority;
+static UBaseType_t current_priority;
+static int64_t byte_tokens;
+static int64_t time_tokens;
+static int64_t last_refill;
+
+// Priority the update tasks must have.
+static UBaseType_t get_priority(void) {
+
+    UBaseType_t requested = atomic_load(&priority);
+
+    return requested == 0 ? initial_priority : requested;
+
+}
+
+// Applies a change of the requested priority to the update tasks.
+static void update_priority(void) {
+
+    UBaseType_t requested = get_priority();
+
+    if (requested == current_priority) {
+        return;
+    }
+    vTaskPrioritySet(receiver, requested);
+    if (writer != NULL) {
+        vTaskPrioritySet(writer, requested);
+    }
+    current_priority = requested;
+
+}
+
+// Adds the tokens earned since the last refill.
+static void refill(uint32_t rate, uint32_t share) {
+
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - last_refill;
+    int64_t max_tokens;
+
+    last_refill = now;
+    if (rate == 0) {
+        byte_tokens = 0;
+    } else {
+        max_tokens = (int64_t)rate * OTA_BUDGET_WINDOW_MS / 1000;
+        if (max_tokens < OTA_PIPE_BUFFER_SIZE) {
+            max_tokens = OTA_PIPE_BUFFER_SIZE;
+        }
+        byte_tokens += elapsed * rate / 1000000;
+        if (byte_tokens > max_tokens) {
+            byte_tokens = max_tokens;
+        }
+    }
+    if (share >= 100) {
+        time_tokens = 0;
+        atomic_store(&writer_busy_time, 0);
+    } else {
+        max_tokens = (int64_t)OTA_BUDGET_WINDOW_MS * 1000 * share / 100;
+        time_tokens += elapsed * share / 100;
+        if (time_tokens > max_tokens) {
+            time_tokens = max_tokens;
+        }
+        time_tokens -= atomic_exchange(&writer_busy_time, 0);
+    }
+
+}
+
+void ota_budget_set(const ota_budget_t *budget) {
+
+    uint8_t share = budget->cpu_share;
+
+    if ((share == 0) || (share > 100)) {
+        share = 100;
+    }
+    atomic_store(&max_rate, budget->max_rate);
+    atomic_store(&cpu_share, share);
+    atomic_store(&priority, budget->priority);
+
+}
+
+void ota_budget_get(ota_budget_t *budget) {
+
+    budget->max_rate = atomic_load(&max_rate);
+    budget->cpu_share = atomic_load(&cpu_share);
+    budget->priority = atomic_load(&priority);
+
+}
+
+void ota_budget_begin(void) {
+
+    receiver = xTaskGetCurrentTaskHandle();
+    writer = NULL;
+    initial_priority = uxTaskPriorityGet(NULL);
+    current_priority = initial_priority;
+    update_priority();
+    byte_tokens = 0;
+    time_tokens = 0;
+    atomic_store(&writer_busy_time, 0);
+    last_refill = esp_timer_get_time();
+
+}
+
+void ota_budget_end(void) {
+
+    if (current_priority != initial_priority) {
+        vTaskPrioritySet(receiver, initial_priority);
+    }
+    receiver = NULL;
+
+}
+
+void ota_budget_set_writer(TaskHandle_t writer_in) {
+
+    writer = writer_in;
+
+}
+
+int64_t ota_budget_wait(void) {
+
+    uint32_t rate = atomic_load(&max_rate);
+    uint32_t share = atomic_load(&cpu_share);
+    int64_t delay = 0;
+    int64_t start;
+
+    update_priority();
+    refill(rate, share);
+    if ((rate != 0) && (byte_tokens < 0)) {
+        delay = -byte_tokens * 1000000 / rate;
+    }
+    if ((share < 100) && (time_tokens < 0) &&
+        (-time_tokens * 100 / share > delay)) {
+        delay = -time_tokens * 100 / share;
+    }
+    if (delay == 0) {
+        return 0;
+    }
+    // The tokens earned meanwhile are added by next refill.
+    start = esp_timer_get_time();
+    vTaskDelay((delay / 1000 + portTICK_PERIOD_MS) / portTICK_PERIOD_MS);
+    return esp_timer_get_time() - start;
+
+}
+
+void ota_budget_charge(size_t length, int64_t busy_time) {
+
+    if (atomic_load(&max_rate) != 0) {
+        byte_tokens -= length;
+    }
+    if (atomic_load(&cpu_share) < 100) {
+        time_tokens -= busy_time;
+    }
+
+}
+
+void ota_budget_charge_writer(int64_t busy_time) {
+
+    atomic_fetch_add(&writer_busy_time, busy_time);
+
+}
@@ -0,0 +1,103 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It keeps an update within the
+ *   budget set by the application: a maximum throughput, a share of the
+ *   CPU time, and the priority of the update tasks.
+ *
+ *   Both limits are enforced by token buckets, refilled with the time
+ *   elapsed: one in bytes, at the maximum throughput, and one in
+ *   microseconds of busy time, at the CPU share. The receiving task takes
+ *   tokens for every read, and the writer task for the processing of every
+ *   chunk (flash operations, decompression, patching and hashing). When a
+ *   bucket is empty, the receiving task sleeps until it is refilled. The
+ *   writer task then runs out of data, and waits too.
+ *
+ *   The busy time of the receiving task is the duration of its reads: it
+ *   includes TLS decryption, but also the wait for data from the network,
+ *   so that the CPU share is enforced conservatively over a slow link.
+ *   Each bucket holds up to OTA_BUDGET_WINDOW_MS of tokens, so that short
+ *   bursts are allowed after a pause.
+ *
+ *   The budget may be changed at any time, by any task. The receiving task
+ *   applies the change before its next read, including a change of the
+ *   priority of both update tasks.
+ *
+ * Usage:
+ *   ota_budget_begin() by the task calling ota_update_b(), and
+ *   ota_budget_end() before it returns. During a download:
+ *   ota_budget_set_writer() once the writer task is created,
+ *   ota_budget_wait() before every read and ota_budget_charge() after it,
+ *   ota_budget_charge_writer() by the writer task.
+ */
+
+#ifndef OTA_BUDGET_H_
+#define OTA_BUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "fuota_b.h"
+
+#define OTA_BUDGET_WINDOW_MS 100
+
+void ota_budget_set(const ota_budget_t *budget);
+
+void ota_budget_get(ota_budget_t *budget);
+
+/**
+ * Starts the accounting, and applies the priority of the budget to the
+ * calling task. Its current priority is restored by ota_budget_end().
+ */
+void ota_budget_begin(void);
+
+void ota_budget_end(void);
+
+/**
+ * Declares the writer task, whose priority follows the one of the budget.
+ * NULL once the writer task is over.
+ */
+void ota_budget_set_writer(TaskHandle_t writer);
+
+/**
+ * Receiving task side: applies a change of the budget, and sleeps if
+ * a bucket is empty.
+ *
+ * Returned value: time spent sleeping, in microseconds.
+ */
+int64_t ota_budget_wait(void);
+
+/**
+ * Receiving task side: accounts for a read of length bytes, which kept
+ * the task busy for busy_time microseconds.
+ */
+void ota_budget_charge(size_t length, int64_t busy_time);
+
+/**
+ * Writer task side: accounts for busy_time microseconds of processing.
+ */
+void ota_budget_charge_writer(int64_t busy_time);
+
+#endif /* OTA_BUDGET_H_ */
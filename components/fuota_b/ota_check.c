@@ -0,0 +1,157 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+
+#include "ota_check.h"
+
+static const char NVS_NAMESPACE[] = "fuota_b";
+static const char NVS_KEY[] = "check";
+
+// Last record read or written, and the end of its validity period, in
+// microseconds since startup.
+static ota_check_t cached;
+static bool cached_valid = false;
+static int64_t expiry_time;
+
+static void init_id(ota_check_t *check, const char *server_name,
+                    uint16_t server_port, const char *path) {
+
+    mbedtls_sha256_context sha;
+    char port[8];
+
+    snprintf(port, sizeof(port), ":%u", server_port);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    mbedtls_sha256_update_ret(&sha, (const unsigned char *)server_name,
+                              strlen(server_name));
+    mbedtls_sha256_update_ret(&sha, (const unsigned char *)port, strlen(port));
+    mbedtls_sha256_update_ret(&sha, (const unsigned char *)path, strlen(path));
+    mbedtls_sha256_finish_ret(&sha, check->request_id);
+    mbedtls_sha256_free(&sha);
+
+}
+
+static void clear(void) {
+
+    nvs_handle_t nvs;
+
+    cached_valid = false;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_erase_key(nvs, NVS_KEY) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+
+}
+
+bool ota_check_load(ota_check_t *check, const char *server_name,
+                    uint16_t server_port, const char *path) {
+
+    esp_err_t esp_rs;
+    nvs_handle_t nvs;
+
+    memset(check, 0, sizeof(*check));
+    init_id(check, server_name, server_port, path);
+    if (cached_valid) {
+        if (memcmp(cached.request_id, check->request_id,
+                   OTA_CHECK_ID_LENGTH) != 0) {
+            return false;
+        }
+        *check = cached;
+        return true;
+    }
+    esp_rs = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (esp_rs != ESP_OK) {
+        // Namespace not created yet.
+        return false;
+    }
+    size_t length = sizeof(cached);
+    esp_rs = nvs_get_blob(nvs, NVS_KEY, &cached, &length);
+    nvs_close(nvs);
+    if ((esp_rs != ESP_OK) || (length != sizeof(cached))) {
+        return false;
+    }
+    cached.etag[OTA_CHECK_VALIDATOR_MAX_LENGTH] = '\0';
+    cached.last_modified[OTA_CHECK_VALIDATOR_MAX_LENGTH] = '\0';
+    cached.file_path[OTA_CHECK_PATH_MAX_LENGTH] = '\0';
+    cached_valid = true;
+    // Time since startup can't be compared with the one of a previous run.
+    expiry_time = 0;
+    if (memcmp(cached.request_id, check->request_id,
+               OTA_CHECK_ID_LENGTH) != 0) {
+        return false;
+    }
+    *check = cached;
+    return true;
+
+}
+
+bool ota_check_is_fresh(const ota_check_t *check) {
+
+    return cached_valid &&
+           (memcmp(cached.request_id, check->request_id,
+                   OTA_CHECK_ID_LENGTH) == 0) &&
+           (esp_timer_get_time() < expiry_time);
+
+}
+
+void ota_check_save(const ota_check_t *check, uint32_t max_age) {
+
+    esp_err_t esp_rs;
+    nvs_handle_t nvs;
+
+    if ((check->etag[0] == '\0') && (check->last_modified[0] == '\0') &&
+        (max_age == 0)) {
+        // Nothing to gain from this result.
+        if (cached_valid) {
+            clear();
+        }
+        return;
+    }
+    expiry_time = esp_timer_get_time() + (int64_t)max_age * 1000000;
+    if (cached_valid && (memcmp(&cached, check, sizeof(cached)) == 0)) {
+        return;
+    }
+    cached = *check;
+    cached_valid = true;
+    esp_rs = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(OTA_TAG, "Error from nvs_open: %s", esp_err_to_name(esp_rs));
+        return;
+    }
+    esp_rs = nvs_set_blob(nvs, NVS_KEY, &cached, sizeof(cached));
+    if (esp_rs == ESP_OK) {
+        esp_rs = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(OTA_TAG, "Error while saving check result: %s",
+                 esp_err_to_name(esp_rs));
+    }
+
+}
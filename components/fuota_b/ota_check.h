@@ -0,0 +1,80 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It caches the result of the
+ *   last update check, so that next check can be conditional.
+ *
+ *   The record identifies the request by a hash of the server and of the
+ *   request path and query, which include the application version. It
+ *   contains the validators (ETag, Last-Modified date) returned by the
+ *   server, and the result: status code and, if an update is available,
+ *   update file path and image size. It is stored in NVS, and only written
+ *   when it changes, so that a 304 Not Modified response does not cause any
+ *   flash write.
+ *
+ *   The expiry time given by a Cache-Control max-age directive is kept in
+ *   RAM only: after a restart, next check is always sent to the server.
+ */
+
+#ifndef OTA_CHECK_H_
+#define OTA_CHECK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+
+#define OTA_CHECK_ID_LENGTH 32
+#define OTA_CHECK_VALIDATOR_MAX_LENGTH 63
+#define OTA_CHECK_PATH_MAX_LENGTH 255
+
+typedef struct {
+    // SHA-256 of "<server>:<port><path>".
+    uint8_t request_id[OTA_CHECK_ID_LENGTH];
+    char etag[OTA_CHECK_VALIDATOR_MAX_LENGTH + 1];
+    char last_modified[OTA_CHECK_VALIDATOR_MAX_LENGTH + 1];
+    uint16_t status_code;
+    // Update file path and image size, for a 200 status code.
+    char file_path[OTA_CHECK_PATH_MAX_LENGTH + 1];
+    uint32_t image_size;
+} ota_check_t;
+
+/**
+ * Reads the cached result for the given request. Returns true if one is
+ * available. check is initialized for this request otherwise.
+ */
+bool ota_check_load(ota_check_t *check, const char *server_name,
+                    uint16_t server_port, const char *path);
+
+/**
+ * Returns true if the cached result for the request of check can be used
+ * without asking the server.
+ */
+bool ota_check_is_fresh(const ota_check_t *check);
+
+/**
+ * Caches the result, valid without asking the server for max_age seconds.
+ * The result is only kept if it can be revalidated or if max_age is not 0.
+ * NVS is written only if the stored record changes.
+ */
+void ota_check_save(const ota_check_t *check, uint32_t max_age);
+
+#endif /* OTA_CHECK_H_ */
@@ -0,0 +1,253 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+
+#include "ota_dedup.h"
+
+static const char NVS_NAMESPACE[] = "fuota_b";
+static const char NVS_KEY[] = "run_hashes";
+
+#define SHORT_HASH_LENGTH 8
+
+// Header of the hashes of the running partition blocks.
+typedef struct {
+    // SHA-256 of the running application.
+    uint8_t app_id[OTA_STORAGE_ID_LENGTH];
+    uint32_t block_size;
+    uint32_t block_count;
+} hashes_header_t;
+
+// Buffer for flash reads. Used by one task at a time.
+#define READ_BUF_SIZE 1024
+static uint8_t read_buf[READ_BUF_SIZE];
+
+// Reads the stored hashes of the running partition blocks. Returns NULL if
+// they are not available for the given header.
+static uint8_t *load_hashes(const hashes_header_t *header) {
+
+    nvs_handle_t nvs;
+    size_t length = sizeof(*header) + header->block_count * SHORT_HASH_LENGTH;
+    size_t stored_length = length;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        // Namespace not created yet.
+        return NULL;
+    }
+    uint8_t *buffer = malloc(length);
+    if ((buffer == NULL) ||
+        (nvs_get_blob(nvs, NVS_KEY, buffer, &stored_length) != ESP_OK) ||
+        (stored_length != length) ||
+        (memcmp(buffer, header, sizeof(*header)) != 0)) {
+        free(buffer);
+        buffer = NULL;
+    }
+    nvs_close(nvs);
+    return buffer;
+
+}
+
+static void store_hashes(const uint8_t *buffer, size_t length) {
+
+    nvs_handle_t nvs;
+
+    esp_err_t esp_rs = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(OTA_TAG, "ota_dedup - Error from nvs_open: %s",
+                 esp_err_to_name(esp_rs));
+        return;
+    }
+    esp_rs = nvs_set_blob(nvs, NVS_KEY, buffer, length);
+    if (esp_rs == ESP_OK) {
+        esp_rs = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(OTA_TAG, "ota_dedup - Error while saving hashes: %s",
+                 esp_err_to_name(esp_rs));
+    }
+
+}
+
+// Hashes the blocks of the running partition. The returned buffer contains
+// the header, followed by the hashes.
+static uint8_t *compute_hashes(ota_storage_t *storage,
+                               const hashes_header_t *header) {
+
+    mbedtls_sha256_context sha;
+    uint8_t hash[32];
+    ota_status_t ota_rs = OTA_OK;
+    size_t length = sizeof(*header) + header->block_count * SHORT_HASH_LENGTH;
+
+    uint8_t *buffer = malloc(length);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    memcpy(buffer, header, sizeof(*header));
+    uint8_t *hashes = buffer + sizeof(*header);
+    mbedtls_sha256_init(&sha);
+    for (uint32_t i = 0; (i < header->block_count) && (ota_rs == OTA_OK); i++) {
+        mbedtls_sha256_starts_ret(&sha, 0);
+        for (uint32_t offset = 0; offset < header->block_size;
+             offset += READ_BUF_SIZE) {
+            ota_rs = storage->ops->read(storage, OTA_STORAGE_RUNNING,
+                                        i * header->block_size + offset,
+                                        read_buf, READ_BUF_SIZE);
+            if (ota_rs != OTA_OK) {
+                break;
+            }
+            mbedtls_sha256_update_ret(&sha, read_buf, READ_BUF_SIZE);
+        }
+        mbedtls_sha256_finish_ret(&sha, hash);
+        memcpy(hashes + i * SHORT_HASH_LENGTH, hash, SHORT_HASH_LENGTH);
+    }
+    mbedtls_sha256_free(&sha);
+    if (ota_rs != OTA_OK) {
+        free(buffer);
+        return NULL;
+    }
+    store_hashes(buffer, length);
+    return buffer;
+
+}
+
+// Returns the index of a block of the running partition whose hash starts
+// like the given one, or OTA_DEDUP_FETCH. The block at the same index is
+// tried first.
+static uint16_t find_block(const uint8_t *hashes, uint32_t count,
+                           const uint8_t *hash, uint32_t index) {
+
+    if ((index < count) &&
+        (memcmp(hashes + index * SHORT_HASH_LENGTH, hash,
+                SHORT_HASH_LENGTH) == 0)) {
+        return index;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (memcmp(hashes + i * SHORT_HASH_LENGTH, hash,
+                   SHORT_HASH_LENGTH) == 0) {
+            return i;
+        }
+    }
+    return OTA_DEDUP_FETCH;
+
+}
+
+ota_status_t ota_dedup_plan(ota_dedup_t *dedup, const ota_manifest_t *manifest,
+                            ota_storage_t *storage) {
+
+    hashes_header_t header;
+
+    memset(dedup, 0, sizeof(*dedup));
+    memset(&header, 0, sizeof(header));
+    memcpy(header.app_id, storage->app_id, OTA_STORAGE_ID_LENGTH);
+    header.block_size = manifest->block_size;
+    header.block_count = storage->running_size / manifest->block_size;
+    if (header.block_count >= OTA_DEDUP_KEEP) {
+        ESP_LOGE(OTA_TAG, "ota_dedup - Too many blocks");
+        return OTA_SYS_ERR;
+    }
+    dedup->sources = malloc(manifest->block_count * sizeof(uint16_t));
+    if (dedup->sources == NULL) {
+        ESP_LOGE(OTA_TAG, "ota_dedup - Can't allocate sources");
+        return OTA_SYS_ERR;
+    }
+    uint8_t *buffer = load_hashes(&header);
+    if (buffer == NULL) {
+        ESP_LOGI(OTA_TAG, "ota_dedup - Hashing running partition");
+        buffer = compute_hashes(storage, &header);
+        if (buffer == NULL) {
+            return OTA_SYS_ERR;
+        }
+    }
+    const uint8_t *hashes = buffer + sizeof(header);
+    for (uint32_t i = 0; i < manifest->block_count; i++) {
+        // esp_ota_end() fails if nothing was written: the first block is
+        // always written.
+        if ((i > 0) &&
+            (ota_manifest_check_block(manifest, storage, i) == OTA_OK)) {
+            dedup->sources[i] = OTA_DEDUP_KEEP;
+            dedup->keep_count++;
+            continue;
+        }
+        dedup->sources[i] = find_block(hashes, header.block_count,
+                                       manifest->hashes +
+                                       i * OTA_MANIFEST_HASH_LENGTH, i);
+        if (dedup->sources[i] == OTA_DEDUP_FETCH) {
+            dedup->fetch_count++;
+        } else {
+            dedup->copy_count++;
+        }
+    }
+    free(buffer);
+    ESP_LOGI(OTA_TAG, "ota_dedup - Blocks to keep: %u, to copy: %u, to fetch: %u",
+             dedup->keep_count, dedup->copy_count, dedup->fetch_count);
+    return OTA_OK;
+
+}
+
+uint16_t ota_dedup_get_source(const ota_dedup_t *dedup, uint32_t index) {
+
+    return dedup->sources[index];
+
+}
+
+ota_status_t ota_dedup_copy_block(const ota_dedup_t *dedup,
+                                  const ota_manifest_t *manifest,
+                                  ota_storage_t *storage, uint32_t index) {
+
+    uint32_t source = dedup->sources[index] * manifest->block_size;
+    uint32_t offset = index * manifest->block_size;
+    uint32_t end = offset + manifest->block_size;
+    ota_status_t ota_rs;
+    size_t step;
+
+    if (end > manifest->image_size) {
+        end = manifest->image_size;
+    }
+    for (; offset < end; offset += step, source += step) {
+        step = end - offset;
+        if (step > READ_BUF_SIZE) {
+            step = READ_BUF_SIZE;
+        }
+        ota_rs = storage->ops->read(storage, OTA_STORAGE_RUNNING, source,
+                                    read_buf, step);
+        if (ota_rs == OTA_OK) {
+            ota_rs = storage->ops->write(storage, offset, read_buf, step);
+        }
+        if (ota_rs != OTA_OK) {
+            ESP_LOGE(OTA_TAG, "ota_dedup - Error while copying block %u",
+                     index);
+            return ota_rs;
+        }
+    }
+    return OTA_OK;
+
+}
+
+void ota_dedup_free(ota_dedup_t *dedup) {
+
+    free(dedup->sources);
+    dedup->sources = NULL;
+
+}
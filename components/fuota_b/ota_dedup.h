@@ -0,0 +1,94 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It finds, from the block
+ *   manifest of a new image, which blocks of this image the device already
+ *   has:
+ *   - blocks already present, at their place, in the update partition,
+ *     for instance written by an interrupted update. The first block is
+ *     never kept, as at least one block must be written
+ *   - blocks present anywhere in the running partition, at a block
+ *     boundary. They are copied from flash to flash
+ *   Only the other blocks have to be downloaded. The server does not need
+ *   to know the running version.
+ *
+ *   The blocks of the running partition are identified by the first 8
+ *   bytes of their SHA-256. These hashes are computed at first use, and
+ *   stored in NVS, for the running application and the block size of the
+ *   manifest. A copied block is always checked against the full hash of the
+ *   manifest once written.
+ *
+ * Usage:
+ *   ota_dedup_plan(), then, for every block, ota_dedup_get_source(), and
+ *   ota_dedup_copy_block() for blocks with a source in the running
+ *   partition. Finally, ota_dedup_free(), which must be called even after
+ *   an error.
+ */
+
+#ifndef OTA_DEDUP_H_
+#define OTA_DEDUP_H_
+
+#include <stdint.h>
+
+#include "fuota_b.h"
+#include "ota_manifest.h"
+#include "ota_storage.h"
+
+// Special sources.
+#define OTA_DEDUP_KEEP 0xFFFE
+#define OTA_DEDUP_FETCH 0xFFFF
+
+typedef struct {
+    // For every block of the new image: OTA_DEDUP_KEEP, OTA_DEDUP_FETCH,
+    // or index of the block of the running partition to be copied.
+    uint16_t *sources;
+    uint32_t keep_count;
+    uint32_t copy_count;
+    uint32_t fetch_count;
+} ota_dedup_t;
+
+/**
+ * Sets the source of every block of the image described by manifest.
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_SYS_ERR: not enough memory, or flash read error
+ */
+ota_status_t ota_dedup_plan(ota_dedup_t *dedup, const ota_manifest_t *manifest,
+                            ota_storage_t *storage);
+
+uint16_t ota_dedup_get_source(const ota_dedup_t *dedup, uint32_t index);
+
+/**
+ * Copies a block from the running partition to the update partition, which
+ * must have been erased.
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_SYS_ERR: flash error
+ */
+ota_status_t ota_dedup_copy_block(const ota_dedup_t *dedup,
+                                  const ota_manifest_t *manifest,
+                                  ota_storage_t *storage, uint32_t index);
+
+void ota_dedup_free(ota_dedup_t *dedup);
+
+#endif /* OTA_DEDUP_H_ */
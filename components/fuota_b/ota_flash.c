@@ -0,0 +1,166 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+#include "ota_flash.h"
+
+typedef struct {
+    ota_storage_t storage;
+    const esp_partition_t *running;
+    const esp_partition_t *update;
+    esp_ota_handle_t handle;
+} ota_flash_t;
+
+static ota_flash_t flash;
+
+static ota_status_t flash_open(ota_storage_t *storage) {
+
+    flash.running = esp_ota_get_running_partition();
+    flash.update = esp_ota_get_next_update_partition(NULL);
+    if ((flash.running == NULL) || (flash.update == NULL)) {
+        ESP_LOGE(OTA_TAG, "ota_flash - No OTA partition");
+        return OTA_SYS_ERR;
+    }
+    storage->update_label = flash.update->label;
+    storage->update_size = flash.update->size;
+    storage->running_size = flash.running->size;
+    memcpy(storage->app_id, esp_ota_get_app_description()->app_elf_sha256,
+           OTA_STORAGE_ID_LENGTH);
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_read(ota_storage_t *storage,
+                               ota_storage_partition_t partition,
+                               uint32_t offset, void *data, size_t length) {
+
+    esp_err_t esp_rs = esp_partition_read(partition == OTA_STORAGE_RUNNING ?
+                                          flash.running : flash.update,
+                                          offset, data, length);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_partition_read: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_get_running_sha256(ota_storage_t *storage,
+                                             uint8_t *sha) {
+
+    esp_err_t esp_rs = esp_partition_get_sha256(flash.running, sha);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_partition_get_sha256: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_begin(ota_storage_t *storage) {
+
+    // The partition is erased by the caller, as the download goes.
+    esp_err_t esp_rs = esp_ota_begin(flash.update, OTA_WITH_SEQUENTIAL_WRITES,
+                                     &flash.handle);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_ota_begin: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_erase(ota_storage_t *storage, uint32_t offset,
+                                size_t length) {
+
+    esp_err_t esp_rs = esp_partition_erase_range(flash.update, offset, length);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_partition_erase_range: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_write(ota_storage_t *storage, uint32_t offset,
+                                const void *data, size_t length) {
+
+    esp_err_t esp_rs = esp_ota_write_with_offset(flash.handle, data, length,
+                                                 offset);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_ota_write_with_offset: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_end(ota_storage_t *storage) {
+
+    esp_err_t esp_rs = esp_ota_end(flash.handle);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_ota_end: %s",
+                 esp_err_to_name(esp_rs));
+        return (esp_rs == ESP_ERR_OTA_VALIDATE_FAILED) ? OTA_PARAM_ERR :
+                                                         OTA_SYS_ERR;
+    }
+    esp_rs = esp_ota_set_boot_partition(flash.update);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "ota_flash - Error from esp_ota_set_boot_partition: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static void flash_abort(ota_storage_t *storage) {
+
+    esp_ota_abort(flash.handle);
+
+}
+
+static const ota_storage_ops_t flash_ops = {
+    .open = flash_open,
+    .read = flash_read,
+    .get_running_sha256 = flash_get_running_sha256,
+    .begin = flash_begin,
+    .erase = flash_erase,
+    .write = flash_write,
+    .end = flash_end,
+    .abort = flash_abort,
+};
+
+ota_storage_t *ota_flash_get(void) {
+
+    flash.storage.ops = &flash_ops;
+    return &flash.storage;
+
+}
@@ -0,0 +1,42 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It is the default storage sink
+ *   (see ota_storage.h): the running partition, and the next update
+ *   partition, are the ESP-IDF OTA partitions, and the new image is written
+ *   through the esp_ota functions.
+ *
+ * Usage:
+ *   ota_flash_get() returns the storage sink, which is statically allocated.
+ */
+
+#ifndef OTA_FLASH_H_
+#define OTA_FLASH_H_
+
+#include "ota_storage.h"
+
+/**
+ * Returns the storage sink using the ESP-IDF OTA partitions.
+ */
+ota_storage_t *ota_flash_get(void);
+
+#endif /* OTA_FLASH_H_ */
@@ -0,0 +1,200 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "ota_hsz.h"
+
+// Decoder states: the value tells which element is expected next.
+enum {
+    ST_HEADER,
+    ST_TAG,
+    ST_LITERAL,
+    ST_DISTANCE,
+    ST_LENGTH,
+};
+
+// Passes the content of the output buffer to the output function.
+static ota_status_t flush_out_buf(ota_hsz_t *hsz) {
+
+    if (hsz->out_length == 0) {
+        return OTA_OK;
+    }
+    ota_status_t ota_rs = hsz->output(hsz->arg, hsz->out_buf,
+                                      hsz->out_length);
+    hsz->out_length = 0;
+    return ota_rs;
+
+}
+
+static ota_status_t push_byte(ota_hsz_t *hsz, uint8_t c) {
+
+    hsz->window[hsz->head & hsz->window_mask] = c;
+    hsz->head++;
+    hsz->out_buf[hsz->out_length++] = c;
+    if (hsz->out_length == OTA_HSZ_OUT_BUF_SIZE) {
+        return flush_out_buf(hsz);
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t process_header(ota_hsz_t *hsz) {
+
+    if (memcmp(hsz->header, OTA_HSZ_MAGIC, OTA_HSZ_MAGIC_LENGTH) != 0) {
+        ESP_LOGE(OTA_TAG, "ota_hsz - Bad magic");
+        return OTA_PARAM_ERR;
+    }
+    hsz->window_bits = hsz->header[OTA_HSZ_MAGIC_LENGTH];
+    hsz->lookahead_bits = hsz->header[OTA_HSZ_MAGIC_LENGTH + 1];
+    if ((hsz->window_bits < OTA_HSZ_WINDOW_MIN) ||
+        (hsz->window_bits > OTA_HSZ_WINDOW_MAX) ||
+        (hsz->lookahead_bits == 0) ||
+        (hsz->lookahead_bits >= hsz->window_bits)) {
+        ESP_LOGE(OTA_TAG, "ota_hsz - Unsupported parameters: %u, %u",
+                 hsz->window_bits, hsz->lookahead_bits);
+        return OTA_PARAM_ERR;
+    }
+    // Back-references before the start of the stream read zeros.
+    hsz->window = calloc(1, 1 << hsz->window_bits);
+    if (hsz->window == NULL) {
+        ESP_LOGE(OTA_TAG, "ota_hsz - Can't allocate window");
+        return OTA_SYS_ERR;
+    }
+    hsz->window_mask = (1 << hsz->window_bits) - 1;
+    ESP_LOGI(OTA_TAG, "ota_hsz - Window: %u bytes", 1 << hsz->window_bits);
+    return OTA_OK;
+
+}
+
+void ota_hsz_begin(ota_hsz_t *hsz, ota_hsz_output_t output, void *arg) {
+
+    memset(hsz, 0, sizeof(*hsz));
+    hsz->output = output;
+    hsz->arg = arg;
+    hsz->state = ST_HEADER;
+
+}
+
+ota_status_t ota_hsz_write(ota_hsz_t *hsz, const uint8_t *data, size_t length) {
+
+    ota_status_t ota_rs;
+    uint8_t needed;
+    uint32_t value;
+
+    if (hsz->state == ST_HEADER) {
+        size_t step = OTA_HSZ_HEADER_LENGTH - hsz->header_length;
+        if (step > length) {
+            step = length;
+        }
+        memcpy(hsz->header + hsz->header_length, data, step);
+        hsz->header_length += step;
+        data += step;
+        length -= step;
+        if (hsz->header_length < OTA_HSZ_HEADER_LENGTH) {
+            return OTA_OK;
+        }
+        ota_rs = process_header(hsz);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        hsz->state = ST_TAG;
+    }
+
+    while (true) {
+        switch (hsz->state) {
+        case ST_TAG:
+            needed = 1;
+            break;
+        case ST_LITERAL:
+            needed = 8;
+            break;
+        case ST_DISTANCE:
+            needed = hsz->window_bits;
+            break;
+        case ST_LENGTH:
+            needed = hsz->lookahead_bits;
+            break;
+        default:
+            ESP_LOGE(OTA_TAG, "ota_hsz - Unexpected state: %d", hsz->state);
+            return OTA_SYS_ERR;
+        }
+        while (hsz->bit_count < needed) {
+            if (length == 0) {
+                // Wait for next chunk. Decompressed bytes are not kept in
+                // the output buffer, to keep data flowing.
+                return flush_out_buf(hsz);
+            }
+            hsz->bits = (hsz->bits << 8) | *data;
+            hsz->bit_count += 8;
+            data++;
+            length--;
+        }
+        hsz->bit_count -= needed;
+        value = (hsz->bits >> hsz->bit_count) & ((1 << needed) - 1);
+
+        switch (hsz->state) {
+        case ST_TAG:
+            hsz->state = value ? ST_LITERAL : ST_DISTANCE;
+            break;
+        case ST_LITERAL:
+            ota_rs = push_byte(hsz, (uint8_t)value);
+            if (ota_rs != OTA_OK) {
+                return ota_rs;
+            }
+            hsz->state = ST_TAG;
+            break;
+        case ST_DISTANCE:
+            hsz->distance = value + 1;
+            hsz->state = ST_LENGTH;
+            break;
+        case ST_LENGTH:
+            for (uint32_t i = 0; i <= value; i++) {
+                ota_rs = push_byte(hsz, hsz->window[(hsz->head - hsz->distance) &
+                                                    hsz->window_mask]);
+                if (ota_rs != OTA_OK) {
+                    return ota_rs;
+                }
+            }
+            hsz->state = ST_TAG;
+            break;
+        }
+    }
+
+}
+
+ota_status_t ota_hsz_end(ota_hsz_t *hsz) {
+
+    ota_status_t ota_rs = OTA_OK;
+
+    // Remaining bits, if any, are padding.
+    if (hsz->state == ST_HEADER) {
+        ESP_LOGE(OTA_TAG, "ota_hsz - Truncated header");
+        ota_rs = OTA_PARAM_ERR;
+    } else {
+        ota_rs = flush_out_buf(hsz);
+    }
+    free(hsz->window);
+    hsz->window = NULL;
+    return ota_rs;
+
+}
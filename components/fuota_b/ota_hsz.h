@@ -0,0 +1,110 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It decompresses a HSZ1 stream,
+ *   received as arbitrary sized chunks, and passes the decompressed data
+ *   to an output function, by chunks of at most OTA_HSZ_OUT_BUF_SIZE bytes.
+ *
+ *   The only memory allocated, at the start of the stream, is the window,
+ *   whose size is given by the stream header. It is released by
+ *   ota_hsz_end().
+ *
+ * HSZ1 format:
+ *   - header: "HSZ1", window size exponent W (1 byte), lookahead size
+ *     exponent L (1 byte), 2 bytes set to 0
+ *   - a heatshrink bit stream (https://github.com/atomicobject/heatshrink),
+ *     compressed with the same W and L values. Bits are read starting from
+ *     the most significant bit of each byte. Each element is either a
+ *     literal (bit 1, followed by 8 bits) or a back-reference (bit 0,
+ *     followed by W bits of distance - 1 and L bits of length - 1)
+ *
+ * Usage:
+ *   ota_hsz_begin(), then ota_hsz_write() for every received chunk,
+ *   and finally ota_hsz_end(), which must be called even after an error.
+ */
+
+#ifndef OTA_HSZ_H_
+#define OTA_HSZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+
+#define OTA_HSZ_MAGIC "HSZ1"
+#define OTA_HSZ_MAGIC_LENGTH 4
+#define OTA_HSZ_HEADER_LENGTH 8
+
+// Limits on the window size exponent. 2^OTA_HSZ_WINDOW_MAX bytes are
+// allocated for the largest window.
+#define OTA_HSZ_WINDOW_MIN 4
+#define OTA_HSZ_WINDOW_MAX 14
+
+#define OTA_HSZ_OUT_BUF_SIZE 512
+
+// Function receiving decompressed data.
+typedef ota_status_t (*ota_hsz_output_t)(void *arg, const uint8_t *data,
+                                         size_t length);
+
+typedef struct {
+    ota_hsz_output_t output;
+    void *arg;
+    uint8_t state;
+    uint8_t header[OTA_HSZ_HEADER_LENGTH];
+    size_t header_length;
+    uint8_t window_bits;
+    uint8_t lookahead_bits;
+    uint8_t *window;
+    uint16_t window_mask;
+    uint16_t head;
+    // Bits received but not processed yet.
+    uint32_t bits;
+    uint8_t bit_count;
+    uint16_t distance;
+    uint8_t out_buf[OTA_HSZ_OUT_BUF_SIZE];
+    size_t out_length;
+} ota_hsz_t;
+
+void ota_hsz_begin(ota_hsz_t *hsz, ota_hsz_output_t output, void *arg);
+
+/**
+ * Processes a chunk of compressed data.
+ *
+ * Returned value:
+ * - OTA_OK: chunk processed
+ * - OTA_PARAM_ERR: invalid stream
+ * - OTA_SYS_ERR: not enough memory for the window
+ * - any status returned by the output function
+ */
+ota_status_t ota_hsz_write(ota_hsz_t *hsz, const uint8_t *data, size_t length);
+
+/**
+ * Passes remaining decompressed data to the output function and releases
+ * the window.
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_PARAM_ERR: stream shorter than its header
+ * - any status returned by the output function
+ */
+ota_status_t ota_hsz_end(ota_hsz_t *hsz);
+
+#endif /* OTA_HSZ_H_ */
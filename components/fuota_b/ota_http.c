@@ -0,0 +1,512 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "base64.h"
+#include "ota_http.h"
+#include "trace_ring.h"
+
+static const char BASIC[] = "Basic ";
+
+// Handshake statistics of all clients, accessed under stats_lock, created
+// by the first call to ota_http_init(). Connections themselves are opened
+// concurrently.
+static ota_tls_stats_t handshake_stats;
+static SemaphoreHandle_t stats_lock = NULL;
+
+// Body reading states.
+enum {
+    BODY_LENGTH,
+    BODY_CLOSE,
+    BODY_CHUNK_SIZE,
+    BODY_CHUNK_DATA,
+    BODY_CHUNK_END,
+    BODY_TRAILER,
+    BODY_DONE,
+};
+
+// Reads data received but not processed yet, or else, reads from the
+// connection.
+static int read_raw(ota_http_t *http, uint8_t *data, size_t length) {
+
+    if (http->buf_start < http->buf_end) {
+        size_t step = http->buf_end - http->buf_start;
+        if (step > length) {
+            step = length;
+        }
+        memcpy(data, http->buf + http->buf_start, step);
+        http->buf_start += step;
+        return step;
+    }
+    return http->transport->ops->read(http->transport, data, length);
+
+}
+
+// Reads a line into the line field, without its end of line. A line longer
+// than the field is truncated.
+// Returned value:
+// - OTA_OK
+// - OTA_CONN_ERR
+static ota_status_t read_line(ota_http_t *http) {
+
+    size_t length = 0;
+    int ret;
+    char c;
+
+    while (true) {
+        if (http->buf_start == http->buf_end) {
+            ret = http->transport->ops->read(http->transport, http->buf,
+                                             OTA_HTTP_BUF_SIZE);
+            if (ret <= 0) {
+                return OTA_CONN_ERR;
+            }
+            http->buf_start = 0;
+            http->buf_end = ret;
+        }
+        c = http->buf[http->buf_start++];
+        if (c == '\n') {
+            break;
+        }
+        if ((c != '\r') && (length < OTA_HTTP_LINE_MAX_LENGTH)) {
+            http->line[length++] = c;
+        }
+    }
+    http->line[length] = '\0';
+    return OTA_OK;
+
+}
+
+// Returned value:
+// - OTA_OK
+// - OTA_PARAM_ERR: request too long
+// - OTA_CONN_ERR
+static ota_status_t send_request(ota_http_t *http, const char *path,
+                                 const char *headers) {
+
+    bool auth = http->authorization[0] != '\0';
+    int length = snprintf((char *)http->buf, OTA_HTTP_BUF_SIZE,
+                          "GET %s HTTP/1.1\r\n"
+                          "Host: %s:%u\r\n"
+                          "User-Agent: esp32-fuota\r\n"
+                          "%s%s%s"
+                          "%s"
+                          "\r\n",
+                          path, http->transport->host, http->transport->port,
+                          auth ? "Authorization: " : "", http->authorization,
+                          auth ? "\r\n" : "",
+                          headers != NULL ? headers : "");
+    if (length >= OTA_HTTP_BUF_SIZE) {
+        ESP_LOGE(OTA_TAG, "ota_http - Request too long");
+        return OTA_PARAM_ERR;
+    }
+    return http->transport->ops->write(http->transport, http->buf, length);
+
+}
+
+// Returns true if the last transfer coding of a Transfer-Encoding value,
+// a comma-separated list, is chunked.
+static bool is_chunked(const char *value) {
+
+    const char *coding = strrchr(value, ',');
+
+    coding = coding != NULL ? coding + 1 : value;
+    while ((*coding == ' ') || (*coding == '\t')) {
+        coding++;
+    }
+    size_t length = strcspn(coding, " \t;");
+    return (length == strlen("chunked")) &&
+           (strncasecmp(coding, "chunked", length) == 0);
+
+}
+
+// Reads the status line of the final response, skipping interim (1xx)
+// responses and their headers.
+// Returned value:
+// - OTA_OK
+// - OTA_CONN_ERR
+static ota_status_t read_status_line(ota_http_t *http, int *major,
+                                     int *minor) {
+
+    ota_status_t ota_rs;
+
+    while (true) {
+        ota_rs = read_line(http);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        if (sscanf(http->line, "HTTP/%d.%d %d", major, minor,
+                   &http->status_code) != 3) {
+            ESP_LOGE(OTA_TAG, "ota_http - Invalid status line: %s",
+                     http->line);
+            return OTA_CONN_ERR;
+        }
+        if ((http->status_code < 100) || (http->status_code >= 200)) {
+            return OTA_OK;
+        }
+        if (http->status_code == 101) {
+            // No protocol switch is requested.
+            ESP_LOGE(OTA_TAG, "ota_http - Unexpected protocol switch");
+            return OTA_CONN_ERR;
+        }
+        ESP_LOGD(OTA_TAG, "ota_http - Interim response %d skipped",
+                 http->status_code);
+        do {
+            ota_rs = read_line(http);
+            if (ota_rs != OTA_OK) {
+                return ota_rs;
+            }
+        } while (http->line[0] != '\0');
+    }
+
+}
+
+// Reads the status line and the headers, and prepares the reading of the
+// body.
+// Returned value:
+// - OTA_OK
+// - OTA_CONN_ERR
+static ota_status_t read_headers(ota_http_t *http) {
+
+    ota_status_t ota_rs;
+    int major;
+    int minor;
+    char *value;
+    bool transfer_encoding = false;
+
+    ota_rs = read_status_line(http, &major, &minor);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    // Default behavior, possibly changed by a Connection header.
+    http->keep_alive = (major == 1) && (minor >= 1);
+    http->content_length = -1;
+    http->chunked = false;
+    while (true) {
+        ota_rs = read_line(http);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        if (http->line[0] == '\0') {
+            break;
+        }
+        value = strchr(http->line, ':');
+        if (value == NULL) {
+            continue;
+        }
+        *value++ = '\0';
+        while ((*value == ' ') || (*value == '\t')) {
+            value++;
+        }
+        if (strcasecmp(http->line, "Content-Length") == 0) {
+            http->content_length = atoi(value);
+        } else if (strcasecmp(http->line, "Transfer-Encoding") == 0) {
+            transfer_encoding = true;
+            http->chunked = is_chunked(value);
+        } else if (strcasecmp(http->line, "Connection") == 0) {
+            if (strcasecmp(value, "close") == 0) {
+                http->keep_alive = false;
+            } else if (strcasecmp(value, "keep-alive") == 0) {
+                http->keep_alive = true;
+            }
+        }
+        if (http->on_header != NULL) {
+            http->on_header(http->arg, http->line, value);
+        }
+    }
+    if ((http->status_code == 204) || (http->status_code == 304)) {
+        http->body_state = BODY_DONE;
+        http->complete = true;
+    } else if (http->chunked) {
+        http->body_state = BODY_CHUNK_SIZE;
+    } else if (!transfer_encoding && (http->content_length >= 0)) {
+        http->body_state = BODY_LENGTH;
+        http->remaining = http->content_length;
+        if (http->remaining == 0) {
+            http->body_state = BODY_DONE;
+            http->complete = true;
+        }
+    } else {
+        // The end of the body is signaled by the closing of the connection.
+        // This is also the case when the last transfer coding is not
+        // chunked: Content-Length is then ignored.
+        http->body_state = BODY_CLOSE;
+        http->keep_alive = false;
+    }
+    return OTA_OK;
+
+}
+
+// Reads a part of the body. Returns the number of bytes read, 0 at the end
+// of the body, or a negative value in case of error.
+static int read_body(ota_http_t *http, uint8_t *data, size_t length) {
+
+    int ret;
+    size_t step;
+
+    while (true) {
+        switch (http->body_state) {
+        case BODY_CHUNK_SIZE:
+            if (read_line(http) != OTA_OK) {
+                return -1;
+            }
+            // Chunk extensions, if any, are ignored.
+            http->remaining = strtoul(http->line, NULL, 16);
+            http->body_state = http->remaining > 0 ? BODY_CHUNK_DATA : BODY_TRAILER;
+            break;
+        case BODY_CHUNK_END:
+            // End of line following chunk data.
+            if (read_line(http) != OTA_OK) {
+                return -1;
+            }
+            http->body_state = BODY_CHUNK_SIZE;
+            break;
+        case BODY_TRAILER:
+            if (read_line(http) != OTA_OK) {
+                return -1;
+            }
+            if (http->line[0] == '\0') {
+                http->body_state = BODY_DONE;
+                http->complete = true;
+                return 0;
+            }
+            break;
+        case BODY_LENGTH:
+        case BODY_CHUNK_DATA:
+            step = length < http->remaining ? length : http->remaining;
+            ret = read_raw(http, data, step);
+            if (ret <= 0) {
+                // Connection closed before the end of the body, or error.
+                return ret;
+            }
+            http->remaining -= ret;
+            if (http->remaining == 0) {
+                if (http->body_state == BODY_LENGTH) {
+                    http->body_state = BODY_DONE;
+                    http->complete = true;
+                } else {
+                    http->body_state = BODY_CHUNK_END;
+                }
+            }
+            return ret;
+        case BODY_CLOSE:
+            ret = read_raw(http, data, length);
+            if (ret == 0) {
+                http->body_state = BODY_DONE;
+                http->complete = true;
+            }
+            return ret;
+        default:
+            return 0;
+        }
+    }
+
+}
+
+static void lock_stats(void) {
+
+    if (stats_lock != NULL) {
+        xSemaphoreTake(stats_lock, portMAX_DELAY);
+    }
+
+}
+
+static void unlock_stats(void) {
+
+    if (stats_lock != NULL) {
+        xSemaphoreGive(stats_lock);
+    }
+
+}
+
+// Opens a connection, and records its statistics.
+// Returned value:
+// - OTA_OK
+// - OTA_CONN_ERR
+static ota_status_t open_connection(ota_http_t *http) {
+
+    ota_transport_t *transport = http->transport;
+
+    ota_status_t ota_rs = transport->ops->connect(transport);
+    http->counters.dns_time += transport->dns_time;
+    http->counters.tcp_time += transport->tcp_time;
+    http->counters.handshake_time += transport->handshake_time;
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    http->counters.connections++;
+    TRACE(HTTP_CONNECT, transport->resumed, transport->handshake_time);
+    uint32_t handshake_time = transport->handshake_time / 1000;
+    lock_stats();
+    handshake_stats.last_resumed = transport->resumed;
+    handshake_stats.last_dns_time = transport->dns_time / 1000;
+    handshake_stats.last_tcp_time = transport->tcp_time / 1000;
+    handshake_stats.last_handshake_time = handshake_time;
+    if (transport->resumed) {
+        handshake_stats.resumed_handshakes++;
+        handshake_stats.resumed_handshake_time += handshake_time;
+    } else {
+        handshake_stats.full_handshakes++;
+        handshake_stats.full_handshake_time += handshake_time;
+    }
+    unlock_stats();
+    return OTA_OK;
+
+}
+
+ota_status_t ota_http_init(ota_http_t *http, ota_transport_t *transport,
+                           const char *username, const char *password,
+                           ota_http_header_cb_t on_header, void *arg) {
+
+    size_t length;
+
+    if (stats_lock == NULL) {
+        stats_lock = xSemaphoreCreateMutex();
+    }
+    memset(http, 0, sizeof(*http));
+    http->transport = transport;
+    http->on_header = on_header;
+    http->arg = arg;
+    http->complete = true;
+    if (username != NULL) {
+        // Basic authentication: base64 of <username>:<password>.
+        int credentials_length = snprintf(http->line, sizeof(http->line),
+                                          "%s:%s", username,
+                                          password != NULL ? password : "");
+        strcpy(http->authorization, BASIC);
+        if ((credentials_length >= (int)sizeof(http->line)) ||
+            (base64_encode(http->line, credentials_length,
+                           http->authorization + strlen(BASIC),
+                           sizeof(http->authorization) - strlen(BASIC),
+                           &length) != BASE64_OK)) {
+            ESP_LOGE(OTA_TAG, "ota_http - Credentials too long");
+            return OTA_PARAM_ERR;
+        }
+    }
+    return OTA_OK;
+
+}
+
+ota_status_t ota_http_open(ota_http_t *http, const char *path,
+                           const char *headers) {
+
+    ota_status_t ota_rs;
+    bool reused;
+    int64_t start;
+
+    // A connection whose previous response was not read completely can't
+    // be used anymore.
+    if (!http->complete) {
+        ota_http_close(http);
+    }
+    do {
+        reused = http->transport->connected;
+        if (!reused) {
+            ota_rs = open_connection(http);
+            if (ota_rs != OTA_OK) {
+                return ota_rs;
+            }
+        }
+        http->buf_start = 0;
+        http->buf_end = 0;
+        http->complete = false;
+        start = esp_timer_get_time();
+        http->counters.requests++;
+        ota_rs = send_request(http, path, headers);
+        if (ota_rs == OTA_OK) {
+            ota_rs = read_headers(http);
+        }
+        http->counters.header_time += esp_timer_get_time() - start;
+        if (ota_rs == OTA_OK) {
+            TRACE(HTTP_RESPONSE, http->status_code, reused);
+            if (reused) {
+                ESP_LOGD(OTA_TAG, "ota_http - Connection reused");
+            }
+            return OTA_OK;
+        }
+        ota_http_close(http);
+        if (ota_rs == OTA_PARAM_ERR) {
+            return ota_rs;
+        }
+        if (reused) {
+            http->counters.retries++;
+        }
+    } while (reused);
+    return OTA_CONN_ERR;
+
+}
+
+int ota_http_read(ota_http_t *http, uint8_t *data, size_t length) {
+
+    size_t total = 0;
+    int ret;
+
+    while ((total < length) && !http->complete) {
+        ret = read_body(http, data + total, length - total);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            break;
+        }
+        total += ret;
+    }
+    http->counters.body_bytes += total;
+    return total;
+
+}
+
+void ota_http_finish(ota_http_t *http) {
+
+    if (!http->keep_alive || !http->complete) {
+        ota_http_close(http);
+    }
+
+}
+
+void ota_http_close(ota_http_t *http) {
+
+    http->transport->ops->close(http->transport);
+    http->complete = true;
+
+}
+
+void ota_http_deinit(ota_http_t *http) {
+
+    http->transport->ops->destroy(http->transport);
+    http->transport = NULL;
+
+}
+
+void ota_http_get_tls_stats(ota_tls_stats_t *stats) {
+
+    lock_stats();
+    *stats = handshake_stats;
+    unlock_stats();
+
+}
@@ -0,0 +1,165 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It is a minimal HTTP/1.1
+ *   client, for GET requests over a connection provided by a transport
+ *   (see ota_transport.h).
+ *
+ *   The connection is kept open from one request to the next one, unless
+ *   the server closes it. If a request sent over a connection kept open
+ *   fails, it is sent again over a new connection.
+ *
+ *   The body of a response may be delimited by a Content-Length header, by
+ *   chunked transfer encoding, or by the closing of the connection.
+ *
+ *   The activity of the client is counted and timed in its counters field,
+ *   which the user of the module may reset at any time. TLS handshakes
+ *   are also counted since startup, for all clients.
+ *
+ *   Several clients may be used by different tasks, and open their
+ *   connections concurrently. The TLS session cache of the transport has
+ *   its own lock, and the handshake statistics are updated under a short
+ *   one.
+ *
+ * Usage:
+ *   ota_http_init(), then for every request, ota_http_open(), ota_http_read()
+ *   until the end of the body, and ota_http_finish(). Finally,
+ *   ota_http_deinit(), which releases the transport.
+ */
+
+#ifndef OTA_HTTP_H_
+#define OTA_HTTP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+#include "ota_transport.h"
+
+#define OTA_HTTP_BUF_SIZE 1024
+#define OTA_HTTP_LINE_MAX_LENGTH 511
+#define OTA_HTTP_AUTH_MAX_LENGTH 255
+
+// Function called for every response header.
+typedef void (*ota_http_header_cb_t)(void *arg, const char *key,
+                                     const char *value);
+
+// Activity of a client. Times are in microseconds.
+typedef struct {
+    uint32_t connections;
+    uint32_t requests;
+    // Requests sent again over a new connection.
+    uint32_t retries;
+    // Cumulated durations of the connection steps, including failed ones.
+    int64_t dns_time;
+    int64_t tcp_time;
+    int64_t handshake_time;
+    // Cumulated durations from the sending of a request to the end of its
+    // response headers.
+    int64_t header_time;
+    // Response body bytes.
+    uint32_t body_bytes;
+} ota_http_counters_t;
+
+typedef struct {
+    ota_transport_t *transport;
+    // Value of the Authorization header, empty if none.
+    char authorization[OTA_HTTP_AUTH_MAX_LENGTH + 1];
+    ota_http_header_cb_t on_header;
+    void *arg;
+    // Response.
+    int status_code;
+    // -1 if the response does not contain any Content-Length header.
+    int content_length;
+    bool chunked;
+    bool keep_alive;
+    // The whole body has been read.
+    bool complete;
+    // State of the body reading.
+    uint8_t body_state;
+    // Bytes of the body, or of the current chunk, not read yet.
+    uint32_t remaining;
+    // Bytes received and not processed yet: from buf_start to buf_end.
+    uint8_t buf[OTA_HTTP_BUF_SIZE];
+    size_t buf_start;
+    size_t buf_end;
+    char line[OTA_HTTP_LINE_MAX_LENGTH + 1];
+    ota_http_counters_t counters;
+} ota_http_t;
+
+/**
+ * Prepares requests over the given transport, which is owned by the client
+ * from now on, even after an error. username and password may be NULL if
+ * no authentication is required.
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_PARAM_ERR: credentials too long
+ */
+ota_status_t ota_http_init(ota_http_t *http, ota_transport_t *transport,
+                           const char *username, const char *password,
+                           ota_http_header_cb_t on_header, void *arg);
+
+/**
+ * Sends a GET request and receives the response headers. path contains the
+ * path and the query. headers contains additional request header lines,
+ * each one terminated by "\r\n", or is NULL.
+ *
+ * Returned value:
+ * - OTA_OK: status_code and content_length fields are set
+ * - OTA_PARAM_ERR: request too long
+ * - OTA_CONN_ERR
+ */
+ota_status_t ota_http_open(ota_http_t *http, const char *path,
+                           const char *headers);
+
+/**
+ * Reads the response body, until length bytes are read or the end of the
+ * body is reached. Returns the number of bytes read, 0 at the end of the
+ * body, or a negative value in case of error. At the end of the body, the
+ * complete field tells whether the whole body has been received.
+ */
+int ota_http_read(ota_http_t *http, uint8_t *data, size_t length);
+
+/**
+ * Ends a request. The connection is kept open for next request, unless the
+ * server is about to close it, or the response has not been read
+ * completely.
+ */
+void ota_http_finish(ota_http_t *http);
+
+/**
+ * Closes the connection, if open.
+ */
+void ota_http_close(ota_http_t *http);
+
+/**
+ * Closes the connection, if open, and releases the transport.
+ */
+void ota_http_deinit(ota_http_t *http);
+
+/**
+ * Returns the TLS handshake statistics, since startup.
+ */
+void ota_http_get_tls_stats(ota_tls_stats_t *stats);
+
+#endif /* OTA_HTTP_H_ */
@@ -0,0 +1,175 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "ota_manifest.h"
+
+// Buffer for block reads. Blocks are checked by one task at a time.
+#define READ_BUF_SIZE 1024
+static uint8_t read_buf[READ_BUF_SIZE];
+
+static uint32_t get_le32(const uint8_t *data) {
+
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+           ((uint32_t)data[3] << 24);
+
+}
+
+static ota_status_t process_header(ota_manifest_t *manifest) {
+
+    if (memcmp(manifest->header, OTA_MANIFEST_MAGIC,
+               OTA_MANIFEST_MAGIC_LENGTH) != 0) {
+        ESP_LOGE(OTA_TAG, "ota_manifest - Bad magic");
+        return OTA_PARAM_ERR;
+    }
+    uint8_t block_bits = manifest->header[OTA_MANIFEST_MAGIC_LENGTH];
+    if ((block_bits < OTA_MANIFEST_BLOCK_MIN) ||
+        (block_bits > OTA_MANIFEST_BLOCK_MAX)) {
+        ESP_LOGE(OTA_TAG, "ota_manifest - Unsupported block size: 2^%u",
+                 block_bits);
+        return OTA_PARAM_ERR;
+    }
+    manifest->block_size = 1 << block_bits;
+    manifest->image_size = get_le32(manifest->header + 8);
+    if ((manifest->image_size == 0) ||
+        (manifest->image_size > OTA_MANIFEST_IMAGE_MAX)) {
+        ESP_LOGE(OTA_TAG, "ota_manifest - Invalid image size: %u",
+                 manifest->image_size);
+        return OTA_PARAM_ERR;
+    }
+    manifest->block_count = (manifest->image_size + manifest->block_size - 1) /
+                            manifest->block_size;
+    manifest->hashes = malloc(manifest->block_count * OTA_MANIFEST_HASH_LENGTH);
+    if (manifest->hashes == NULL) {
+        ESP_LOGE(OTA_TAG, "ota_manifest - Can't allocate %u hashes",
+                 manifest->block_count);
+        return OTA_SYS_ERR;
+    }
+    ESP_LOGI(OTA_TAG, "ota_manifest - Image: %u bytes, %u blocks of %u bytes",
+             manifest->image_size, manifest->block_count, manifest->block_size);
+    return OTA_OK;
+
+}
+
+void ota_manifest_init(ota_manifest_t *manifest) {
+
+    memset(manifest, 0, sizeof(*manifest));
+
+}
+
+ota_status_t ota_manifest_write(ota_manifest_t *manifest, const uint8_t *data,
+                                size_t length) {
+
+    ota_status_t ota_rs;
+    size_t step;
+
+    if (manifest->header_length < OTA_MANIFEST_HEADER_LENGTH) {
+        step = OTA_MANIFEST_HEADER_LENGTH - manifest->header_length;
+        if (step > length) {
+            step = length;
+        }
+        memcpy(manifest->header + manifest->header_length, data, step);
+        manifest->header_length += step;
+        data += step;
+        length -= step;
+        if (manifest->header_length < OTA_MANIFEST_HEADER_LENGTH) {
+            return OTA_OK;
+        }
+        ota_rs = process_header(manifest);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+    }
+    if (length > manifest->block_count * OTA_MANIFEST_HASH_LENGTH -
+                 manifest->hashes_length) {
+        ESP_LOGE(OTA_TAG, "ota_manifest - Manifest too long");
+        return OTA_PARAM_ERR;
+    }
+    memcpy(manifest->hashes + manifest->hashes_length, data, length);
+    manifest->hashes_length += length;
+    return OTA_OK;
+
+}
+
+ota_status_t ota_manifest_end(ota_manifest_t *manifest) {
+
+    if ((manifest->hashes == NULL) ||
+        (manifest->hashes_length <
+         manifest->block_count * OTA_MANIFEST_HASH_LENGTH)) {
+        ESP_LOGE(OTA_TAG, "ota_manifest - Truncated manifest");
+        return OTA_PARAM_ERR;
+    }
+    manifest->loaded = true;
+    return OTA_OK;
+
+}
+
+ota_status_t ota_manifest_check_block(const ota_manifest_t *manifest,
+                                      ota_storage_t *storage,
+                                      uint32_t index) {
+
+    mbedtls_sha256_context sha;
+    uint8_t hash[OTA_MANIFEST_HASH_LENGTH];
+    uint32_t offset = index * manifest->block_size;
+    uint32_t end = offset + manifest->block_size;
+    size_t step;
+    ota_status_t ota_rs = OTA_OK;
+
+    if (end > manifest->image_size) {
+        end = manifest->image_size;
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    for (; offset < end; offset += step) {
+        step = end - offset;
+        if (step > READ_BUF_SIZE) {
+            step = READ_BUF_SIZE;
+        }
+        ota_rs = storage->ops->read(storage, OTA_STORAGE_UPDATE, offset,
+                                    read_buf, step);
+        if (ota_rs != OTA_OK) {
+            break;
+        }
+        mbedtls_sha256_update_ret(&sha, read_buf, step);
+    }
+    mbedtls_sha256_finish_ret(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (memcmp(hash, manifest->hashes + index * OTA_MANIFEST_HASH_LENGTH,
+               OTA_MANIFEST_HASH_LENGTH) != 0) {
+        return OTA_PARAM_ERR;
+    }
+    return OTA_OK;
+
+}
+
+void ota_manifest_free(ota_manifest_t *manifest) {
+
+    free(manifest->hashes);
+    manifest->hashes = NULL;
+    manifest->loaded = false;
+
+}
@@ -0,0 +1,112 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It receives a block manifest,
+ *   which gives the SHA-256 of every block of an application image, and
+ *   checks blocks written to a partition against it.
+ *
+ *   The hashes are stored in a buffer allocated when the manifest header
+ *   is received, and released by ota_manifest_free(): 32 bytes per block,
+ *   i.e. 8 KB for a 1 MB image with 4 KB blocks.
+ *
+ * FBM1 format:
+ *   - header: "FBM1", block size exponent B (1 byte, from 12 to 16), 3 bytes
+ *     set to 0, image size (4 bytes, little endian)
+ *   - SHA-256 of every block of 2^B bytes of the image, in order. The last
+ *     block may be shorter
+ *
+ * Usage:
+ *   ota_manifest_init(), then ota_manifest_write() for every received chunk
+ *   and ota_manifest_end(). Blocks can then be checked with
+ *   ota_manifest_check_block(). Finally, ota_manifest_free(), which must be
+ *   called even after an error.
+ */
+
+#ifndef OTA_MANIFEST_H_
+#define OTA_MANIFEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+#include "ota_storage.h"
+
+#define OTA_MANIFEST_MAGIC "FBM1"
+#define OTA_MANIFEST_MAGIC_LENGTH 4
+#define OTA_MANIFEST_HEADER_LENGTH 12
+#define OTA_MANIFEST_HASH_LENGTH 32
+
+// Limits on the block size exponent. A block is at least a flash sector.
+#define OTA_MANIFEST_BLOCK_MIN 12
+#define OTA_MANIFEST_BLOCK_MAX 16
+// Size of the largest flash chip.
+#define OTA_MANIFEST_IMAGE_MAX (16 * 1024 * 1024)
+
+typedef struct {
+    uint8_t header[OTA_MANIFEST_HEADER_LENGTH];
+    size_t header_length;
+    uint32_t block_size;
+    uint32_t image_size;
+    uint32_t block_count;
+    uint8_t *hashes;
+    // Number of hash bytes received.
+    size_t hashes_length;
+    // The whole manifest has been received.
+    bool loaded;
+} ota_manifest_t;
+
+void ota_manifest_init(ota_manifest_t *manifest);
+
+/**
+ * Processes a chunk of the manifest.
+ *
+ * Returned value:
+ * - OTA_OK: chunk processed
+ * - OTA_PARAM_ERR: invalid manifest
+ * - OTA_SYS_ERR: not enough memory for the hashes
+ */
+ota_status_t ota_manifest_write(ota_manifest_t *manifest, const uint8_t *data,
+                                size_t length);
+
+/**
+ * Returned value:
+ * - OTA_OK: the manifest can be used
+ * - OTA_PARAM_ERR: truncated manifest
+ */
+ota_status_t ota_manifest_end(ota_manifest_t *manifest);
+
+/**
+ * Reads the given block back from the update partition, and compares its hash
+ * with the one of the manifest.
+ *
+ * Returned value:
+ * - OTA_OK: the block is correct
+ * - OTA_PARAM_ERR: the block is not correct
+ * - OTA_SYS_ERR: read error
+ */
+ota_status_t ota_manifest_check_block(const ota_manifest_t *manifest,
+                                      ota_storage_t *storage,
+                                      uint32_t index);
+
+void ota_manifest_free(ota_manifest_t *manifest);
+
+#endif /* OTA_MANIFEST_H_ */
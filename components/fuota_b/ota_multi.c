@@ -0,0 +1,340 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+
+#include "ota_multi.h"
+
+typedef struct {
+    ota_storage_t base;
+    ota_storage_t *target;
+} locked_storage_t;
+
+static SemaphoreHandle_t storage_lock = NULL;
+static locked_storage_t locked_storage;
+
+static ota_status_t locked_open(ota_storage_t *storage) {
+
+    return locked_storage.target->ops->open(locked_storage.target);
+
+}
+
+static ota_status_t locked_read(ota_storage_t *storage,
+                                ota_storage_partition_t partition,
+                                uint32_t offset, void *data, size_t length) {
+
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    ota_status_t ota_rs = locked_storage.target->ops->read(
+        locked_storage.target, partition, offset, data, length);
+    xSemaphoreGive(storage_lock);
+    return ota_rs;
+
+}
+
+static ota_status_t locked_get_running_sha256(ota_storage_t *storage,
+                                              uint8_t *sha) {
+
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    ota_status_t ota_rs = locked_storage.target->ops->get_running_sha256(
+        locked_storage.target, sha);
+    xSemaphoreGive(storage_lock);
+    return ota_rs;
+
+}
+
+static ota_status_t locked_begin(ota_storage_t *storage) {
+
+    return locked_storage.target->ops->begin(locked_storage.target);
+
+}
+
+static ota_status_t locked_erase(ota_storage_t *storage, uint32_t offset,
+                                 size_t length) {
+
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    ota_status_t ota_rs = locked_storage.target->ops->erase(
+        locked_storage.target, offset, length);
+    xSemaphoreGive(storage_lock);
+    return ota_rs;
+
+}
+
+static ota_status_t locked_write(ota_storage_t *storage, uint32_t offset,
+                                 const void *data, size_t length) {
+
+    xSemaphoreTake(storage_lock, portMAX_DELAY);
+    ota_status_t ota_rs = locked_storage.target->ops->write(
+        locked_storage.target, offset, data, length);
+    xSemaphoreGive(storage_lock);
+    return ota_rs;
+
+}
+
+static ota_status_t locked_end(ota_storage_t *storage) {
+
+    return locked_storage.target->ops->end(locked_storage.target);
+
+}
+
+static void locked_abort(ota_storage_t *storage) {
+
+    locked_storage.target->ops->abort(locked_storage.target);
+
+}
+
+static const ota_storage_ops_t locked_ops = {
+    .open = locked_open,
+    .read = locked_read,
+    .get_running_sha256 = locked_get_running_sha256,
+    .begin = locked_begin,
+    .erase = locked_erase,
+    .write = locked_write,
+    .end = locked_end,
+    .abort = locked_abort,
+};
+
+// Called by the HTTP client of a stream for every response header.
+static void on_header(void *arg, const char *key, const char *value) {
+
+    ota_multi_stream_t *stream = arg;
+
+    if (strcasecmp(key, "Content-Range") == 0) {
+        strncpy(stream->content_range, value,
+                sizeof(stream->content_range) - 1);
+    }
+
+}
+
+// Erases the sectors of the part up to the end of the sector containing
+// the byte preceding end, if not done yet.
+static ota_status_t erase_until(ota_multi_stream_t *stream, uint32_t end) {
+
+    if (end <= stream->erased_end) {
+        return OTA_OK;
+    }
+    uint32_t erase_end = (end + OTA_STORAGE_SECTOR_SIZE - 1) &
+                         ~(OTA_STORAGE_SECTOR_SIZE - 1);
+    ota_status_t ota_rs = stream->storage->ops->erase(stream->storage,
+                                                      stream->erased_end,
+                                                      erase_end -
+                                                      stream->erased_end);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    stream->erased_end = erase_end;
+    return OTA_OK;
+
+}
+
+static ota_status_t run_stream(ota_multi_stream_t *stream) {
+
+    ota_status_t ota_rs;
+    unsigned int range_start;
+    unsigned int range_last;
+    unsigned int file_size;
+    int read_length;
+    size_t step;
+
+    ota_rs = ota_http_open(&stream->http, stream->path, stream->headers);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if ((stream->http.status_code != 206) ||
+        (sscanf(stream->content_range, "bytes %u-%u/%u", &range_start,
+                &range_last, &file_size) != 3) ||
+        (range_start != stream->start) || (range_last != stream->end - 1) ||
+        (file_size != stream->file_size)) {
+        ESP_LOGW(OTA_TAG, "ota_multi - Unexpected response to range request: "
+                 "%d", stream->http.status_code);
+        return OTA_PARAM_ERR;
+    }
+    while (stream->offset < stream->end) {
+        if (atomic_load(stream->cancelled) || atomic_load(stream->stopped)) {
+            return OTA_CANCELLED;
+        }
+        step = stream->end - stream->offset;
+        if (step > sizeof(stream->buf)) {
+            step = sizeof(stream->buf);
+        }
+        read_length = ota_http_read(&stream->http, stream->buf, step);
+        if (read_length <= 0) {
+            ESP_LOGW(OTA_TAG, "ota_multi - Part interrupted at 0x%x",
+                     stream->offset);
+            return OTA_CONN_ERR;
+        }
+        ota_rs = erase_until(stream, stream->offset + read_length);
+        if (ota_rs == OTA_OK) {
+            ota_rs = stream->storage->ops->write(stream->storage,
+                                                 stream->offset, stream->buf,
+                                                 read_length);
+        }
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        stream->offset += read_length;
+        atomic_fetch_add(stream->received, read_length);
+    }
+    return OTA_OK;
+
+}
+
+static void stream_task(void *arg) {
+
+    ota_multi_stream_t *stream = arg;
+
+    stream->result = run_stream(stream);
+    xSemaphoreGive(stream->done);
+    vTaskDelete(NULL);
+
+}
+
+ota_status_t ota_multi_begin(ota_storage_t *storage, ota_storage_t **locked) {
+
+    if (storage_lock == NULL) {
+        storage_lock = xSemaphoreCreateMutex();
+        if (storage_lock == NULL) {
+            ESP_LOGE(OTA_TAG, "ota_multi - Error from xSemaphoreCreateMutex");
+            return OTA_SYS_ERR;
+        }
+    }
+    locked_storage.base = *storage;
+    locked_storage.base.ops = &locked_ops;
+    locked_storage.target = storage;
+    *locked = &locked_storage.base;
+    return OTA_OK;
+
+}
+
+void ota_multi_end(void) {
+
+    locked_storage.target = NULL;
+
+}
+
+int ota_multi_get_available(int count) {
+
+    uint32_t free_heap = esp_get_free_heap_size();
+    int available = 0;
+
+    while ((available < count) &&
+           (free_heap >= (uint32_t)(available + 2) *
+                         CONFIG_FUOTA_B_STREAM_HEAP * 1024)) {
+        available++;
+    }
+    return available;
+
+}
+
+ota_status_t ota_multi_start(const ota_multi_request_t *request,
+                             uint32_t start, uint32_t end,
+                             ota_multi_stream_t **stream_out) {
+
+    ota_status_t ota_rs;
+    ota_transport_t *transport;
+    ota_multi_stream_t *stream;
+
+    if (strlen(request->path) > OTA_MULTI_PATH_MAX_LENGTH) {
+        return OTA_PARAM_ERR;
+    }
+    stream = calloc(1, sizeof(*stream));
+    if (stream == NULL) {
+        ESP_LOGE(OTA_TAG, "ota_multi - Can't allocate stream");
+        return OTA_SYS_ERR;
+    }
+    stream->storage = &locked_storage.base;
+    strcpy(stream->path, request->path);
+    int length = snprintf(stream->headers, sizeof(stream->headers),
+                          "Range: bytes=%u-%u\r\n", start, end - 1);
+    if (request->validator[0] != '\0') {
+        snprintf(stream->headers + length, sizeof(stream->headers) - length,
+                 "If-Range: %s\r\n", request->validator);
+    }
+    stream->file_size = request->file_size;
+    stream->cancelled = request->cancelled;
+    stream->stopped = request->stopped;
+    stream->received = request->received;
+    stream->start = start;
+    stream->end = end;
+    stream->offset = start;
+    stream->erased_end = start;
+    stream->done = xSemaphoreCreateBinary();
+    if (stream->done == NULL) {
+        free(stream);
+        return OTA_SYS_ERR;
+    }
+    ota_rs = request->create_transport(request->host, request->port,
+                                       request->cert_pem,
+                                       request->timeout_ms, &transport);
+    if (ota_rs != OTA_OK) {
+        vSemaphoreDelete(stream->done);
+        free(stream);
+        return OTA_SYS_ERR;
+    }
+    ota_rs = ota_http_init(&stream->http, transport, request->username,
+                           request->password, on_header, stream);
+    if ((ota_rs != OTA_OK) ||
+        (xTaskCreatePinnedToCore(stream_task, "fuota_b_stream",
+                                 OTA_MULTI_STACK_SIZE, stream,
+                                 uxTaskPriorityGet(NULL), NULL,
+                                 tskNO_AFFINITY) != pdPASS)) {
+        ESP_LOGE(OTA_TAG, "ota_multi - Can't start stream");
+        ota_http_deinit(&stream->http);
+        vSemaphoreDelete(stream->done);
+        free(stream);
+        return OTA_SYS_ERR;
+    }
+    *stream_out = stream;
+    return OTA_OK;
+
+}
+
+ota_status_t ota_multi_wait(ota_multi_stream_t *stream,
+                            ota_http_counters_t *counters, uint32_t *offset) {
+
+    ota_status_t ota_rs;
+
+    xSemaphoreTake(stream->done, portMAX_DELAY);
+    ota_rs = stream->result;
+    *offset = stream->offset;
+    counters->connections += stream->http.counters.connections;
+    counters->requests += stream->http.counters.requests;
+    counters->retries += stream->http.counters.retries;
+    counters->dns_time += stream->http.counters.dns_time;
+    counters->tcp_time += stream->http.counters.tcp_time;
+    counters->handshake_time += stream->http.counters.handshake_time;
+    counters->header_time += stream->http.counters.header_time;
+    counters->body_bytes += stream->http.counters.body_bytes;
+    ota_http_deinit(&stream->http);
+    vSemaphoreDelete(stream->done);
+    free(stream);
+    return ota_rs;
+
+}
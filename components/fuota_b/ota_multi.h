@@ -0,0 +1,155 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It downloads parts of an
+ *   uncompressed application image in parallel with the main download,
+ *   each one over its own connection, with a range request. Every part is
+ *   written directly to its offset in the update partition.
+ *
+ *   A stream has its own transport, HTTP client, buffer and task. It is
+ *   allocated from the heap, and only when the free heap is larger than
+ *   twice CONFIG_FUOTA_B_STREAM_HEAP kB: a TLS connection needs tens of
+ *   kB, and the application must keep some.
+ *
+ *   Streams open their connections concurrently: their handshakes overlap,
+ *   and only the accesses to the TLS session cache are serialized. The
+ *   operations of the storage sink are serialized: ota_multi_begin()
+ *   returns a storage sink wrapping the given one.
+ *
+ *   The request of a stream gives the validator of the update file, so
+ *   that the server returns the part only if the file did not change. A
+ *   stream which fails, for instance after a connection loss, tells how
+ *   far it went, so that the rest of its part can be fetched again, from
+ *   the start of the sector reached.
+ *
+ * Usage:
+ *   ota_multi_begin(), then ota_multi_start() for every part, and
+ *   ota_multi_wait() for every started stream. Finally, ota_multi_end().
+ */
+
+#ifndef OTA_MULTI_H_
+#define OTA_MULTI_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "fuota_b.h"
+#include "ota_http.h"
+#include "ota_storage.h"
+
+#define OTA_MULTI_MAX_STREAMS 4
+#define OTA_MULTI_BUF_SIZE 4096
+#define OTA_MULTI_STACK_SIZE 6144
+#define OTA_MULTI_PATH_MAX_LENGTH 255
+#define OTA_MULTI_HEADERS_MAX_LENGTH 127
+
+// Server and request of the update file, shared by all streams.
+typedef struct {
+    ota_transport_create_t create_transport;
+    const char *host;
+    uint16_t port;
+    const char *cert_pem;
+    const char *username;
+    const char *password;
+    uint32_t timeout_ms;
+    const char *path;
+    const char *validator;
+    uint32_t file_size;
+    // Checked before every read: when set, streams stop. cancelled is set
+    // by the client application, stopped when the download has failed
+    // anyway. Bytes received by streams are added to received.
+    atomic_bool *cancelled;
+    atomic_bool *stopped;
+    atomic_uint *received;
+} ota_multi_request_t;
+
+typedef struct {
+    ota_http_t http;
+    ota_storage_t *storage;
+    char path[OTA_MULTI_PATH_MAX_LENGTH + 1];
+    char headers[OTA_MULTI_HEADERS_MAX_LENGTH + 1];
+    char content_range[OTA_MULTI_HEADERS_MAX_LENGTH + 1];
+    uint32_t file_size;
+    atomic_bool *cancelled;
+    atomic_bool *stopped;
+    atomic_uint *received;
+    // Part of the file, from start to end - 1. Bytes up to offset are
+    // written, and the partition is erased up to erased_end.
+    uint32_t start;
+    uint32_t end;
+    uint32_t offset;
+    uint32_t erased_end;
+    // Valid once done is given.
+    ota_status_t result;
+    SemaphoreHandle_t done;
+    uint8_t buf[OTA_MULTI_BUF_SIZE];
+} ota_multi_stream_t;
+
+/**
+ * Prepares parallel downloads to the update partition of storage.
+ *
+ * Returned value:
+ * - OTA_OK: *locked is the storage sink to be used until ota_multi_end()
+ * - OTA_SYS_ERR
+ */
+ota_status_t ota_multi_begin(ota_storage_t *storage, ota_storage_t **locked);
+
+void ota_multi_end(void);
+
+/**
+ * Returns the number of streams, up to count, which can be started given
+ * the free heap.
+ */
+int ota_multi_get_available(int count);
+
+/**
+ * Starts a stream, which downloads the part of the update file from start
+ * to end - 1.
+ *
+ * Returned value:
+ * - OTA_OK: *stream must be given to ota_multi_wait()
+ * - OTA_PARAM_ERR: path too long
+ * - OTA_SYS_ERR: not enough memory
+ */
+ota_status_t ota_multi_start(const ota_multi_request_t *request,
+                             uint32_t start, uint32_t end,
+                             ota_multi_stream_t **stream);
+
+/**
+ * Waits for the end of a stream, adds its activity to counters, and
+ * releases it. *offset is the end of the bytes written.
+ *
+ * Returned value:
+ * - OTA_OK: the whole part was written
+ * - OTA_PARAM_ERR: the server did not return the expected part
+ * - OTA_CONN_ERR
+ * - OTA_SYS_ERR
+ * - OTA_CANCELLED
+ */
+ota_status_t ota_multi_wait(ota_multi_stream_t *stream,
+                            ota_http_counters_t *counters, uint32_t *offset);
+
+#endif /* OTA_MULTI_H_ */
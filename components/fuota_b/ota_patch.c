@@ -0,0 +1,325 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "ota_patch.h"
+
+// Parser states.
+enum {
+    ST_HEADER,
+    ST_OPCODE,
+    ST_ARGS,
+    ST_ADD,
+    ST_INSERT,
+    ST_DONE,
+};
+
+// Opcodes.
+static const uint8_t OP_COPY = 'C';
+static const uint8_t OP_ADD = 'A';
+static const uint8_t OP_INSERT = 'I';
+static const uint8_t OP_END = 'E';
+
+#define SHA256_LENGTH 32
+
+static uint32_t get_u32_le(const uint8_t *p) {
+
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+
+}
+
+// Passes the content of the output buffer to the output function.
+static ota_status_t flush_out_buf(ota_patch_t *patch) {
+
+    if (patch->out_length == 0) {
+        return OTA_OK;
+    }
+    ota_status_t ota_rs = patch->output(patch->arg, patch->out_buf,
+                                        patch->out_length);
+    patch->out_length = 0;
+    return ota_rs;
+
+}
+
+// Returns the number of bytes that can be produced in one step, for the
+// current operation, flushing the output buffer if it is full.
+static ota_status_t get_room(ota_patch_t *patch, size_t *room) {
+
+    if (patch->out_length == OTA_PATCH_BUF_SIZE) {
+        ota_status_t ota_rs = flush_out_buf(patch);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+    }
+    *room = OTA_PATCH_BUF_SIZE - patch->out_length;
+    if (*room > patch->remaining) {
+        *room = patch->remaining;
+    }
+    return OTA_OK;
+
+}
+
+// Reads length bytes of the source image into the output buffer.
+static ota_status_t read_source(ota_patch_t *patch, size_t length) {
+
+    return patch->storage->ops->read(patch->storage, OTA_STORAGE_RUNNING,
+                                     patch->source_offset,
+                                     patch->out_buf + patch->out_length,
+                                     length);
+
+}
+
+static ota_status_t process_header(ota_patch_t *patch) {
+
+    uint8_t source_sha[SHA256_LENGTH];
+
+    if (memcmp(patch->field, OTA_PATCH_MAGIC, OTA_PATCH_MAGIC_LENGTH) != 0) {
+        ESP_LOGE(OTA_TAG, "ota_patch - Bad magic");
+        return OTA_PARAM_ERR;
+    }
+    patch->source_size = get_u32_le(patch->field + OTA_PATCH_MAGIC_LENGTH);
+    patch->target_size = get_u32_le(patch->field + OTA_PATCH_MAGIC_LENGTH + 4);
+    if ((patch->source_size > patch->storage->running_size) ||
+        (patch->target_size > patch->storage->update_size)) {
+        ESP_LOGE(OTA_TAG, "ota_patch - Bad sizes: %u, %u",
+                 patch->source_size, patch->target_size);
+        return OTA_PARAM_ERR;
+    }
+    // The patch must have been built against the running image.
+    ota_status_t ota_rs = patch->storage->ops->get_running_sha256(patch->storage,
+                                                                  source_sha);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (memcmp(source_sha, patch->field + OTA_PATCH_MAGIC_LENGTH + 8,
+               SHA256_LENGTH) != 0) {
+        ESP_LOGE(OTA_TAG, "ota_patch - Patch does not apply to running image");
+        return OTA_PARAM_ERR;
+    }
+    ESP_LOGI(OTA_TAG, "ota_patch - Source size: %u, target size: %u",
+             patch->source_size, patch->target_size);
+    return OTA_OK;
+
+}
+
+// Checks the operation arguments against source and target sizes.
+static ota_status_t check_op(ota_patch_t *patch) {
+
+    if (patch->remaining > patch->target_size - patch->produced) {
+        ESP_LOGE(OTA_TAG, "ota_patch - Target overflow");
+        return OTA_PARAM_ERR;
+    }
+    if ((patch->opcode != OP_INSERT) &&
+        ((patch->source_offset > patch->source_size) ||
+         (patch->remaining > patch->source_size - patch->source_offset))) {
+        ESP_LOGE(OTA_TAG, "ota_patch - Source overflow");
+        return OTA_PARAM_ERR;
+    }
+    return OTA_OK;
+
+}
+
+// Executes a copy operation. It does not need any patch data.
+static ota_status_t do_copy(ota_patch_t *patch) {
+
+    ota_status_t ota_rs;
+    size_t length;
+
+    while (patch->remaining > 0) {
+        ota_rs = get_room(patch, &length);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        ota_rs = read_source(patch, length);
+        if (ota_rs != OTA_OK) {
+            return ota_rs;
+        }
+        patch->out_length += length;
+        patch->source_offset += length;
+        patch->remaining -= length;
+        patch->produced += length;
+    }
+    return OTA_OK;
+
+}
+
+// Called once the opcode and its arguments have been received.
+static ota_status_t start_op(ota_patch_t *patch) {
+
+    ota_status_t ota_rs;
+
+    if (patch->opcode == OP_END) {
+        if (patch->produced != patch->target_size) {
+            ESP_LOGE(OTA_TAG, "ota_patch - Target size mismatch: %u",
+                     patch->produced);
+            return OTA_PARAM_ERR;
+        }
+        patch->state = ST_DONE;
+        return OTA_OK;
+    }
+    if (patch->opcode == OP_INSERT) {
+        patch->remaining = get_u32_le(patch->field);
+    } else {
+        patch->source_offset = get_u32_le(patch->field);
+        patch->remaining = get_u32_le(patch->field + 4);
+    }
+    ota_rs = check_op(patch);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    if (patch->opcode == OP_COPY) {
+        ota_rs = do_copy(patch);
+        patch->state = ST_OPCODE;
+        return ota_rs;
+    }
+    patch->state = (patch->opcode == OP_ADD) ? ST_ADD : ST_INSERT;
+    if (patch->remaining == 0) {
+        patch->state = ST_OPCODE;
+    }
+    return OTA_OK;
+
+}
+
+void ota_patch_begin(ota_patch_t *patch, ota_storage_t *storage,
+                     ota_patch_output_t output, void *arg) {
+
+    memset(patch, 0, sizeof(*patch));
+    patch->storage = storage;
+    patch->output = output;
+    patch->arg = arg;
+    patch->state = ST_HEADER;
+    patch->field_expected = OTA_PATCH_HEADER_LENGTH;
+
+}
+
+ota_status_t ota_patch_write(ota_patch_t *patch, const uint8_t *data,
+                             size_t length) {
+
+    ota_status_t ota_rs;
+    size_t step;
+
+    while (length > 0) {
+
+        switch (patch->state) {
+
+        case ST_HEADER:
+        case ST_ARGS:
+            step = patch->field_expected - patch->field_length;
+            if (step > length) {
+                step = length;
+            }
+            memcpy(patch->field + patch->field_length, data, step);
+            patch->field_length += step;
+            data += step;
+            length -= step;
+            if (patch->field_length < patch->field_expected) {
+                break;
+            }
+            ota_rs = (patch->state == ST_HEADER) ? process_header(patch) :
+                                                   start_op(patch);
+            if (ota_rs != OTA_OK) {
+                return ota_rs;
+            }
+            if (patch->state == ST_HEADER) {
+                patch->state = ST_OPCODE;
+            }
+            break;
+
+        case ST_OPCODE:
+            patch->opcode = *data;
+            data++;
+            length--;
+            patch->field_length = 0;
+            if ((patch->opcode == OP_COPY) || (patch->opcode == OP_ADD)) {
+                patch->field_expected = 8;
+            } else if (patch->opcode == OP_INSERT) {
+                patch->field_expected = 4;
+            } else if (patch->opcode == OP_END) {
+                ota_rs = start_op(patch);
+                if (ota_rs != OTA_OK) {
+                    return ota_rs;
+                }
+                break;
+            } else {
+                ESP_LOGE(OTA_TAG, "ota_patch - Unknown opcode: 0x%02x",
+                         patch->opcode);
+                return OTA_PARAM_ERR;
+            }
+            patch->state = ST_ARGS;
+            break;
+
+        case ST_ADD:
+        case ST_INSERT:
+            ota_rs = get_room(patch, &step);
+            if (ota_rs != OTA_OK) {
+                return ota_rs;
+            }
+            if (step > length) {
+                step = length;
+            }
+            uint8_t *out = patch->out_buf + patch->out_length;
+            if (patch->state == ST_ADD) {
+                ota_rs = read_source(patch, step);
+                if (ota_rs != OTA_OK) {
+                    return ota_rs;
+                }
+                for (size_t i = 0; i < step; i++) {
+                    out[i] += data[i];
+                }
+                patch->source_offset += step;
+            } else {
+                memcpy(out, data, step);
+            }
+            patch->out_length += step;
+            patch->remaining -= step;
+            patch->produced += step;
+            data += step;
+            length -= step;
+            if (patch->remaining == 0) {
+                patch->state = ST_OPCODE;
+            }
+            break;
+
+        case ST_DONE:
+            ESP_LOGE(OTA_TAG, "ota_patch - Data after end of patch");
+            return OTA_PARAM_ERR;
+
+        default:
+            ESP_LOGE(OTA_TAG, "ota_patch - Unexpected state: %d", patch->state);
+            return OTA_SYS_ERR;
+        }
+
+    }
+    return OTA_OK;
+
+}
+
+ota_status_t ota_patch_end(ota_patch_t *patch) {
+
+    if (patch->state != ST_DONE) {
+        ESP_LOGE(OTA_TAG, "ota_patch - Incomplete patch");
+        return OTA_PARAM_ERR;
+    }
+    return flush_out_buf(patch);
+
+}
@@ -0,0 +1,130 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It applies a binary patch,
+ *   received as a stream of arbitrary sized chunks, to the image stored
+ *   in the running partition, and passes the resulting image to an output
+ *   function.
+ *
+ *   Memory use does not depend on the image size: the source image is read
+ *   from flash memory when needed, and the resulting image is passed to the
+ *   output function by blocks of OTA_PATCH_BUF_SIZE bytes.
+ *
+ * Patch format (FDP1), all integers being little-endian 32-bit values:
+ *   - header: "FDP1", source image size, target image size, SHA-256 of the
+ *     source image (32 bytes, as returned by esp_partition_get_sha256() for
+ *     the running partition)
+ *   - a sequence of operations, each one starting with an opcode byte:
+ *     - 'C' (copy): source offset, length. Copies <length> bytes of the
+ *       source image
+ *     - 'A' (add): source offset, length, followed by <length> bytes. Each
+ *       byte is added (modulo 256) to the corresponding source image byte
+ *     - 'I' (insert): length, followed by <length> bytes written as is
+ *     - 'E' (end): end of the patch
+ *
+ * Usage:
+ *   ota_patch_begin(), then ota_patch_write() for every received chunk,
+ *   and finally ota_patch_end(). Any other status than OTA_OK means that
+ *   the update must be aborted.
+ */
+
+#ifndef OTA_PATCH_H_
+#define OTA_PATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fuota_b.h"
+#include "ota_storage.h"
+
+// Patch magic, at the start of the patch header.
+#define OTA_PATCH_MAGIC "FDP1"
+#define OTA_PATCH_MAGIC_LENGTH 4
+
+// Header length: magic, source size, target size, source SHA-256.
+#define OTA_PATCH_HEADER_LENGTH (OTA_PATCH_MAGIC_LENGTH + 4 + 4 + 32)
+
+// Size of the buffer used to build the target image before writing it.
+#define OTA_PATCH_BUF_SIZE 1024
+
+// Function receiving the target image.
+typedef ota_status_t (*ota_patch_output_t)(void *arg, const uint8_t *data,
+                                           size_t length);
+
+typedef struct {
+    ota_storage_t *storage;
+    ota_patch_output_t output;
+    void *arg;
+    uint8_t state;
+    uint8_t opcode;
+    // Header or operation arguments being received.
+    uint8_t field[OTA_PATCH_HEADER_LENGTH];
+    size_t field_length;
+    size_t field_expected;
+    uint32_t source_size;
+    // Known once the header is processed, 0 before.
+    uint32_t target_size;
+    // Current operation.
+    uint32_t source_offset;
+    uint32_t remaining;
+    // Number of bytes of the target image produced so far.
+    uint32_t produced;
+    uint8_t out_buf[OTA_PATCH_BUF_SIZE];
+    size_t out_length;
+} ota_patch_t;
+
+/**
+ * Prepares the application of a patch.
+ *
+ * Parameters:
+ * - patch: patch context, owned by the caller
+ * - storage: storage sink, whose running partition contains the source
+ *   image, and whose update partition size is used to check the target
+ *   image size
+ * - output: function receiving the target image
+ * - arg: passed to output
+ */
+void ota_patch_begin(ota_patch_t *patch, ota_storage_t *storage,
+                     ota_patch_output_t output, void *arg);
+
+/**
+ * Processes a chunk of the patch.
+ *
+ * Returned value:
+ * - OTA_OK: chunk processed
+ * - OTA_PARAM_ERR: invalid patch, or patch not applicable to the source image
+ * - OTA_SYS_ERR: flash memory access error
+ * - any status returned by the output function
+ */
+ota_status_t ota_patch_write(ota_patch_t *patch, const uint8_t *data,
+                             size_t length);
+
+/**
+ * Ends the application of the patch, writing the remaining target bytes.
+ *
+ * Returned value:
+ * - OTA_OK: the whole target image has been written
+ * - OTA_PARAM_ERR: incomplete patch
+ * - any status returned by the output function
+ */
+ota_status_t ota_patch_end(ota_patch_t *patch);
+
+#endif /* OTA_PATCH_H_ */
@@ -0,0 +1,110 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include "ota_pipe.h"
+
+bool ota_pipe_init(ota_pipe_t *pipe, size_t buffer_size) {
+
+    if (pipe->released == NULL) {
+        pipe->released = xSemaphoreCreateBinary();
+        if (pipe->released == NULL) {
+            return false;
+        }
+    }
+    if (pipe->committed == NULL) {
+        pipe->committed = xSemaphoreCreateBinary();
+        if (pipe->committed == NULL) {
+            return false;
+        }
+    }
+    if (buffer_size < OTA_PIPE_MIN_BUFFER_SIZE) {
+        buffer_size = OTA_PIPE_MIN_BUFFER_SIZE;
+    }
+    if (buffer_size > OTA_PIPE_BUFFER_SIZE) {
+        buffer_size = OTA_PIPE_BUFFER_SIZE;
+    }
+    pipe->buffer_size = buffer_size;
+    pipe->depth = OTA_PIPE_POOL_SIZE / buffer_size;
+    atomic_init(&pipe->head, 0);
+    atomic_init(&pipe->tail, 0);
+    pipe->producer_stalls = 0;
+    pipe->consumer_stalls = 0;
+    // Clears the signals left by a previous use of the ring.
+    xSemaphoreTake(pipe->released, 0);
+    xSemaphoreTake(pipe->committed, 0);
+    return true;
+
+}
+
+uint8_t *ota_pipe_acquire(ota_pipe_t *pipe) {
+
+    unsigned int head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&pipe->tail, memory_order_acquire) ==
+        pipe->depth) {
+        pipe->producer_stalls++;
+        do {
+            xSemaphoreTake(pipe->released, portMAX_DELAY);
+        } while (head - atomic_load_explicit(&pipe->tail, memory_order_acquire) ==
+                 pipe->depth);
+    }
+    return pipe->pool + (head % pipe->depth) * pipe->buffer_size;
+
+}
+
+void ota_pipe_commit(ota_pipe_t *pipe, size_t length) {
+
+    unsigned int head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+    pipe->lengths[head % pipe->depth] = length;
+    atomic_store_explicit(&pipe->head, head + 1, memory_order_release);
+    xSemaphoreGive(pipe->committed);
+
+}
+
+const uint8_t *ota_pipe_try_peek(ota_pipe_t *pipe, size_t *length) {
+
+    unsigned int tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&pipe->head, memory_order_acquire) == tail) {
+        return NULL;
+    }
+    *length = pipe->lengths[tail % pipe->depth];
+    return pipe->pool + (tail % pipe->depth) * pipe->buffer_size;
+
+}
+
+const uint8_t *ota_pipe_peek(ota_pipe_t *pipe, size_t *length) {
+
+    unsigned int tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&pipe->head, memory_order_acquire) == tail) {
+        pipe->consumer_stalls++;
+        do {
+            xSemaphoreTake(pipe->committed, portMAX_DELAY);
+        } while (atomic_load_explicit(&pipe->head, memory_order_acquire) == tail);
+    }
+    *length = pipe->lengths[tail % pipe->depth];
+    return pipe->pool + (tail % pipe->depth) * pipe->buffer_size;
+
+}
+
+void ota_pipe_release(ota_pipe_t *pipe) {
+
+    unsigned int tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+    atomic_store_explicit(&pipe->tail, tail + 1, memory_order_release);
+    xSemaphoreGive(pipe->released);
+
+}
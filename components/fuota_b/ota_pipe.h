@@ -0,0 +1,122 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It is a bounded ring of
+ *   buffers, shared by one producer task and one consumer task, without
+ *   lock: each index is written by a single task.
+ *
+ *   The producer gets a free buffer, fills it and commits it. The consumer
+ *   gets the oldest committed buffer, processes it and releases it. A task
+ *   waiting for the other one (producer on a full ring, consumer on an
+ *   empty ring) blocks on a semaphore of the ring, given by the other one
+ *   after every commit or release, and the wait is counted as a stall. The
+ *   task notifications of the tasks are not used: the producer may be a
+ *   task of the client application.
+ *
+ *   A committed buffer with a length of 0 marks the end of the stream.
+ *
+ *   The buffers are carved out of a static pool of OTA_PIPE_DEPTH buffers
+ *   of OTA_PIPE_BUFFER_SIZE bytes. Smaller buffers may be requested when
+ *   the ring is initialized: there are then more of them, in the same
+ *   memory.
+ *
+ * Usage:
+ *   ota_pipe_init() before the consumer task is started.
+ */
+
+#ifndef OTA_PIPE_H_
+#define OTA_PIPE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sdkconfig.h"
+
+#define OTA_PIPE_DEPTH CONFIG_FUOTA_B_PIPE_DEPTH
+#define OTA_PIPE_BUFFER_SIZE CONFIG_FUOTA_B_PIPE_BUFFER_SIZE
+#define OTA_PIPE_POOL_SIZE (OTA_PIPE_DEPTH * OTA_PIPE_BUFFER_SIZE)
+// Smallest buffer size accepted by ota_pipe_init().
+#define OTA_PIPE_MIN_BUFFER_SIZE 512
+#define OTA_PIPE_MAX_DEPTH (OTA_PIPE_POOL_SIZE / OTA_PIPE_MIN_BUFFER_SIZE)
+
+typedef struct {
+    uint8_t pool[OTA_PIPE_POOL_SIZE];
+    size_t lengths[OTA_PIPE_MAX_DEPTH];
+    size_t buffer_size;
+    unsigned int depth;
+    // Free running counters of committed and released buffers.
+    atomic_uint head;
+    atomic_uint tail;
+    // Given after a release (a buffer may be free), and after a commit (a
+    // buffer may be committed). Created once, kept between uses.
+    SemaphoreHandle_t released;
+    SemaphoreHandle_t committed;
+    // Number of times the producer found the ring full, and the consumer
+    // found it empty.
+    uint32_t producer_stalls;
+    uint32_t consumer_stalls;
+} ota_pipe_t;
+
+/**
+ * Initializes the ring, with buffers of buffer_size bytes, from
+ * OTA_PIPE_MIN_BUFFER_SIZE to OTA_PIPE_BUFFER_SIZE. The ring must be
+ * zeroed before its first use. Returns false if its semaphores can't be
+ * created.
+ */
+bool ota_pipe_init(ota_pipe_t *pipe, size_t buffer_size);
+
+/**
+ * Producer side: returns a free buffer of pipe->buffer_size bytes, waiting
+ * for one if required.
+ */
+uint8_t *ota_pipe_acquire(ota_pipe_t *pipe);
+
+/**
+ * Producer side: passes the buffer returned by ota_pipe_acquire() to the
+ * consumer. length is the number of bytes written to the buffer, 0 for the
+ * end of the stream.
+ */
+void ota_pipe_commit(ota_pipe_t *pipe, size_t length);
+
+/**
+ * Consumer side: returns the oldest committed buffer and its length,
+ * waiting for one if required.
+ */
+const uint8_t *ota_pipe_peek(ota_pipe_t *pipe, size_t *length);
+
+/**
+ * Consumer side: returns the oldest committed buffer and its length, or
+ * NULL if the ring is empty.
+ */
+const uint8_t *ota_pipe_try_peek(ota_pipe_t *pipe, size_t *length);
+
+/**
+ * Consumer side: gives the buffer returned by ota_pipe_peek() back to the
+ * producer.
+ */
+void ota_pipe_release(ota_pipe_t *pipe);
+
+#endif /* OTA_PIPE_H_ */
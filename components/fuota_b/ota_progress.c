@@ -0,0 +1,123 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "ota_progress.h"
+
+static const char NVS_NAMESPACE[] = "fuota_b";
+static const char NVS_KEY[] = "progress";
+
+static void init_ids(ota_progress_t *progress, const uint8_t *app_id,
+                     const char *path) {
+
+    memcpy(progress->app_id, app_id, OTA_PROGRESS_ID_LENGTH);
+    mbedtls_sha256_ret((const unsigned char *)path, strlen(path),
+                       progress->path_id, 0);
+
+}
+
+void ota_progress_init(ota_progress_t *progress, const uint8_t *app_id,
+                       const char *path) {
+
+    memset(progress, 0, sizeof(*progress));
+    init_ids(progress, app_id, path);
+    mbedtls_sha256_init(&progress->sha);
+    mbedtls_sha256_starts_ret(&progress->sha, 0);
+
+}
+
+bool ota_progress_load(ota_progress_t *progress, const uint8_t *app_id,
+                       const char *path) {
+
+    esp_err_t esp_rs;
+    nvs_handle_t nvs;
+    ota_progress_t expected;
+
+    ota_progress_init(progress, app_id, path);
+    esp_rs = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (esp_rs != ESP_OK) {
+        // Namespace not created yet.
+        return false;
+    }
+    size_t length = sizeof(*progress);
+    esp_rs = nvs_get_blob(nvs, NVS_KEY, progress, &length);
+    nvs_close(nvs);
+    if ((esp_rs != ESP_OK) || (length != sizeof(*progress))) {
+        ota_progress_init(progress, app_id, path);
+        return false;
+    }
+    init_ids(&expected, app_id, path);
+    if ((memcmp(progress->app_id, expected.app_id,
+                OTA_PROGRESS_ID_LENGTH) != 0) ||
+        (memcmp(progress->path_id, expected.path_id,
+                OTA_PROGRESS_ID_LENGTH) != 0)) {
+        ESP_LOGI(OTA_TAG, "Progress record for another file or application");
+        ota_progress_init(progress, app_id, path);
+        return false;
+    }
+    progress->validator[OTA_PROGRESS_VALIDATOR_MAX_LENGTH] = '\0';
+    return true;
+
+}
+
+ota_status_t ota_progress_save(ota_progress_t *progress,
+                               const mbedtls_sha256_context *sha) {
+
+    esp_err_t esp_rs;
+    nvs_handle_t nvs;
+
+    // The clone of a hash computed by the hardware accelerator is a
+    // software state, which can be stored as is.
+    mbedtls_sha256_clone(&progress->sha, sha);
+    esp_rs = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "Error from nvs_open: %s", esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    esp_rs = nvs_set_blob(nvs, NVS_KEY, progress, sizeof(*progress));
+    if (esp_rs == ESP_OK) {
+        esp_rs = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(OTA_TAG, "Error while saving progress: %s",
+                 esp_err_to_name(esp_rs));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+void ota_progress_clear(void) {
+
+    nvs_handle_t nvs;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_erase_key(nvs, NVS_KEY) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+
+}
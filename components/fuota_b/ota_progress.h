@@ -0,0 +1,92 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It stores in NVS the progress
+ *   of the download of an update file, so that an interrupted download
+ *   can be resumed by a later call to ota_update_b().
+ *
+ *   The record identifies the update file by a hash of its path and by
+ *   the validator (ETag, or Last-Modified date) returned by the server.
+ *   It contains the number of bytes written to the update partition and
+ *   the state of the SHA-256 of these bytes.
+ *
+ *   The hash state is stored as is, so a record is only valid for the
+ *   application that wrote it. A record written by another application
+ *   is ignored.
+ */
+
+#ifndef OTA_PROGRESS_H_
+#define OTA_PROGRESS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbedtls/sha256.h"
+
+#include "fuota_b.h"
+
+#define OTA_PROGRESS_ID_LENGTH 32
+// Long enough for a Last-Modified date, and for usual ETags.
+#define OTA_PROGRESS_VALIDATOR_MAX_LENGTH 63
+
+typedef struct {
+    // SHA-256 of the application writing the record.
+    uint8_t app_id[OTA_PROGRESS_ID_LENGTH];
+    // SHA-256 of the update file path.
+    uint8_t path_id[OTA_PROGRESS_ID_LENGTH];
+    char validator[OTA_PROGRESS_VALIDATOR_MAX_LENGTH + 1];
+    uint32_t file_size;
+    uint32_t offset;
+    mbedtls_sha256_context sha;
+} ota_progress_t;
+
+/**
+ * Initializes a record for the download of the given file, from its start.
+ * app_id identifies the running application (OTA_PROGRESS_ID_LENGTH bytes).
+ */
+void ota_progress_init(ota_progress_t *progress, const uint8_t *app_id,
+                       const char *path);
+
+/**
+ * Reads the stored record. Returns true if a record, written by the running
+ * application for the given file, is available. progress is initialized
+ * for a download from the start otherwise.
+ */
+bool ota_progress_load(ota_progress_t *progress, const uint8_t *app_id,
+                       const char *path);
+
+/**
+ * Stores the record. sha is the hash state corresponding to the offset
+ * field.
+ *
+ * Returned value:
+ * - OTA_OK
+ * - OTA_SYS_ERR: NVS error
+ */
+ota_status_t ota_progress_save(ota_progress_t *progress,
+                               const mbedtls_sha256_context *sha);
+
+/**
+ * Removes the stored record, if any.
+ */
+void ota_progress_clear(void);
+
+#endif /* OTA_PROGRESS_H_ */
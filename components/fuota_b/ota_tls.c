@@ -0,0 +1,577 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "mbedtls/net_sockets.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "ota_tls.h"
+
+static const char PERS[] = "fuota_b";
+
+// Persistent storage of the session, as serialized by mbed TLS.
+#define SESSION_MAX_SIZE 2048
+#if CONFIG_FUOTA_B_TLS_SESSION_NVS
+static const char NVS_NAMESPACE[] = "fuota_b";
+static const char NVS_KEY_SERVER[] = "tls_server";
+static const char NVS_KEY_SESSION[] = "tls_session";
+#elif CONFIG_FUOTA_B_TLS_SESSION_RTC
+#define RTC_SESSION_MAGIC 0x53534c54
+// Survives a software restart, not a power cycle. Its content is checked
+// by a CRC.
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    char server[OTA_TRANSPORT_HOST_MAX_LENGTH + 7];
+    uint16_t length;
+    uint8_t data[SESSION_MAX_SIZE];
+} rtc_session_t;
+static RTC_NOINIT_ATTR rtc_session_t rtc_session;
+#endif
+
+// Session cache: last session established with cached_server, a
+// "<host>:<port>" string. The streams of a parallel download connect from
+// their own tasks: the cache, and the buffer used to store it, are
+// accessed under session_lock only. The handshakes themselves work on
+// copies of the session, made by mbedtls_ssl_set_session() and
+// mbedtls_ssl_get_session().
+static SemaphoreHandle_t session_lock = NULL;
+static mbedtls_ssl_session cached_session;
+static bool session_cached = false;
+static bool session_loaded = false;
+static char cached_server[OTA_TRANSPORT_HOST_MAX_LENGTH + 7];
+
+#if CONFIG_FUOTA_B_TLS_SESSION_NVS || CONFIG_FUOTA_B_TLS_SESSION_RTC
+static uint8_t session_buf[SESSION_MAX_SIZE];
+
+// Writes the cached session to persistent storage.
+static void store_session(void) {
+
+    size_t length;
+
+    int ret = mbedtls_ssl_session_save(&cached_session, session_buf,
+                                       sizeof(session_buf), &length);
+    if (ret != 0) {
+        ESP_LOGW(OTA_TAG, "ota_tls - Can't serialize session: -0x%04x", -ret);
+        return;
+    }
+#if CONFIG_FUOTA_B_TLS_SESSION_NVS
+    nvs_handle_t nvs;
+    esp_err_t esp_rs = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(OTA_TAG, "ota_tls - Error from nvs_open: %s",
+                 esp_err_to_name(esp_rs));
+        return;
+    }
+    esp_rs = nvs_set_str(nvs, NVS_KEY_SERVER, cached_server);
+    if (esp_rs == ESP_OK) {
+        esp_rs = nvs_set_blob(nvs, NVS_KEY_SESSION, session_buf, length);
+    }
+    if (esp_rs == ESP_OK) {
+        esp_rs = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(OTA_TAG, "ota_tls - Error while saving session: %s",
+                 esp_err_to_name(esp_rs));
+    }
+#else
+    strcpy(rtc_session.server, cached_server);
+    rtc_session.length = length;
+    memcpy(rtc_session.data, session_buf, length);
+    rtc_session.magic = RTC_SESSION_MAGIC;
+    rtc_session.crc = esp_rom_crc32_le(0, (const uint8_t *)&rtc_session.server,
+                                       sizeof(rtc_session) -
+                                       offsetof(rtc_session_t, server));
+#endif
+
+}
+
+// Reads the session stored in persistent storage for the given server, if
+// any, into the cache.
+static void load_session(const char *server) {
+
+    size_t length;
+
+#if CONFIG_FUOTA_B_TLS_SESSION_NVS
+    nvs_handle_t nvs;
+    char stored_server[sizeof(cached_server)];
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        // Namespace not created yet.
+        return;
+    }
+    length = sizeof(stored_server);
+    esp_err_t esp_rs = nvs_get_str(nvs, NVS_KEY_SERVER, stored_server, &length);
+    if ((esp_rs == ESP_OK) && (strcmp(stored_server, server) == 0)) {
+        length = sizeof(session_buf);
+        esp_rs = nvs_get_blob(nvs, NVS_KEY_SESSION, session_buf, &length);
+    } else {
+        esp_rs = ESP_ERR_NOT_FOUND;
+    }
+    nvs_close(nvs);
+    if (esp_rs != ESP_OK) {
+        return;
+    }
+#else
+    if ((rtc_session.magic != RTC_SESSION_MAGIC) ||
+        (rtc_session.crc != esp_rom_crc32_le(0,
+                                             (const uint8_t *)&rtc_session.server,
+                                             sizeof(rtc_session) -
+                                             offsetof(rtc_session_t, server))) ||
+        (rtc_session.length > SESSION_MAX_SIZE) ||
+        (strncmp(rtc_session.server, server, sizeof(rtc_session.server)) != 0)) {
+        return;
+    }
+    length = rtc_session.length;
+    memcpy(session_buf, rtc_session.data, length);
+#endif
+    // Fails if the session was saved by an mbed TLS with another
+    // configuration.
+    if (mbedtls_ssl_session_load(&cached_session, session_buf, length) != 0) {
+        mbedtls_ssl_session_free(&cached_session);
+        mbedtls_ssl_session_init(&cached_session);
+        return;
+    }
+    session_cached = true;
+    ESP_LOGI(OTA_TAG, "ota_tls - Stored session loaded");
+
+}
+#else
+static void store_session(void) {
+}
+
+static void load_session(const char *server) {
+}
+#endif
+
+// Makes the cache relevant for the given server, loading the stored
+// session at first use.
+static void select_session(const char *server) {
+
+    if (!session_loaded) {
+        mbedtls_ssl_session_init(&cached_session);
+        session_loaded = true;
+        strcpy(cached_server, server);
+        load_session(server);
+        return;
+    }
+    if (strcmp(cached_server, server) != 0) {
+        mbedtls_ssl_session_free(&cached_session);
+        mbedtls_ssl_session_init(&cached_session);
+        session_cached = false;
+        strcpy(cached_server, server);
+        load_session(server);
+    }
+
+}
+
+static void invalidate_session(void) {
+
+    mbedtls_ssl_session_free(&cached_session);
+    mbedtls_ssl_session_init(&cached_session);
+    session_cached = false;
+
+}
+
+static int send_cb(void *ctx, const unsigned char *buf, size_t len) {
+
+    int fd = *(int *)ctx;
+    int ret = send(fd, buf, len, 0);
+    if (ret < 0) {
+        return MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return ret;
+
+}
+
+static int recv_cb(void *ctx, unsigned char *buf, size_t len) {
+
+    int fd = *(int *)ctx;
+    int ret = recv(fd, buf, len, 0);
+    if (ret < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            return MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+        return MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    return ret;
+
+}
+
+static int64_t elapsed_us(int64_t start) {
+
+    return esp_timer_get_time() - start;
+
+}
+
+// Resolves the server name and opens a TCP connection, with a timeout.
+static ota_status_t open_socket(ota_tls_t *tls) {
+
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    char port[6];
+    int64_t start;
+    int ret;
+
+    snprintf(port, sizeof(port), "%u", tls->transport.port);
+    start = esp_timer_get_time();
+    ret = getaddrinfo(tls->transport.host, port, &hints, &res);
+    tls->transport.dns_time = elapsed_us(start);
+    if ((ret != 0) || (res == NULL)) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Can't resolve %s", tls->transport.host);
+        return OTA_CONN_ERR;
+    }
+    start = esp_timer_get_time();
+    tls->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (tls->fd < 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Can't create socket: %d", errno);
+        freeaddrinfo(res);
+        return OTA_CONN_ERR;
+    }
+    struct timeval tv = {
+        .tv_sec = tls->timeout_ms / 1000,
+        .tv_usec = (tls->timeout_ms % 1000) * 1000,
+    };
+    setsockopt(tls->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(tls->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    // Non-blocking connection, so that its duration is limited.
+    int flags = fcntl(tls->fd, F_GETFL, 0);
+    fcntl(tls->fd, F_SETFL, flags | O_NONBLOCK);
+    ret = connect(tls->fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if ((ret < 0) && (errno == EINPROGRESS)) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(tls->fd, &fds);
+        ret = select(tls->fd + 1, NULL, &fds, NULL, &tv);
+        if (ret == 1) {
+            int error = 0;
+            socklen_t error_length = sizeof(error);
+            getsockopt(tls->fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+            ret = error == 0 ? 0 : -1;
+        } else {
+            ret = -1;
+        }
+    }
+    tls->transport.tcp_time = elapsed_us(start);
+    if (ret < 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Can't connect to %s:%u",
+                 tls->transport.host, tls->transport.port);
+        close(tls->fd);
+        tls->fd = -1;
+        return OTA_CONN_ERR;
+    }
+    fcntl(tls->fd, F_SETFL, flags);
+    return OTA_OK;
+
+}
+
+static void tls_close(ota_transport_t *transport);
+static void tls_deinit(ota_tls_t *tls);
+
+// Initializes a transport. After an error, the transport does not hold any
+// resource.
+static ota_status_t tls_init(ota_tls_t *tls, const char *host, uint16_t port,
+                             const char *cert_pem, uint32_t timeout_ms) {
+
+    int ret;
+
+    memset(tls, 0, sizeof(*tls));
+    if (strlen(host) > OTA_TRANSPORT_HOST_MAX_LENGTH) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Host name too long");
+        return OTA_PARAM_ERR;
+    }
+    strcpy(tls->transport.host, host);
+    tls->transport.port = port;
+    tls->timeout_ms = timeout_ms;
+    tls->fd = -1;
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_x509_crt_init(&tls->ca);
+    mbedtls_ctr_drbg_init(&tls->drbg);
+    mbedtls_entropy_init(&tls->entropy);
+    ret = mbedtls_ctr_drbg_seed(&tls->drbg, mbedtls_entropy_func,
+                                &tls->entropy, (const unsigned char *)PERS,
+                                sizeof(PERS));
+    if (ret != 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Error from mbedtls_ctr_drbg_seed: -0x%04x",
+                 -ret);
+        tls_deinit(tls);
+        return OTA_SYS_ERR;
+    }
+    ret = mbedtls_x509_crt_parse(&tls->ca, (const unsigned char *)cert_pem,
+                                 strlen(cert_pem) + 1);
+    if (ret != 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Invalid certificate: -0x%04x", -ret);
+        tls_deinit(tls);
+        return OTA_PARAM_ERR;
+    }
+    ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Error from mbedtls_ssl_config_defaults: -0x%04x",
+                 -ret);
+        tls_deinit(tls);
+        return OTA_SYS_ERR;
+    }
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&tls->conf, &tls->ca, NULL);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&tls->conf,
+                                     MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&tls->ssl, host);
+    }
+    if (ret != 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Error from mbedtls_ssl_setup: -0x%04x",
+                 -ret);
+        tls_deinit(tls);
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t tls_connect(ota_transport_t *transport) {
+
+    ota_tls_t *tls = (ota_tls_t *)transport;
+    char server[sizeof(cached_server)];
+    mbedtls_ssl_session session;
+    unsigned char master[sizeof(session.master)];
+    int64_t start;
+    int ret;
+
+    tls_close(transport);
+    tls->transport.dns_time = 0;
+    tls->transport.tcp_time = 0;
+    tls->transport.handshake_time = 0;
+    ota_status_t ota_rs = open_socket(tls);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    snprintf(server, sizeof(server), "%s:%u", tls->transport.host,
+             tls->transport.port);
+    // Master secret of the offered session, to detect a resumption.
+    bool offered = false;
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    select_session(server);
+    if (session_cached &&
+        (mbedtls_ssl_set_session(&tls->ssl, &cached_session) == 0)) {
+        memcpy(master, cached_session.master, sizeof(master));
+        offered = true;
+    }
+    xSemaphoreGive(session_lock);
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->fd, send_cb, recv_cb, NULL);
+    start = esp_timer_get_time();
+    do {
+        ret = mbedtls_ssl_handshake(&tls->ssl);
+    } while ((ret == MBEDTLS_ERR_SSL_WANT_READ) ||
+             (ret == MBEDTLS_ERR_SSL_WANT_WRITE));
+    tls->transport.handshake_time = elapsed_us(start);
+    if (ret != 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Handshake error: -0x%04x", -ret);
+        // In case the cached session is the problem.
+        xSemaphoreTake(session_lock, portMAX_DELAY);
+        invalidate_session();
+        xSemaphoreGive(session_lock);
+        tls_close(transport);
+        return OTA_CONN_ERR;
+    }
+    tls->transport.connected = true;
+
+    // A resumed session keeps the master secret of the cached one, a full
+    // handshake computes a new one.
+    mbedtls_ssl_session_init(&session);
+    ret = mbedtls_ssl_get_session(&tls->ssl, &session);
+    bool resumed = offered && (ret == 0) &&
+                   (memcmp(session.master, master, sizeof(master)) == 0);
+    if (ret == 0) {
+        xSemaphoreTake(session_lock, portMAX_DELAY);
+        // Another stream may have selected another server meanwhile.
+        if (strcmp(cached_server, server) == 0) {
+            mbedtls_ssl_session_free(&cached_session);
+            cached_session = session;
+            session_cached = true;
+            if (!resumed) {
+                store_session();
+            }
+        } else {
+            mbedtls_ssl_session_free(&session);
+        }
+        xSemaphoreGive(session_lock);
+    } else {
+        mbedtls_ssl_session_free(&session);
+    }
+
+    tls->transport.resumed = resumed;
+    ESP_LOGI(OTA_TAG, "ota_tls - %s handshake - DNS: %u ms, TCP: %u ms, TLS: %u ms",
+             resumed ? "Resumed" : "Full",
+             (uint32_t)(tls->transport.dns_time / 1000),
+             (uint32_t)(tls->transport.tcp_time / 1000),
+             (uint32_t)(tls->transport.handshake_time / 1000));
+    return OTA_OK;
+
+}
+
+static int tls_read(ota_transport_t *transport, uint8_t *data,
+                    size_t length) {
+
+    ota_tls_t *tls = (ota_tls_t *)transport;
+    int ret;
+
+    do {
+        ret = mbedtls_ssl_read(&tls->ssl, data, length);
+    } while ((ret == MBEDTLS_ERR_SSL_WANT_READ) ||
+             (ret == MBEDTLS_ERR_SSL_WANT_WRITE));
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return 0;
+    }
+    // mbedtls_ssl_read() returns 0, or MBEDTLS_ERR_SSL_CONN_EOF, when the
+    // TCP connection is closed without a close_notify alert: the data
+    // received may have been truncated by an attacker.
+    if ((ret == 0) || (ret == MBEDTLS_ERR_SSL_CONN_EOF)) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Connection closed without close_notify");
+        return -1;
+    }
+    if (ret < 0) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Read error: -0x%04x", -ret);
+    }
+    return ret;
+
+}
+
+static ota_status_t tls_write(ota_transport_t *transport, const uint8_t *data,
+                              size_t length) {
+
+    ota_tls_t *tls = (ota_tls_t *)transport;
+    int ret;
+
+    while (length > 0) {
+        ret = mbedtls_ssl_write(&tls->ssl, data, length);
+        if ((ret == MBEDTLS_ERR_SSL_WANT_READ) ||
+            (ret == MBEDTLS_ERR_SSL_WANT_WRITE)) {
+            continue;
+        }
+        if (ret < 0) {
+            ESP_LOGE(OTA_TAG, "ota_tls - Write error: -0x%04x", -ret);
+            return OTA_CONN_ERR;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return OTA_OK;
+
+}
+
+static void tls_close(ota_transport_t *transport) {
+
+    ota_tls_t *tls = (ota_tls_t *)transport;
+
+    if (tls->transport.connected) {
+        mbedtls_ssl_close_notify(&tls->ssl);
+        tls->transport.connected = false;
+    }
+    if (tls->fd >= 0) {
+        close(tls->fd);
+        tls->fd = -1;
+        // The context can then be used for a new connection.
+        mbedtls_ssl_session_reset(&tls->ssl);
+    }
+
+}
+
+// Releases the resources allocated by tls_init().
+static void tls_deinit(ota_tls_t *tls) {
+
+    tls_close(&tls->transport);
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_x509_crt_free(&tls->ca);
+    mbedtls_ctr_drbg_free(&tls->drbg);
+    mbedtls_entropy_free(&tls->entropy);
+
+}
+
+static void tls_destroy(ota_transport_t *transport) {
+
+    tls_deinit((ota_tls_t *)transport);
+    free(transport);
+
+}
+
+static const ota_transport_ops_t tls_ops = {
+    .connect = tls_connect,
+    .read = tls_read,
+    .write = tls_write,
+    .close = tls_close,
+    .destroy = tls_destroy,
+};
+
+ota_status_t ota_tls_create(const char *host, uint16_t port,
+                            const char *cert_pem, uint32_t timeout_ms,
+                            ota_transport_t **transport) {
+
+    // Transports are created by the task calling ota_update_b(), before
+    // the streams start.
+    if (session_lock == NULL) {
+        session_lock = xSemaphoreCreateMutex();
+        if (session_lock == NULL) {
+            ESP_LOGE(OTA_TAG, "ota_tls - Error from xSemaphoreCreateMutex");
+            return OTA_SYS_ERR;
+        }
+    }
+    // mbed TLS contexts are large: the transport is not allocated on the
+    // stack.
+    ota_tls_t *tls = malloc(sizeof(*tls));
+    if (tls == NULL) {
+        ESP_LOGE(OTA_TAG, "ota_tls - Can't allocate transport");
+        return OTA_SYS_ERR;
+    }
+    ota_status_t ota_rs = tls_init(tls, host, port, cert_pem, timeout_ms);
+    if (ota_rs != OTA_OK) {
+        free(tls);
+        return ota_rs;
+    }
+    tls->transport.ops = &tls_ops;
+    *transport = &tls->transport;
+    return OTA_OK;
+
+}
@@ -0,0 +1,72 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It is the default transport
+ *   (see ota_transport.h): a TLS connection to the update server, over a
+ *   socket, with mbed TLS.
+ *
+ *   The last TLS session established with the server is cached, so that
+ *   next connections perform an abbreviated handshake (session ticket or
+ *   session ID), which saves around one second of CPU time. The session is
+ *   cached in RAM and, depending on the configuration, in NVS or in RTC
+ *   memory, so that it survives a restart.
+ *
+ *   Every connection step is timed: DNS resolution, TCP connection and
+ *   handshake, which is either full or resumed.
+ *
+ * Usage:
+ *   ota_tls_create(), then the operations of the transport.
+ */
+
+#ifndef OTA_TLS_H_
+#define OTA_TLS_H_
+
+#include <stdint.h>
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+
+#include "fuota_b.h"
+#include "ota_transport.h"
+
+typedef struct {
+    ota_transport_t transport;
+    // Send and receive timeout, in ms.
+    uint32_t timeout_ms;
+    int fd;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_context entropy;
+} ota_tls_t;
+
+/**
+ * Creates a TLS transport. cert_pem is parsed here. See
+ * ota_transport_create_t.
+ */
+ota_status_t ota_tls_create(const char *host, uint16_t port,
+                            const char *cert_pem, uint32_t timeout_ms,
+                            ota_transport_t **transport);
+
+#endif /* OTA_TLS_H_ */
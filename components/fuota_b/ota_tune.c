@@ -0,0 +1,258 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "nvs_cache.h"
+#include "trace_ring.h"
+
+#include "fuota_b.h"
+#include "ota_tune.h"
+
+static const char NVS_NAMESPACE[] = "fuota_b";
+static const char NVS_KEY[] = "tune";
+
+#if CONFIG_FUOTA_B_TUNE
+#define PROBE_SIZE (CONFIG_FUOTA_B_TUNE_PROBE_SIZE * 1024)
+#else
+// No probe, and no cached setting.
+#define PROBE_SIZE 0
+#endif
+
+typedef struct {
+    nvc_entry_t lru;
+    uint8_t link_id[OTA_TUNE_LINK_ID_MAX_LENGTH];
+    uint8_t link_id_length;
+    uint32_t chunk_size;
+    uint32_t throughput;
+} tune_entry_t;
+
+static tune_entry_t entries[OTA_TUNE_CACHE_ENTRIES];
+
+// Reads the cache. Entries are unused if there is none.
+static void load_entries(void) {
+
+    nvc_load(NVS_NAMESPACE, NVS_KEY, entries, sizeof(entries));
+
+}
+
+static void save_entries(void) {
+
+    nvc_save(NVS_NAMESPACE, NVS_KEY, entries, sizeof(entries));
+
+}
+
+// Returns the entry of the link, or NULL.
+static tune_entry_t *find_entry(const ota_tune_t *tune) {
+
+    for (int i = 0; i < OTA_TUNE_CACHE_ENTRIES; i++) {
+        if ((entries[i].lru.sequence != 0) &&
+            (entries[i].link_id_length == tune->link_id_length) &&
+            (memcmp(entries[i].link_id, tune->link_id,
+                    tune->link_id_length) == 0)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+
+}
+
+static uint32_t candidate_size(uint8_t candidate) {
+
+    return OTA_PIPE_BUFFER_SIZE >> candidate;
+
+}
+
+// Returns true if size is one of the candidates of the current
+// configuration.
+static bool is_candidate(const ota_tune_t *tune, uint32_t size) {
+
+    for (uint8_t i = 0; i < tune->candidate_count; i++) {
+        if (candidate_size(i) == size) {
+            return true;
+        }
+    }
+    return false;
+
+}
+
+// Ends the probe: selects the size, and caches it for the link.
+static void select_size(ota_tune_t *tune) {
+
+    uint32_t throughputs[OTA_TUNE_CANDIDATES] = { 0 };
+    uint32_t best = 0;
+    uint8_t selected = 0;
+    tune_entry_t *entry;
+
+    for (uint8_t i = 0; i < tune->candidate_count; i++) {
+        if (tune->times[i] > 0) {
+            throughputs[i] = (int64_t)tune->bytes[i] * 1000000 /
+                             tune->times[i];
+        }
+        if (throughputs[i] > best) {
+            best = throughputs[i];
+        }
+    }
+    for (uint8_t i = 0; i < tune->candidate_count; i++) {
+        if ((uint64_t)throughputs[i] * 100 >=
+            (uint64_t)best * (100 - OTA_TUNE_TOLERANCE_PERCENT)) {
+            selected = i;
+        }
+    }
+    tune->probing = false;
+    tune->chunk_size = candidate_size(selected);
+    ESP_LOGI(OTA_TAG, "ota_tune - Throughputs (B/s): %u %u %u %u",
+             throughputs[0], throughputs[1], throughputs[2], throughputs[3]);
+    ESP_LOGI(OTA_TAG, "ota_tune - Chunk size: %u, throughput: %u B/s, "
+             "min free heap: %u", tune->chunk_size, throughputs[selected],
+             tune->min_free_heap);
+    TRACE(OTA_TUNE, tune->chunk_size, throughputs[selected]);
+    // The entry of the link, or an unused one, or the oldest one.
+    load_entries();
+    entry = find_entry(tune);
+    if (entry == NULL) {
+        entry = nvc_lru_oldest(entries, sizeof(entries[0]),
+                               OTA_TUNE_CACHE_ENTRIES);
+    }
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->link_id, tune->link_id, tune->link_id_length);
+    entry->link_id_length = tune->link_id_length;
+    entry->chunk_size = tune->chunk_size;
+    entry->throughput = throughputs[selected];
+    nvc_lru_touch(entries, sizeof(entries[0]), OTA_TUNE_CACHE_ENTRIES,
+                  entry);
+    save_entries();
+
+}
+
+void ota_tune_set_link(ota_tune_t *tune, const uint8_t *link_id,
+                       size_t length) {
+
+    if (link_id == NULL) {
+        length = 0;
+    }
+    if (length > OTA_TUNE_LINK_ID_MAX_LENGTH) {
+        length = OTA_TUNE_LINK_ID_MAX_LENGTH;
+    }
+    memset(tune->link_id, 0, sizeof(tune->link_id));
+    if (length > 0) {
+        memcpy(tune->link_id, link_id, length);
+    }
+    tune->link_id_length = length;
+
+}
+
+void ota_tune_begin(ota_tune_t *tune) {
+
+    tune_entry_t *entry;
+
+    tune->active = true;
+    tune->probing = false;
+    tune->cached = false;
+    tune->chunk_size = OTA_PIPE_BUFFER_SIZE;
+    tune->buffer_size = OTA_PIPE_BUFFER_SIZE;
+    tune->candidate_count = 0;
+    while ((tune->candidate_count < OTA_TUNE_CANDIDATES) &&
+           (candidate_size(tune->candidate_count) >=
+            OTA_PIPE_MIN_BUFFER_SIZE)) {
+        tune->candidate_count++;
+    }
+    if ((PROBE_SIZE == 0) || (tune->candidate_count < 2)) {
+        return;
+    }
+    load_entries();
+    entry = find_entry(tune);
+    if ((entry != NULL) && is_candidate(tune, entry->chunk_size)) {
+        tune->cached = true;
+        tune->cached_throughput = entry->throughput;
+        tune->chunk_size = entry->chunk_size;
+        tune->buffer_size = entry->chunk_size;
+        ESP_LOGI(OTA_TAG, "ota_tune - Cached chunk size: %u (%u B/s)",
+                 entry->chunk_size, entry->throughput);
+        return;
+    }
+    tune->probing = true;
+    tune->candidate = 0;
+    tune->slice_bytes = 0;
+    tune->probe_bytes = 0;
+    memset(tune->bytes, 0, sizeof(tune->bytes));
+    memset(tune->times, 0, sizeof(tune->times));
+    tune->min_free_heap = esp_get_free_heap_size();
+
+}
+
+void ota_tune_record(ota_tune_t *tune, size_t length, int64_t duration) {
+
+    uint32_t free_heap;
+
+    if (!tune->probing) {
+        return;
+    }
+    tune->bytes[tune->candidate] += length;
+    tune->times[tune->candidate] += duration;
+    free_heap = esp_get_free_heap_size();
+    if (free_heap < tune->min_free_heap) {
+        tune->min_free_heap = free_heap;
+    }
+    tune->probe_bytes += length;
+    if (tune->probe_bytes >= PROBE_SIZE) {
+        select_size(tune);
+        return;
+    }
+    tune->slice_bytes += length;
+    if (tune->slice_bytes >= OTA_TUNE_SLICE_SIZE) {
+        tune->slice_bytes = 0;
+        tune->candidate = (tune->candidate + 1) % tune->candidate_count;
+        tune->chunk_size = candidate_size(tune->candidate);
+    }
+
+}
+
+void ota_tune_end(ota_tune_t *tune, uint32_t file_bytes,
+                  uint32_t throughput) {
+
+    tune_entry_t *entry;
+
+    if (!tune->active) {
+        return;
+    }
+    tune->active = false;
+    if (tune->probing) {
+        ESP_LOGI(OTA_TAG, "ota_tune - Download too short for a probe");
+        tune->probing = false;
+        return;
+    }
+    // A short download says little about the link.
+    if (!tune->cached || (file_bytes < PROBE_SIZE) ||
+        (throughput >= tune->cached_throughput / 2)) {
+        return;
+    }
+    ESP_LOGI(OTA_TAG, "ota_tune - Throughput down to %u B/s, dropping "
+             "cached setting", throughput);
+    load_entries();
+    entry = find_entry(tune);
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(*entry));
+        save_entries();
+    }
+
+}
@@ -0,0 +1,120 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Private module of the fuota_b component. It selects, for the current
+ *   network link, the length of the reads of the update file, and the size
+ *   of the buffers of the download ring.
+ *
+ *   The candidate sizes are the download buffer size divided by 1, 2, 4
+ *   and 8, not below OTA_PIPE_MIN_BUFFER_SIZE. When no setting is cached
+ *   for the link, the first CONFIG_FUOTA_B_TUNE_PROBE_SIZE kB of the
+ *   download are read with every candidate in turn, by slices of
+ *   OTA_TUNE_SLICE_SIZE bytes, so that all of them see the same link
+ *   conditions. Then the smallest size whose throughput is within
+ *   OTA_TUNE_TOLERANCE_PERCENT of the best one is used for the rest of the
+ *   download: smaller reads hand the data over to the writer task sooner,
+ *   and smaller buffers make a deeper ring. Sizes are never larger than
+ *   the configured buffer size: the ring is a static pool, so the
+ *   selection does not change the heap used by the download. The lowest
+ *   free heap size seen during the probe is only logged with the result.
+ *
+ *   The result is cached in NVS for the link. Next download over the same
+ *   link uses it from the start, with a ring of buffers of the selected
+ *   size. If its throughput falls below half of the cached one, the
+ *   setting is dropped, and next download probes again.
+ *
+ *   A link is identified by a byte string given by the application, for
+ *   instance the BSSID of the access point. The settings of the last
+ *   OTA_TUNE_CACHE_ENTRIES probed links are kept.
+ *
+ * Usage:
+ *   ota_tune_begin() before a download. Every read of the update file is
+ *   chunk_size bytes long, and is passed to ota_tune_record() with its
+ *   duration. ota_tune_end() once the update is over.
+ */
+
+#ifndef OTA_TUNE_H_
+#define OTA_TUNE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ota_pipe.h"
+
+#define OTA_TUNE_LINK_ID_MAX_LENGTH 16
+#define OTA_TUNE_CANDIDATES 4
+#define OTA_TUNE_SLICE_SIZE (16 * 1024)
+#define OTA_TUNE_TOLERANCE_PERCENT 10
+#define OTA_TUNE_CACHE_ENTRIES 8
+
+typedef struct {
+    uint8_t link_id[OTA_TUNE_LINK_ID_MAX_LENGTH];
+    uint8_t link_id_length;
+    // Between ota_tune_begin() and ota_tune_end().
+    bool active;
+    bool probing;
+    // Setting found in the cache, and the throughput measured with it.
+    bool cached;
+    uint32_t cached_throughput;
+    // Length of next read, and size of the buffers of the ring.
+    uint32_t chunk_size;
+    uint32_t buffer_size;
+    // Probe state.
+    uint8_t candidate_count;
+    uint8_t candidate;
+    uint32_t slice_bytes;
+    uint32_t probe_bytes;
+    uint32_t bytes[OTA_TUNE_CANDIDATES];
+    int64_t times[OTA_TUNE_CANDIDATES];
+    // Logged with the result only.
+    uint32_t min_free_heap;
+} ota_tune_t;
+
+/**
+ * Sets the identifier of the link used by next downloads. NULL, or a length
+ * of 0, for an unknown link. Longer identifiers are truncated to
+ * OTA_TUNE_LINK_ID_MAX_LENGTH bytes.
+ */
+void ota_tune_set_link(ota_tune_t *tune, const uint8_t *link_id,
+                       size_t length);
+
+/**
+ * Prepares a download: loads the setting cached for the link, or starts
+ * a probe. Without CONFIG_FUOTA_B_TUNE, chunk_size and buffer_size are
+ * OTA_PIPE_BUFFER_SIZE.
+ */
+void ota_tune_begin(ota_tune_t *tune);
+
+/**
+ * Accounts for a read of length bytes, which took duration microseconds,
+ * including the wait for a free buffer. chunk_size may change.
+ */
+void ota_tune_record(ota_tune_t *tune, size_t length, int64_t duration);
+
+/**
+ * Ends a download. throughput is the one of the whole update file, of
+ * file_bytes bytes. Does nothing if ota_tune_begin() was not called.
+ */
+void ota_tune_end(ota_tune_t *tune, uint32_t file_bytes, uint32_t throughput);
+
+#endif /* OTA_TUNE_H_ */
@@ -0,0 +1,91 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   This component keeps small caches in NVS, as a single blob each: the
+ *   channel where an SSID was last found, the DHCP lease of an AP, the
+ *   download settings of a link, or the history of absences of an AP.
+ *
+ *   A cache of a fixed number of entries is an array of structures whose
+ *   first member is an nvc_entry_t. When all entries are used, the least
+ *   recently stored one is replaced.
+ *
+ * Prerequisites:
+ *   - The NVS must be initialized (nvs_flash_init())
+ *
+ * Usage:
+ *   nvc_load() once, before the first lookup. After a change,
+ *   nvc_lru_touch() for the changed entry, then nvc_save(). An entry to
+ *   replace is given by nvc_lru_oldest().
+ */
+
+#ifndef NVS_CACHE_H_
+#define NVS_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern const char NVC_TAG[];
+
+// First member of every entry of a cache.
+typedef struct {
+    // 0 for an unused entry. Higher for more recent entries.
+    uint32_t sequence;
+} nvc_entry_t;
+
+/**
+ * Reads the blob key of namespace name_space, of size bytes, into data.
+ * data is zeroed if there is no such blob, or if its size differs, for
+ * instance after a change of its layout.
+ *
+ * Returned value:
+ * - true: data was read
+ * - false: data was zeroed
+ */
+bool nvc_load(const char *name_space, const char *key, void *data,
+              size_t size);
+
+/**
+ * Writes data, of size bytes, to the blob key of namespace name_space.
+ * Errors are logged.
+ *
+ * Returned value:
+ * - true: data was written
+ * - false: NVS error
+ */
+bool nvc_save(const char *name_space, const char *key, const void *data,
+              size_t size);
+
+/**
+ * Returns the entry to replace in the count entries of entry_size bytes
+ * starting at entries: an unused one, or the least recently stored one.
+ */
+void *nvc_lru_oldest(void *entries, size_t entry_size, size_t count);
+
+/**
+ * Makes entry, one of the count entries of entry_size bytes starting at
+ * entries, the most recently stored one.
+ */
+void nvc_lru_touch(void *entries, size_t entry_size, size_t count,
+                   void *entry);
+
+#endif /* NVS_CACHE_H_ */
@@ -0,0 +1,116 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "nvs_cache.h"
+
+const char NVC_TAG[] = "NVC";
+
+// Returns entry i of the cache.
+static nvc_entry_t *get_entry(void *entries, size_t entry_size, size_t i) {
+
+    return (nvc_entry_t *)((uint8_t *)entries + i * entry_size);
+
+}
+
+bool nvc_load(const char *name_space, const char *key, void *data,
+              size_t size) {
+
+    esp_err_t esp_rs;
+    nvs_handle_t nvs;
+    size_t length = size;
+
+    esp_rs = nvs_open(name_space, NVS_READONLY, &nvs);
+    if (esp_rs != ESP_OK) {
+        // Namespace not created yet.
+        memset(data, 0, size);
+        return false;
+    }
+    esp_rs = nvs_get_blob(nvs, key, data, &length);
+    nvs_close(nvs);
+    if ((esp_rs != ESP_OK) || (length != size)) {
+        memset(data, 0, size);
+        return false;
+    }
+    return true;
+
+}
+
+bool nvc_save(const char *name_space, const char *key, const void *data,
+              size_t size) {
+
+    esp_err_t esp_rs;
+    nvs_handle_t nvs;
+
+    esp_rs = nvs_open(name_space, NVS_READWRITE, &nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(NVC_TAG, "%s - Error from nvs_open: %s", name_space,
+                 esp_err_to_name(esp_rs));
+        return false;
+    }
+    esp_rs = nvs_set_blob(nvs, key, data, size);
+    if (esp_rs == ESP_OK) {
+        esp_rs = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGW(NVC_TAG, "%s - Error while saving %s: %s", name_space, key,
+                 esp_err_to_name(esp_rs));
+        return false;
+    }
+    return true;
+
+}
+
+void *nvc_lru_oldest(void *entries, size_t entry_size, size_t count) {
+
+    nvc_entry_t *oldest = get_entry(entries, entry_size, 0);
+
+    for (size_t i = 1; i < count; i++) {
+        nvc_entry_t *entry = get_entry(entries, entry_size, i);
+        if (entry->sequence < oldest->sequence) {
+            oldest = entry;
+        }
+    }
+    return oldest;
+
+}
+
+void nvc_lru_touch(void *entries, size_t entry_size, size_t count,
+                   void *entry) {
+
+    uint32_t sequence = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        nvc_entry_t *other = get_entry(entries, entry_size, i);
+        if (other->sequence > sequence) {
+            sequence = other->sequence;
+        }
+    }
+    ((nvc_entry_t *)entry)->sequence = sequence + 1;
+
+}
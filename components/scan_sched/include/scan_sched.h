@@ -0,0 +1,133 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   This component decides when to look for the FUOTA AP again, from the
+ *   result of every scan and from a history of the absences of the AP:
+ *   - right after the AP is lost, a few rescans are done at a short
+ *     interval, in case it was only missed
+ *   - the durations of past absences are learned. While the time since
+ *     the last sighting is shorter than all of them, by their spread, the
+ *     AP is not expected back: the interval doubles after every scan, up
+ *     to a maximum
+ *   - when the time since the last sighting approaches one of them, the
+ *     AP is probed densely
+ *   - otherwise, the AP may be back at any time, and the interval is
+ *     backoff_min
+ *   - while the AP is present, the interval is fixed
+ *
+ *   For a device which comes back regularly, for instance a vehicle back
+ *   to its depot every evening, this cuts the number of scans done while
+ *   the AP is absent, and so the radio-on time, and detects its return
+ *   sooner than scans at a fixed interval. Only a return much earlier
+ *   than all learned ones waits for the back-off.
+ *
+ *   Times are in seconds, on a clock given by the caller, which must not
+ *   go backwards. The history of absences can be kept in NVS. The
+ *   component does not depend on Wi-Fi: the host build uses it to replay
+ *   recorded traces of sightings (see host/bench/bench_scan_sched.c).
+ *
+ * Usage:
+ *   scan_sched_init(), then optionally scan_sched_load(). After every
+ *   scan, scan_sched_report() gives the delay before the next one, and
+ *   scan_sched_save() stores the history, if it changed.
+ *
+ *   This component is not reentrant.
+ */
+
+#ifndef SCAN_SCHED_H_
+#define SCAN_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern const char SSC_TAG[];
+
+// Number of absence durations kept.
+#define SCAN_SCHED_HISTORY 8
+
+typedef struct {
+    // Interval while the AP is present.
+    uint32_t present_interval;
+    // Interval and number of the rescans right after the AP is lost.
+    uint32_t rescan_interval;
+    uint32_t rescan_count;
+    // Interval while the AP may be back, and first interval of the
+    // back-off while it is not expected. Maximum interval of the back-off.
+    uint32_t backoff_min;
+    uint32_t backoff_max;
+    // Interval around a learned return time, shorter than backoff_min. The
+    // probing window spans a sixteenth of the absence duration on both
+    // sides, and at least window_min.
+    uint32_t dense_interval;
+    uint32_t window_min;
+    // Shorter absences are not learned, and no back-off is done before.
+    uint32_t min_absence;
+} scan_sched_config_t;
+
+#define SCAN_SCHED_CONFIG_DEFAULT() { \
+    .present_interval = 30,           \
+    .rescan_interval = 5,             \
+    .rescan_count = 3,                \
+    .backoff_min = 25,                \
+    .backoff_max = 600,               \
+    .dense_interval = 15,             \
+    .window_min = 300,                \
+    .min_absence = 600,               \
+}
+
+typedef struct {
+    scan_sched_config_t config;
+    // Learned absence durations, the most recent one before next.
+    uint32_t absences[SCAN_SCHED_HISTORY];
+    uint32_t absence_count;
+    uint32_t next;
+    bool changed;
+    // Set once the AP was seen, and while it is seen.
+    bool known;
+    bool present;
+    uint32_t last_seen;
+    // Scans without the AP since the last sighting.
+    uint32_t misses;
+    uint32_t backoff;
+} scan_sched_t;
+
+void scan_sched_init(scan_sched_t *sched, const scan_sched_config_t *config);
+
+/**
+ * Reads the history of absences from NVS. The NVS must be initialized.
+ * Returns false if there is none.
+ */
+bool scan_sched_load(scan_sched_t *sched);
+
+/**
+ * Writes the history of absences to NVS, if it changed since the last
+ * load or save.
+ */
+void scan_sched_save(scan_sched_t *sched);
+
+/**
+ * Reports the result of the scan done at time now, and returns the delay
+ * before the next scan, at least 1 s.
+ */
+uint32_t scan_sched_report(scan_sched_t *sched, uint32_t now, bool seen);
+
+#endif /* SCAN_SCHED_H_ */
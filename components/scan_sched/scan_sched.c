@@ -0,0 +1,200 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "nvs_cache.h"
+#include "scan_sched.h"
+
+const char SSC_TAG[] = "SSC";
+
+static const char NVS_NAMESPACE[] = "scan_sched";
+static const char NVS_KEY[] = "absences";
+
+// Number of absences to learn before backing off after min_absence.
+#define QUIET_MIN_HISTORY 4
+
+// Stored history.
+typedef struct {
+    uint32_t absences[SCAN_SCHED_HISTORY];
+    uint32_t absence_count;
+    uint32_t next;
+} history_t;
+
+static void learn(scan_sched_t *sched, uint32_t absence) {
+
+    sched->absences[sched->next] = absence;
+    sched->next = (sched->next + 1) % SCAN_SCHED_HISTORY;
+    if (sched->absence_count < SCAN_SCHED_HISTORY) {
+        sched->absence_count++;
+    }
+    sched->changed = true;
+    ESP_LOGI(SSC_TAG, "Absence of %u s learned", absence);
+
+}
+
+// Gives the probing window of a learned absence, as times since the last
+// sighting.
+static void get_window(const scan_sched_t *sched, uint32_t absence,
+                       uint32_t *start, uint32_t *end) {
+
+    uint32_t window = absence / 16 > sched->config.window_min ? absence / 16 :
+                      sched->config.window_min;
+
+    *start = absence > window ? absence - window : 0;
+    *end = absence + window;
+
+}
+
+// Limits delay so that the next scan does not jump over the probing window
+// of a learned absence, and probes densely inside windows. elapsed is the
+// time since the last sighting.
+static uint32_t fit_windows(const scan_sched_t *sched, uint32_t elapsed,
+                            uint32_t delay) {
+
+    const scan_sched_config_t *config = &sched->config;
+
+    for (uint32_t i = 0; i < sched->absence_count; i++) {
+        uint32_t start;
+        uint32_t end;
+        get_window(sched, sched->absences[i], &start, &end);
+        if ((elapsed >= start) && (elapsed < end)) {
+            if (delay > config->dense_interval) {
+                delay = config->dense_interval;
+            }
+        } else if ((elapsed < start) && (elapsed + delay > start)) {
+            delay = start - elapsed;
+        }
+    }
+    return delay;
+
+}
+
+// Returns true if the AP is not expected back at this time since the last
+// sighting: after min_absence, and earlier than the shortest learned
+// absence, by at least the spread of the learned absences.
+static bool is_quiet(const scan_sched_t *sched, uint32_t elapsed) {
+
+    const scan_sched_config_t *config = &sched->config;
+
+    if ((sched->absence_count < QUIET_MIN_HISTORY) ||
+        (elapsed < config->min_absence)) {
+        return false;
+    }
+    uint32_t shortest = sched->absences[0];
+    uint32_t longest = sched->absences[0];
+    for (uint32_t i = 1; i < sched->absence_count; i++) {
+        if (sched->absences[i] < shortest) {
+            shortest = sched->absences[i];
+        }
+        if (sched->absences[i] > longest) {
+            longest = sched->absences[i];
+        }
+    }
+    uint32_t margin = longest - shortest > config->window_min ?
+                      longest - shortest : config->window_min;
+    return elapsed + margin < shortest;
+
+}
+
+void scan_sched_init(scan_sched_t *sched, const scan_sched_config_t *config) {
+
+    memset(sched, 0, sizeof(*sched));
+    sched->config = *config;
+    sched->backoff = config->backoff_min;
+
+}
+
+bool scan_sched_load(scan_sched_t *sched) {
+
+    history_t history;
+
+    if (!nvc_load(NVS_NAMESPACE, NVS_KEY, &history, sizeof(history)) ||
+        (history.absence_count > SCAN_SCHED_HISTORY) ||
+        (history.next >= SCAN_SCHED_HISTORY)) {
+        return false;
+    }
+    memcpy(sched->absences, history.absences, sizeof(sched->absences));
+    sched->absence_count = history.absence_count;
+    sched->next = history.next;
+    sched->changed = false;
+    return true;
+
+}
+
+void scan_sched_save(scan_sched_t *sched) {
+
+    history_t history;
+
+    if (!sched->changed) {
+        return;
+    }
+    memcpy(history.absences, sched->absences, sizeof(history.absences));
+    history.absence_count = sched->absence_count;
+    history.next = sched->next;
+    if (nvc_save(NVS_NAMESPACE, NVS_KEY, &history, sizeof(history))) {
+        sched->changed = false;
+    }
+
+}
+
+uint32_t scan_sched_report(scan_sched_t *sched, uint32_t now, bool seen) {
+
+    const scan_sched_config_t *config = &sched->config;
+    uint32_t delay;
+
+    if (seen) {
+        if (sched->known && !sched->present &&
+            (now - sched->last_seen >= config->min_absence)) {
+            learn(sched, now - sched->last_seen);
+        }
+        sched->known = true;
+        sched->present = true;
+        sched->last_seen = now;
+        sched->misses = 0;
+        sched->backoff = config->backoff_min;
+        return config->present_interval > 0 ? config->present_interval : 1;
+    }
+    sched->present = false;
+    sched->misses++;
+    uint32_t elapsed = now - sched->last_seen;
+    // Before the first sighting, the time of the return is unknown.
+    if (sched->known && (sched->misses <= config->rescan_count)) {
+        delay = config->rescan_interval;
+    } else if (!sched->known || is_quiet(sched, elapsed)) {
+        delay = sched->backoff;
+        sched->backoff = sched->backoff > config->backoff_max / 2 ?
+                         config->backoff_max : sched->backoff * 2;
+        if (sched->known) {
+            delay = fit_windows(sched, elapsed, delay);
+        }
+    } else {
+        // The AP may be back at any time: it is probed as often as with
+        // scans at a fixed interval, and more often inside windows.
+        delay = fit_windows(sched, elapsed, config->backoff_min);
+    }
+    return delay > 0 ? delay : 1;
+
+}
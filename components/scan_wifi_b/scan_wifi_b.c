@@ -18,11 +18,16 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 
+#include "nvs_cache.h"
 #include "scan_wifi_b.h"
+#include "wifi_life.h"
 
 const char SWB_TAG[] = "SWB";
 
@@ -46,38 +51,47 @@ static const wifi_scan_config_t scan_config = {
 
 static const bool BLOCK = true;
 
-// ESP-NETIF instance.
-static esp_netif_t *netif_instance;
+// Targeted scan: one channel at a time. An AP answers a probe request
+// within a few ms.
+static const wifi_active_scan_time_t targeted_scan_time = {
+        .min = 10,
+        .max = 40
+};
 
-swb_status_t swb_scan_b(uint8_t ap_nb, wifi_ap_record_t *ap_records,
-                        uint8_t *found_ap_nb) {
+// Channels where most APs are, scanned right after the cached ones.
+static const uint8_t COMMON_CHANNELS[] = { 1, 6, 11 };
+// Used if the country settings can't be read.
+#define DEFAULT_CHANNEL_NB 13
+#define MAX_CHANNEL 14
 
-    esp_err_t esp_rs;   // Return status for ESP-IDF calls.
+// Records returned by a targeted scan of one channel.
+#define TARGETED_AP_NB 8
+static wifi_ap_record_t targeted_records[TARGETED_AP_NB];
 
-    netif_instance = esp_netif_create_default_wifi_sta();
-    if (netif_instance == NULL) {
-        ESP_LOGE(SWB_TAG, "Error from esp_netif_create_default_wifi_sta");
-        return SWB_ERROR;
-    }
+// Channel cache, kept in NVS: the channel where every SSID was last found.
+static const char NVS_NAMESPACE[] = "scan_wifi_b";
+static const char NVS_KEY[] = "channels";
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_rs = esp_wifi_init(&cfg);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(SWB_TAG, "Error from esp_wifi_init: %s", esp_err_to_name(esp_rs));
-        return SWB_ERROR;
-    }
+#define SSID_MAX_LENGTH 32
 
-    esp_rs = esp_wifi_set_mode(WIFI_MODE_STA);
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(SWB_TAG, "Error from esp_wifi_set_mode: %s", esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
-        return SWB_ERROR;
-    }
+typedef struct {
+    nvc_entry_t lru;
+    char ssid[SSID_MAX_LENGTH + 1];
+    uint8_t channel;
+} channel_entry_t;
 
-    // At this stage, Wi-Fi initialization is OK.
-    esp_rs = esp_wifi_start();
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(SWB_TAG, "Error from esp_wifi_start: %s", esp_err_to_name(esp_rs));
+static channel_entry_t entries[SWB_CACHE_ENTRIES];
+static bool entries_loaded = false;
+
+swb_status_t swb_scan_b(uint8_t ap_nb, wifi_ap_record_t *ap_records,
+                        uint8_t *found_ap_nb) {
+
+    esp_err_t esp_rs;   // Return status for ESP-IDF calls.
+
+    // The driver and the network interface are initialized at first scan,
+    // and kept, only the radio is started.
+    if (wfl_start(NULL) != WFL_OK) {
+        ESP_LOGE(SWB_TAG, "Error from wfl_start");
         return SWB_ERROR;
     }
 
@@ -85,8 +99,8 @@ swb_status_t swb_scan_b(uint8_t ap_nb, wifi_ap_record_t *ap_records,
     if (esp_rs != ESP_OK) {
         ESP_LOGE(SWB_TAG, "Error from esp_wifi_scan_start: %s",
                  esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
-        esp_netif_destroy(netif_instance);
+        // The scan has failed anyway, the result of the stop is ignored.
+        wfl_stop();
         return SWB_ERROR;
     }
 
@@ -96,8 +110,7 @@ swb_status_t swb_scan_b(uint8_t ap_nb, wifi_ap_record_t *ap_records,
     if (esp_rs != ESP_OK) {
         ESP_LOGE(SWB_TAG, "Error from esp_wifi_scan_get_ap_records: %s",
                  esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
-        esp_netif_destroy(netif_instance);
+        wfl_stop();
         return SWB_ERROR;
     }
     // Could be that next call is required, to release memory.
@@ -106,22 +119,15 @@ swb_status_t swb_scan_b(uint8_t ap_nb, wifi_ap_record_t *ap_records,
     if (esp_rs != ESP_OK) {
         ESP_LOGE(SWB_TAG, "Error from esp_wifi_scan_get_ap_num: %s",
                  esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
-        esp_netif_destroy(netif_instance);
+        wfl_stop();
         return SWB_ERROR;
     }
 
-    // Stop Wi-Fi.
-    esp_rs = esp_wifi_stop();
-    if (esp_rs != ESP_OK) {
-        ESP_LOGE(SWB_TAG, "Error from esp_wifi_stop: %s",
-                 esp_err_to_name(esp_rs));
-        esp_wifi_deinit();
-        esp_netif_destroy(netif_instance);
+    // Stop the radio, the driver is kept for next operation.
+    if (wfl_stop() != WFL_OK) {
+        ESP_LOGE(SWB_TAG, "Error from wfl_stop");
         return SWB_ERROR;
     }
-    esp_wifi_deinit();
-    esp_netif_destroy(netif_instance);
 
     // Return information.
     if (ap_count > (uint16_t)ap_nb) {
@@ -132,3 +138,194 @@ swb_status_t swb_scan_b(uint8_t ap_nb, wifi_ap_record_t *ap_records,
 
     return SWB_SUCCESS;
 }
+
+// Reads the cache, once. Entries are unused if there is none.
+static void load_entries(void) {
+
+    if (entries_loaded) {
+        return;
+    }
+    entries_loaded = true;
+    nvc_load(NVS_NAMESPACE, NVS_KEY, entries, sizeof(entries));
+
+}
+
+// Returns the cached channel of ssid, 0 if unknown.
+static uint8_t get_cached_channel(const char *ssid) {
+
+    for (int i = 0; i < SWB_CACHE_ENTRIES; i++) {
+        if ((entries[i].channel != 0) &&
+            (strcmp(entries[i].ssid, ssid) == 0)) {
+            return entries[i].channel;
+        }
+    }
+    return 0;
+
+}
+
+// Records the channel where ssid was found. NVS is written only if the
+// channel changed.
+static void set_cached_channel(const char *ssid, uint8_t channel) {
+
+    channel_entry_t *entry = NULL;
+
+    for (int i = 0; i < SWB_CACHE_ENTRIES; i++) {
+        if ((entries[i].channel != 0) &&
+            (strcmp(entries[i].ssid, ssid) == 0)) {
+            entry = &entries[i];
+        }
+    }
+    if ((entry != NULL) && (entry->channel == channel)) {
+        return;
+    }
+    if (entry == NULL) {
+        entry = nvc_lru_oldest(entries, sizeof(entries[0]),
+                               SWB_CACHE_ENTRIES);
+        memset(entry, 0, sizeof(*entry));
+        strncpy(entry->ssid, ssid, SSID_MAX_LENGTH);
+    }
+    entry->channel = channel;
+    nvc_lru_touch(entries, sizeof(entries[0]), SWB_CACHE_ENTRIES, entry);
+    nvc_save(NVS_NAMESPACE, NVS_KEY, entries, sizeof(entries));
+
+}
+
+// Adds channel to the list, if valid and not present yet.
+static void add_channel(uint8_t *channels, uint8_t *channel_nb,
+                        uint8_t channel, uint8_t first, uint8_t last) {
+
+    if ((channel < first) || (channel > last)) {
+        return;
+    }
+    for (uint8_t i = 0; i < *channel_nb; i++) {
+        if (channels[i] == channel) {
+            return;
+        }
+    }
+    channels[(*channel_nb)++] = channel;
+
+}
+
+// Builds the list of channels to scan, in order: channels where the SSIDs
+// were last found, common channels, and all other channels allowed by the
+// country settings.
+static uint8_t build_channels(const char *const *ssids, uint8_t ssid_nb,
+                              uint8_t *channels) {
+
+    wifi_country_t country;
+    uint8_t first = 1;
+    uint8_t last = DEFAULT_CHANNEL_NB;
+    uint8_t channel_nb = 0;
+
+    if ((esp_wifi_get_country(&country) == ESP_OK) && (country.nchan > 0)) {
+        first = country.schan;
+        last = country.schan + country.nchan - 1;
+        if (last > MAX_CHANNEL) {
+            last = MAX_CHANNEL;
+        }
+    }
+    for (uint8_t i = 0; i < ssid_nb; i++) {
+        add_channel(channels, &channel_nb, get_cached_channel(ssids[i]),
+                    first, last);
+    }
+    for (size_t i = 0; i < sizeof(COMMON_CHANNELS); i++) {
+        add_channel(channels, &channel_nb, COMMON_CHANNELS[i], first, last);
+    }
+    for (uint8_t channel = first; channel <= last; channel++) {
+        add_channel(channels, &channel_nb, channel, first, last);
+    }
+    return channel_nb;
+
+}
+
+// Scans one channel, for the given SSIDs.
+// Returned value:
+// - SWB_SUCCESS: *ap_record is the strongest AP found
+// - SWB_NOT_FOUND
+// - SWB_ERROR
+static swb_status_t scan_channel(const char *const *ssids, uint8_t ssid_nb,
+                                 uint8_t channel,
+                                 wifi_ap_record_t *ap_record) {
+
+    esp_err_t esp_rs;
+    uint16_t ap_nb = TARGETED_AP_NB;
+    wifi_scan_config_t config = {
+            // With one SSID, the probe request is sent for it only.
+            .ssid = ssid_nb == 1 ? (uint8_t *)ssids[0] : NULL,
+            .bssid = NULL,
+            .channel = channel,
+            .show_hidden = false,
+            .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+            .scan_time = {
+                    .active = targeted_scan_time,
+                    .passive = 0
+            }
+    };
+
+    esp_rs = esp_wifi_scan_start(&config, BLOCK);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(SWB_TAG, "Error from esp_wifi_scan_start: %s",
+                 esp_err_to_name(esp_rs));
+        return SWB_ERROR;
+    }
+    // Also releases the records which don't fit.
+    esp_rs = esp_wifi_scan_get_ap_records(&ap_nb, targeted_records);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(SWB_TAG, "Error from esp_wifi_scan_get_ap_records: %s",
+                 esp_err_to_name(esp_rs));
+        return SWB_ERROR;
+    }
+    // Records are ordered by decreasing RSSI.
+    for (uint16_t i = 0; i < ap_nb; i++) {
+        for (uint8_t j = 0; j < ssid_nb; j++) {
+            if (strcmp((const char *)targeted_records[i].ssid,
+                       ssids[j]) == 0) {
+                *ap_record = targeted_records[i];
+                return SWB_SUCCESS;
+            }
+        }
+    }
+    return SWB_NOT_FOUND;
+
+}
+
+swb_status_t swb_find_b(const char *const *ssids, uint8_t ssid_nb,
+                        wifi_ap_record_t *ap_record) {
+
+    uint8_t channels[MAX_CHANNEL];
+    uint8_t channel_nb;
+    swb_status_t swb_rs = SWB_NOT_FOUND;
+    int64_t start = esp_timer_get_time();
+
+    if ((ssids == NULL) || (ssid_nb == 0) || (ssid_nb > SWB_MAX_SSIDS) ||
+        (ap_record == NULL)) {
+        return SWB_ERROR;
+    }
+    for (uint8_t i = 0; i < ssid_nb; i++) {
+        if ((ssids[i] == NULL) || (strlen(ssids[i]) > SSID_MAX_LENGTH)) {
+            return SWB_ERROR;
+        }
+    }
+    if (wfl_start(NULL) != WFL_OK) {
+        ESP_LOGE(SWB_TAG, "Error from wfl_start");
+        return SWB_ERROR;
+    }
+    load_entries();
+    channel_nb = build_channels(ssids, ssid_nb, channels);
+    for (uint8_t i = 0; (i < channel_nb) && (swb_rs == SWB_NOT_FOUND); i++) {
+        swb_rs = scan_channel(ssids, ssid_nb, channels[i], ap_record);
+    }
+    if (wfl_stop() != WFL_OK) {
+        ESP_LOGE(SWB_TAG, "Error from wfl_stop");
+        return SWB_ERROR;
+    }
+    if (swb_rs == SWB_SUCCESS) {
+        ESP_LOGI(SWB_TAG, "%s found on channel %d in %lld ms",
+                 (const char *)ap_record->ssid, ap_record->primary,
+                 (long long)((esp_timer_get_time() - start) / 1000));
+        set_cached_channel((const char *)ap_record->ssid,
+                           ap_record->primary);
+    }
+    return swb_rs;
+
+}
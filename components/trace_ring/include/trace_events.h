@@ -0,0 +1,57 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   List of the trace events, shared by the components using trace_ring
+ *   and by the host decoder (tools/trace_decode.py), which reads this file
+ *   to name the events and their arguments. Events are identified by their
+ *   position in the list: a new event must be added at the end.
+ *
+ *   Every entry gives the name of the event, its component and short name
+ *   for the decoder, and the names of its two arguments. An empty name
+ *   means that the argument is not used. A name ending with _4cc means
+ *   that the argument holds up to 4 characters, see trace_ring_4cc().
+ */
+
+#ifndef TRACE_EVENTS_H_
+#define TRACE_EVENTS_H_
+
+#define TRACE_EVENTS(X) \
+    X(OTA_UPDATE_START, "ota", "update_start", "port", "") \
+    X(OTA_UPDATE_END, "ota", "update_end", "status", "duration_ms") \
+    X(OTA_HEADER, "ota", "header", "key_4cc", "value_length") \
+    X(OTA_RECEIVE, "ota", "receive", "length", "") \
+    X(OTA_ERASE, "ota", "erase", "offset", "length") \
+    X(OTA_WRITE, "ota", "write", "offset", "length") \
+    X(OTA_REFETCH, "ota", "refetch", "block", "") \
+    X(HTTP_CONNECT, "http", "connect", "resumed", "handshake_us") \
+    X(HTTP_RESPONSE, "http", "response", "status", "reused") \
+    X(CWB_EVENT, "cwb", "event", "base_4cc", "id") \
+    X(OTA_TUNE, "ota", "tune", "chunk_size", "throughput")
+
+typedef enum {
+#define TRACE_EVENT_ID(name, component, event, arg0, arg1) TRACE_##name,
+    TRACE_EVENTS(TRACE_EVENT_ID)
+#undef TRACE_EVENT_ID
+    TRACE_EVENT_COUNT,
+} trace_event_t;
+
+#endif /* TRACE_EVENTS_H_ */
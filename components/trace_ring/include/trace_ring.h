@@ -0,0 +1,105 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   This component records trace events in a ring buffer, as fixed-size
+ *   binary records: timestamp, core, event identifier and two arguments.
+ *   Recording an event takes a few hundred nanoseconds, does not format
+ *   anything, does not block, and can be done from any task, on any core,
+ *   or from an interrupt handler. When the ring is full, the oldest records
+ *   are overwritten.
+ *
+ *   Records are written to the console, as hexadecimal lines starting with
+ *   "TRC ", either on demand, or periodically by a low priority task. The
+ *   host decoder (tools/trace_decode.py) turns a console capture back into
+ *   a timeline.
+ *
+ * Usage:
+ *   Events are declared in trace_events.h, and recorded with
+ *   TRACE(<name>, <arg0>, <arg1>), which is empty if the component is
+ *   disabled in the configuration (TRACE_RING_ENABLED). Records are written
+ *   to the console by trace_ring_dump(), or by the task started by
+ *   trace_ring_start_drain(). Alternatively, they can be read with
+ *   trace_ring_read(), by one task only.
+ */
+
+#ifndef TRACE_RING_H_
+#define TRACE_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "trace_events.h"
+
+typedef struct {
+    // Index of the record, plus 1. Gaps mean lost records.
+    uint32_t sequence;
+    // Low 32 bits of esp_timer_get_time(), in microseconds.
+    uint32_t timestamp;
+    uint16_t event;
+    uint8_t core;
+    uint8_t reserved;
+    uint32_t args[2];
+} trace_record_t;
+
+#if CONFIG_TRACE_RING_ENABLED
+#define TRACE(event, arg0, arg1) \
+    trace_ring_record(TRACE_##event, (arg0), (arg1))
+#else
+#define TRACE(event, arg0, arg1) do {} while (0)
+#endif
+
+/**
+ * Records an event. Use TRACE() instead.
+ */
+void trace_ring_record(trace_event_t event, uint32_t arg0, uint32_t arg1);
+
+/**
+ * Packs the first 4 characters of a string in an argument, so that the
+ * decoder displays them.
+ */
+uint32_t trace_ring_4cc(const char *text);
+
+/**
+ * Reads at most count records, from the oldest one. lost is incremented by
+ * the number of records overwritten before they could be read. Returns the
+ * number of records read.
+ */
+size_t trace_ring_read(trace_record_t *records, size_t count,
+                       uint32_t *lost);
+
+/**
+ * Writes the records not read yet to the console. Does nothing if records
+ * are already being written by another task.
+ */
+void trace_ring_dump(void);
+
+/**
+ * Starts a task, with the lowest priority above the idle task, which calls
+ * trace_ring_dump() periodically (TRACE_RING_DRAIN_PERIOD_MS). Returns
+ * false if the task can't be created.
+ */
+bool trace_ring_start_drain(void);
+
+#endif /* TRACE_RING_H_ */
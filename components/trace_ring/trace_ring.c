@@ -0,0 +1,177 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+
+#include "trace_ring.h"
+
+// When tracing is disabled, nothing is recorded, but the API remains.
+#if CONFIG_TRACE_RING_ENABLED
+#define RING_SIZE CONFIG_TRACE_RING_SIZE
+#else
+#define RING_SIZE 1
+#endif
+
+#if (RING_SIZE & (RING_SIZE - 1)) != 0
+#error "CONFIG_TRACE_RING_SIZE must be a power of two"
+#endif
+
+#ifdef CONFIG_TRACE_RING_DRAIN_PERIOD_MS
+#define DRAIN_PERIOD_MS CONFIG_TRACE_RING_DRAIN_PERIOD_MS
+#else
+#define DRAIN_PERIOD_MS 1000
+#endif
+
+#define DRAIN_TASK_STACK_SIZE 3072
+// Records read at a time by trace_ring_dump().
+#define DUMP_BATCH 16
+
+// A slot is being written while its sequence is 0, and holds a complete
+// record once it is the record index plus 1.
+typedef struct {
+    atomic_uint_least32_t sequence;
+    trace_record_t record;
+} slot_t;
+
+static slot_t ring[RING_SIZE];
+// Index of next record to be written.
+static atomic_uint_least32_t head;
+// Index of next record to be read.
+static uint32_t tail;
+static atomic_flag reading = ATOMIC_FLAG_INIT;
+
+void trace_ring_record(trace_event_t event, uint32_t arg0, uint32_t arg1) {
+
+    uint32_t index = atomic_fetch_add_explicit(&head, 1,
+                                               memory_order_relaxed);
+    slot_t *slot = &ring[index & (RING_SIZE - 1)];
+
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->record.sequence = index + 1;
+    slot->record.timestamp = (uint32_t)esp_timer_get_time();
+    slot->record.event = event;
+    slot->record.core = xPortGetCoreID();
+    slot->record.args[0] = arg0;
+    slot->record.args[1] = arg1;
+    atomic_store_explicit(&slot->sequence, index + 1, memory_order_release);
+
+}
+
+uint32_t trace_ring_4cc(const char *text) {
+
+    uint32_t value = 0;
+
+    for (int i = 0; (i < 4) && (text[i] != '\0'); i++) {
+        value |= (uint32_t)(uint8_t)text[i] << (8 * i);
+    }
+    return value;
+
+}
+
+size_t trace_ring_read(trace_record_t *records, size_t count,
+                       uint32_t *lost) {
+
+    size_t read = 0;
+    uint32_t end = atomic_load_explicit(&head, memory_order_acquire);
+
+    if (end - tail > RING_SIZE) {
+        *lost += end - tail - RING_SIZE;
+        tail = end - RING_SIZE;
+    }
+    while ((tail != end) && (read < count)) {
+        slot_t *slot = &ring[tail & (RING_SIZE - 1)];
+        uint32_t sequence = atomic_load_explicit(&slot->sequence,
+                                                 memory_order_acquire);
+        if (sequence == tail + 1) {
+            records[read] = slot->record;
+            atomic_thread_fence(memory_order_acquire);
+            // The record may have been overwritten while being copied.
+            if (atomic_load_explicit(&slot->sequence,
+                                     memory_order_relaxed) == tail + 1) {
+                read++;
+            } else {
+                (*lost)++;
+            }
+        } else if ((int32_t)(sequence - (tail + 1)) > 0) {
+            // Already overwritten by a more recent record.
+            (*lost)++;
+        } else {
+            // Still being written: read it next time.
+            break;
+        }
+        tail++;
+    }
+    return read;
+
+}
+
+void trace_ring_dump(void) {
+
+    trace_record_t records[DUMP_BATCH];
+    uint32_t lost = 0;
+    size_t count;
+
+    if (atomic_flag_test_and_set(&reading)) {
+        return;
+    }
+    do {
+        count = trace_ring_read(records, DUMP_BATCH, &lost);
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t *bytes = (const uint8_t *)&records[i];
+            char line[4 + 2 * sizeof(trace_record_t) + 1];
+            memcpy(line, "TRC ", 4);
+            for (size_t j = 0; j < sizeof(trace_record_t); j++) {
+                snprintf(line + 4 + 2 * j, 3, "%02x", bytes[j]);
+            }
+            printf("%s\n", line);
+        }
+    } while (count == DUMP_BATCH);
+    if (lost > 0) {
+        printf("TRC lost %u\n", (unsigned int)lost);
+    }
+    atomic_flag_clear(&reading);
+
+}
+
+static void drain_task(void *arg) {
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(DRAIN_PERIOD_MS));
+        trace_ring_dump();
+    }
+
+}
+
+bool trace_ring_start_drain(void) {
+
+    return xTaskCreatePinnedToCore(drain_task, "trace_drain",
+                                   DRAIN_TASK_STACK_SIZE, NULL,
+                                   tskIDLE_PRIORITY + 1, NULL,
+                                   tskNO_AFFINITY) == pdPASS;
+
+}
@@ -0,0 +1,114 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   This component manages the lifecycle of the Wi-Fi driver shared by the
+ *   scan_wifi_b and conn_wifi_b components: the default station network
+ *   interface is created, and the driver initialized in station mode,
+ *   once, and both are kept between operations. Only the radio is started
+ *   and stopped by every operation.
+ *
+ *   Initializing the driver allocates, and deinitializing it frees, tens
+ *   of kB of heap, and takes hundreds of ms. Doing it for every scan, as
+ *   often as every 30 s, fragments the heap over days of uptime.
+ *
+ * Prerequisites:
+ *   - The NVS must be initialized (nvs_flash_init())
+ *   - The TCP/IP stack must be initialized (esp_netif_init())
+ *   - The default event loop must be started (esp_event_loop_create_default())
+ *
+ * Usage:
+ *   wfl_start() before an operation needing the radio, wfl_stop() after
+ *   it. wfl_start() initializes the driver, if not done yet. wfl_deinit()
+ *   releases the driver and the network interface, for instance before
+ *   another Wi-Fi mode is used: next wfl_start() initializes them again.
+ *
+ *   The functions can be called by several tasks.
+ */
+
+#ifndef WIFI_LIFE_H_
+#define WIFI_LIFE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern const char WFL_TAG[];
+
+// Status values.
+typedef enum {
+    WFL_OK,
+    WFL_ERROR,
+} wfl_status_t;
+
+// Activity of the driver, since startup.
+typedef struct {
+    // Number of driver initializations and deinitializations.
+    uint32_t inits;
+    uint32_t deinits;
+    // Number of radio starts and stops.
+    uint32_t starts;
+    uint32_t stops;
+} wfl_stats_t;
+
+/**
+ * Creates the default station network interface and initializes the
+ * driver in station mode, if not done yet.
+ *
+ * Returned value:
+ * - WFL_OK
+ * - WFL_ERROR: system error
+ */
+wfl_status_t wfl_init(void);
+
+/**
+ * Initializes the driver, if not done yet, and starts the radio, if not
+ * started yet. *started is set to true if the radio is started by this
+ * call: WIFI_EVENT_STA_START is then posted. started may be NULL.
+ *
+ * Returned value:
+ * - WFL_OK
+ * - WFL_ERROR: system error
+ */
+wfl_status_t wfl_start(bool *started);
+
+/**
+ * Stops the radio, if started. The driver and the network interface are
+ * kept. WIFI_EVENT_STA_STOP is posted if the radio was started.
+ *
+ * Returned value:
+ * - WFL_OK
+ * - WFL_ERROR: system error
+ */
+wfl_status_t wfl_stop(void);
+
+/**
+ * Stops the radio, deinitializes the driver, and destroys the network
+ * interface, if not done yet.
+ *
+ * Returned value:
+ * - WFL_OK
+ * - WFL_ERROR: system error
+ */
+wfl_status_t wfl_deinit(void);
+
+void wfl_get_stats(wfl_stats_t *stats);
+
+#endif /* WIFI_LIFE_H_ */
@@ -0,0 +1,204 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+
+#include "wifi_life.h"
+
+const char WFL_TAG[] = "WFL";
+
+// Serializes the operations on the driver. Created by the first caller.
+static StaticSemaphore_t lock_buffer;
+static SemaphoreHandle_t lock = NULL;
+static portMUX_TYPE lock_creation = portMUX_INITIALIZER_UNLOCKED;
+
+// ESP-NETIF instance, NULL if not created.
+static esp_netif_t *netif_instance = NULL;
+
+static bool initialized = false;
+static bool started = false;
+
+static wfl_stats_t stats;
+
+static void take_lock(void) {
+
+    if (lock == NULL) {
+        taskENTER_CRITICAL(&lock_creation);
+        if (lock == NULL) {
+            lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+        }
+        taskEXIT_CRITICAL(&lock_creation);
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+}
+
+static void give_lock(void) {
+
+    xSemaphoreGive(lock);
+
+}
+
+// Must be called with the lock taken.
+static wfl_status_t init_locked(void) {
+
+    esp_err_t esp_rs;
+
+    if (initialized) {
+        return WFL_OK;
+    }
+    if (netif_instance == NULL) {
+        netif_instance = esp_netif_create_default_wifi_sta();
+        if (netif_instance == NULL) {
+            ESP_LOGE(WFL_TAG, "Error from esp_netif_create_default_wifi_sta");
+            return WFL_ERROR;
+        }
+    }
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_rs = esp_wifi_init(&cfg);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(WFL_TAG, "Error from esp_wifi_init: %s",
+                 esp_err_to_name(esp_rs));
+        return WFL_ERROR;
+    }
+    esp_rs = esp_wifi_set_mode(WIFI_MODE_STA);
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(WFL_TAG, "Error from esp_wifi_set_mode: %s",
+                 esp_err_to_name(esp_rs));
+        esp_wifi_deinit();
+        return WFL_ERROR;
+    }
+    initialized = true;
+    stats.inits++;
+    ESP_LOGD(WFL_TAG, "Driver initialized");
+    return WFL_OK;
+
+}
+
+// Must be called with the lock taken.
+static wfl_status_t stop_locked(void) {
+
+    esp_err_t esp_rs;
+
+    if (!started) {
+        return WFL_OK;
+    }
+    esp_rs = esp_wifi_stop();
+    if (esp_rs != ESP_OK) {
+        ESP_LOGE(WFL_TAG, "Error from esp_wifi_stop: %s",
+                 esp_err_to_name(esp_rs));
+        return WFL_ERROR;
+    }
+    started = false;
+    stats.stops++;
+    return WFL_OK;
+
+}
+
+wfl_status_t wfl_init(void) {
+
+    take_lock();
+    wfl_status_t wfl_rs = init_locked();
+    give_lock();
+    return wfl_rs;
+
+}
+
+wfl_status_t wfl_start(bool *started_now) {
+
+    esp_err_t esp_rs;
+    wfl_status_t wfl_rs;
+
+    if (started_now != NULL) {
+        *started_now = false;
+    }
+    take_lock();
+    wfl_rs = init_locked();
+    if ((wfl_rs == WFL_OK) && !started) {
+        esp_rs = esp_wifi_start();
+        if (esp_rs != ESP_OK) {
+            ESP_LOGE(WFL_TAG, "Error from esp_wifi_start: %s",
+                     esp_err_to_name(esp_rs));
+            wfl_rs = WFL_ERROR;
+        } else {
+            started = true;
+            stats.starts++;
+            if (started_now != NULL) {
+                *started_now = true;
+            }
+        }
+    }
+    give_lock();
+    return wfl_rs;
+
+}
+
+wfl_status_t wfl_stop(void) {
+
+    take_lock();
+    wfl_status_t wfl_rs = stop_locked();
+    give_lock();
+    return wfl_rs;
+
+}
+
+wfl_status_t wfl_deinit(void) {
+
+    esp_err_t esp_rs;
+    wfl_status_t wfl_rs;
+
+    take_lock();
+    wfl_rs = stop_locked();
+    if ((wfl_rs == WFL_OK) && initialized) {
+        esp_rs = esp_wifi_deinit();
+        if (esp_rs != ESP_OK) {
+            ESP_LOGE(WFL_TAG, "Error from esp_wifi_deinit: %s",
+                     esp_err_to_name(esp_rs));
+            wfl_rs = WFL_ERROR;
+        } else {
+            initialized = false;
+            stats.deinits++;
+        }
+    }
+    if ((wfl_rs == WFL_OK) && (netif_instance != NULL)) {
+        // Also removes the default handlers of the interface.
+        esp_netif_destroy_default_wifi(netif_instance);
+        netif_instance = NULL;
+    }
+    give_lock();
+    return wfl_rs;
+
+}
+
+void wfl_get_stats(wfl_stats_t *stats_out) {
+
+    take_lock();
+    *stats_out = stats;
+    give_lock();
+
+}
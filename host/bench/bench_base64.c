@@ -0,0 +1,38 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Host program running the base64 benchmark of the ESP32 application
+ *   (main/base64_bench.h).
+ *
+ * Usage:
+ *   fuota_bench_base64
+ */
+
+#include <stdlib.h>
+
+#include "base64_bench.h"
+
+int main(void) {
+
+    return base64_bench_run() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+}
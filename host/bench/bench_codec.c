@@ -0,0 +1,535 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Benchmark of the decompression of update files: HSZ1 (ota_hsz.h), for
+ *   several window and lookahead sizes, against zlib, for several window
+ *   sizes. Every image given on the command line is compressed with each
+ *   configuration, then decompressed several times, from chunks of the
+ *   size of a TCP segment. The median run is reported as a JSON line:
+ *   compression ratio, decompression throughput in MB/s and peak heap
+ *   usage of the decompression.
+ *
+ *   HSZ1 files are compressed with the same greedy encoder as
+ *   tools/hsz_compress.py, zlib ones with the maximum compression level.
+ *
+ * Usage:
+ *   fuota_bench_codec [--runs <count>] [-o <file>] <image> ...
+ *   Results are printed, and appended to the file if given.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "esp_log.h"
+
+#include "ota_hsz.h"
+
+#include "bench_heap.h"
+
+#define MAX_RUNS 15
+// Size of the chunks given to the decompressors, a TCP segment.
+#define CHUNK_SIZE 1460
+// Size of the output buffer of zlib, the one of ota_hsz.
+#define ZLIB_OUT_BUF_SIZE OTA_HSZ_OUT_BUF_SIZE
+// Maximum number of candidate positions checked for each match, as
+// tools/hsz_compress.py.
+#define MAX_CHAIN 32
+#define HASH_BITS 16
+
+typedef enum {
+    CODEC_HSZ,
+    CODEC_ZLIB,
+} codec_t;
+
+typedef struct {
+    codec_t codec;
+    uint8_t window_bits;
+    // HSZ1 only.
+    uint8_t lookahead_bits;
+} config_t;
+
+static const config_t CONFIGS[] = {
+    { CODEC_HSZ, 8, 4 },
+    { CODEC_HSZ, 10, 5 },
+    { CODEC_HSZ, 12, 5 },
+    { CODEC_HSZ, 14, 6 },
+    { CODEC_ZLIB, 9, 0 },
+    { CODEC_ZLIB, 12, 0 },
+    { CODEC_ZLIB, 15, 0 },
+};
+
+// Tag of the log messages of ota_hsz, fuota_b.c not being linked.
+const char OTA_TAG[] = "OTA";
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} buffer_t;
+
+typedef struct {
+    uint8_t *out;
+    size_t length;
+    uint8_t acc;
+    uint8_t count;
+} bit_writer_t;
+
+// Measures of one run.
+typedef struct {
+    bool valid;
+    double wall_time;
+    size_t peak_heap;
+} run_t;
+
+static bool read_file(const char *path, buffer_t *buffer) {
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length <= 0) {
+        fprintf(stderr, "%s: empty or unreadable file\n", path);
+        fclose(file);
+        return false;
+    }
+    buffer->data = malloc(length);
+    buffer->length = length;
+    bool read_ok = (buffer->data != NULL) &&
+                   (fread(buffer->data, 1, length, file) == (size_t)length);
+    fclose(file);
+    if (!read_ok) {
+        fprintf(stderr, "%s: read error\n", path);
+        free(buffer->data);
+    }
+    return read_ok;
+
+}
+
+static void push_bits(bit_writer_t *writer, uint32_t value, uint8_t bits) {
+
+    while (bits > 0) {
+        bits--;
+        writer->acc = (writer->acc << 1) | ((value >> bits) & 1);
+        writer->count++;
+        if (writer->count == 8) {
+            writer->out[writer->length++] = writer->acc;
+            writer->acc = 0;
+            writer->count = 0;
+        }
+    }
+
+}
+
+static uint32_t hash3(const uint8_t *data) {
+
+    uint32_t value = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+
+}
+
+// Compresses the image into the HSZ1 format, with hash chains of 3-byte
+// prefixes.
+// Returned value:
+// - true: compressed
+// - false: not enough memory
+static bool compress_hsz(const buffer_t *image, const config_t *config,
+                         buffer_t *compressed) {
+
+    size_t n = image->length;
+    size_t window = (size_t)1 << config->window_bits;
+    size_t max_length = (size_t)1 << config->lookahead_bits;
+    size_t backref_bits = 1 + config->window_bits + config->lookahead_bits;
+
+    // A literal takes 9 bits: the output is at most 9/8 of the input.
+    compressed->capacity = OTA_HSZ_HEADER_LENGTH + n + n / 8 + 2;
+    compressed->data = malloc(compressed->capacity);
+    int32_t *heads = malloc(sizeof(int32_t) << HASH_BITS);
+    int32_t *previous = malloc(n * sizeof(int32_t));
+    if ((compressed->data == NULL) || (heads == NULL) || (previous == NULL)) {
+        free(compressed->data);
+        free(heads);
+        free(previous);
+        return false;
+    }
+    memset(heads, 0xFF, sizeof(int32_t) << HASH_BITS);
+
+    memcpy(compressed->data, OTA_HSZ_MAGIC, OTA_HSZ_MAGIC_LENGTH);
+    compressed->data[4] = config->window_bits;
+    compressed->data[5] = config->lookahead_bits;
+    compressed->data[6] = 0;
+    compressed->data[7] = 0;
+    bit_writer_t writer = {
+        .out = compressed->data + OTA_HSZ_HEADER_LENGTH,
+    };
+
+    size_t i = 0;
+    while (i < n) {
+        size_t best_length = 0;
+        size_t best_distance = 0;
+        size_t limit = n - i < max_length ? n - i : max_length;
+        if (i + 3 <= n) {
+            int32_t j = heads[hash3(image->data + i)];
+            for (int c = 0; (c < MAX_CHAIN) && (j >= 0); c++) {
+                if (i - j > window) {
+                    break;
+                }
+                size_t length = 0;
+                while ((length < limit) &&
+                       (image->data[j + length] == image->data[i + length])) {
+                    length++;
+                }
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = i - j;
+                    if (length == limit) {
+                        break;
+                    }
+                }
+                j = previous[j];
+            }
+        }
+        size_t step;
+        if (best_length * 9 > backref_bits) {
+            push_bits(&writer, 0, 1);
+            push_bits(&writer, best_distance - 1, config->window_bits);
+            push_bits(&writer, best_length - 1, config->lookahead_bits);
+            step = best_length;
+        } else {
+            push_bits(&writer, 1, 1);
+            push_bits(&writer, image->data[i], 8);
+            step = 1;
+        }
+        for (size_t k = i; (k < i + step) && (k + 3 <= n); k++) {
+            uint32_t hash = hash3(image->data + k);
+            previous[k] = heads[hash];
+            heads[hash] = k;
+        }
+        i += step;
+    }
+    if (writer.count > 0) {
+        writer.out[writer.length++] = writer.acc << (8 - writer.count);
+    }
+    compressed->length = OTA_HSZ_HEADER_LENGTH + writer.length;
+
+    free(heads);
+    free(previous);
+    return true;
+
+}
+
+// Returned value:
+// - true: compressed
+// - false: not enough memory, or zlib error
+static bool compress_zlib(const buffer_t *image, const config_t *config,
+                          buffer_t *compressed) {
+
+    z_stream stream = { 0 };
+
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED,
+                     config->window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    compressed->capacity = deflateBound(&stream, image->length);
+    compressed->data = malloc(compressed->capacity);
+    if (compressed->data == NULL) {
+        deflateEnd(&stream);
+        return false;
+    }
+    stream.next_in = image->data;
+    stream.avail_in = image->length;
+    stream.next_out = compressed->data;
+    stream.avail_out = compressed->capacity;
+    int z_rs = deflate(&stream, Z_FINISH);
+    compressed->length = stream.total_out;
+    deflateEnd(&stream);
+    if (z_rs != Z_STREAM_END) {
+        free(compressed->data);
+        return false;
+    }
+    return true;
+
+}
+
+// Output function of ota_hsz.
+static ota_status_t hsz_output(void *arg, const uint8_t *data,
+                               size_t length) {
+
+    buffer_t *output = arg;
+
+    if (output->length + length > output->capacity) {
+        return OTA_PARAM_ERR;
+    }
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+    return OTA_OK;
+
+}
+
+static bool decompress_hsz(const buffer_t *compressed, buffer_t *output) {
+
+    // The decoder state is allocated, as zlib's one.
+    ota_hsz_t *hsz = malloc(sizeof(ota_hsz_t));
+    if (hsz == NULL) {
+        return false;
+    }
+    ota_hsz_begin(hsz, hsz_output, output);
+    ota_status_t ota_rs = OTA_OK;
+    for (size_t offset = 0;
+         (offset < compressed->length) && (ota_rs == OTA_OK);
+         offset += CHUNK_SIZE) {
+        size_t length = compressed->length - offset;
+        if (length > CHUNK_SIZE) {
+            length = CHUNK_SIZE;
+        }
+        ota_rs = ota_hsz_write(hsz, compressed->data + offset, length);
+    }
+    ota_status_t end_rs = ota_hsz_end(hsz);
+    free(hsz);
+    return (ota_rs == OTA_OK) && (end_rs == OTA_OK);
+
+}
+
+// Allocation functions of zlib, so that its allocations are tracked: the
+// library itself is not linked with --wrap.
+static voidpf zlib_alloc(voidpf opaque, uInt items, uInt size) {
+
+    return calloc(items, size);
+
+}
+
+static void zlib_free(voidpf opaque, voidpf address) {
+
+    free(address);
+
+}
+
+// The window size is the one of the stream, as given by the first byte of
+// its header, so that only 2^W bytes are allocated for the window.
+static bool decompress_zlib(const buffer_t *compressed, uint8_t window_bits,
+                            buffer_t *output) {
+
+    uint8_t out_buf[ZLIB_OUT_BUF_SIZE];
+    z_stream *stream = calloc(1, sizeof(z_stream));
+
+    if (stream == NULL) {
+        return false;
+    }
+    stream->zalloc = zlib_alloc;
+    stream->zfree = zlib_free;
+    if (inflateInit2(stream, window_bits) != Z_OK) {
+        free(stream);
+        return false;
+    }
+    int z_rs = Z_OK;
+    for (size_t offset = 0;
+         (offset < compressed->length) && (z_rs == Z_OK);
+         offset += CHUNK_SIZE) {
+        size_t length = compressed->length - offset;
+        if (length > CHUNK_SIZE) {
+            length = CHUNK_SIZE;
+        }
+        stream->next_in = compressed->data + offset;
+        stream->avail_in = length;
+        // Output by chunks of at most ZLIB_OUT_BUF_SIZE bytes, as ota_hsz.
+        do {
+            stream->next_out = out_buf;
+            stream->avail_out = sizeof(out_buf);
+            z_rs = inflate(stream, Z_NO_FLUSH);
+            if (z_rs == Z_BUF_ERROR) {
+                // No progress possible: the chunk has been processed.
+                z_rs = Z_OK;
+            }
+            if ((z_rs != Z_OK) && (z_rs != Z_STREAM_END)) {
+                break;
+            }
+            size_t produced = sizeof(out_buf) - stream->avail_out;
+            if (hsz_output(output, out_buf, produced) != OTA_OK) {
+                z_rs = Z_DATA_ERROR;
+                break;
+            }
+        } while (stream->avail_out == 0);
+    }
+    inflateEnd(stream);
+    free(stream);
+    return z_rs == Z_STREAM_END;
+
+}
+
+static double get_time(void) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+
+}
+
+// Decompresses the file, and checks the result against the image.
+static void run_decompression(const config_t *config,
+                              const buffer_t *compressed,
+                              const buffer_t *image, buffer_t *output,
+                              run_t *run) {
+
+    output->length = 0;
+    bench_heap_reset_peak();
+    size_t heap_before = bench_heap_get_current();
+    double start = get_time();
+    bool decompressed = config->codec == CODEC_HSZ ?
+                        decompress_hsz(compressed, output) :
+                        decompress_zlib(compressed, config->window_bits,
+                                        output);
+    run->wall_time = get_time() - start;
+    run->peak_heap = bench_heap_get_peak() - heap_before;
+    run->valid = decompressed && (output->length == image->length) &&
+                 (memcmp(output->data, image->data, image->length) == 0);
+
+}
+
+static int compare_runs(const void *a, const void *b) {
+
+    double diff = ((const run_t *)a)->wall_time - ((const run_t *)b)->wall_time;
+    return (diff > 0) - (diff < 0);
+
+}
+
+static void report(FILE *output, const char *path, const buffer_t *image,
+                   const config_t *config, size_t compressed_length,
+                   const run_t *run) {
+
+    fprintf(output, "{\"image\": \"%s\", \"image_size\": %zu, "
+            "\"codec\": \"%s\", \"window_bits\": %u, ",
+            path, image->length,
+            config->codec == CODEC_HSZ ? "hsz1" : "zlib",
+            config->window_bits);
+    if (config->codec == CODEC_HSZ) {
+        fprintf(output, "\"lookahead_bits\": %u, ", config->lookahead_bits);
+    }
+    fprintf(output, "\"compressed_size\": %zu, \"ratio\": %.3f, "
+            "\"valid\": %s, \"mb_per_s\": %.1f, \"peak_heap\": %zu}\n",
+            compressed_length, (double)compressed_length / image->length,
+            run->valid ? "true" : "false",
+            image->length / (1024.0 * 1024.0) / run->wall_time,
+            run->peak_heap);
+
+}
+
+int main(int argc, char *argv[]) {
+
+    int runs = 5;
+    const char *output_path = NULL;
+    int first_image = 1;
+    run_t results[MAX_RUNS];
+
+    while (first_image < argc) {
+        if ((strcmp(argv[first_image], "--runs") == 0) &&
+            (first_image + 1 < argc)) {
+            runs = atoi(argv[first_image + 1]);
+            if ((runs <= 0) || (runs > MAX_RUNS)) {
+                break;
+            }
+        } else if ((strcmp(argv[first_image], "-o") == 0) &&
+                   (first_image + 1 < argc)) {
+            output_path = argv[first_image + 1];
+        } else {
+            break;
+        }
+        first_image += 2;
+    }
+    if ((first_image == argc) || (argv[first_image][0] == '-')) {
+        fprintf(stderr, "Usage: %s [--runs <count>] [-o <file>] "
+                "<image> ...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    FILE *output = NULL;
+    if (output_path != NULL) {
+        output = fopen(output_path, "a");
+        if (output == NULL) {
+            perror(output_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int failures = 0;
+    for (int i = first_image; i < argc; i++) {
+        buffer_t image;
+        if (!read_file(argv[i], &image)) {
+            failures++;
+            continue;
+        }
+        buffer_t decompressed = {
+            .data = malloc(image.length),
+            .capacity = image.length,
+        };
+        if (decompressed.data == NULL) {
+            fprintf(stderr, "Not enough memory\n");
+            return EXIT_FAILURE;
+        }
+        for (size_t c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); c++) {
+            const config_t *config = &CONFIGS[c];
+            buffer_t compressed;
+            bool compressed_ok = config->codec == CODEC_HSZ ?
+                                 compress_hsz(&image, config, &compressed) :
+                                 compress_zlib(&image, config, &compressed);
+            if (!compressed_ok) {
+                fprintf(stderr, "%s: compression failed\n", argv[i]);
+                failures++;
+                continue;
+            }
+            for (int r = 0; r < runs; r++) {
+                run_decompression(config, &compressed, &image, &decompressed,
+                                  &results[r]);
+            }
+            qsort(results, runs, sizeof(results[0]), compare_runs);
+            run_t *median = &results[runs / 2];
+            if (!median->valid) {
+                failures++;
+            }
+            report(stdout, argv[i], &image, config, compressed.length,
+                   median);
+            if (output != NULL) {
+                report(output, argv[i], &image, config, compressed.length,
+                       median);
+            }
+            free(compressed.data);
+        }
+        free(decompressed.data);
+        free(image.data);
+    }
+    if (output != NULL) {
+        fclose(output);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+}
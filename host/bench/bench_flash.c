@@ -0,0 +1,199 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "bench_flash.h"
+
+// Timing model, from typical datasheet values of the SPI NOR flash chips
+// of ESP32 modules, and from the 40 MHz QIO read speed.
+#define SECTOR_ERASE_US 45000
+#define PAGE_SIZE 256
+#define PAGE_PROGRAM_US 400
+#define READ_NS_PER_BYTE 50
+
+// Delays shorter than this are cumulated, as sleeping for a few
+// microseconds costs more than the delay itself.
+#define MIN_SLEEP_US 1000
+
+typedef struct {
+    ota_storage_t storage;
+    uint8_t *running;
+    uint8_t *update;
+    double latency;
+    // Simulated time not slept yet.
+    int64_t pending_us;
+    int64_t busy_time;
+} bench_flash_t;
+
+static bench_flash_t flash;
+
+// Blocks the calling task for the simulated duration of an operation,
+// cumulated with the previous ones until long enough to be slept.
+static void wait_for(int64_t duration_us) {
+
+    int64_t start = esp_timer_get_time();
+
+    flash.pending_us += duration_us * flash.latency;
+    if (flash.pending_us >= MIN_SLEEP_US) {
+        struct timespec delay = {
+            .tv_sec = flash.pending_us / 1000000,
+            .tv_nsec = (flash.pending_us % 1000000) * 1000,
+        };
+        nanosleep(&delay, NULL);
+        flash.pending_us = 0;
+    }
+    flash.busy_time += esp_timer_get_time() - start;
+
+}
+
+static ota_status_t flash_open(ota_storage_t *storage) {
+
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_read(ota_storage_t *storage,
+                               ota_storage_partition_t partition,
+                               uint32_t offset, void *data, size_t length) {
+
+    if ((offset > storage->update_size) ||
+        (length > storage->update_size - offset)) {
+        return OTA_SYS_ERR;
+    }
+    memcpy(data, (partition == OTA_STORAGE_RUNNING ? flash.running :
+                  flash.update) + offset, length);
+    wait_for(length * READ_NS_PER_BYTE / 1000);
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_get_running_sha256(ota_storage_t *storage,
+                                             uint8_t *sha) {
+
+    memset(sha, 0, OTA_STORAGE_ID_LENGTH);
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_begin(ota_storage_t *storage) {
+
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_erase(ota_storage_t *storage, uint32_t offset,
+                                size_t length) {
+
+    if ((offset % OTA_STORAGE_SECTOR_SIZE != 0) ||
+        (length % OTA_STORAGE_SECTOR_SIZE != 0) ||
+        (offset + length > storage->update_size)) {
+        ESP_LOGE(OTA_TAG, "bench_flash - Invalid erase: 0x%x", offset);
+        return OTA_SYS_ERR;
+    }
+    memset(flash.update + offset, 0xFF, length);
+    wait_for(length / OTA_STORAGE_SECTOR_SIZE * SECTOR_ERASE_US);
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_write(ota_storage_t *storage, uint32_t offset,
+                                const void *data, size_t length) {
+
+    if ((offset > storage->update_size) ||
+        (length > storage->update_size - offset)) {
+        ESP_LOGE(OTA_TAG, "bench_flash - Invalid write: 0x%x", offset);
+        return OTA_SYS_ERR;
+    }
+    // As flash memory, bits can only be cleared.
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        flash.update[offset + i] &= bytes[i];
+    }
+    // Pages are programmed one at a time, even partially.
+    uint32_t pages = (offset + length + PAGE_SIZE - 1) / PAGE_SIZE -
+                     offset / PAGE_SIZE;
+    wait_for(pages * PAGE_PROGRAM_US);
+    return OTA_OK;
+
+}
+
+static ota_status_t flash_end(ota_storage_t *storage) {
+
+    return OTA_OK;
+
+}
+
+static void flash_abort(ota_storage_t *storage) {
+
+}
+
+static const ota_storage_ops_t flash_ops = {
+    .open = flash_open,
+    .read = flash_read,
+    .get_running_sha256 = flash_get_running_sha256,
+    .begin = flash_begin,
+    .erase = flash_erase,
+    .write = flash_write,
+    .end = flash_end,
+    .abort = flash_abort,
+};
+
+ota_storage_t *bench_flash_init(uint32_t partition_size) {
+
+    flash.running = malloc(partition_size);
+    flash.update = malloc(partition_size);
+    if ((flash.running == NULL) || (flash.update == NULL)) {
+        free(flash.running);
+        free(flash.update);
+        return NULL;
+    }
+    srand(1);
+    for (uint32_t i = 0; i < partition_size; i++) {
+        flash.running[i] = rand();
+    }
+    memset(flash.update, 0xFF, partition_size);
+    flash.storage.ops = &flash_ops;
+    flash.storage.update_label = "bench";
+    flash.storage.update_size = partition_size;
+    flash.storage.running_size = partition_size;
+    memcpy(flash.storage.app_id, flash.running, OTA_STORAGE_ID_LENGTH);
+    return &flash.storage;
+
+}
+
+void bench_flash_set_latency(double factor) {
+
+    flash.latency = factor;
+    flash.pending_us = 0;
+    flash.busy_time = 0;
+
+}
+
+int64_t bench_flash_get_busy_time(void) {
+
+    return flash.busy_time;
+
+}
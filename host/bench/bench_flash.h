@@ -0,0 +1,58 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   RAM flash emulator of the benchmark, used as storage sink (see
+ *   ota_storage.h). Both partitions are in RAM. Erase, write and read
+ *   operations block the calling task for the time the ESP32 flash would
+ *   take, multiplied by a latency factor: 0 disables the timing model, 1
+ *   gives the typical timings of the SPI NOR flash of ESP32 modules.
+ *
+ * Usage:
+ *   bench_flash_init() once, then bench_flash_set_latency() before every
+ *   run, and pass the storage sink to ota_set_backends_b().
+ */
+
+#ifndef BENCH_FLASH_H_
+#define BENCH_FLASH_H_
+
+#include <stdint.h>
+
+#include "ota_storage.h"
+
+/**
+ * Allocates both partitions. The running partition is filled with a
+ * pseudo-random image. Returns NULL if there is not enough memory.
+ */
+ota_storage_t *bench_flash_init(uint32_t partition_size);
+
+/**
+ * Sets the latency factor, and resets the time spent in flash operations.
+ */
+void bench_flash_set_latency(double factor);
+
+/**
+ * Returns the time spent in flash operations since the last call to
+ * bench_flash_set_latency(), in microseconds.
+ */
+int64_t bench_flash_get_busy_time(void);
+
+#endif /* BENCH_FLASH_H_ */
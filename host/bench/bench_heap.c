@@ -0,0 +1,110 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "bench_heap.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static atomic_size_t current;
+static atomic_size_t peak;
+
+static void add(void *ptr) {
+
+    if (ptr == NULL) {
+        return;
+    }
+    size_t now = atomic_fetch_add(&current, malloc_usable_size(ptr)) +
+                 malloc_usable_size(ptr);
+    size_t highest = atomic_load(&peak);
+    while ((now > highest) &&
+           !atomic_compare_exchange_weak(&peak, &highest, now)) {
+    }
+
+}
+
+static void sub(void *ptr) {
+
+    if (ptr != NULL) {
+        atomic_fetch_sub(&current, malloc_usable_size(ptr));
+    }
+
+}
+
+void *__wrap_malloc(size_t size) {
+
+    void *ptr = __real_malloc(size);
+    add(ptr);
+    return ptr;
+
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+
+    void *ptr = __real_calloc(count, size);
+    add(ptr);
+    return ptr;
+
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+
+    sub(ptr);
+    void *new_ptr = __real_realloc(ptr, size);
+    if ((new_ptr == NULL) && (size != 0)) {
+        // The initial block is still allocated.
+        add(ptr);
+        return NULL;
+    }
+    add(new_ptr);
+    return new_ptr;
+
+}
+
+void __wrap_free(void *ptr) {
+
+    sub(ptr);
+    __real_free(ptr);
+
+}
+
+void bench_heap_reset_peak(void) {
+
+    atomic_store(&peak, atomic_load(&current));
+
+}
+
+size_t bench_heap_get_peak(void) {
+
+    return atomic_load(&peak);
+
+}
+
+size_t bench_heap_get_current(void) {
+
+    return atomic_load(&current);
+
+}
@@ -0,0 +1,54 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Heap usage tracking of the benchmark. The executable is linked with
+ *   --wrap for malloc(), calloc(), realloc() and free(), so that every
+ *   allocation, including the ones of the C library, goes through the
+ *   functions below.
+ *
+ * Usage:
+ *   bench_heap_reset_peak() before the measured code, then
+ *   bench_heap_get_peak().
+ */
+
+#ifndef BENCH_HEAP_H_
+#define BENCH_HEAP_H_
+
+#include <stddef.h>
+
+/**
+ * Sets the peak heap usage to the current usage.
+ */
+void bench_heap_reset_peak(void);
+
+/**
+ * Returns the highest heap usage, in bytes, since the last call to
+ * bench_heap_reset_peak().
+ */
+size_t bench_heap_get_peak(void);
+
+/**
+ * Returns the current heap usage, in bytes.
+ */
+size_t bench_heap_get_current(void);
+
+#endif /* BENCH_HEAP_H_ */
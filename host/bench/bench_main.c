@@ -0,0 +1,281 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Throughput benchmark of the update pipeline: download of an update file
+ *   from the in-process server, and writing of the image to the RAM flash
+ *   emulator. For every combination of image size, transport chunk size
+ *   and flash latency factor, the update is run several times, and the
+ *   median run is reported as a JSON line: throughput in MB/s, CPU time
+ *   per MB, peak heap usage above the one before the run, time spent in
+ *   flash operations.
+ *
+ *   The download buffer size (CONFIG_FUOTA_B_PIPE_BUFFER_SIZE) is a build
+ *   option: there is one executable per value, see host/CMakeLists.txt.
+ *
+ * Usage:
+ *   fuota_bench_<buffer size> [--sizes <list>] [--chunks <list>]
+ *                             [--latencies <list>] [--runs <count>]
+ *                             [-o <file>]
+ *   Lists are comma-separated. Sizes accept the K and M suffixes. Results
+ *   are printed, and appended to the file if given.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "fuota_b.h"
+
+#include "bench_flash.h"
+#include "bench_heap.h"
+#include "bench_server.h"
+
+#define MAX_VALUES 16
+#define MAX_RUNS 15
+// Largest flash of an ESP32 module.
+#define MAX_IMAGE_SIZE (16 * 1024 * 1024)
+
+static const char *STATUS_NAMES[] = {
+    "OTA_OK", "OTA_UPDATED", "OTA_PARAM_ERR", "OTA_NO_UPDATE",
+    "OTA_CONN_ERR", "OTA_SYS_ERR",
+};
+
+typedef struct {
+    double values[MAX_VALUES];
+    int count;
+} value_list_t;
+
+// Measures of one run.
+typedef struct {
+    ota_status_t status;
+    double wall_time;
+    double cpu_time;
+    size_t peak_heap;
+    double flash_busy_time;
+} run_t;
+
+// Parses a comma-separated list of values, with optional K and M suffixes.
+static bool parse_list(const char *text, value_list_t *list) {
+
+    char *end;
+
+    list->count = 0;
+    while (*text != '\0') {
+        if (list->count == MAX_VALUES) {
+            return false;
+        }
+        double value = strtod(text, &end);
+        if ((end == text) || (value < 0)) {
+            return false;
+        }
+        if (*end == 'K') {
+            value *= 1024;
+            end++;
+        } else if (*end == 'M') {
+            value *= 1024 * 1024;
+            end++;
+        }
+        if ((*end != ',') && (*end != '\0')) {
+            return false;
+        }
+        list->values[list->count++] = value;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return list->count > 0;
+
+}
+
+static double get_time(clockid_t clock) {
+
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+
+}
+
+static void run_update(run_t *run) {
+
+    ota_close_b();
+    bench_heap_reset_peak();
+    size_t heap_before = bench_heap_get_current();
+    double wall_start = get_time(CLOCK_MONOTONIC);
+    double cpu_start = get_time(CLOCK_PROCESS_CPUTIME_ID);
+    run->status = ota_update_b("bench", 443, "", "bench", "bench", "00001",
+                               "0.1.0");
+    run->wall_time = get_time(CLOCK_MONOTONIC) - wall_start;
+    run->cpu_time = get_time(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    run->peak_heap = bench_heap_get_peak() - heap_before;
+    run->flash_busy_time = bench_flash_get_busy_time() / 1e6;
+
+}
+
+static int compare_runs(const void *a, const void *b) {
+
+    double diff = ((const run_t *)a)->wall_time - ((const run_t *)b)->wall_time;
+    return (diff > 0) - (diff < 0);
+
+}
+
+static void report(FILE *output, uint32_t image_size, size_t chunk_size,
+                   double latency, const run_t *run) {
+
+    double mb = image_size / (1024.0 * 1024.0);
+
+    fprintf(output, "{\"pipe_buffer_size\": %d, \"image_size\": %u, "
+            "\"chunk_size\": %zu, \"flash_latency\": %g, \"status\": \"%s\", "
+            "\"mb_per_s\": %.3f, \"cpu_ms_per_mb\": %.3f, "
+            "\"peak_heap\": %zu, \"flash_busy_ms\": %.1f}\n",
+            CONFIG_FUOTA_B_PIPE_BUFFER_SIZE, image_size, chunk_size, latency,
+            STATUS_NAMES[run->status], mb / run->wall_time,
+            run->cpu_time * 1000 / mb, run->peak_heap,
+            run->flash_busy_time * 1000);
+
+}
+
+int main(int argc, char *argv[]) {
+
+    value_list_t sizes = { .values = { 256 * 1024, 1024 * 1024 }, .count = 2 };
+    value_list_t chunks = { .values = { 536, 1460, 4096 }, .count = 3 };
+    value_list_t latencies = { .values = { 0, 0.1 }, .count = 2 };
+    int runs = 3;
+    const char *output_path = NULL;
+    run_t results[MAX_RUNS];
+
+    for (int i = 1; i < argc; i++) {
+        bool valid = true;
+        if (i + 1 == argc) {
+            valid = false;
+        } else if (strcmp(argv[i], "--sizes") == 0) {
+            valid = parse_list(argv[++i], &sizes);
+        } else if (strcmp(argv[i], "--chunks") == 0) {
+            valid = parse_list(argv[++i], &chunks);
+        } else if (strcmp(argv[i], "--latencies") == 0) {
+            valid = parse_list(argv[++i], &latencies);
+        } else if (strcmp(argv[i], "--runs") == 0) {
+            runs = atoi(argv[++i]);
+            valid = (runs > 0) && (runs <= MAX_RUNS);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            output_path = argv[++i];
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            fprintf(stderr, "Usage: %s [--sizes <list>] [--chunks <list>] "
+                    "[--latencies <list>] [--runs <count>] [-o <file>]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Progress records and update check results are kept in a temporary
+    // directory.
+    char nvs_dir[] = "/tmp/fuota_bench_XXXXXX";
+    if (mkdtemp(nvs_dir) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    nvs_host_init(nvs_dir);
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    // Partitions are large enough for the largest image.
+    double largest_size = 0;
+    bool sizes_valid = true;
+    for (int i = 0; i < sizes.count; i++) {
+        if (sizes.values[i] < 1) {
+            sizes_valid = false;
+        }
+        if (sizes.values[i] > largest_size) {
+            largest_size = sizes.values[i];
+        }
+    }
+    if (!sizes_valid || (largest_size < 1) ||
+        (largest_size > MAX_IMAGE_SIZE)) {
+        fprintf(stderr, "Image sizes must be between 1 and %u bytes\n",
+                MAX_IMAGE_SIZE);
+        return EXIT_FAILURE;
+    }
+    uint32_t partition_size = ((uint32_t)largest_size +
+                               OTA_STORAGE_SECTOR_SIZE - 1) /
+                              OTA_STORAGE_SECTOR_SIZE *
+                              OTA_STORAGE_SECTOR_SIZE;
+    ota_storage_t *storage = bench_flash_init(partition_size);
+    uint8_t *image = malloc(partition_size);
+    if ((storage == NULL) || (image == NULL)) {
+        fprintf(stderr, "Not enough memory\n");
+        return EXIT_FAILURE;
+    }
+    // Pseudo-random content, with the magic byte of an application image.
+    srand(2);
+    for (uint32_t i = 0; i < partition_size; i++) {
+        image[i] = rand();
+    }
+    image[0] = 0xE9;
+    ota_set_backends_b(bench_server_create, storage);
+
+    FILE *output = NULL;
+    if (output_path != NULL) {
+        output = fopen(output_path, "a");
+        if (output == NULL) {
+            perror(output_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int failures = 0;
+    for (int s = 0; s < sizes.count; s++) {
+        for (int c = 0; c < chunks.count; c++) {
+            for (int l = 0; l < latencies.count; l++) {
+                uint32_t image_size = sizes.values[s];
+                size_t chunk_size = chunks.values[c];
+                bench_server_set(image, image_size, chunk_size);
+                for (int r = 0; r < runs; r++) {
+                    bench_flash_set_latency(latencies.values[l]);
+                    run_update(&results[r]);
+                }
+                qsort(results, runs, sizeof(results[0]), compare_runs);
+                run_t *median = &results[runs / 2];
+                if (median->status != OTA_UPDATED) {
+                    failures++;
+                }
+                report(stdout, image_size, chunk_size, latencies.values[l],
+                       median);
+                if (output != NULL) {
+                    report(output, image_size, chunk_size,
+                           latencies.values[l], median);
+                }
+            }
+        }
+    }
+    ota_close_b();
+    if (output != NULL) {
+        fclose(output);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+}
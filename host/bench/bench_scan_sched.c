@@ -0,0 +1,232 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+
+/**
+ * Overview:
+ *   Host program replaying a trace of sightings of the FUOTA AP, to
+ *   compare the adaptive scan scheduling of the scan_sched component with
+ *   scans at a fixed interval.
+ *
+ *   The trace gives the intervals during which the AP is reachable, one
+ *   per line, as "<start> <end>" in seconds from the start of the trace,
+ *   in increasing order. Lines starting with '#' are ignored. Such traces
+ *   are generated by tools/sighting_trace.py, or extracted from the
+ *   scan results logged by devices.
+ *
+ *   For every policy, a JSON line gives the number of scans, the scans
+ *   done while the AP was absent, the radio-on time, and the time needed
+ *   to detect the AP after its return: mean, 95th percentile and maximum.
+ *   A presence interval without any scan is missed.
+ *
+ * Usage:
+ *   fuota_scan_sim [-i <fixed interval>] [-d <scan duration>] [-o <file>]
+ *                  <trace file>
+ *   -i gives the interval of the fixed policy, in s, 30 by default. -d
+ *   gives the radio-on time of a scan, in ms, 50 by default. Results are
+ *   also appended to the -o file.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "scan_sched.h"
+
+#define MAX_INTERVALS 65536
+#define LINE_MAX_LENGTH 255
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} interval_t;
+
+static interval_t intervals[MAX_INTERVALS];
+static size_t interval_nb;
+// Detection latency of every interval, NOT_DETECTED if missed.
+#define NOT_DETECTED UINT32_MAX
+static uint32_t latencies[MAX_INTERVALS];
+
+// Returns the delay before the next scan.
+typedef uint32_t (*policy_t)(void *context, uint32_t now, bool seen);
+
+static uint32_t fixed_policy(void *context, uint32_t now, bool seen) {
+
+    return *(uint32_t *)context;
+
+}
+
+static uint32_t adaptive_policy(void *context, uint32_t now, bool seen) {
+
+    return scan_sched_report(context, now, seen);
+
+}
+
+static bool read_trace(const char *path) {
+
+    char line[LINE_MAX_LENGTH + 1];
+    unsigned int start;
+    unsigned int end;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return false;
+    }
+    interval_nb = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if ((line[0] == '#') || (line[0] == '\n')) {
+            continue;
+        }
+        if ((sscanf(line, "%u %u", &start, &end) != 2) || (end <= start) ||
+            ((interval_nb > 0) && (start < intervals[interval_nb - 1].end)) ||
+            (interval_nb == MAX_INTERVALS)) {
+            fprintf(stderr, "Invalid trace line: %s", line);
+            fclose(file);
+            return false;
+        }
+        intervals[interval_nb].start = start;
+        intervals[interval_nb].end = end;
+        interval_nb++;
+    }
+    fclose(file);
+    if (interval_nb == 0) {
+        fprintf(stderr, "Empty trace\n");
+        return false;
+    }
+    return true;
+
+}
+
+static int compare(const void *a, const void *b) {
+
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+
+}
+
+static void simulate(const char *name, policy_t policy, void *context,
+                     uint32_t scan_ms, const char *trace, FILE *out) {
+
+    uint32_t end = intervals[interval_nb - 1].end;
+    uint32_t scans = 0;
+    uint32_t absent_scans = 0;
+    uint32_t detected = 0;
+    uint64_t latency_sum = 0;
+    size_t k = 0;
+    char result[LINE_MAX_LENGTH + 1];
+
+    for (size_t i = 0; i < interval_nb; i++) {
+        latencies[i] = NOT_DETECTED;
+    }
+    for (uint32_t now = 0; now < end; ) {
+        while ((k < interval_nb) && (intervals[k].end <= now)) {
+            k++;
+        }
+        bool seen = (k < interval_nb) && (intervals[k].start <= now);
+        scans++;
+        if (!seen) {
+            absent_scans++;
+        } else if (latencies[k] == NOT_DETECTED) {
+            latencies[k] = now - intervals[k].start;
+            latency_sum += latencies[k];
+            detected++;
+        }
+        now += policy(context, now, seen);
+    }
+    // Missed intervals sort last.
+    qsort(latencies, interval_nb, sizeof(latencies[0]), compare);
+    snprintf(result, sizeof(result),
+             "{\"trace\": \"%s\", \"policy\": \"%s\", \"scans\": %u, "
+             "\"absent_scans\": %u, \"radio_on_s\": %.1f, "
+             "\"detected\": %u, \"missed\": %u, \"mean_latency_s\": %.1f, "
+             "\"p95_latency_s\": %u, \"max_latency_s\": %u}\n",
+             trace, name, scans, absent_scans,
+             (double)scans * scan_ms / 1000, detected,
+             (unsigned int)interval_nb - detected,
+             detected > 0 ? (double)latency_sum / detected : 0.0,
+             detected > 0 ? latencies[(detected - 1) * 95 / 100] : 0,
+             detected > 0 ? latencies[detected - 1] : 0);
+    fputs(result, stdout);
+    if (out != NULL) {
+        fputs(result, out);
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+
+    uint32_t interval = 30;
+    uint32_t scan_ms = 50;
+    const char *out_path = NULL;
+    FILE *out = NULL;
+    scan_sched_t sched;
+    scan_sched_config_t config = SCAN_SCHED_CONFIG_DEFAULT();
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:d:o:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            scan_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            interval = 0;
+            break;
+        }
+    }
+    if ((optind != argc - 1) || (interval == 0)) {
+        fprintf(stderr, "Usage: %s [-i <fixed interval>] "
+                "[-d <scan duration>] [-o <file>] <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!read_trace(argv[optind])) {
+        return EXIT_FAILURE;
+    }
+    if (out_path != NULL) {
+        out = fopen(out_path, "a");
+        if (out == NULL) {
+            fprintf(stderr, "Can't open %s\n", out_path);
+            return EXIT_FAILURE;
+        }
+    }
+    // Only the JSON lines are printed.
+    esp_log_level_set("*", ESP_LOG_WARN);
+    simulate("fixed", fixed_policy, &interval, scan_ms, argv[optind], out);
+    // The history is not loaded: the schedule learns from the trace only.
+    scan_sched_init(&sched, &config);
+    simulate("adaptive", adaptive_policy, &sched, scan_ms, argv[optind], out);
+    if (out != NULL) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,194 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "bench_server.h"
+
+static const char UPDATE_FILE[] = "bench.bin";
+static const char CHECK_PATH[] = "/devices/";
+static const char FILE_PATH[] = "/files/bench.bin";
+
+#define REQUEST_MAX_LENGTH 1024
+#define HEADER_MAX_LENGTH 256
+
+typedef struct {
+    ota_transport_t transport;
+    // Request being received.
+    char request[REQUEST_MAX_LENGTH + 1];
+    size_t request_length;
+    // Response being sent: header, then body.
+    char header[HEADER_MAX_LENGTH];
+    size_t header_length;
+    size_t header_offset;
+    const uint8_t *body;
+    size_t body_length;
+    size_t body_offset;
+} bench_server_t;
+
+static const uint8_t *served_image;
+static uint32_t served_size;
+static size_t served_chunk_size;
+
+// Prepares the response to the request received.
+static void respond(bench_server_t *server) {
+
+    char path[REQUEST_MAX_LENGTH + 1];
+    int status = 404;
+
+    server->body = NULL;
+    server->body_length = 0;
+    if (sscanf(server->request, "GET %1024s ", path) == 1) {
+        if (strncmp(path, CHECK_PATH, strlen(CHECK_PATH)) == 0) {
+            status = 200;
+            server->body = (const uint8_t *)UPDATE_FILE;
+            server->body_length = strlen(UPDATE_FILE);
+        } else if (strcmp(path, FILE_PATH) == 0) {
+            status = 200;
+            server->body = served_image;
+            server->body_length = served_size;
+        }
+    }
+    server->header_length = snprintf(server->header, sizeof(server->header),
+                                     "HTTP/1.1 %d %s\r\n"
+                                     "Content-Length: %u\r\n"
+                                     "\r\n",
+                                     status, status == 200 ? "OK" : "Not Found",
+                                     (unsigned int)server->body_length);
+    server->header_offset = 0;
+    server->body_offset = 0;
+
+}
+
+static ota_status_t server_connect(ota_transport_t *transport) {
+
+    bench_server_t *server = (bench_server_t *)transport;
+
+    server->request_length = 0;
+    server->header_length = 0;
+    server->header_offset = 0;
+    server->body_length = 0;
+    server->body_offset = 0;
+    transport->resumed = false;
+    transport->connected = true;
+    return OTA_OK;
+
+}
+
+static int server_read(ota_transport_t *transport, uint8_t *data,
+                       size_t length) {
+
+    bench_server_t *server = (bench_server_t *)transport;
+    size_t step;
+
+    if (length > served_chunk_size) {
+        length = served_chunk_size;
+    }
+    if (server->header_offset < server->header_length) {
+        step = server->header_length - server->header_offset;
+        step = step < length ? step : length;
+        memcpy(data, server->header + server->header_offset, step);
+        server->header_offset += step;
+        return step;
+    }
+    step = server->body_length - server->body_offset;
+    if (step == 0) {
+        // The client never reads beyond a response.
+        ESP_LOGE(OTA_TAG, "bench_server - Read without response");
+        return -1;
+    }
+    step = step < length ? step : length;
+    memcpy(data, server->body + server->body_offset, step);
+    server->body_offset += step;
+    return step;
+
+}
+
+static ota_status_t server_write(ota_transport_t *transport,
+                                 const uint8_t *data, size_t length) {
+
+    bench_server_t *server = (bench_server_t *)transport;
+
+    if (server->request_length + length > REQUEST_MAX_LENGTH) {
+        ESP_LOGE(OTA_TAG, "bench_server - Request too long");
+        return OTA_CONN_ERR;
+    }
+    memcpy(server->request + server->request_length, data, length);
+    server->request_length += length;
+    server->request[server->request_length] = '\0';
+    if (strstr(server->request, "\r\n\r\n") != NULL) {
+        respond(server);
+        server->request_length = 0;
+    }
+    return OTA_OK;
+
+}
+
+static void server_close(ota_transport_t *transport) {
+
+    transport->connected = false;
+
+}
+
+static void server_destroy(ota_transport_t *transport) {
+
+    free(transport);
+
+}
+
+static const ota_transport_ops_t server_ops = {
+    .connect = server_connect,
+    .read = server_read,
+    .write = server_write,
+    .close = server_close,
+    .destroy = server_destroy,
+};
+
+void bench_server_set(const uint8_t *image, uint32_t image_size,
+                      size_t chunk_size) {
+
+    served_image = image;
+    served_size = image_size;
+    served_chunk_size = chunk_size;
+
+}
+
+ota_status_t bench_server_create(const char *host, uint16_t port,
+                                 const char *cert_pem, uint32_t timeout_ms,
+                                 ota_transport_t **transport) {
+
+    if (strlen(host) > OTA_TRANSPORT_HOST_MAX_LENGTH) {
+        return OTA_PARAM_ERR;
+    }
+    bench_server_t *server = calloc(1, sizeof(*server));
+    if (server == NULL) {
+        return OTA_SYS_ERR;
+    }
+    server->transport.ops = &server_ops;
+    strcpy(server->transport.host, host);
+    server->transport.port = port;
+    *transport = &server->transport;
+    return OTA_OK;
+
+}
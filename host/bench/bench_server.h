@@ -0,0 +1,57 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   In-process update server of the benchmark, used as transport (see
+ *   ota_transport.h): requests are parsed as they are written, and
+ *   responses are read from memory, by chunks of at most the configured
+ *   size, as they would arrive from a TCP connection. The server answers
+ *   the update check with an update file, which is the configured image,
+ *   and has no block manifest.
+ *
+ * Usage:
+ *   bench_server_set(), then pass bench_server_create() to
+ *   ota_set_backends_b().
+ */
+
+#ifndef BENCH_SERVER_H_
+#define BENCH_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ota_transport.h"
+
+/**
+ * Sets the image served, and the largest number of bytes returned by a
+ * read operation. The image is not copied.
+ */
+void bench_server_set(const uint8_t *image, uint32_t image_size,
+                      size_t chunk_size);
+
+/**
+ * See ota_transport_create_t in fuota_b.h. The certificate is ignored.
+ */
+ota_status_t bench_server_create(const char *host, uint16_t port,
+                                 const char *cert_pem, uint32_t timeout_ms,
+                                 ota_transport_t **transport);
+
+#endif /* BENCH_SERVER_H_ */
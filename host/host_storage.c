@@ -0,0 +1,339 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "host_storage.h"
+
+// Application image format: header, segments, each one with a header,
+// padding and checksum byte, and optional SHA-256 of all this.
+#define IMAGE_MAGIC 0xE9
+#define IMAGE_HEADER_LENGTH 24
+#define SEGMENT_COUNT_OFFSET 1
+#define HASH_APPENDED_OFFSET 23
+#define SEGMENT_HEADER_LENGTH 8
+#define CHECKSUM_SEED 0xEF
+#define SHA256_LENGTH 32
+
+typedef struct {
+    ota_storage_t storage;
+    const char *running_path;
+    const char *update_path;
+    // Running image, padded with 0xFF up to the partition size.
+    uint8_t *running;
+    uint32_t running_length;
+    int update_fd;
+} host_storage_t;
+
+static host_storage_t host;
+
+// Buffer for erase operations and image validation.
+#define BUF_SIZE OTA_STORAGE_SECTOR_SIZE
+static uint8_t buf[BUF_SIZE];
+
+static ota_status_t load_running(void) {
+
+    FILE *file = fopen(host.running_path, "rb");
+    if (file == NULL) {
+        ESP_LOGE(OTA_TAG, "host_storage - Can't open %s: %s",
+                 host.running_path, strerror(errno));
+        return OTA_SYS_ERR;
+    }
+    free(host.running);
+    host.running = malloc(host.storage.running_size);
+    if (host.running == NULL) {
+        fclose(file);
+        return OTA_SYS_ERR;
+    }
+    memset(host.running, 0xFF, host.storage.running_size);
+    host.running_length = fread(host.running, 1, host.storage.running_size,
+                                file);
+    bool too_large = fgetc(file) != EOF;
+    fclose(file);
+    if (too_large || (host.running_length < SHA256_LENGTH)) {
+        ESP_LOGE(OTA_TAG, "host_storage - Invalid running image size");
+        return OTA_SYS_ERR;
+    }
+    mbedtls_sha256_ret(host.running, host.running_length, host.storage.app_id,
+                       0);
+    return OTA_OK;
+
+}
+
+static ota_status_t open_update(void) {
+
+    if (host.update_fd >= 0) {
+        return OTA_OK;
+    }
+    host.update_fd = open(host.update_path, O_RDWR);
+    if ((host.update_fd < 0) && (errno == ENOENT)) {
+        host.update_fd = open(host.update_path, O_RDWR | O_CREAT, 0644);
+        memset(buf, 0xFF, BUF_SIZE);
+        for (uint32_t offset = 0; (host.update_fd >= 0) &&
+             (offset < host.storage.update_size); offset += BUF_SIZE) {
+            if (pwrite(host.update_fd, buf, BUF_SIZE, offset) != BUF_SIZE) {
+                close(host.update_fd);
+                host.update_fd = -1;
+            }
+        }
+    }
+    if (host.update_fd < 0) {
+        ESP_LOGE(OTA_TAG, "host_storage - Can't open %s: %s",
+                 host.update_path, strerror(errno));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t host_open(ota_storage_t *storage) {
+
+    ota_status_t ota_rs = load_running();
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    return open_update();
+
+}
+
+static ota_status_t host_read(ota_storage_t *storage,
+                              ota_storage_partition_t partition,
+                              uint32_t offset, void *data, size_t length) {
+
+    uint32_t size = (partition == OTA_STORAGE_RUNNING) ? storage->running_size :
+                                                         storage->update_size;
+    if ((offset > size) || (length > size - offset)) {
+        ESP_LOGE(OTA_TAG, "host_storage - Read out of partition: 0x%x",
+                 offset);
+        return OTA_SYS_ERR;
+    }
+    if (partition == OTA_STORAGE_RUNNING) {
+        memcpy(data, host.running + offset, length);
+        return OTA_OK;
+    }
+    if (pread(host.update_fd, data, length, offset) != (ssize_t)length) {
+        ESP_LOGE(OTA_TAG, "host_storage - Read error: %s", strerror(errno));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t host_get_running_sha256(ota_storage_t *storage,
+                                            uint8_t *sha) {
+
+    memcpy(sha, host.running + host.running_length - SHA256_LENGTH,
+           SHA256_LENGTH);
+    return OTA_OK;
+
+}
+
+static ota_status_t host_begin(ota_storage_t *storage) {
+
+    // The partition is erased by the caller, as the download goes.
+    return OTA_OK;
+
+}
+
+static ota_status_t host_erase(ota_storage_t *storage, uint32_t offset,
+                               size_t length) {
+
+    if ((offset % OTA_STORAGE_SECTOR_SIZE != 0) ||
+        (length % OTA_STORAGE_SECTOR_SIZE != 0) ||
+        (offset + length > storage->update_size)) {
+        ESP_LOGE(OTA_TAG, "host_storage - Invalid erase: 0x%x, 0x%x",
+                 offset, (unsigned int)length);
+        return OTA_SYS_ERR;
+    }
+    memset(buf, 0xFF, BUF_SIZE);
+    for (; length > 0; offset += BUF_SIZE, length -= BUF_SIZE) {
+        if (pwrite(host.update_fd, buf, BUF_SIZE, offset) != BUF_SIZE) {
+            ESP_LOGE(OTA_TAG, "host_storage - Erase error: %s",
+                     strerror(errno));
+            return OTA_SYS_ERR;
+        }
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t host_write(ota_storage_t *storage, uint32_t offset,
+                               const void *data, size_t length) {
+
+    const uint8_t *bytes = data;
+    size_t step;
+
+    if ((offset > storage->update_size) ||
+        (length > storage->update_size - offset)) {
+        ESP_LOGE(OTA_TAG, "host_storage - Write out of partition: 0x%x",
+                 offset);
+        return OTA_SYS_ERR;
+    }
+    // As flash memory, a byte must be erased before being written.
+    for (size_t done = 0; done < length; done += step) {
+        step = length - done;
+        if (step > BUF_SIZE) {
+            step = BUF_SIZE;
+        }
+        if (pread(host.update_fd, buf, step, offset + done) != (ssize_t)step) {
+            return OTA_SYS_ERR;
+        }
+        for (size_t i = 0; i < step; i++) {
+            if (buf[i] != 0xFF) {
+                ESP_LOGE(OTA_TAG, "host_storage - Write to non erased byte: 0x%x",
+                         (unsigned int)(offset + done + i));
+                return OTA_SYS_ERR;
+            }
+        }
+    }
+    if (pwrite(host.update_fd, bytes, length, offset) != (ssize_t)length) {
+        ESP_LOGE(OTA_TAG, "host_storage - Write error: %s", strerror(errno));
+        return OTA_SYS_ERR;
+    }
+    return OTA_OK;
+
+}
+
+// Reads length bytes of the update partition, and adds them to the hash
+// and to the checksum, if not NULL.
+static ota_status_t read_image(uint32_t offset, uint32_t length,
+                               mbedtls_sha256_context *sha, uint8_t *checksum) {
+
+    size_t step;
+
+    for (; length > 0; offset += step, length -= step) {
+        step = length > BUF_SIZE ? BUF_SIZE : length;
+        if ((offset + step > host.storage.update_size) ||
+            (pread(host.update_fd, buf, step, offset) != (ssize_t)step)) {
+            return OTA_PARAM_ERR;
+        }
+        mbedtls_sha256_update_ret(sha, buf, step);
+        for (size_t i = 0; (checksum != NULL) && (i < step); i++) {
+            *checksum ^= buf[i];
+        }
+    }
+    return OTA_OK;
+
+}
+
+// Checks the image written, as the bootloader does: its segments, its
+// checksum and, if appended, its SHA-256. Images without any segment, such
+// as test images, are only checked for their magic.
+static ota_status_t host_end(ota_storage_t *storage) {
+
+    mbedtls_sha256_context sha;
+    uint8_t hash[SHA256_LENGTH];
+    uint8_t header[IMAGE_HEADER_LENGTH];
+    uint8_t segment[SEGMENT_HEADER_LENGTH];
+    uint8_t checksum = CHECKSUM_SEED;
+    uint32_t offset = IMAGE_HEADER_LENGTH;
+    ota_status_t ota_rs = OTA_OK;
+
+    fsync(host.update_fd);
+    if ((pread(host.update_fd, header, sizeof(header), 0) != sizeof(header)) ||
+        (header[0] != IMAGE_MAGIC)) {
+        ESP_LOGE(OTA_TAG, "host_storage - Invalid image magic");
+        return OTA_PARAM_ERR;
+    }
+    if (header[SEGMENT_COUNT_OFFSET] == 0) {
+        ESP_LOGW(OTA_TAG, "host_storage - Image without segment, not checked");
+        return OTA_OK;
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    mbedtls_sha256_update_ret(&sha, header, sizeof(header));
+    for (int i = 0; (i < header[SEGMENT_COUNT_OFFSET]) && (ota_rs == OTA_OK);
+         i++) {
+        ota_rs = read_image(offset, sizeof(segment), &sha, NULL);
+        memcpy(segment, buf, sizeof(segment));
+        uint32_t length = segment[4] | (segment[5] << 8) | (segment[6] << 16) |
+                          ((uint32_t)segment[7] << 24);
+        if ((ota_rs == OTA_OK) && (length <= storage->update_size)) {
+            ota_rs = read_image(offset + sizeof(segment), length, &sha,
+                                &checksum);
+        }
+        offset += sizeof(segment) + length;
+    }
+    // The checksum is the last byte of a 16-byte aligned block.
+    uint32_t checksum_offset = (offset | 0x0F);
+    if (ota_rs == OTA_OK) {
+        ota_rs = read_image(offset, checksum_offset + 1 - offset, &sha, NULL);
+    }
+    if ((ota_rs != OTA_OK) || (buf[checksum_offset - offset] != checksum)) {
+        mbedtls_sha256_free(&sha);
+        ESP_LOGE(OTA_TAG, "host_storage - Invalid image segments or checksum");
+        return OTA_PARAM_ERR;
+    }
+    mbedtls_sha256_finish_ret(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    uint32_t image_size = checksum_offset + 1;
+    if (header[HASH_APPENDED_OFFSET] == 1) {
+        if ((pread(host.update_fd, buf, SHA256_LENGTH, image_size) !=
+             SHA256_LENGTH) || (memcmp(buf, hash, SHA256_LENGTH) != 0)) {
+            ESP_LOGE(OTA_TAG, "host_storage - Image hash mismatch");
+            return OTA_PARAM_ERR;
+        }
+        image_size += SHA256_LENGTH;
+    }
+    ESP_LOGI(OTA_TAG, "host_storage - Valid image of %u bytes", image_size);
+    return OTA_OK;
+
+}
+
+static void host_abort(ota_storage_t *storage) {
+
+    // The partition is left as is, as flash memory would be.
+
+}
+
+static const ota_storage_ops_t host_ops = {
+    .open = host_open,
+    .read = host_read,
+    .get_running_sha256 = host_get_running_sha256,
+    .begin = host_begin,
+    .erase = host_erase,
+    .write = host_write,
+    .end = host_end,
+    .abort = host_abort,
+};
+
+ota_storage_t *host_storage_init(const char *running_path,
+                                 const char *update_path,
+                                 uint32_t partition_size) {
+
+    host.storage.ops = &host_ops;
+    host.storage.update_label = update_path;
+    host.storage.update_size = partition_size;
+    host.storage.running_size = partition_size;
+    host.running_path = running_path;
+    host.update_path = update_path;
+    host.update_fd = -1;
+    return &host.storage;
+
+}
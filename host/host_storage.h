@@ -0,0 +1,52 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Storage sink of the host build (see ota_storage.h). The running
+ *   partition is an image file, read at open. The update partition is a
+ *   file of the partition size, created erased (0xFF) if it does not exist,
+ *   and kept between runs, as flash memory would be.
+ *
+ *   The SHA-256 of the running image is, as for an ESP-IDF application
+ *   image, its last 32 bytes. The running application is identified by
+ *   the SHA-256 of the whole image file.
+ *
+ * Usage:
+ *   host_storage_init(), then pass the returned storage sink to
+ *   ota_set_backends_b().
+ */
+
+#ifndef HOST_STORAGE_H_
+#define HOST_STORAGE_H_
+
+#include <stdint.h>
+
+#include "ota_storage.h"
+
+/**
+ * Sets the files used as partitions. partition_size is the size of both
+ * partitions, a multiple of OTA_STORAGE_SECTOR_SIZE.
+ */
+ota_storage_t *host_storage_init(const char *running_path,
+                                 const char *update_path,
+                                 uint32_t partition_size);
+
+#endif /* HOST_STORAGE_H_ */
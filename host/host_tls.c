@@ -0,0 +1,307 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "host_tls.h"
+
+typedef struct {
+    ota_transport_t transport;
+    uint32_t timeout_ms;
+    int fd;
+    SSL_CTX *ctx;
+    SSL *ssl;
+} host_tls_t;
+
+// Session of the last server, resumed by next connection to it. The streams
+// of a parallel download connect from their own threads: the cache is
+// accessed under session_lock only.
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static SSL_SESSION *cached_session = NULL;
+static char cached_server[OTA_TRANSPORT_HOST_MAX_LENGTH + 7];
+
+static void log_ssl_error(const char *message) {
+
+    unsigned long error = ERR_get_error();
+    ESP_LOGE(OTA_TAG, "host_tls - %s: %s", message,
+             error != 0 ? ERR_reason_error_string(error) : "no details");
+    ERR_clear_error();
+
+}
+
+static void tls_close(ota_transport_t *transport) {
+
+    host_tls_t *tls = (host_tls_t *)transport;
+
+    if (tls->ssl != NULL) {
+        if (transport->connected) {
+            // With TLS 1.3, the session ticket is received after the
+            // handshake: the session is saved once the connection was used.
+            SSL_SESSION *session = SSL_get1_session(tls->ssl);
+            if ((session != NULL) && SSL_SESSION_is_resumable(session)) {
+                pthread_mutex_lock(&session_lock);
+                SSL_SESSION_free(cached_session);
+                cached_session = session;
+                snprintf(cached_server, sizeof(cached_server), "%s:%u",
+                         transport->host, transport->port);
+                pthread_mutex_unlock(&session_lock);
+            } else {
+                SSL_SESSION_free(session);
+            }
+            SSL_shutdown(tls->ssl);
+        }
+        SSL_free(tls->ssl);
+        tls->ssl = NULL;
+    }
+    if (tls->fd >= 0) {
+        close(tls->fd);
+        tls->fd = -1;
+    }
+    transport->connected = false;
+
+}
+
+static ota_status_t open_socket(host_tls_t *tls) {
+
+    struct addrinfo hints;
+    struct addrinfo *addresses;
+    char port[6];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", tls->transport.port);
+    int64_t start = esp_timer_get_time();
+    int ret = getaddrinfo(tls->transport.host, port, &hints, &addresses);
+    tls->transport.dns_time = esp_timer_get_time() - start;
+    if (ret != 0) {
+        ESP_LOGE(OTA_TAG, "host_tls - Can't resolve %s: %s",
+                 tls->transport.host, gai_strerror(ret));
+        return OTA_CONN_ERR;
+    }
+    start = esp_timer_get_time();
+    struct timeval timeout = {
+        .tv_sec = tls->timeout_ms / 1000,
+        .tv_usec = (tls->timeout_ms % 1000) * 1000,
+    };
+    for (struct addrinfo *address = addresses; address != NULL;
+         address = address->ai_next) {
+        tls->fd = socket(address->ai_family, address->ai_socktype,
+                         address->ai_protocol);
+        if (tls->fd < 0) {
+            continue;
+        }
+        setsockopt(tls->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(tls->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(tls->fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(tls->fd);
+        tls->fd = -1;
+    }
+    freeaddrinfo(addresses);
+    tls->transport.tcp_time = esp_timer_get_time() - start;
+    if (tls->fd < 0) {
+        ESP_LOGE(OTA_TAG, "host_tls - Can't connect to %s:%u",
+                 tls->transport.host, tls->transport.port);
+        return OTA_CONN_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static ota_status_t tls_connect(ota_transport_t *transport) {
+
+    host_tls_t *tls = (host_tls_t *)transport;
+    char server[sizeof(cached_server)];
+
+    tls_close(transport);
+    transport->dns_time = 0;
+    transport->tcp_time = 0;
+    transport->handshake_time = 0;
+    transport->resumed = false;
+    ota_status_t ota_rs = open_socket(tls);
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    tls->ssl = SSL_new(tls->ctx);
+    if ((tls->ssl == NULL) || (SSL_set_fd(tls->ssl, tls->fd) != 1) ||
+        (SSL_set_tlsext_host_name(tls->ssl, transport->host) != 1) ||
+        (SSL_set1_host(tls->ssl, transport->host) != 1)) {
+        log_ssl_error("Can't set up connection");
+        tls_close(transport);
+        return OTA_CONN_ERR;
+    }
+    snprintf(server, sizeof(server), "%s:%u", transport->host, transport->port);
+    // The connection takes its own reference to the session.
+    pthread_mutex_lock(&session_lock);
+    if ((cached_session != NULL) && (strcmp(server, cached_server) == 0)) {
+        SSL_set_session(tls->ssl, cached_session);
+    }
+    pthread_mutex_unlock(&session_lock);
+    int64_t start = esp_timer_get_time();
+    int ret = SSL_connect(tls->ssl);
+    transport->handshake_time = esp_timer_get_time() - start;
+    if (ret != 1) {
+        log_ssl_error("Handshake error");
+        // In case the cached session is the problem.
+        pthread_mutex_lock(&session_lock);
+        SSL_SESSION_free(cached_session);
+        cached_session = NULL;
+        pthread_mutex_unlock(&session_lock);
+        tls_close(transport);
+        return OTA_CONN_ERR;
+    }
+    transport->resumed = SSL_session_reused(tls->ssl) == 1;
+    transport->connected = true;
+    ESP_LOGI(OTA_TAG, "host_tls - Connected to %s, %s handshake in %lld ms",
+             server, transport->resumed ? "resumed" : "full",
+             (long long)(transport->handshake_time / 1000));
+    return OTA_OK;
+
+}
+
+static int tls_read(ota_transport_t *transport, uint8_t *data, size_t length) {
+
+    host_tls_t *tls = (host_tls_t *)transport;
+    size_t read_length;
+
+    if (SSL_read_ex(tls->ssl, data, length, &read_length) == 1) {
+        return (int)read_length;
+    }
+    // Only a close_notify alert is an end of data. A connection closed
+    // without it is reported by OpenSSL as an error, as expected.
+    int error = SSL_get_error(tls->ssl, 0);
+    if (error == SSL_ERROR_ZERO_RETURN) {
+        return 0;
+    }
+    log_ssl_error("Read error");
+    return -1;
+
+}
+
+static ota_status_t tls_write(ota_transport_t *transport, const uint8_t *data,
+                              size_t length) {
+
+    host_tls_t *tls = (host_tls_t *)transport;
+    size_t written;
+
+    if (SSL_write_ex(tls->ssl, data, length, &written) != 1) {
+        log_ssl_error("Write error");
+        return OTA_CONN_ERR;
+    }
+    return OTA_OK;
+
+}
+
+static void tls_destroy(ota_transport_t *transport) {
+
+    host_tls_t *tls = (host_tls_t *)transport;
+
+    tls_close(transport);
+    SSL_CTX_free(tls->ctx);
+    free(tls);
+
+}
+
+static const ota_transport_ops_t tls_ops = {
+    .connect = tls_connect,
+    .read = tls_read,
+    .write = tls_write,
+    .close = tls_close,
+    .destroy = tls_destroy,
+};
+
+// Adds the CA certificates found in cert_pem to the context.
+static ota_status_t load_ca(SSL_CTX *ctx, const char *cert_pem) {
+
+    X509 *cert;
+    int count = 0;
+
+    BIO *bio = BIO_new_mem_buf(cert_pem, -1);
+    if (bio == NULL) {
+        return OTA_SYS_ERR;
+    }
+    X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+    while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+        if (X509_STORE_add_cert(store, cert) == 1) {
+            count++;
+        }
+        X509_free(cert);
+    }
+    BIO_free(bio);
+    ERR_clear_error();
+    if (count == 0) {
+        ESP_LOGE(OTA_TAG, "host_tls - Invalid certificate");
+        return OTA_PARAM_ERR;
+    }
+    return OTA_OK;
+
+}
+
+ota_status_t host_tls_create(const char *host, uint16_t port,
+                             const char *cert_pem, uint32_t timeout_ms,
+                             ota_transport_t **transport) {
+
+    if (strlen(host) > OTA_TRANSPORT_HOST_MAX_LENGTH) {
+        ESP_LOGE(OTA_TAG, "host_tls - Host name too long");
+        return OTA_PARAM_ERR;
+    }
+    host_tls_t *tls = calloc(1, sizeof(*tls));
+    if (tls == NULL) {
+        return OTA_SYS_ERR;
+    }
+    tls->transport.ops = &tls_ops;
+    strcpy(tls->transport.host, host);
+    tls->transport.port = port;
+    tls->timeout_ms = timeout_ms;
+    tls->fd = -1;
+    tls->ctx = SSL_CTX_new(TLS_client_method());
+    if (tls->ctx == NULL) {
+        log_ssl_error("Can't create context");
+        free(tls);
+        return OTA_SYS_ERR;
+    }
+    SSL_CTX_set_verify(tls->ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_CLIENT);
+    ota_status_t ota_rs = load_ca(tls->ctx, cert_pem);
+    if (ota_rs != OTA_OK) {
+        tls_destroy(&tls->transport);
+        return ota_rs;
+    }
+    *transport = &tls->transport;
+    return OTA_OK;
+
+}
@@ -0,0 +1,48 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Transport of the host build (see ota_transport.h): TLS over POSIX
+ *   sockets, with OpenSSL. The server certificate is checked against the
+ *   given CA certificate, and its name against the server name.
+ *
+ *   As with the ESP32 transport, the TLS session of the last server is
+ *   kept in RAM, so that next connection resumes it.
+ *
+ * Usage:
+ *   Pass host_tls_create() to ota_set_backends_b().
+ */
+
+#ifndef HOST_TLS_H_
+#define HOST_TLS_H_
+
+#include <stdint.h>
+
+#include "ota_transport.h"
+
+/**
+ * See ota_transport_create_t in fuota_b.h.
+ */
+ota_status_t host_tls_create(const char *host, uint16_t port,
+                             const char *cert_pem, uint32_t timeout_ms,
+                             ota_transport_t **transport);
+
+#endif /* HOST_TLS_H_ */
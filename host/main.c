@@ -0,0 +1,195 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Host application: requests an update from the update server, as the
+ *   ESP32 application does, with files as partitions, and prints the
+ *   metrics of the update.
+ *
+ * Usage:
+ *   fuota_host [-s <streams>] [-a] [-c <ms>] <server name> <server port>
+ *              <CA certificate file> <username> <password> <device id>
+ *              <application version> <running image file>
+ *              <update partition file> [<NVS directory>]
+ *   -s gives the maximum number of connections an uncompressed image is
+ *   downloaded over, 1 by default. -a runs the update with ota_start_b(),
+ *   and prints its progress. -c cancels it after the given time, in ms,
+ *   and implies -a.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvs.h"
+
+#include "fuota_b.h"
+#include "host_storage.h"
+#include "host_tls.h"
+#include "trace_ring.h"
+
+// Size of the OTA partitions, see fuota_partitions.csv.
+#define PARTITION_SIZE 0x180000
+
+// Largest accepted CA certificate file.
+#define CERT_MAX_LENGTH 16384
+static char cert_pem[CERT_MAX_LENGTH + 1];
+
+static const char *STATUS_NAMES[] = {
+    "OTA_OK", "OTA_UPDATED", "OTA_PARAM_ERR", "OTA_NO_UPDATE",
+    "OTA_CONN_ERR", "OTA_SYS_ERR", "OTA_RUNNING", "OTA_CANCELLED",
+};
+
+// Period of the checks of the update started by ota_start_b(), in ms.
+#define POLL_PERIOD_MS 100
+
+static bool read_cert(const char *path) {
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    size_t length = fread(cert_pem, 1, CERT_MAX_LENGTH, file);
+    bool complete = feof(file);
+    fclose(file);
+    cert_pem[length] = '\0';
+    return complete;
+
+}
+
+// Called by the update task.
+static void print_event(void *arg, ota_event_t event,
+                        const ota_event_data_t *data) {
+
+    printf("%s: %u/%u bytes\n",
+           event == OTA_EVENT_PROGRESS ? "progress" : "done", data->received,
+           data->total);
+
+}
+
+// Runs the update with ota_start_b(), and cancels it after cancel_ms ms,
+// unless cancel_ms is negative.
+static ota_status_t run_async(char *argv[], long cancel_ms) {
+
+    long elapsed_ms = 0;
+    ota_status_t ota_rs = ota_start_b(argv[1], atoi(argv[2]), cert_pem,
+                                      argv[4], argv[5], argv[6], argv[7],
+                                      print_event, NULL);
+
+    if (ota_rs != OTA_OK) {
+        return ota_rs;
+    }
+    while ((ota_rs = ota_wait_b(POLL_PERIOD_MS)) == OTA_RUNNING) {
+        elapsed_ms += POLL_PERIOD_MS;
+        if ((cancel_ms >= 0) && (elapsed_ms >= cancel_ms)) {
+            ota_cancel_b();
+            cancel_ms = -1;
+        }
+    }
+    return ota_rs;
+
+}
+
+int main(int argc, char *argv[]) {
+
+    ota_metrics_t metrics;
+    ota_tls_stats_t stats;
+    ota_status_t ota_rs;
+    int streams = 1;
+    bool async = false;
+    long cancel_ms = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:ac:")) != -1) {
+        if (opt == 's') {
+            streams = atoi(optarg);
+        } else if (opt == 'a') {
+            async = true;
+        } else if (opt == 'c') {
+            async = true;
+            cancel_ms = atol(optarg);
+        } else {
+            break;
+        }
+    }
+    // Positional arguments.
+    char *program = argv[0];
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (((argc != 10) && (argc != 11)) || (opt == '?')) {
+        fprintf(stderr, "Usage: %s [-s <streams>] [-a] [-c <ms>] "
+                "<server name> <server port> "
+                "<CA certificate file> <username> <password> <device id> "
+                "<application version> <running image file> "
+                "<update partition file> [<NVS directory>]\n",
+                program);
+        return 2;
+    }
+    if (!read_cert(argv[3])) {
+        fprintf(stderr, "Can't read %s\n", argv[3]);
+        return 2;
+    }
+    if (argc == 11) {
+        nvs_host_init(argv[10]);
+    }
+    ota_set_streams_b(streams);
+    // A write to a connection reset by the server must fail, as with lwIP,
+    // not kill the program.
+    signal(SIGPIPE, SIG_IGN);
+    ota_set_backends_b(host_tls_create,
+                       host_storage_init(argv[8], argv[9], PARTITION_SIZE));
+    // The link, for the cache of download settings, is the server.
+    ota_set_link_b((const uint8_t *)argv[1], strlen(argv[1]));
+    if (async) {
+        ota_rs = run_async(argv, cancel_ms);
+    } else {
+        ota_rs = ota_update_b(argv[1], atoi(argv[2]), cert_pem, argv[4],
+                              argv[5], argv[6], argv[7]);
+    }
+    ota_close_b();
+    ota_get_last_metrics_b(&metrics);
+    ota_get_tls_stats_b(&stats);
+    printf("status: %s\n", STATUS_NAMES[ota_rs]);
+    printf("time (us): total %lld, check %lld, dns %lld, tcp %lld, tls %lld, "
+           "headers %lld, transfer %lld, flash %lld, validation %lld, "
+           "throttle %lld\n",
+           (long long)metrics.total_time, (long long)metrics.check_time,
+           (long long)metrics.dns_time, (long long)metrics.tcp_time,
+           (long long)metrics.tls_time, (long long)metrics.header_time,
+           (long long)metrics.transfer_time, (long long)metrics.flash_time,
+           (long long)metrics.validation_time,
+           (long long)metrics.throttle_time);
+    printf("connections: %u, requests: %u, retries: %u, refetched blocks: %u\n",
+           metrics.connections, metrics.requests, metrics.request_retries,
+           metrics.refetched_blocks);
+    printf("bytes: received %u, file %u, image %u, throughput %u B/s\n",
+           metrics.bytes_received, metrics.file_bytes, metrics.image_bytes,
+           metrics.throughput);
+    printf("chunk size: %u\n", metrics.chunk_size);
+    printf("handshakes: full %u, resumed %u\n", stats.full_handshakes,
+           stats.resumed_handshakes);
+    trace_ring_dump();
+    return (ota_rs == OTA_UPDATED) || (ota_rs == OTA_NO_UPDATE) ? 0 : 1;
+
+}
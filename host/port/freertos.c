@@ -0,0 +1,266 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+// Host implementation of the FreeRTOS functions used by fuota_b. A task is
+// a thread, with a notification counter protected by a mutex.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct host_task {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notifications;
+    TaskFunction_t task_code;
+    void *parameters;
+    UBaseType_t priority;
+};
+
+struct host_semaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t given;
+};
+
+// Task of the calling thread. Allocated on first use for threads which
+// were not created by xTaskCreatePinnedToCore(), such as the main one.
+static __thread struct host_task *current_task = NULL;
+
+static struct host_task *new_task(void) {
+
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        abort();
+    }
+    pthread_mutex_init(&task->mutex, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    task->priority = 1;
+    return task;
+
+}
+
+static struct host_task *get_current_task(void) {
+
+    if (current_task == NULL) {
+        current_task = new_task();
+    }
+    return current_task;
+
+}
+
+static void *run_task(void *arg) {
+
+    current_task = arg;
+    current_task->task_code(current_task->parameters);
+    return NULL;
+
+}
+
+// Waits on cond until *flag is not zero, or until ticks elapse.
+static void wait_for(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                     const volatile uint32_t *flag, TickType_t ticks) {
+
+    struct timespec deadline;
+
+    if (ticks == portMAX_DELAY) {
+        while (*flag == 0) {
+            pthread_cond_wait(cond, mutex);
+        }
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks / 1000;
+    deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (*flag == 0) {
+        if (pthread_cond_timedwait(cond, mutex, &deadline) != 0) {
+            return;
+        }
+    }
+
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name,
+                                   uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority,
+                                   TaskHandle_t *created_task,
+                                   BaseType_t core_id) {
+
+    struct host_task *task = new_task();
+
+    task->task_code = task_code;
+    task->parameters = parameters;
+    task->priority = priority;
+    if (created_task != NULL) {
+        *created_task = task;
+    }
+    if (pthread_create(&task->thread, NULL, run_task, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+
+}
+
+void vTaskDelete(TaskHandle_t task) {
+
+    if ((task == NULL) || (task == current_task)) {
+        // The task structure may still be notified: it is not freed.
+        pthread_exit(NULL);
+    }
+
+}
+
+void vTaskDelay(TickType_t ticks) {
+
+    struct timespec delay = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (long)(ticks % 1000) * 1000000,
+    };
+    nanosleep(&delay, NULL);
+
+}
+
+TickType_t xTaskGetTickCount(void) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+
+    return get_current_task();
+
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+
+    return task == NULL ? get_current_task()->priority : task->priority;
+
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+
+    if (task == NULL) {
+        task = get_current_task();
+    }
+    task->priority = priority;
+
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+
+    struct host_task *task = get_current_task();
+
+    pthread_mutex_lock(&task->mutex);
+    wait_for(&task->cond, &task->mutex, &task->notifications, ticks_to_wait);
+    uint32_t value = task->notifications;
+    if (clear_on_exit) {
+        task->notifications = 0;
+    } else if (value > 0) {
+        task->notifications--;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+
+    pthread_mutex_lock(&task->mutex);
+    task->notifications++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+
+}
+
+BaseType_t xPortGetCoreID(void) {
+
+    return 0;
+
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+
+    struct host_semaphore *semaphore = calloc(1, sizeof(*semaphore));
+    if (semaphore == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, NULL);
+    return semaphore;
+
+}
+
+// A mutex is a binary semaphore initially given: there is no priority
+// inheritance to provide.
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+
+    SemaphoreHandle_t semaphore = xSemaphoreCreateBinary();
+    if (semaphore != NULL) {
+        semaphore->given = 1;
+    }
+    return semaphore;
+
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+
+    pthread_mutex_lock(&semaphore->mutex);
+    wait_for(&semaphore->cond, &semaphore->mutex, &semaphore->given,
+             ticks_to_wait);
+    BaseType_t taken = semaphore->given != 0 ? pdTRUE : pdFALSE;
+    semaphore->given = 0;
+    pthread_mutex_unlock(&semaphore->mutex);
+    return taken;
+
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+
+    pthread_mutex_lock(&semaphore->mutex);
+    semaphore->given = 1;
+    pthread_cond_signal(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+    return pdTRUE;
+
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+
+    pthread_mutex_destroy(&semaphore->mutex);
+    pthread_cond_destroy(&semaphore->cond);
+    free(semaphore);
+
+}
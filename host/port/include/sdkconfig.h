@@ -0,0 +1,50 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+// Configuration of the fuota_b and trace_ring components for the host
+// build. The values are the defaults of their Kconfig files. The buffer size
+// and the tuning may be set on the command line, for benchmarks.
+
+#ifndef SDKCONFIG_H_
+#define SDKCONFIG_H_
+
+#define CONFIG_IDF_TARGET_LINUX 1
+#define CONFIG_FREERTOS_UNICORE 1
+
+#define CONFIG_FUOTA_B_PIPE_DEPTH 4
+#ifndef CONFIG_FUOTA_B_PIPE_BUFFER_SIZE
+#define CONFIG_FUOTA_B_PIPE_BUFFER_SIZE 4096
+#endif
+#define CONFIG_FUOTA_B_MAX_RATE 0
+#define CONFIG_FUOTA_B_CPU_SHARE 100
+#ifndef CONFIG_FUOTA_B_TUNE
+#define CONFIG_FUOTA_B_TUNE 1
+#endif
+#define CONFIG_FUOTA_B_TUNE_PROBE_SIZE 256
+#define CONFIG_FUOTA_B_STREAMS 1
+#define CONFIG_FUOTA_B_STREAM_HEAP 48
+#define CONFIG_FUOTA_B_TASK_STACK_SIZE 8192
+#define CONFIG_FUOTA_B_MANIFEST 1
+#define CONFIG_FUOTA_B_DEDUP 1
+
+#define CONFIG_TRACE_RING_ENABLED 1
+#define CONFIG_TRACE_RING_SIZE 512
+
+#endif /* SDKCONFIG_H_ */
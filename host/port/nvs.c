@@ -0,0 +1,160 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+// Host implementation of the NVS functions used by fuota_b. A handle is an
+// index in a table of open namespaces. Every write goes directly to its
+// file, so that commit has nothing to do.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvs.h"
+
+#define NAME_MAX_LENGTH 15
+#define MAX_HANDLES 8
+#define PATH_MAX_LENGTH 255
+
+typedef struct {
+    bool used;
+    bool writable;
+    char name[NAME_MAX_LENGTH + 1];
+} namespace_t;
+
+static const char *nvs_dir = ".";
+static namespace_t namespaces[MAX_HANDLES];
+static char path[PATH_MAX_LENGTH + 1];
+
+// Returns the path of the file containing the key, or NULL for an invalid
+// handle or key.
+static const char *get_path(nvs_handle_t handle, const char *key) {
+
+    if ((handle == 0) || (handle > MAX_HANDLES) ||
+        !namespaces[handle - 1].used || (strlen(key) > NAME_MAX_LENGTH)) {
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/%s.%s", nvs_dir,
+             namespaces[handle - 1].name, key);
+    return path;
+
+}
+
+void nvs_host_init(const char *dir) {
+
+    nvs_dir = dir;
+
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode,
+                   nvs_handle_t *out_handle) {
+
+    if (strlen(name) > NAME_MAX_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < MAX_HANDLES; i++) {
+        if (!namespaces[i].used) {
+            namespaces[i].used = true;
+            namespaces[i].writable = open_mode == NVS_READWRITE;
+            strcpy(namespaces[i].name, name);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length) {
+
+    const char *file_path = get_path(handle, key);
+    if (file_path == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *file = fopen(file_path, "rb");
+    if (file == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t stored_length = ftell(file);
+    esp_err_t esp_rs = ESP_OK;
+    if (out_value != NULL) {
+        if (*length < stored_length) {
+            esp_rs = ESP_ERR_NVS_INVALID_LENGTH;
+        } else {
+            fseek(file, 0, SEEK_SET);
+            if (fread(out_value, 1, stored_length, file) != stored_length) {
+                esp_rs = ESP_FAIL;
+            }
+        }
+    }
+    fclose(file);
+    *length = stored_length;
+    return esp_rs;
+
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+
+    const char *file_path = get_path(handle, key);
+    if ((file_path == NULL) || !namespaces[handle - 1].writable) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE *file = fopen(file_path, "wb");
+    if (file == NULL) {
+        return ESP_FAIL;
+    }
+    size_t written = fwrite(value, 1, length, file);
+    if ((fclose(file) != 0) || (written != length)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+
+    const char *file_path = get_path(handle, key);
+    if ((file_path == NULL) || !namespaces[handle - 1].writable) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (unlink(file_path) != 0) {
+        return errno == ENOENT ? ESP_ERR_NVS_NOT_FOUND : ESP_FAIL;
+    }
+    return ESP_OK;
+
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+
+    return ESP_OK;
+
+}
+
+void nvs_close(nvs_handle_t handle) {
+
+    if ((handle > 0) && (handle <= MAX_HANDLES)) {
+        namespaces[handle - 1].used = false;
+    }
+
+}
@@ -0,0 +1,158 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "mbedtls/base64.h"
+
+#include "base64.h"
+#include "base64_bench.h"
+
+// Decoded data sizes: credentials, SHA-256 digest, signature, manifest.
+static const size_t SIZES[] = { 24, 32, 256, 4096 };
+#define MAX_SIZE 4096
+
+// Amount of data processed for every measure.
+#define BYTES_PER_MEASURE (256 * 1024)
+
+// Chunk size of the streaming decoding, as received from a connection.
+#define CHUNK_SIZE 100
+
+static uint8_t data[MAX_SIZE];
+static char encoded[BASE64_ENCODED_LENGTH(MAX_SIZE) + 1];
+static uint8_t decoded[MAX_SIZE];
+static char reference[BASE64_ENCODED_LENGTH(MAX_SIZE) + 1];
+
+typedef enum {
+    MBEDTLS_ENCODE,
+    MBEDTLS_DECODE,
+    BASE64_ENCODE,
+    BASE64_DECODE,
+    BASE64_STREAM_DECODE,
+} operation_t;
+
+static const char *OPERATIONS[][2] = {
+    { "encode", "mbedtls" },
+    { "decode", "mbedtls" },
+    { "encode", "base64" },
+    { "decode", "base64" },
+    { "stream_decode", "base64" },
+};
+
+// Decodes encoded by chunks.
+static size_t stream_decode(size_t encoded_length) {
+
+    base64_decoder_t decoder;
+    size_t length = 0;
+    size_t step;
+
+    base64_decoder_init(&decoder, false);
+    for (size_t i = 0; i < encoded_length; i += CHUNK_SIZE) {
+        size_t chunk = encoded_length - i < CHUNK_SIZE ? encoded_length - i :
+                       CHUNK_SIZE;
+        base64_decoder_update(&decoder, encoded + i, chunk, decoded + length,
+                              sizeof(decoded) - length, &step);
+        length += step;
+    }
+    base64_decoder_final(&decoder, decoded + length, sizeof(decoded) - length,
+                         &step);
+    return length + step;
+
+}
+
+static void run(operation_t operation, size_t size, size_t encoded_length) {
+
+    size_t length;
+    uint32_t iterations = BYTES_PER_MEASURE / size;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+        switch (operation) {
+        case MBEDTLS_ENCODE:
+            mbedtls_base64_encode((unsigned char *)encoded, sizeof(encoded),
+                                  &length, data, size);
+            break;
+        case MBEDTLS_DECODE:
+            mbedtls_base64_decode(decoded, sizeof(decoded), &length,
+                                  (const unsigned char *)encoded,
+                                  encoded_length);
+            break;
+        case BASE64_ENCODE:
+            base64_encode(data, size, encoded, sizeof(encoded), &length);
+            break;
+        case BASE64_DECODE:
+            base64_decode(encoded, encoded_length, decoded, sizeof(decoded),
+                          &length);
+            break;
+        case BASE64_STREAM_DECODE:
+            stream_decode(encoded_length);
+            break;
+        }
+    }
+    int64_t duration = esp_timer_get_time() - start;
+    if (duration == 0) {
+        duration = 1;
+    }
+    printf("{\"operation\": \"%s\", \"implementation\": \"%s\", "
+           "\"size\": %u, \"mb_per_s\": %.2f}\n",
+           OPERATIONS[operation][0], OPERATIONS[operation][1],
+           (unsigned int)size,
+           (double)iterations * size / duration * 1000000 / (1024 * 1024));
+
+}
+
+bool base64_bench_run(void) {
+
+    size_t reference_length;
+    size_t length;
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7 + (i >> 8);
+    }
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++) {
+        size_t size = SIZES[s];
+        // Both implementations must agree.
+        mbedtls_base64_encode((unsigned char *)reference, sizeof(reference),
+                              &reference_length, data, size);
+        if ((base64_encode(data, size, encoded, sizeof(encoded),
+                           &length) != BASE64_OK) ||
+            (length != reference_length) ||
+            (memcmp(encoded, reference, length) != 0) ||
+            (base64_decode(encoded, length, decoded, sizeof(decoded),
+                           &length) != BASE64_OK) ||
+            (length != size) || (memcmp(decoded, data, size) != 0) ||
+            (stream_decode(reference_length) != size) ||
+            (memcmp(decoded, data, size) != 0)) {
+            printf("base64 results differ for %u bytes\n",
+                   (unsigned int)size);
+            return false;
+        }
+        run(MBEDTLS_ENCODE, size, reference_length);
+        run(BASE64_ENCODE, size, reference_length);
+        run(MBEDTLS_DECODE, size, reference_length);
+        run(BASE64_DECODE, size, reference_length);
+        run(BASE64_STREAM_DECODE, size, reference_length);
+    }
+    return true;
+
+}
@@ -0,0 +1,47 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+/**
+ * Overview:
+ *   Benchmark of the base64 codec of the fuota_b component against the
+ *   mbedtls one, on the sizes met by the update: Basic authentication
+ *   credentials, SHA-256 digest, signature, manifest. The same source is
+ *   built for the ESP32, when the FUO_BASE64_BENCH option is set, and for
+ *   the host (see host/CMakeLists.txt).
+ *
+ *   Results are printed as JSON lines: operation, implementation, size of
+ *   the decoded data, throughput.
+ *
+ * Usage:
+ *   base64_bench_run().
+ */
+
+#ifndef BASE64_BENCH_H_
+#define BASE64_BENCH_H_
+
+#include <stdbool.h>
+
+/**
+ * Runs the benchmark. Returns false if both implementations do not give
+ * the same results.
+ */
+bool base64_bench_run(void);
+
+#endif /* BASE64_BENCH_H_ */
@@ -25,11 +25,17 @@
 #include "freertos/task.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
 #include "nvs_flash.h"
 
+#include "base64_bench.h"
 #include "conn_wifi_b.h"
 #include "fuota_b.h"
+#include "scan_sched.h"
 #include "scan_wifi_b.h"
+#include "trace_ring.h"
+#include "wifi_bench.h"
 
 // Automaton states.
 typedef enum {
@@ -60,9 +66,6 @@ static const uint32_t WAIT_BEFORE_START_PERIOD_MS = 30000;
 // Time period before restart in case of fatal error, in ms.
 static const uint32_t WAIT_BEFORE_RESTART_PERIOD_MS = 30000;
 
-// Time period before performing next scan, in ms.
-static const uint32_t WAIT_BEFORE_NEXT_SCAN_MS = 30000;
-
 // Maximum wait period to get an IP address.
 static const uint32_t IP_TIMEOUT_MS = 5000;
 
@@ -71,28 +74,12 @@ const char DEV_ID[] = "00001";
 
 static const char APP_TAG[] = "APP";
 
-// Max number of APs we can accept.
-#define AP_NB 50
-// Array for storing APs returned by scan_wifi_b component.
-static wifi_ap_record_t ap_records[AP_NB];
-
-/**
- * Returns true if the AP defined by OTA_UPDATE_AP_SSID is available.
- */
-static bool is_ota_ap_available(uint8_t found_ap_nb) {
-
-    uint8_t ssid_ota_l = strlen(OTA_UPDATE_AP_SSID);
-    uint8_t ssid_l;
-    for (uint16_t i = 0; i < found_ap_nb; i++) {
-        ssid_l = strlen((char *)ap_records[i].ssid);
-        if ((ssid_l == ssid_ota_l) &&
-            (strncmp((char *)ap_records[i].ssid, OTA_UPDATE_AP_SSID, ssid_l) == 0)) {
-            return true;
-        }
-    }
-    return false;
+// SSIDs looked for by the scan.
+static const char *const OTA_AP_SSIDS[] = { OTA_UPDATE_AP_SSID };
+#define OTA_AP_SSID_NB (sizeof(OTA_AP_SSIDS) / sizeof(OTA_AP_SSIDS[0]))
 
-}
+// Decides when to scan next, from the absences of the OTA AP.
+static scan_sched_t scan_sched;
 
 void app_main(void)
 {
@@ -101,6 +88,12 @@ void app_main(void)
     swb_status_t swb_rs;
     cwb_status_t cwb_rs;
     ota_status_t ota_rs;
+    ota_tls_stats_t tls_stats;
+    ota_metrics_t metrics;
+    cwb_stats_t cwb_stats;
+    wifi_ap_record_t ap_info;
+    // Delay before next scan, in s.
+    uint32_t scan_delay;
 
     // Period of time before restarting in case of fatal error.
     const TickType_t wait_before_restart_period =
@@ -108,6 +101,16 @@ void app_main(void)
 
     ESP_LOGI(APP_TAG, "===== esp32-fuota %s =====", OTA_VERSION);
 
+#if CONFIG_FUO_BASE64_BENCH
+    base64_bench_run();
+#endif
+
+#if CONFIG_TRACE_RING_DRAIN
+    if (!trace_ring_start_drain()) {
+        ESP_LOGE(APP_TAG, "Error from trace_ring_start_drain");
+    }
+#endif
+
     // Wait a bit before first operation, that's better for test and flash erase.
     vTaskDelay(pdMS_TO_TICKS(WAIT_BEFORE_START_PERIOD_MS));
 
@@ -129,6 +132,14 @@ void app_main(void)
         }
     }
 
+    // Scan scheduling, with the absences learned before the last restart.
+    scan_sched_config_t sched_config = SCAN_SCHED_CONFIG_DEFAULT();
+    scan_sched_init(&scan_sched, &sched_config);
+    if (scan_sched_load(&scan_sched)) {
+        ESP_LOGI(APP_TAG, "%u absences of the OTA AP known",
+                 scan_sched.absence_count);
+    }
+
     // Initialize TCP/IP stack.
     esp_rs = esp_netif_init();
     if (esp_rs != ESP_OK) {
@@ -145,39 +156,44 @@ void app_main(void)
         goto exit_on_fatal_error;
     }
 
-    state_t current_state = ST_SCAN;
+#if CONFIG_FUO_WIFI_BENCH
+    if (!wifi_bench_run(CONFIG_FUO_WIFI_BENCH_CYCLES)) {
+        ESP_LOGE(APP_TAG, "Error from wifi_bench_run");
+    }
+#endif
 
-    // Number of APs returned by the scan operation.
-    uint8_t found_ap_nb;
+    state_t current_state = ST_SCAN;
 
     while (true) {
 
         switch (current_state) {
 
         case ST_SCAN:
-            // Look for AP.
-            swb_rs = swb_scan_b(AP_NB, ap_records, &found_ap_nb);
+            // Look for the OTA AP only, on the channel where it was last
+            // found first.
+            swb_rs = swb_find_b(OTA_AP_SSIDS, OTA_AP_SSID_NB, &ap_info);
             if (swb_rs == SWB_ERROR) {
-                ESP_LOGE(APP_TAG, "Error from swb_scan_b");
+                ESP_LOGE(APP_TAG, "Error from swb_find_b");
                 goto exit_on_fatal_error;
             }
+            scan_delay = scan_sched_report(&scan_sched,
+                                           esp_timer_get_time() / 1000000,
+                                           swb_rs == SWB_SUCCESS);
+            scan_sched_save(&scan_sched);
+            if (swb_rs == SWB_NOT_FOUND) {
+                // Stay in same state, wait before next scan.
+                ESP_LOGI(APP_TAG, "OTA AP not found, next scan in %u s",
+                         scan_delay);
+                vTaskDelay(pdMS_TO_TICKS(scan_delay * 1000));
+                break;
+            }
             if (swb_rs == SWB_SUCCESS) {
-                ESP_LOGI(APP_TAG, "%d APs found", found_ap_nb);
-                if (found_ap_nb == 0) {
-                    // No open AP available. Stay in same state, wait before next scan.
-                    vTaskDelay(pdMS_TO_TICKS(WAIT_BEFORE_NEXT_SCAN_MS));
-                    break;
-                }
-                // At this stage, we have one open AP at least. Check if we
-                // have the OTA update AP.
-                if (is_ota_ap_available(found_ap_nb)) {
-                    ESP_LOGI(APP_TAG, "OTA AP is available");
-                    current_state = ST_TRY_OTA;
-                    break;
-                }
+                ESP_LOGI(APP_TAG, "OTA AP is available");
+                current_state = ST_TRY_OTA;
+                break;
             }
-            // At this stage, unexpected return status from swb_scan_b.
-            ESP_LOGE(APP_TAG, "Unexpected return status from sw_scan_b: %d", swb_rs);
+            // At this stage, unexpected return status from swb_find_b.
+            ESP_LOGE(APP_TAG, "Unexpected return status from swb_find_b: %d", swb_rs);
             goto exit_on_fatal_error;
 
         case ST_TRY_OTA:
@@ -186,10 +202,47 @@ void app_main(void)
             if (cwb_rs == CWB_OK) {
                 // Connection established with AP.
                 ESP_LOGI(APP_TAG, "Connected to AP %s", OTA_UPDATE_AP_SSID);
+                cwb_get_stats_b(&cwb_stats);
+                ESP_LOGI(APP_TAG, "IP address in %lld ms, cached lease: %s "
+                         "(%u cached, %u new)",
+                         (long long)(cwb_stats.ip_time / 1000),
+                         cwb_stats.lease_reused ? "yes" : "no",
+                         cwb_stats.leases_reused, cwb_stats.dhcp_leases);
+                // Download settings are adapted, and cached, per AP.
+                if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+                    ota_set_link_b(ap_info.bssid, sizeof(ap_info.bssid));
+                } else {
+                    ota_set_link_b(NULL, 0);
+                }
                 ota_rs = ota_update_b(OTA_SERVER_NAME, OTA_SERVER_PORT,
                                       (const char *)server_cert_pem_start,
                                       OTA_SERVER_USERNAME, OTA_SERVER_PASSWORD,
                                       DEV_ID, OTA_VERSION);
+                ota_get_tls_stats_b(&tls_stats);
+                ESP_LOGI(APP_TAG, "TLS handshakes - full: %u, resumed: %u",
+                         tls_stats.full_handshakes, tls_stats.resumed_handshakes);
+                ota_get_last_metrics_b(&metrics);
+                ESP_LOGI(APP_TAG, "Update metrics - total: %lld ms, check: %lld ms, "
+                         "DNS: %lld ms, TCP: %lld ms, TLS: %lld ms, headers: %lld ms, "
+                         "throttle: %lld ms",
+                         (long long)(metrics.total_time / 1000),
+                         (long long)(metrics.check_time / 1000),
+                         (long long)(metrics.dns_time / 1000),
+                         (long long)(metrics.tcp_time / 1000),
+                         (long long)(metrics.tls_time / 1000),
+                         (long long)(metrics.header_time / 1000),
+                         (long long)(metrics.throttle_time / 1000));
+                ESP_LOGI(APP_TAG, "Update metrics - transfer: %lld ms, flash: %lld ms, "
+                         "validation: %lld ms, %u bytes received, %u B/s, %u retries, "
+                         "chunk size: %u",
+                         (long long)(metrics.transfer_time / 1000),
+                         (long long)(metrics.flash_time / 1000),
+                         (long long)(metrics.validation_time / 1000),
+                         metrics.bytes_received,
+                         metrics.throughput, metrics.request_retries,
+                         metrics.chunk_size);
+                // Trace of the update, if not written by the drain task yet.
+                trace_ring_dump();
                 if (ota_rs == OTA_SYS_ERR) {
                     goto exit_on_fatal_error;
                 }
@@ -213,11 +266,12 @@ void app_main(void)
                         ESP_LOGE(APP_TAG, "Inconsistent value for ota_rs: %d", ota_rs);
                         goto exit_on_fatal_error;
                     }
+                    ota_close_b();
                     cwb_rs = cwb_disconnect_b();
                     if ((cwb_rs == CWB_OK) || (cwb_rs == CWB_ALREADY_DIS)) {
                         current_state = ST_SCAN;
                         // Wait before next scan.
-                        vTaskDelay(pdMS_TO_TICKS(WAIT_BEFORE_NEXT_SCAN_MS));
+                        vTaskDelay(pdMS_TO_TICKS(scan_delay * 1000));
                         break;
                     }
                     if ((cwb_rs == CWB_DIS_TIMEOUT) || (cwb_rs == CWB_SYS_ERR)) {
@@ -229,6 +283,7 @@ void app_main(void)
                 if (ota_rs == OTA_UPDATED) {
                     ESP_LOGI(APP_TAG, "Firmware updated, restarting");
                     // Disconnect. We don't test the return status as we restart right after.
+                    ota_close_b();
                     cwb_disconnect_b();
                     esp_restart();
                 }
@@ -241,7 +296,7 @@ void app_main(void)
                 ESP_LOGW(APP_TAG, "Couldn't connect to OTA AP");
                 current_state = ST_SCAN;
                 // Wait before next scan.
-                vTaskDelay(pdMS_TO_TICKS(WAIT_BEFORE_NEXT_SCAN_MS));
+                vTaskDelay(pdMS_TO_TICKS(scan_delay * 1000));
                 break;
             }
             if ((cwb_rs == CWB_ALREADY_CON) || (cwb_rs == CWB_PARAM_ERR) ||
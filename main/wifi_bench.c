@@ -0,0 +1,109 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "scan_wifi_b.h"
+#include "wifi_bench.h"
+#include "wifi_life.h"
+
+// Max number of APs returned by a scan.
+#define AP_NB 20
+static wifi_ap_record_t ap_records[AP_NB];
+
+// Number of intermediate results per mode.
+#define STEPS 10
+
+typedef enum {
+    MODE_TEARDOWN,
+    MODE_PERSISTENT,
+} bench_mode_t;
+
+static const char *MODES[] = { "teardown", "persistent" };
+
+static void print_result(bench_mode_t mode, uint32_t cycles,
+                         int64_t total_time, int64_t max_time) {
+
+    size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    wfl_stats_t stats;
+
+    wfl_get_stats(&stats);
+    printf("{\"mode\": \"%s\", \"cycles\": %u, \"mean_ms\": %.1f, "
+           "\"max_ms\": %.1f, \"free_heap\": %u, \"largest_block\": %u, "
+           "\"min_free_heap\": %u, \"fragmentation\": %.3f, "
+           "\"inits\": %u}\n",
+           MODES[mode], cycles, (double)total_time / cycles / 1000,
+           (double)max_time / 1000, (unsigned int)free_heap,
+           (unsigned int)largest_block,
+           (unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+           free_heap > 0 ? 1.0 - (double)largest_block / free_heap : 0.0,
+           stats.inits);
+
+}
+
+static bool run(bench_mode_t mode, uint32_t cycles) {
+
+    uint8_t found_ap_nb;
+    int64_t total_time = 0;
+    int64_t max_time = 0;
+    uint32_t step = cycles / STEPS > 0 ? cycles / STEPS : 1;
+
+    // Both modes start from a released driver.
+    if (wfl_deinit() != WFL_OK) {
+        return false;
+    }
+    for (uint32_t i = 1; i <= cycles; i++) {
+        int64_t start = esp_timer_get_time();
+        if (swb_scan_b(AP_NB, ap_records, &found_ap_nb) != SWB_SUCCESS) {
+            printf("Scan error at cycle %u\n", i);
+            return false;
+        }
+        if ((mode == MODE_TEARDOWN) && (wfl_deinit() != WFL_OK)) {
+            return false;
+        }
+        int64_t duration = esp_timer_get_time() - start;
+        total_time += duration;
+        if (duration > max_time) {
+            max_time = duration;
+        }
+        if ((i % step == 0) || (i == cycles)) {
+            print_result(mode, i, total_time, max_time);
+        }
+    }
+    return true;
+
+}
+
+bool wifi_bench_run(uint32_t cycles) {
+
+    if (cycles == 0) {
+        return true;
+    }
+    return run(MODE_TEARDOWN, cycles) && run(MODE_PERSISTENT, cycles);
+
+}
@@ -0,0 +1,54 @@
+/**
+ * This file is part of esp32-fuota.
+ *
+ * esp32-fuota is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-fuota is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2023 Pascal Bodin
+ */
+
+
+
+/**
+ * Overview:
+ *   Soak benchmark of the Wi-Fi driver lifecycle. It runs scan cycles, as
+ *   the sample application does, in two modes:
+ *   - teardown: the driver and the network interface are released after
+ *     every scan, as was done before the wifi_life component
+ *   - persistent: they are kept between scans, only the radio is started
+ *     and stopped
+ *
+ *   For every mode, results are printed as a JSON line: number of cycles,
+ *   mean and maximum cycle time, free heap, largest free block and minimum
+ *   free heap at the end, and heap fragmentation (1 - largest free block /
+ *   free heap). Intermediate results are printed every 10% of the cycles,
+ *   to follow the drift over a long run.
+ *
+ * Usage:
+ *   wifi_bench_run(), once the TCP/IP stack and the default event loop are
+ *   initialized, and before any other Wi-Fi operation.
+ */
+
+#ifndef WIFI_BENCH_H_
+#define WIFI_BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Runs the benchmark, with the given number of scan cycles per mode.
+ * Returns false on scan error. The driver is left initialized.
+ */
+bool wifi_bench_run(uint32_t cycles);
+
+#endif /* WIFI_BENCH_H_ */
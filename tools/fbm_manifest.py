@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+"""
+Builds the FBM1 block manifest of an application file, described in
+components/fuota_b/ota_manifest.h. The manifest must be uploaded next to
+the update file, with the same name followed by .fbm.
+
+The manifest gives the hashes of the resulting application image, whatever
+the type of the update file: for a patch or a compressed file, use the new
+application file as input.
+
+Usage: fbm_manifest.py [-b <block size exponent>] <application> <output>
+"""
+
+import argparse
+import hashlib
+import struct
+
+MAGIC = b'FBM1'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='FBM1 manifest builder')
+    parser.add_argument('-b', type=int, default=12,
+                        help='block size exponent')
+    parser.add_argument('input')
+    parser.add_argument('output')
+    args = parser.parse_args()
+    if not 12 <= args.b <= 16:
+        parser.error('unsupported block size')
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    if not data:
+        parser.error('empty application file')
+    block_size = 1 << args.b
+    hashes = [hashlib.sha256(data[i:i + block_size]).digest()
+              for i in range(0, len(data), block_size)]
+    with open(args.output, 'wb') as f:
+        f.write(MAGIC + struct.pack('<B3xI', args.b, len(data)) +
+                b''.join(hashes))
+    print('{}: {} blocks of {} bytes'.format(args.output, len(hashes),
+                                              block_size))
+
+
+if __name__ == '__main__':
+    main()
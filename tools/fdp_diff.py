@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+"""
+Builds a FDP1 patch, transforming an application image into another one.
+
+The patch format is described in components/fuota_b/ota_patch.h. The source
+image must be the one running on the device: the patch is rejected by the
+device otherwise.
+
+Usage: fdp_diff.py <source image> <target image> <patch file>
+"""
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b'FDP1'
+SHA256_LENGTH = 32
+# Length of the blocks used to look for common sequences.
+BLOCK = 32
+# Source image is indexed every STRIDE bytes. Any common sequence of at least
+# BLOCK + STRIDE - 1 bytes is found.
+STRIDE = 4
+
+
+def source_sha256(image):
+    """Returns the SHA-256 appended to the image, after checking it."""
+    digest = hashlib.sha256(image[:-SHA256_LENGTH]).digest()
+    if digest != image[-SHA256_LENGTH:]:
+        sys.exit('Source image does not end with its SHA-256 '
+                 '(CONFIG_APP_BUILD_TYPE must append it)')
+    return digest
+
+
+def encode_gap(old, new, start, end, old_pos):
+    """Encodes new[start:end], using ADD against old[old_pos:] if most bytes
+    are identical (typical of code where only addresses changed), INSERT
+    otherwise."""
+    length = end - start
+    if length == 0:
+        return b''
+    if 0 <= old_pos and old_pos + length <= len(old):
+        diff = bytes((new[start + i] - old[old_pos + i]) & 0xff
+                     for i in range(length))
+        if diff.count(0) * 2 >= length:
+            return b'A' + struct.pack('<II', old_pos, length) + diff
+    return b'I' + struct.pack('<I', length) + new[start:end]
+
+
+def diff(old, new):
+    index = {}
+    for j in range(0, len(old) - BLOCK + 1, STRIDE):
+        index.setdefault(old[j:j + BLOCK], j)
+
+    ops = []
+    gap_start = 0
+    # Source position following the last copied sequence.
+    old_end = 0
+    i = 0
+    while i + BLOCK <= len(new):
+        j = index.get(new[i:i + BLOCK])
+        if j is None:
+            i += 1
+            continue
+        length = BLOCK
+        while (i + length < len(new) and j + length < len(old)
+               and new[i + length] == old[j + length]):
+            length += 1
+        while i > gap_start and j > 0 and new[i - 1] == old[j - 1]:
+            i -= 1
+            j -= 1
+            length += 1
+        ops.append(encode_gap(old, new, gap_start, i, old_end))
+        ops.append(b'C' + struct.pack('<II', j, length))
+        i += length
+        gap_start = i
+        old_end = j + length
+    ops.append(encode_gap(old, new, gap_start, len(new), old_end))
+    ops.append(b'E')
+    return b''.join(ops)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    with open(sys.argv[1], 'rb') as f:
+        old = f.read()
+    with open(sys.argv[2], 'rb') as f:
+        new = f.read()
+    header = MAGIC + struct.pack('<II', len(old), len(new)) + source_sha256(old)
+    patch = header + diff(old, new)
+    with open(sys.argv[3], 'wb') as f:
+        f.write(patch)
+    print('{}: {} bytes ({:.1f}% of target image)'.format(
+        sys.argv[3], len(patch), 100.0 * len(patch) / max(len(new), 1)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+
+"""
+Fleet load simulator: runs many devices at the same time against
+fuota_test_server.py, to size the server and tune the back-off of the
+devices. Every device is a process of the host build of the FUOTA client
+(host/ directory), with its own device id, application version, NVS
+directory and update partition, so that it runs the real fuota_b logic.
+As the application would do, a device calls ota_update_b() again after a
+failure, after an exponential back-off with full jitter, until the update
+succeeds or the maximum number of attempts is reached.
+
+Devices arrive uniformly over the ramp duration (0: all at once, as a
+fleet returning to the depot). The devices can share an impaired link,
+through impair_proxy.py: --rate is then the bandwidth of the whole depot.
+
+For every fleet size, the following values are printed, and appended as a
+JSON line to the output file if one is given:
+- devices, updated: number of devices, and of devices which got the update
+- latency_s: distribution (p50, p90, p99, max) of the time from the
+  arrival of a device to the end of its last attempt, back-off included
+- attempts: mean number of calls to ota_update_b() per device
+- failures: number of failed attempts per status (OTA_CONN_ERR, ...,
+  timeout, crash)
+- duration_s: time from the first arrival to the end of the last device
+- server: counters of the server (see fuota_test_server.py), plus its
+  mean and peak throughput (mb_per_s, peak_mb_per_s) and handshake rate
+  (handshakes_per_s, peak_handshakes_per_s)
+
+Usage: fleet_sim.py [-b <host build directory>] [-s <image size>]
+                    [-n <fleet sizes>] [--ramp <s>] [--attempts <n>]
+                    [--backoff <s>] [--backoff-max <s>] [--delay <ms>]
+                    [--rate <bytes/s>] [--backlog <n>] [-o <output file>]
+"""
+
+import argparse
+import asyncio
+import json
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+from impair_scenarios import (ATTEMPT_TIMEOUT, TOOLS_DIR, UPDATE_FILE,
+                              parse_size, start, stop, write_image)
+
+VERSIONS = ('0.1.0', '0.1.1', '0.2.0')
+
+
+def percentile(values, fraction):
+    """Nearest-rank percentile of a sorted list."""
+    if not values:
+        return 0
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+async def run_attempt(client):
+    """Runs the client once. Returns its status, as printed, or timeout or
+    crash."""
+    process = await asyncio.create_subprocess_exec(
+        *client, stdout=asyncio.subprocess.PIPE,
+        stderr=asyncio.subprocess.STDOUT)
+    try:
+        output, _ = await asyncio.wait_for(process.communicate(),
+                                           ATTEMPT_TIMEOUT)
+    except asyncio.TimeoutError:
+        process.kill()
+        await process.wait()
+        return 'timeout'
+    status = re.search(r'^status: (\w+)', output.decode(errors='replace'),
+                       re.M)
+    return status.group(1) if status else 'crash'
+
+
+async def run_device(index, arrival, args, work_dir, port):
+    device_dir = os.path.join(work_dir, 'device{}'.format(index))
+    nvs_dir = os.path.join(device_dir, 'nvs')
+    os.makedirs(nvs_dir)
+    client = [os.path.join(args.b, 'fuota_host'), 'localhost', str(port),
+              os.path.join(work_dir, 'cert.pem'), 'user', 'password',
+              '{:05d}'.format(index + 1), VERSIONS[index % len(VERSIONS)],
+              os.path.join(work_dir, 'running.bin'),
+              os.path.join(device_dir, 'update_partition.bin'), nvs_dir]
+    await asyncio.sleep(arrival)
+    start_time = time.monotonic()
+    result = {'updated': False, 'attempts': 0, 'failures': []}
+    while not result['updated'] and result['attempts'] < args.attempts:
+        if result['attempts'] > 0:
+            delay = min(args.backoff_max,
+                        args.backoff * 2 ** (result['attempts'] - 1))
+            await asyncio.sleep(random.uniform(0, delay))
+        result['attempts'] += 1
+        status = await run_attempt(client)
+        result['updated'] = status == 'OTA_UPDATED'
+        if not result['updated']:
+            result['failures'].append(status)
+    result['latency_s'] = time.monotonic() - start_time
+    # Partitions of large fleets would fill the disk.
+    shutil.rmtree(device_dir)
+    return result
+
+
+async def run_fleet(count, args, work_dir, port):
+    arrivals = sorted(random.uniform(0, args.ramp) for _ in range(count))
+    return await asyncio.gather(*(
+        run_device(i, arrivals[i], args, work_dir, port)
+        for i in range(count)))
+
+
+def run(count, args, work_dir):
+    stats_path = os.path.join(work_dir, 'server_stats.json')
+    server, port = start(
+        [sys.executable, os.path.join(TOOLS_DIR, 'fuota_test_server.py'),
+         '-b', str(args.backlog), '--stats', stats_path,
+         os.path.join(work_dir, 'cert.pem'),
+         os.path.join(work_dir, 'key.pem'), os.path.join(work_dir, 'files'),
+         UPDATE_FILE])
+    proxy = None
+    if args.delay or args.rate:
+        proxy, port = start(
+            [sys.executable, os.path.join(TOOLS_DIR, 'impair_proxy.py'),
+             '--delay', str(args.delay), '--rate', str(args.rate),
+             '--stats', os.path.join(work_dir, 'proxy_stats.json'), '0',
+             '127.0.0.1', str(port)])
+    start_time = time.monotonic()
+    try:
+        devices = asyncio.run(run_fleet(count, args, work_dir, port))
+    finally:
+        duration = time.monotonic() - start_time
+        if proxy is not None:
+            stop(proxy)
+        stop(server)
+    with open(stats_path) as f:
+        stats = json.load(f)
+
+    latencies = sorted(device['latency_s'] for device in devices)
+    failures = {}
+    for device in devices:
+        for status in device['failures']:
+            failures[status] = failures.get(status, 0) + 1
+    handshakes = stats['full_handshakes'] + stats['resumed_handshakes']
+    stats.update({
+        'mb_per_s': round(stats['body_bytes'] / duration / 1e6, 3),
+        'peak_mb_per_s': round(max(stats['bytes_by_s'] or [0]) / 1e6, 3),
+        'handshakes_per_s': round(handshakes / duration, 1),
+        'peak_handshakes_per_s': max(stats['handshakes_by_s'] or [0]),
+    })
+    return {
+        'devices': count,
+        'updated': sum(device['updated'] for device in devices),
+        'latency_s': {name: round(percentile(latencies, fraction), 2)
+                      for name, fraction in (('p50', 0.5), ('p90', 0.9),
+                                             ('p99', 0.99), ('max', 1))},
+        'attempts': round(sum(device['attempts'] for device in devices) /
+                          count, 2),
+        'failures': failures,
+        'duration_s': round(duration, 2),
+        'server': stats,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Fleet load simulator')
+    parser.add_argument('-b', default='host_build',
+                        help='host build directory')
+    parser.add_argument('-s', type=parse_size, default=256 * 1024,
+                        help='update image size (K and M suffixes accepted)')
+    parser.add_argument('-n', default='10,50,100',
+                        type=lambda t: [int(v) for v in t.split(',') if v],
+                        help='comma-separated fleet sizes')
+    parser.add_argument('--ramp', type=float, default=0,
+                        help='duration over which devices arrive, in s')
+    parser.add_argument('--attempts', type=int, default=5,
+                        help='maximum number of attempts per device')
+    parser.add_argument('--backoff', type=float, default=1,
+                        help='back-off after the first failure, in s, '
+                             'doubled after every failure')
+    parser.add_argument('--backoff-max', type=float, default=30,
+                        help='largest back-off, in s')
+    parser.add_argument('--delay', type=float, default=0,
+                        help='round-trip time added by the proxy, in ms')
+    parser.add_argument('--rate', type=float, default=0,
+                        help='bandwidth of the link shared by all devices, '
+                             'in bytes/s')
+    parser.add_argument('--backlog', type=int, default=128,
+                        help='server queue of pending connections')
+    parser.add_argument('-o', help='output file, JSON lines appended')
+    args = parser.parse_args()
+    if not os.access(os.path.join(args.b, 'fuota_host'), os.X_OK):
+        parser.error('no fuota_host in ' + args.b)
+
+    work_dir = tempfile.mkdtemp(prefix='fuota_fleet_')
+    cert = os.path.join(work_dir, 'cert.pem')
+    key = os.path.join(work_dir, 'key.pem')
+    subprocess.run(['openssl', 'req', '-x509', '-newkey', 'rsa:2048',
+                    '-nodes', '-days', '1', '-subj', '/CN=localhost',
+                    '-addext', 'subjectAltName=DNS:localhost',
+                    '-keyout', key, '-out', cert],
+                   check=True, stderr=subprocess.DEVNULL)
+    write_image(os.path.join(work_dir, 'running.bin'), args.s, False)
+    files_dir = os.path.join(work_dir, 'files')
+    os.makedirs(files_dir)
+    write_image(os.path.join(files_dir, UPDATE_FILE), args.s, True)
+
+    incomplete = 0
+    try:
+        print('{:>7} {:>7} {:>7} {:>7} {:>7} {:>7} {:>8} {:>9} {:>9} '
+              '{}'.format('devices', 'updated', 'p50 (s)', 'p90 (s)',
+                          'p99 (s)', 'max (s)', 'attempts', 'MB/s',
+                          'hs/s', 'failures'))
+        for count in args.n:
+            result = run(count, args, work_dir)
+            incomplete += result['devices'] - result['updated']
+            latency = result['latency_s']
+            server = result['server']
+            print('{:>7} {:>7} {:>7.2f} {:>7.2f} {:>7.2f} {:>7.2f} {:>8.2f} '
+                  '{:>9.3f} {:>9.1f} {}'.format(
+                      result['devices'], result['updated'], latency['p50'],
+                      latency['p90'], latency['p99'], latency['max'],
+                      result['attempts'], server['mb_per_s'],
+                      server['handshakes_per_s'],
+                      json.dumps(result['failures'])), flush=True)
+            if args.o:
+                with open(args.o, 'a') as f:
+                    f.write(json.dumps(dict(
+                        result, image_size=args.s, ramp=args.ramp,
+                        delay=args.delay, rate=args.rate,
+                        backoff=args.backoff)) + '\n')
+    finally:
+        shutil.rmtree(work_dir)
+    return 1 if incomplete else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
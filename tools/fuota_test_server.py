@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+"""
+Minimal stand-in for the FUOTA server, for tests on a single computer. It
+answers every update check with the name of the update file, and serves
+the files of a directory over HTTPS, as Nginx would for static files:
+ETag, Range and If-Range headers, plus the Digest header expected by the
+fuota_b component. Credentials are not checked.
+
+Every connection is handled by its own thread, TLS handshake included, so
+that many devices can be served at the same time.
+
+On exit (SIGINT or SIGTERM), counters are written as JSON to the file given
+with --stats, if any: connections, TLS handshakes (full, resumed and
+failed), requests per status code, response body bytes, largest number of
+simultaneous connections, and the number of handshakes and body bytes for
+every second since the start of the server (handshakes_by_s,
+bytes_by_s).
+
+Usage: fuota_test_server.py [-p <port>] [-b <backlog>] [--stats <file>]
+                            <certificate> <key> <directory>
+                            <update file name>
+
+Use port 0 to get a free port: the port actually used is printed on the
+first line of the standard output.
+"""
+
+import argparse
+import base64
+import hashlib
+import http.server
+import json
+import os
+import signal
+import ssl
+import sys
+import threading
+import time
+
+
+class Stats:
+    """Server counters, updated by all connection threads."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.start = time.monotonic()
+        self.active = 0
+        self.counters = {'connections': 0, 'full_handshakes': 0,
+                         'resumed_handshakes': 0, 'failed_handshakes': 0,
+                         'requests': {}, 'body_bytes': 0,
+                         'max_connections': 0, 'handshakes_by_s': [],
+                         'bytes_by_s': []}
+
+    def add(self, name, value=1):
+        with self.lock:
+            self.counters[name] += value
+
+    def add_per_second(self, name, value):
+        second = int(time.monotonic() - self.start)
+        with self.lock:
+            series = self.counters[name]
+            series.extend([0] * (second + 1 - len(series)))
+            series[second] += value
+
+    def count_request(self, status):
+        with self.lock:
+            requests = self.counters['requests']
+            requests[str(status)] = requests.get(str(status), 0) + 1
+
+    def open_connection(self):
+        with self.lock:
+            self.active += 1
+            self.counters['connections'] += 1
+            self.counters['max_connections'] = max(
+                self.counters['max_connections'], self.active)
+
+    def close_connection(self):
+        with self.lock:
+            self.active -= 1
+
+
+class Server(http.server.ThreadingHTTPServer):
+
+    allow_reuse_address = True
+    daemon_threads = True
+
+    def finish_request(self, request, client_address):
+        # In the thread of the connection.
+        self.stats.open_connection()
+        try:
+            try:
+                request = self.context.wrap_socket(request, server_side=True)
+            except (ssl.SSLError, OSError):
+                self.stats.add('failed_handshakes')
+                return
+            self.stats.add('resumed_handshakes' if request.session_reused
+                           else 'full_handshakes')
+            self.stats.add_per_second('handshakes_by_s', 1)
+            self.RequestHandlerClass(request, client_address, self)
+        finally:
+            self.stats.close_connection()
+
+    def read_file(self, name):
+        """Returns the content of a file and its SHA-256, computed once per
+        version of the file."""
+        path = os.path.join(self.directory, name)
+        mtime = os.stat(path).st_mtime_ns
+        with self.stats.lock:
+            cached = self.files.get(name)
+        if cached is None or cached[0] != mtime:
+            with open(path, 'rb') as f:
+                data = f.read()
+            cached = (mtime, data, hashlib.sha256(data).digest())
+            with self.stats.lock:
+                self.files[name] = cached
+        return cached[1], cached[2]
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        pass
+
+    def send_response(self, code, message=None):
+        self.server.stats.count_request(code)
+        super().send_response(code, message)
+
+    def send_empty(self, status):
+        self.send_response(status)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_GET(self):
+        path = self.path.split('?')[0]
+        if path.startswith('/devices/'):
+            body = self.server.update_file.encode()
+            self.send_response(200)
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+        if not path.startswith('/files/'):
+            self.send_empty(404)
+            return
+        name = os.path.basename(path[len('/files/'):])
+        try:
+            data, digest = self.server.read_file(name)
+        except OSError:
+            self.send_empty(404)
+            return
+        etag = '"{}"'.format(digest[:8].hex())
+        start, end, status = 0, len(data), 200
+        range_header = self.headers.get('Range')
+        if_range = self.headers.get('If-Range')
+        if range_header and (if_range is None or if_range == etag):
+            first, _, last = range_header[len('bytes='):].partition('-')
+            start = int(first)
+            end = int(last) + 1 if last else len(data)
+            if start >= len(data):
+                self.send_response(416)
+                self.send_header('Content-Range',
+                                 'bytes */{}'.format(len(data)))
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                return
+            end = min(end, len(data))
+            status = 206
+        self.send_response(status)
+        self.send_header('ETag', etag)
+        self.send_header('Digest',
+                         'SHA-256=' + base64.b64encode(digest).decode())
+        if status == 206:
+            self.send_header('Content-Range', 'bytes {}-{}/{}'.format(
+                start, end - 1, len(data)))
+        self.send_header('Content-Length', str(end - start))
+        self.end_headers()
+        try:
+            self.wfile.write(data[start:end])
+            self.server.stats.add('body_bytes', end - start)
+            self.server.stats.add_per_second('bytes_by_s', end - start)
+        except OSError:
+            # Connection reset by the device, or by a test proxy.
+            self.close_connection = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='FUOTA test server')
+    parser.add_argument('-p', type=int, default=0, help='server port')
+    parser.add_argument('-b', type=int, default=128,
+                        help='length of the queue of pending connections')
+    parser.add_argument('--stats', help='statistics file')
+    parser.add_argument('certificate')
+    parser.add_argument('key')
+    parser.add_argument('directory')
+    parser.add_argument('update_file')
+    args = parser.parse_args()
+    Server.request_queue_size = args.b
+    server = Server(('127.0.0.1', args.p), Handler)
+    server.directory = args.directory
+    server.update_file = args.update_file
+    server.files = {}
+    server.stats = Stats()
+    server.context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    server.context.load_cert_chain(args.certificate, args.key)
+    print(server.server_address[1], flush=True)
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+    try:
+        server.serve_forever()
+    except (KeyboardInterrupt, SystemExit):
+        pass
+    if args.stats:
+        with server.stats.lock:
+            output = json.dumps(server.stats.counters)
+        with open(args.stats, 'w') as f:
+            f.write(output + '\n')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
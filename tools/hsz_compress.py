@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+"""
+Compresses an update file (application image or patch) into the HSZ1 format
+described in components/fuota_b/ota_hsz.h.
+
+The heatshrink2 Python package is used if it is installed. Otherwise, a
+slower, pure Python, encoder is used.
+
+Usage: hsz_compress.py [-w <window bits>] [-l <lookahead bits>] <input> <output>
+"""
+
+import argparse
+import struct
+
+MAGIC = b'HSZ1'
+# Maximum number of candidate positions checked for each match.
+MAX_CHAIN = 32
+
+
+class BitWriter:
+
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.count = 0
+
+    def push(self, value, bits):
+        self.acc = (self.acc << bits) | value
+        self.count += bits
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.acc >> self.count) & 0xff)
+        self.acc &= (1 << self.count) - 1
+
+    def finish(self):
+        if self.count > 0:
+            self.out.append((self.acc << (8 - self.count)) & 0xff)
+        return bytes(self.out)
+
+
+def compress_python(data, window_bits, lookahead_bits):
+    window = 1 << window_bits
+    max_length = 1 << lookahead_bits
+    backref_bits = 1 + window_bits + lookahead_bits
+    chains = {}
+    writer = BitWriter()
+    n = len(data)
+    i = 0
+    while i < n:
+        best_length = 0
+        best_distance = 0
+        key = data[i:i + 3]
+        candidates = chains.get(key, [])
+        limit = min(max_length, n - i)
+        for j in reversed(candidates[-MAX_CHAIN:]):
+            if i - j > window:
+                break
+            length = min(3, limit)
+            while length < limit and data[j + length] == data[i + length]:
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_distance = i - j
+                if length == limit:
+                    break
+        if best_length * 9 > backref_bits:
+            writer.push(0, 1)
+            writer.push(best_distance - 1, window_bits)
+            writer.push(best_length - 1, lookahead_bits)
+            step = best_length
+        else:
+            writer.push(1, 1)
+            writer.push(data[i], 8)
+            step = 1
+        for k in range(i, min(i + step, n - 2)):
+            chain = chains.setdefault(data[k:k + 3], [])
+            chain.append(k)
+            if len(chain) > 4 * MAX_CHAIN:
+                del chain[:2 * MAX_CHAIN]
+        i += step
+    return writer.finish()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HSZ1 compressor')
+    parser.add_argument('-w', type=int, default=12, help='window size exponent')
+    parser.add_argument('-l', type=int, default=5,
+                        help='lookahead size exponent')
+    parser.add_argument('input')
+    parser.add_argument('output')
+    args = parser.parse_args()
+    if not 4 <= args.w <= 14 or not 0 < args.l < args.w:
+        parser.error('unsupported window or lookahead size')
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    try:
+        import heatshrink2
+        body = heatshrink2.compress(data, window_sz2=args.w,
+                                    lookahead_sz2=args.l)
+    except ImportError:
+        body = compress_python(data, args.w, args.l)
+    with open(args.output, 'wb') as f:
+        f.write(MAGIC + struct.pack('<BBH', args.w, args.l, 0) + body)
+    print('{}: {} bytes ({:.1f}% of {} bytes)'.format(
+        args.output, len(body) + 8, 100.0 * (len(body) + 8) / max(len(data), 1),
+        len(data)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+"""
+TCP proxy impairing the link between a device, or a host build of the
+FUOTA client, and the update server. Every direction of every connection
+goes through:
+- a delay, with uniform jitter. Data stays in order, as with TCP
+- losses: a lost segment, and the data behind it, is held for a
+  retransmission timeout (200 ms plus the round-trip time), as the
+  receiver of a real TCP connection would experience it
+- a bandwidth cap, shared by all connections, per direction
+- a window: the amount of data in flight per direction of a connection is
+  limited, as by the TCP receive window, so that the throughput of a
+  connection is at most the window divided by the round-trip time
+- connection resets, on a schedule: after a given number of bytes sent to
+  the client, or at a given time, counted from the start of the proxy
+
+Data is forwarded by segments of at most 1460 bytes, to which losses
+apply.
+
+On exit (SIGINT or SIGTERM), or when all resets took place if --exit-after
+is given, counters are written as JSON to the standard output, or to the
+file given with --stats: connections, resets, bytes sent in each direction.
+
+Usage: impair_proxy.py [options] <listening port> <server host> <server port>
+
+Use listening port 0 to get a free port: the port actually used is printed
+on the first line of the standard output.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import signal
+import socket
+import struct
+import sys
+import time
+
+SEGMENT_SIZE = 1460
+MIN_RTO = 0.2
+# Default largest number of segments waiting for their delivery time, per
+# direction of a connection.
+QUEUE_SIZE = 256
+
+
+class Link:
+    """Impairments of one direction, shared by all connections."""
+
+    def __init__(self, delay, jitter, loss, rate):
+        self.delay = delay
+        self.jitter = jitter
+        self.loss = loss
+        self.rate = rate
+        # Time at which the link is available for the next segment.
+        self.free_at = 0.0
+
+    def delivery_time(self, length, previous):
+        now = time.monotonic()
+        start = max(now, self.free_at)
+        if self.rate > 0:
+            self.free_at = start + length / self.rate
+            start = self.free_at
+        delivery = start + self.delay + random.uniform(-self.jitter,
+                                                       self.jitter)
+        if random.random() < self.loss:
+            delivery += MIN_RTO + 2 * self.delay
+        # No reordering.
+        return max(delivery, previous)
+
+
+class Proxy:
+
+    def __init__(self, args):
+        self.args = args
+        self.up = Link(args.delay / 2000, args.jitter / 1000,
+                       args.loss / 100, args.rate)
+        self.down = Link(args.delay / 2000, args.jitter / 1000,
+                         args.loss / 100, args.rate)
+        self.reset_bytes = sorted(args.reset_bytes)
+        self.reset_times = sorted(args.reset_times)
+        self.start = time.monotonic()
+        self.connections = set()
+        self.stats = {'connections': 0, 'resets': 0, 'bytes_up': 0,
+                      'bytes_down': 0}
+        self.done = asyncio.Event()
+
+    def resets_pending(self):
+        return bool(self.reset_bytes or self.reset_times)
+
+    def reset_all(self):
+        self.stats['resets'] += 1
+        for writers in list(self.connections):
+            for writer in writers:
+                sock = writer.get_extra_info('socket')
+                if sock is not None:
+                    # Zero linger time: close() sends a RST.
+                    sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER,
+                                    struct.pack('ii', 1, 0))
+                writer.transport.abort()
+        self.connections.clear()
+        if self.args.exit_after and not self.resets_pending():
+            self.done.set()
+
+    def count_down(self, length):
+        self.stats['bytes_down'] += length
+        if (self.reset_bytes and
+                self.stats['bytes_down'] >= self.reset_bytes[0]):
+            self.reset_bytes.pop(0)
+            self.reset_all()
+
+    async def reset_timer(self):
+        for at in self.reset_times[:]:
+            await asyncio.sleep(max(0, self.start + at - time.monotonic()))
+            self.reset_times.pop(0)
+            self.reset_all()
+
+    async def forward(self, reader, writer, link, downstream):
+        queue = asyncio.Queue(max(1, self.args.window // SEGMENT_SIZE))
+
+        async def receive():
+            previous = 0.0
+            try:
+                while True:
+                    data = await reader.read(SEGMENT_SIZE)
+                    if not data:
+                        break
+                    previous = link.delivery_time(len(data), previous)
+                    await queue.put((previous, data))
+            except OSError:
+                pass
+            await queue.put((previous, None))
+
+        receiver = asyncio.get_running_loop().create_task(receive())
+        try:
+            while True:
+                delivery, data = await queue.get()
+                await asyncio.sleep(max(0, delivery - time.monotonic()))
+                if writer.is_closing():
+                    break
+                if data is None:
+                    if writer.can_write_eof():
+                        writer.write_eof()
+                    break
+                writer.write(data)
+                await writer.drain()
+                if downstream:
+                    self.count_down(len(data))
+                else:
+                    self.stats['bytes_up'] += len(data)
+        except OSError:
+            pass
+        finally:
+            receiver.cancel()
+
+    async def handle(self, client_reader, client_writer):
+        try:
+            server_reader, server_writer = await asyncio.open_connection(
+                self.args.server_host, self.args.server_port)
+        except OSError:
+            client_writer.close()
+            return
+        self.stats['connections'] += 1
+        writers = (client_writer, server_writer)
+        self.connections.add(writers)
+        try:
+            await asyncio.gather(
+                self.forward(client_reader, server_writer, self.up, False),
+                self.forward(server_reader, client_writer, self.down, True))
+        except asyncio.CancelledError:
+            # Proxy exit.
+            pass
+        self.connections.discard(writers)
+        for writer in writers:
+            writer.close()
+
+    async def run(self):
+        server = await asyncio.start_server(self.handle, '127.0.0.1',
+                                            self.args.port)
+        print(server.sockets[0].getsockname()[1], flush=True)
+        loop = asyncio.get_running_loop()
+        for sig in (signal.SIGINT, signal.SIGTERM):
+            loop.add_signal_handler(sig, self.done.set)
+        timer = loop.create_task(self.reset_timer())
+        await self.done.wait()
+        timer.cancel()
+        server.close()
+
+
+def parse_size(text):
+    factor = {'K': 1024, 'M': 1024 * 1024}.get(text[-1], 1)
+    return int(text.rstrip('KM')) * factor
+
+
+def parse_sizes(text):
+    return [parse_size(item) for item in filter(None, text.split(','))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='TCP impairment proxy')
+    parser.add_argument('--delay', type=float, default=0,
+                        help='round-trip time added, in ms')
+    parser.add_argument('--jitter', type=float, default=0,
+                        help='maximum deviation of one-way delay, in ms')
+    parser.add_argument('--loss', type=float, default=0,
+                        help='segment loss rate, in percent')
+    parser.add_argument('--rate', type=float, default=0,
+                        help='bandwidth cap per direction, in bytes/s')
+    parser.add_argument('--window', type=parse_size,
+                        default=QUEUE_SIZE * SEGMENT_SIZE,
+                        help='bytes in flight per direction of a connection '
+                             '(K and M suffixes accepted)')
+    parser.add_argument('--reset-bytes', type=parse_sizes, default=[],
+                        help='comma-separated amounts of bytes sent to the '
+                             'client after which connections are reset '
+                             '(K and M suffixes accepted)')
+    parser.add_argument('--reset-times', default=[],
+                        type=lambda t: [float(v) for v in t.split(',') if v],
+                        help='comma-separated times, in s, at which '
+                             'connections are reset')
+    parser.add_argument('--exit-after', action='store_true',
+                        help='exit once all resets took place')
+    parser.add_argument('--stats', help='statistics file')
+    parser.add_argument('port', type=int)
+    parser.add_argument('server_host')
+    parser.add_argument('server_port', type=int)
+    args = parser.parse_args()
+    proxy = Proxy(args)
+    asyncio.run(proxy.run())
+    output = json.dumps(proxy.stats)
+    if args.stats:
+        with open(args.stats, 'w') as f:
+            f.write(output + '\n')
+    else:
+        print(output, flush=True)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+"""
+Runs update scenarios over impaired links: for every scenario, the host
+build of the FUOTA client (host/ directory) downloads an update file from
+fuota_test_server.py through impair_proxy.py. As the application would do,
+ota_update_b() is called again after a failure, until the update succeeds
+or the maximum number of attempts is reached.
+
+For every scenario, the following values are printed, and appended as a
+JSON line to the output file if one is given:
+- completed: whether the update succeeded
+- attempts: number of calls to ota_update_b()
+- time_s: cumulated duration of these calls, pauses between attempts
+  excluded
+- body_bytes: response body bytes received by the client
+- wasted_bytes: body bytes received beyond the update file and the update
+  check responses, i.e. received but not used, then downloaded again
+- wire_bytes_down, wire_bytes_up: bytes forwarded by the proxy, TLS
+  overhead and retransmitted requests included
+- connections, resets: connections opened through the proxy, resets
+  injected
+
+Resets are given as fractions of the update file size: the connection is
+reset once this amount of bytes was sent to the client.
+
+Usage: impair_scenarios.py [-b <host build directory>] [-s <image size>]
+                           [-n <max attempts>] [-o <output file>]
+                           [<scenario>...]
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+# Proxy settings: delay (round-trip, ms), jitter (ms), loss (%), rate
+# (bytes/s), resets (fractions of the update file size).
+SCENARIOS = {
+    'baseline': {},
+    'rtt200': {'delay': 200, 'jitter': 20},
+    'loss5': {'delay': 200, 'jitter': 20, 'loss': 5},
+    'cap256k': {'delay': 200, 'rate': 32000},
+    'drop_mid': {'delay': 200, 'resets': [0.5]},
+    'flapping': {'delay': 200, 'loss': 2, 'resets': [0.2, 0.4, 0.6, 0.8]},
+    'vehicle': {'delay': 200, 'jitter': 50, 'loss': 5, 'rate': 64000,
+                'resets': [0.3, 0.7]},
+}
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+UPDATE_FILE = 'update.bin'
+ATTEMPT_TIMEOUT = 600
+
+
+def start(command):
+    """Starts a tool printing its port on its first output line."""
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, text=True)
+    return process, int(process.stdout.readline())
+
+
+def stop(process):
+    process.send_signal(signal.SIGTERM)
+    try:
+        process.wait(10)
+    except subprocess.TimeoutExpired:
+        process.kill()
+        process.wait()
+
+
+def write_image(path, size, seed):
+    """Writes an application image without segments: the host storage sink
+    then only checks its magic byte."""
+    data = bytearray(os.urandom(size)) if seed else bytearray(size)
+    data[0:2] = b'\xe9\x00'
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+def run_scenario(name, settings, args, work_dir, server_port):
+    scenario_dir = os.path.join(work_dir, name)
+    nvs_dir = os.path.join(scenario_dir, 'nvs')
+    os.makedirs(nvs_dir)
+    stats_path = os.path.join(scenario_dir, 'stats.json')
+    command = [sys.executable, os.path.join(TOOLS_DIR, 'impair_proxy.py'),
+               '--stats', stats_path]
+    for option in ('delay', 'jitter', 'loss', 'rate'):
+        if option in settings:
+            command += ['--' + option, str(settings[option])]
+    if 'resets' in settings:
+        command += ['--reset-bytes', ','.join(
+            str(int(fraction * args.s)) for fraction in settings['resets'])]
+    proxy, proxy_port = start(command + ['0', '127.0.0.1', str(server_port)])
+
+    client = [os.path.join(args.b, 'fuota_host'), 'localhost',
+              str(proxy_port), os.path.join(work_dir, 'cert.pem'), 'user',
+              'password', '00001', '0.1.0',
+              os.path.join(work_dir, 'running.bin'),
+              os.path.join(scenario_dir, 'update_partition.bin'), nvs_dir]
+    result = {'scenario': name, 'completed': False, 'attempts': 0,
+              'time_s': 0.0, 'body_bytes': 0}
+    while not result['completed'] and result['attempts'] < args.n:
+        result['attempts'] += 1
+        start_time = time.monotonic()
+        output = subprocess.run(client, stdout=subprocess.PIPE,
+                                stderr=subprocess.STDOUT, text=True,
+                                timeout=ATTEMPT_TIMEOUT).stdout
+        result['time_s'] += time.monotonic() - start_time
+        received = re.search(r'^bytes: received (\d+)', output, re.M)
+        if received:
+            result['body_bytes'] += int(received.group(1))
+        result['completed'] = 'status: OTA_UPDATED' in output
+        if not result['completed']:
+            time.sleep(args.pause)
+    stop(proxy)
+
+    with open(stats_path) as f:
+        stats = json.load(f)
+    result['time_s'] = round(result['time_s'], 3)
+    result['wasted_bytes'] = (result['body_bytes'] - args.s -
+                              result['attempts'] * len(UPDATE_FILE))
+    result['wire_bytes_down'] = stats['bytes_down']
+    result['wire_bytes_up'] = stats['bytes_up']
+    result['connections'] = stats['connections']
+    result['resets'] = stats['resets']
+    return result
+
+
+def parse_size(text):
+    factor = {'K': 1024, 'M': 1024 * 1024}.get(text[-1:], 1)
+    return int(text.rstrip('KM')) * factor
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Impaired link scenarios')
+    parser.add_argument('-b', default='host_build',
+                        help='host build directory')
+    parser.add_argument('-s', type=parse_size, default=512 * 1024,
+                        help='update image size (K and M suffixes accepted)')
+    parser.add_argument('-n', type=int, default=10,
+                        help='maximum number of attempts')
+    parser.add_argument('--pause', type=float, default=0.5,
+                        help='pause between attempts, in s')
+    parser.add_argument('-o', help='output file, JSON lines appended')
+    parser.add_argument('scenarios', nargs='*', default=list(SCENARIOS),
+                        help='scenarios among: ' + ', '.join(SCENARIOS))
+    args = parser.parse_args()
+    for name in args.scenarios:
+        if name not in SCENARIOS:
+            parser.error('unknown scenario: ' + name)
+    if not os.access(os.path.join(args.b, 'fuota_host'), os.X_OK):
+        parser.error('no fuota_host in ' + args.b)
+
+    work_dir = tempfile.mkdtemp(prefix='fuota_impair_')
+    cert = os.path.join(work_dir, 'cert.pem')
+    key = os.path.join(work_dir, 'key.pem')
+    subprocess.run(['openssl', 'req', '-x509', '-newkey', 'rsa:2048',
+                    '-nodes', '-days', '1', '-subj', '/CN=localhost',
+                    '-addext', 'subjectAltName=DNS:localhost',
+                    '-keyout', key, '-out', cert],
+                   check=True, stderr=subprocess.DEVNULL)
+    write_image(os.path.join(work_dir, 'running.bin'), args.s, False)
+    files_dir = os.path.join(work_dir, 'files')
+    os.makedirs(files_dir)
+    write_image(os.path.join(files_dir, UPDATE_FILE), args.s, True)
+    server, server_port = start(
+        [sys.executable, os.path.join(TOOLS_DIR, 'fuota_test_server.py'),
+         cert, key, files_dir, UPDATE_FILE])
+
+    failures = 0
+    try:
+        print('{:<10} {:>9} {:>8} {:>9} {:>11} {:>12} {:>11}'.format(
+            'scenario', 'completed', 'attempts', 'time (s)', 'body bytes',
+            'wasted bytes', 'wire bytes'))
+        for name in args.scenarios:
+            result = run_scenario(name, SCENARIOS[name], args, work_dir,
+                                  server_port)
+            failures += not result['completed']
+            print('{scenario:<10} {completed!s:>9} {attempts:>8} '
+                  '{time_s:>9.1f} {body_bytes:>11} {wasted_bytes:>12} '
+                  '{wire_bytes_down:>11}'.format(**result), flush=True)
+            if args.o:
+                with open(args.o, 'a') as f:
+                    f.write(json.dumps(dict(result, image_size=args.s,
+                                            **SCENARIOS[name])) + '\n')
+    finally:
+        stop(server)
+        shutil.rmtree(work_dir)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
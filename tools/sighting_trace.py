@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+
+
+"""
+Generates a synthetic trace of the sightings of the FUOTA AP by a device
+installed in a vehicle: the vehicle leaves its depot in the morning, and
+comes back in the evening, with some jitter, and stays at the depot during
+week-ends. While at the depot, the AP can be lost for a short time.
+
+The trace is written as one presence interval per line, "<start> <end>" in
+seconds from the start of the trace, as expected by the host scan
+scheduling simulator (fuota_scan_sim).
+
+Usage: sighting_trace.py [-d <days>] [-l <leave time>] [-b <back time>]
+                         [-j <jitter>] [-w] [-f <flickers per day>]
+                         [-s <seed>] [-o <output file>]
+"""
+
+import argparse
+import random
+import sys
+
+DAY = 86400
+# Duration of a loss of the AP while at the depot, in s.
+FLICKER_MIN = 10
+FLICKER_MAX = 120
+
+
+def parse_time(value):
+    hours, minutes = value.split(':')
+    return int(hours) * 3600 + int(minutes) * 60
+
+
+def generate(args):
+    rng = random.Random(args.seed)
+    jitter = args.jitter * 60
+    # Absences of the AP, as (start, end).
+    absences = []
+    for day in range(args.days):
+        if args.weekends and (day % 7 in (5, 6)):
+            continue
+        leave = day * DAY + parse_time(args.leave) + rng.gauss(0, jitter)
+        back = day * DAY + parse_time(args.back) + rng.gauss(0, jitter)
+        if back > leave:
+            absences.append((int(leave), int(back)))
+    end = args.days * DAY
+    for _ in range(int(args.flickers * args.days)):
+        start = rng.randrange(end)
+        absences.append((start,
+                         start + rng.randint(FLICKER_MIN, FLICKER_MAX)))
+    absences.sort()
+    # Presence intervals are the gaps between absences.
+    intervals = []
+    position = 0
+    for start, stop in absences:
+        if start > position:
+            intervals.append((position, start))
+        position = max(position, stop)
+    if end > position:
+        intervals.append((position, end))
+    return intervals
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Sighting trace generator')
+    parser.add_argument('-d', '--days', type=int, default=28)
+    parser.add_argument('-l', '--leave', default='08:00',
+                        help='time the vehicle leaves the depot, HH:MM')
+    parser.add_argument('-b', '--back', default='18:00',
+                        help='time the vehicle comes back, HH:MM')
+    parser.add_argument('-j', '--jitter', type=float, default=20,
+                        help='standard deviation of both times, in minutes')
+    parser.add_argument('-w', '--weekends', action='store_true',
+                        help='stay at the depot on days 6 and 7 of every week')
+    parser.add_argument('-f', '--flickers', type=float, default=2,
+                        help='short losses of the AP per day')
+    parser.add_argument('-s', '--seed', type=int, default=1)
+    parser.add_argument('-o', '--output')
+    args = parser.parse_args()
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    out.write('# days {} leave {} back {} jitter {} min seed {}\n'.format(
+        args.days, args.leave, args.back, args.jitter, args.seed))
+    for start, stop in generate(args):
+        out.write('{} {}\n'.format(start, stop))
+    if args.output:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+"""
+Measures the completion time of an update against the number of
+connections the image is downloaded over (fuota_host -s option), under
+simulated latency: for every round-trip time, and every number of streams,
+the host build of the FUOTA client (host/ directory) downloads an update
+image from fuota_test_server.py through impair_proxy.py.
+
+The proxy limits the data in flight per connection (--window), as the TCP
+window of the device does: the throughput of a single connection is then
+bounded by the window divided by the round-trip time.
+
+For every run, the following values are printed, and appended as a JSON
+line to the output file if one is given:
+- rtt_ms, streams: settings of the run
+- completed: whether the update succeeded
+- time_s: duration of the update, update check and TLS handshakes included
+- transfer_s: duration of the download of the image
+- connections: connections opened by the client
+
+Usage: stream_bench.py [-b <host build directory>] [-s <image size>]
+                       [-w <window>] [-r <round-trip times>]
+                       [-n <max streams>] [-o <output file>]
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from impair_scenarios import (ATTEMPT_TIMEOUT, TOOLS_DIR, UPDATE_FILE,
+                              parse_size, start, stop, write_image)
+
+
+def run(rtt, streams, args, work_dir, server_port):
+    run_dir = os.path.join(work_dir, '{}_{}'.format(rtt, streams))
+    nvs_dir = os.path.join(run_dir, 'nvs')
+    os.makedirs(nvs_dir)
+    proxy, proxy_port = start(
+        [sys.executable, os.path.join(TOOLS_DIR, 'impair_proxy.py'),
+         '--delay', str(rtt), '--window', str(args.w), '--stats',
+         os.path.join(run_dir, 'stats.json'), '0', '127.0.0.1',
+         str(server_port)])
+    client = [os.path.join(args.b, 'fuota_host'), '-s', str(streams),
+              'localhost', str(proxy_port),
+              os.path.join(work_dir, 'cert.pem'), 'user', 'password',
+              '00001', '0.1.0', os.path.join(work_dir, 'running.bin'),
+              os.path.join(run_dir, 'update_partition.bin'), nvs_dir]
+    try:
+        output = subprocess.run(client, stdout=subprocess.PIPE,
+                                stderr=subprocess.STDOUT, text=True,
+                                timeout=ATTEMPT_TIMEOUT).stdout
+    finally:
+        stop(proxy)
+    result = {'rtt_ms': rtt, 'streams': streams,
+              'completed': 'status: OTA_UPDATED' in output}
+    times = re.search(r'^time \(us\): total (\d+),.* transfer (\d+),', output,
+                      re.M)
+    connections = re.search(r'^connections: (\d+)', output, re.M)
+    result['time_s'] = round(int(times.group(1)) / 1e6, 3) if times else 0
+    result['transfer_s'] = round(int(times.group(2)) / 1e6, 3) if times else 0
+    result['connections'] = int(connections.group(1)) if connections else 0
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Parallel download '
+                                                 'benchmark')
+    parser.add_argument('-b', default='host_build',
+                        help='host build directory')
+    parser.add_argument('-s', type=parse_size, default=1024 * 1024,
+                        help='update image size (K and M suffixes accepted)')
+    parser.add_argument('-w', type=parse_size, default=16 * 1024,
+                        help='bytes in flight per connection (K and M '
+                             'suffixes accepted)')
+    parser.add_argument('-r', default='20,100,300',
+                        type=lambda t: [int(v) for v in t.split(',') if v],
+                        help='comma-separated round-trip times, in ms')
+    parser.add_argument('-n', type=int, default=4,
+                        help='largest number of streams')
+    parser.add_argument('-o', help='output file, JSON lines appended')
+    args = parser.parse_args()
+    if not os.access(os.path.join(args.b, 'fuota_host'), os.X_OK):
+        parser.error('no fuota_host in ' + args.b)
+
+    work_dir = tempfile.mkdtemp(prefix='fuota_streams_')
+    cert = os.path.join(work_dir, 'cert.pem')
+    key = os.path.join(work_dir, 'key.pem')
+    subprocess.run(['openssl', 'req', '-x509', '-newkey', 'rsa:2048',
+                    '-nodes', '-days', '1', '-subj', '/CN=localhost',
+                    '-addext', 'subjectAltName=DNS:localhost',
+                    '-keyout', key, '-out', cert],
+                   check=True, stderr=subprocess.DEVNULL)
+    write_image(os.path.join(work_dir, 'running.bin'), args.s, False)
+    files_dir = os.path.join(work_dir, 'files')
+    os.makedirs(files_dir)
+    write_image(os.path.join(files_dir, UPDATE_FILE), args.s, True)
+    server, server_port = start(
+        [sys.executable, os.path.join(TOOLS_DIR, 'fuota_test_server.py'),
+         cert, key, files_dir, UPDATE_FILE])
+
+    failures = 0
+    try:
+        print('{:>8} {:>7} {:>9} {:>9} {:>12} {:>11}'.format(
+            'rtt (ms)', 'streams', 'completed', 'time (s)', 'transfer (s)',
+            'connections'))
+        for rtt in args.r:
+            for streams in range(1, args.n + 1):
+                result = run(rtt, streams, args, work_dir, server_port)
+                failures += not result['completed']
+                print('{rtt_ms:>8} {streams:>7} {completed!s:>9} '
+                      '{time_s:>9.2f} {transfer_s:>12.2f} '
+                      '{connections:>11}'.format(**result), flush=True)
+                if args.o:
+                    with open(args.o, 'a') as f:
+                        f.write(json.dumps(dict(result, image_size=args.s,
+                                                window=args.w)) + '\n')
+    finally:
+        stop(server)
+        shutil.rmtree(work_dir)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32-fuota.
+#
+# esp32-fuota is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-fuota is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-fuota. If not, see <https://www.gnu.org/licenses/>.
+#
+# Copyright 2023 Pascal Bodin
+
+
+"""
+Decodes the trace records written by the trace_ring component (lines
+starting with "TRC ", see components/trace_ring/include/trace_ring.h), for
+instance in a capture of the ESP32 console, or in the output of the host
+build, and prints them as a timeline: time since the first record, time
+since the previous record, core, event and arguments. Other lines are
+ignored.
+
+Event names are read from trace_events.h.
+
+Usage: trace_decode.py [-e <trace_events.h>] [--json] [<capture file>...]
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+DEFAULT_EVENTS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              '..', 'components', 'trace_ring', 'include',
+                              'trace_events.h')
+# Sequence, timestamp, event, core, reserved, arguments.
+RECORD = struct.Struct('<IIHBBII')
+TRACE_LINE = re.compile(r'TRC ([0-9a-f]{%d})\s*$' % (2 * RECORD.size))
+LOST_LINE = re.compile(r'TRC lost (\d+)')
+EVENT_ENTRY = re.compile(r'X\((\w+),\s*"(\w*)",\s*"(\w*)",\s*"(\w*)",'
+                         r'\s*"(\w*)"\)')
+
+
+def read_events(path):
+    with open(path) as f:
+        return [match.groups()[1:] for match in EVENT_ENTRY.finditer(f.read())]
+
+
+def decode_arg(name, value):
+    """Returns the name and the value to be displayed."""
+    if name.endswith('_4cc'):
+        text = value.to_bytes(4, 'little').rstrip(b'\0')
+        return name[:-4], text.decode('ascii', 'replace')
+    return name, value
+
+
+def decode(lines, events, as_json):
+    first = None
+    previous = None
+    high = 0
+    sequence = None
+    for line in lines:
+        match = LOST_LINE.search(line)
+        if match:
+            print('{} records lost'.format(match.group(1)))
+            continue
+        match = TRACE_LINE.search(line)
+        if not match:
+            continue
+        (record_sequence, timestamp, event, core, _,
+         arg0, arg1) = RECORD.unpack(bytes.fromhex(match.group(1)))
+        if (sequence is not None) and (record_sequence > sequence + 1):
+            print('{} records lost'.format(record_sequence - sequence - 1))
+        sequence = record_sequence
+        # Timestamps are the low 32 bits of a microsecond counter. Records
+        # of different cores may be slightly out of order.
+        if (previous is not None) and (
+                (timestamp - previous) & 0xffffffff) < 0x80000000:
+            if timestamp < previous:
+                high += 1 << 32
+        time = high + timestamp
+        previous = timestamp
+        if first is None:
+            first = last = time
+        if event < len(events):
+            component, name, arg0_name, arg1_name = events[event]
+        else:
+            component, name, arg0_name, arg1_name = ('?', str(event),
+                                                     'arg0', 'arg1')
+        args = [decode_arg(arg_name, value) for arg_name, value in
+                ((arg0_name, arg0), (arg1_name, arg1)) if arg_name]
+        if as_json:
+            print(json.dumps({'sequence': record_sequence,
+                              'time_us': time - first, 'core': core,
+                              'event': component + '.' + name,
+                              'args': dict(args)}))
+        else:
+            print('{:12.3f} {:+10.3f} ms  core {}  {}.{} {}'.format(
+                (time - first) / 1000, (time - last) / 1000, core,
+                component, name,
+                ' '.join('{}={}'.format(*arg) for arg in args)))
+        last = time
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Trace ring decoder')
+    parser.add_argument('-e', default=DEFAULT_EVENTS,
+                        help='trace_events.h file')
+    parser.add_argument('--json', action='store_true',
+                        help='print one JSON object per record')
+    parser.add_argument('captures', nargs='*', help='capture files')
+    args = parser.parse_args()
+    events = read_events(args.e)
+    if not args.captures:
+        decode(sys.stdin, events, args.json)
+    for path in args.captures:
+        with open(path, errors='replace') as f:
+            decode(f, events, args.json)
+
+
+if __name__ == '__main__':
+    sys.exit(main())